@@ -8,9 +8,10 @@ BINARY_PATH="$TARGET_DIR/$BINARY_NAME"
 
 # Compiler settings
 CC="gcc"
-CFLAGS="-Wall -Wextra -std=c99 -O2"
+CFLAGS="-Wall -Wextra -std=c99 -O2 -pthread"
 DEBUG_FLAGS="-g -DDEBUG"
-TEST_FLAGS="-DDEBUG_TRACE_EXECUTION"
+TEST_FLAGS="-DDEBUG_TRACE_EXECUTION -DCOUNT_INSTRUCTIONS"
+STATS_FLAGS="-DCOUNT_INSTRUCTIONS"
 
 # Colors for output
 RED='\033[0;31m'
@@ -40,6 +41,9 @@ compile() {
     if [ "$1" = "debug" ]; then
         print_status "Building in debug mode..."
         COMPILE_CMD="$CC $CFLAGS $DEBUG_FLAGS $SRC_DIR/*.c -o $BINARY_PATH"
+    elif [ "$1" = "stats" ]; then
+        print_status "Building with instruction counting..."
+        COMPILE_CMD="$CC $CFLAGS $STATS_FLAGS $SRC_DIR/*.c -o $BINARY_PATH"
     else
         COMPILE_CMD="$CC $CFLAGS $SRC_DIR/*.c -o $BINARY_PATH"
     fi
@@ -70,7 +74,7 @@ compile_test() {
     fi
     
     # Get all source files except main.c
-    SRC_FILES=$(find "$SRC_DIR" -name "*.c" ! -name "main.c")
+    SRC_FILES=$(find "$SRC_DIR" -maxdepth 1 -name "*.c" ! -name "main.c")
     
     for test_file in $TEST_FILES; do
         test_name=$(basename "$test_file" .c)
@@ -88,6 +92,16 @@ compile_test() {
         fi
     done
     
+    # The lexer again, with the byte loops the SIMD kernels replace
+    COMPILE_CMD="$CC $CFLAGS $TEST_FLAGS -DSCALAR_LEXER $TEST_DIR/test_lexer.c $SRC_FILES -o $TARGET_DIR/test_lexer_scalar"
+    print_status "Compiling test_lexer_scalar..."
+    if $COMPILE_CMD; then
+        print_status "✓ test_lexer_scalar compiled successfully"
+    else
+        print_error "✗ Failed to compile test_lexer_scalar"
+        return 1
+    fi
+    
     return 0
 }
 
@@ -140,6 +154,90 @@ run_tests() {
     fi
 }
 
+# Function to build the svmc translator and the runtime library its
+# programs link against
+compile_svmc() {
+    print_status "Compiling svmc..."
+    
+    mkdir -p "$TARGET_DIR/svmrt"
+    
+    RUNTIME_FILES="$SRC_DIR/value.c $SRC_DIR/number.c $SRC_DIR/object.c $SRC_DIR/map.c $SRC_DIR/memory.c $SRC_DIR/stack.c $SRC_DIR/svmc/svmrt.c"
+    for file in $RUNTIME_FILES; do
+        if ! $CC $CFLAGS -c "$file" -o "$TARGET_DIR/svmrt/$(basename "$file" .c).o"; then
+            print_error "Failed to compile $file"
+            return 1
+        fi
+    done
+    rm -f "$TARGET_DIR/libsvmrt.a"
+    ar rcs "$TARGET_DIR/libsvmrt.a" "$TARGET_DIR"/svmrt/*.o
+    print_status "Runtime library created at $TARGET_DIR/libsvmrt.a"
+    
+    SRC_FILES=$(find "$SRC_DIR" -maxdepth 1 -name "*.c" ! -name "main.c")
+    if $CC $CFLAGS -DSVMC_INCLUDE="\"$(pwd)/$SRC_DIR/svmc\"" \
+        -DSVMC_LIB="\"$(pwd)/$TARGET_DIR\"" \
+        $SRC_FILES "$SRC_DIR/svmc/svmc.c" -o "$TARGET_DIR/svmc" -lm; then
+        print_status "Compilation successful! Translator created at $TARGET_DIR/svmc"
+        return 0
+    else
+        print_error "Compilation failed!"
+        return 1
+    fi
+}
+
+# Function to build the multi-threaded tests with ThreadSanitizer and run
+# them
+run_tsan() {
+    print_status "Running threaded tests under ThreadSanitizer..."
+    
+    mkdir -p "$TARGET_DIR"
+    
+    SRC_FILES=$(find "$SRC_DIR" -maxdepth 1 -name "*.c" ! -name "main.c")
+    FAILED=0
+    for test_name in test_embed test_compiler; do
+        test_binary="$TARGET_DIR/tsan_$test_name"
+        if ! $CC $CFLAGS -g -fsanitize=thread "$TEST_DIR/$test_name.c" \
+            $SRC_FILES -o "$test_binary"; then
+            print_error "✗ Failed to compile $test_name"
+            return 1
+        fi
+        if TSAN_OPTIONS="halt_on_error=1" ./"$test_binary" > /dev/null; then
+            print_status "✓ $test_name is race-free"
+        else
+            FAILED=$((FAILED + 1))
+            print_error "✗ $test_name failed under ThreadSanitizer"
+        fi
+    done
+    
+    [ $FAILED -eq 0 ]
+}
+
+# Function to build every test with AddressSanitizer and run it
+run_asan() {
+    print_status "Running tests under AddressSanitizer..."
+    
+    mkdir -p "$TARGET_DIR"
+    
+    SRC_FILES=$(find "$SRC_DIR" -maxdepth 1 -name "*.c" ! -name "main.c")
+    FAILED=0
+    for test_file in $(find "$TEST_DIR" -name "test_*.c"); do
+        test_name=$(basename "$test_file" .c)
+        test_binary="$TARGET_DIR/asan_$test_name"
+        if ! $CC $CFLAGS -g -fsanitize=address "$test_file" $SRC_FILES \
+            -o "$test_binary"; then
+            print_error "✗ Failed to compile $test_name"
+            return 1
+        fi
+        if ./"$test_binary" > /dev/null 2>&1; then
+            print_status "✓ $test_name is clean"
+        else
+            FAILED=$((FAILED + 1))
+            print_error "✗ $test_name failed under AddressSanitizer"
+        fi
+    done
+    
+    [ $FAILED -eq 0 ]
+}
+
 # Function to compile and run the binary
 run() {
     if compile; then
@@ -171,13 +269,17 @@ clean() {
 
 # Function to show usage
 usage() {
-    echo "Usage: $0 {build|debug|run|test|clean} [args]"
+    echo "Usage: $0 {build|debug|stats|run|test|tsan|asan|svmc|clean} [args]"
     echo ""
     echo "Commands:"
     echo "  build, compile, b    Build the project"
     echo "  debug, d             Build with debug flags"
+    echo "  stats                Build with instruction counting for --stats"
     echo "  run, r [args]        Build and run the program"
     echo "  test, t              Compile and run all tests"
+    echo "  tsan                 Run the threaded tests under ThreadSanitizer"
+    echo "  asan                 Run every test under AddressSanitizer"
+    echo "  svmc                 Build the svmc translator and its runtime"
     echo "  clean, c             Remove build artifacts"
     echo ""
 }
@@ -190,6 +292,9 @@ case "$1" in
     "debug"|"d")
         compile debug
         ;;
+    "stats")
+        compile stats
+        ;;
     "run"|"r")
         shift
         run "$@"
@@ -197,6 +302,15 @@ case "$1" in
     "test"|"t")
         run_tests
         ;;
+    "tsan")
+        run_tsan
+        ;;
+    "asan")
+        run_asan
+        ;;
+    "svmc")
+        compile_svmc
+        ;;
     "clean"|"c")
         clean
         ;;
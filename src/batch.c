@@ -0,0 +1,318 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch.h"
+#include "memory.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Batch mode. Script indices are dealt round-robin onto one deque per
+ * worker. A worker takes from the front of its own deque, so it runs its
+ * scripts roughly in list order, and when that runs dry steals from the back
+ * of another worker's, where the work least likely to be needed soon is.
+ * Nothing is added once the workers start, so a worker that finds every
+ * deque empty is done. Scripts write into buffers of their own; the calling
+ * thread copies each one out as soon as it and every script before it have
+ * finished.
+ */
+
+typedef struct {
+  char *path;
+  char *output;
+  size_t outputSize;
+  char *errors;
+  size_t errorsSize;
+  int status; // What `svm <path>` would exit with
+  double seconds;
+  bool done;
+} Script;
+
+typedef struct {
+  int length;
+  int capacity;
+  Script *values;
+} ScriptArray;
+
+DECLARE_CONTAINER_FUNCTIONS(Script, ScriptArray);
+IMPLEMENT_CONTAINER_FUNCTIONS(Script, ScriptArray)
+
+typedef struct {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head; // Next job the owner takes
+  int tail; // One past the next job a thief takes
+} Deque;
+
+typedef struct {
+  ScriptArray *scripts;
+  const BatchOptions *options;
+  Deque *deques;
+  int workers;
+  pthread_mutex_t lock; // Guards every Script's `done`
+  pthread_cond_t finished;
+} Batch;
+
+typedef struct {
+  Batch *batch;
+  int id;
+} Worker;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *copyString(const char *chars, size_t length) {
+  char *copy = ALLOCATE(char, length + 1);
+  memcpy(copy, chars, length);
+  copy[length] = '\0';
+  return copy;
+}
+
+static void addScript(ScriptArray *scripts, char *path) {
+  Script script;
+  memset(&script, 0, sizeof(script));
+  script.path = path;
+  writeScriptArray(scripts, script);
+}
+
+static int comparePaths(const void *a, const void *b) {
+  return strcmp(((const Script *)a)->path, ((const Script *)b)->path);
+}
+
+static bool listDirectory(const char *dir, ScriptArray *scripts) {
+  DIR *stream = opendir(dir);
+  if (stream == NULL) return false;
+
+  size_t dirLength = strlen(dir);
+  struct dirent *entry;
+  while ((entry = readdir(stream)) != NULL) {
+    size_t length = strlen(entry->d_name);
+    if (length <= 4 || strcmp(entry->d_name + length - 4, ".svm") != 0) {
+      continue;
+    }
+    char *path = ALLOCATE(char, dirLength + length + 2);
+    memcpy(path, dir, dirLength);
+    path[dirLength] = '/';
+    memcpy(path + dirLength + 1, entry->d_name, length + 1);
+    addScript(scripts, path);
+  }
+  closedir(stream);
+  qsort(scripts->values, scripts->length, sizeof(Script), comparePaths);
+  return true;
+}
+
+static bool listFile(const char *list, ScriptArray *scripts) {
+  FILE *file = fopen(list, "r");
+  if (file == NULL) return false;
+
+  char *line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  while ((length = getline(&line, &capacity, file)) != -1) {
+    while (length > 0 &&
+           (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      length--;
+    }
+    if (length > 0) addScript(scripts, copyString(line, length));
+  }
+  free(line);
+  fclose(file);
+  return true;
+}
+
+static char *readSource(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  long fileSize = ftell(file);
+  rewind(file);
+
+  char *buf = fileSize < 0 ? NULL : malloc(fileSize + 1);
+  if (buf != NULL && fread(buf, 1, fileSize, file) < (size_t)fileSize) {
+    free(buf);
+    buf = NULL;
+  }
+  if (buf != NULL) buf[fileSize] = '\0';
+  fclose(file);
+  return buf;
+}
+
+static void runScript(Batch *batch, Script *script) {
+  double start = now();
+  FILE *err = open_memstream(&script->errors, &script->errorsSize);
+  char *src = err != NULL ? readSource(script->path) : NULL;
+
+  if (src == NULL) {
+    if (err != NULL) {
+      fprintf(err, "Could not read file \"%s\".\n", script->path);
+    }
+    script->status = 74;
+  } else {
+    VM vm;
+    initVM(&vm);
+    vm.optimize = batch->options->optimize;
+    vm.jit = batch->options->jit;
+    vm.dispatch = batch->options->dispatch;
+    sinkFree(&vm.out);
+    sinkInit(&vm.out, -1);
+    vm.err = err;
+    switch (interpret(&vm, src)) {
+      case INTERPRET_OK: script->status = 0; break;
+      case INTERPRET_COMPILE_ERROR: script->status = 65; break;
+      case INTERPRET_RUNTIME_ERROR: script->status = 70; break;
+    }
+    script->output = sinkTake(&vm.out, &script->outputSize);
+    closeVM(&vm);
+    free(src);
+  }
+  if (err != NULL) fclose(err);
+  script->seconds = now() - start;
+
+  pthread_mutex_lock(&batch->lock);
+  script->done = true;
+  pthread_cond_broadcast(&batch->finished);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+static bool takeJob(Deque *deque, bool steal, int *job) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->head < deque->tail;
+  if (found) {
+    *job = steal ? deque->jobs[--deque->tail] : deque->jobs[deque->head++];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static void *runWorker(void *arg) {
+  Worker *worker = arg;
+  Batch *batch = worker->batch;
+  int job;
+
+  for (;;) {
+    bool found = takeJob(&batch->deques[worker->id], false, &job);
+    for (int i = 1; i < batch->workers && !found; i++) {
+      int victim = (worker->id + i) % batch->workers;
+      found = takeJob(&batch->deques[victim], true, &job);
+    }
+    if (!found) return NULL;
+    runScript(batch, &batch->scripts->values[job]);
+  }
+}
+
+static void writeSummary(ScriptArray *scripts, int workers, double seconds,
+                         FILE *err) {
+  int failed = 0;
+  double busy = 0;
+  for (int i = 0; i < scripts->length; i++) {
+    Script *script = &scripts->values[i];
+    fprintf(err, "%3d %10.3f ms  %s\n", script->status, script->seconds * 1e3,
+            script->path);
+    if (script->status != 0) failed++;
+    busy += script->seconds;
+  }
+  fprintf(err, "%d scripts, %d failed, %.3f s on %d workers (%.3f s running "
+               "scripts)\n",
+          scripts->length, failed, seconds, workers, busy);
+}
+
+int runBatch(const char *source, const BatchOptions *options, FILE *out,
+             FILE *err) {
+  ScriptArray scripts;
+  initScriptArray(&scripts);
+  struct stat info;
+  bool listed = stat(source, &info) == 0 && S_ISDIR(info.st_mode)
+                    ? listDirectory(source, &scripts)
+                    : listFile(source, &scripts);
+  if (!listed) {
+    fprintf(err, "Could not read \"%s\".\n", source);
+    return 74;
+  }
+
+  int workers = options->jobs > 0 ? options->jobs
+                                  : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers > scripts.length) workers = scripts.length;
+  if (workers < 1) workers = 1;
+
+  Batch batch;
+  batch.scripts = &scripts;
+  batch.options = options;
+  batch.workers = workers;
+  batch.deques = ALLOCATE(Deque, workers);
+  pthread_mutex_init(&batch.lock, NULL);
+  pthread_cond_init(&batch.finished, NULL);
+  for (int w = 0; w < workers; w++) {
+    Deque *deque = &batch.deques[w];
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->jobs = ALLOCATE(int, scripts.length / workers + 1);
+    deque->head = 0;
+    deque->tail = 0;
+    for (int job = w; job < scripts.length; job += workers) {
+      deque->jobs[deque->tail++] = job;
+    }
+  }
+
+  double start = now();
+  pthread_t *threads = ALLOCATE(pthread_t, workers);
+  Worker *pool = ALLOCATE(Worker, workers);
+  // Workers steal from every deque, so the ones that start run every job.
+  int started = 0;
+  for (int w = 0; w < workers; w++) {
+    pool[w].batch = &batch;
+    pool[w].id = w;
+    if (pthread_create(&threads[started], NULL, runWorker, &pool[w]) == 0) {
+      started++;
+    }
+  }
+  if (started < workers) {
+    fprintf(err, "Could not start %d of %d worker threads.\n",
+            workers - started, workers);
+  }
+  if (started == 0) runWorker(&pool[0]);
+
+  int status = 0;
+  for (int i = 0; i < scripts.length; i++) {
+    Script *script = &scripts.values[i];
+    pthread_mutex_lock(&batch.lock);
+    while (!script->done) pthread_cond_wait(&batch.finished, &batch.lock);
+    pthread_mutex_unlock(&batch.lock);
+
+    if (script->output != NULL) {
+      fwrite(script->output, 1, script->outputSize, out);
+      free(script->output);
+    }
+    if (script->errors != NULL) {
+      fflush(out);
+      fwrite(script->errors, 1, script->errorsSize, err);
+      free(script->errors);
+    }
+    if (status == 0) status = script->status;
+  }
+  fflush(out);
+
+  for (int w = 0; w < started; w++) pthread_join(threads[w], NULL);
+  writeSummary(&scripts, started > 0 ? started : 1, now() - start, err);
+
+  for (int w = 0; w < workers; w++) {
+    pthread_mutex_destroy(&batch.deques[w].lock);
+    FREE_ARRAY(int, batch.deques[w].jobs, scripts.length / workers + 1);
+  }
+  FREE_ARRAY(Deque, batch.deques, workers);
+  FREE_ARRAY(pthread_t, threads, workers);
+  FREE_ARRAY(Worker, pool, workers);
+  pthread_cond_destroy(&batch.finished);
+  pthread_mutex_destroy(&batch.lock);
+  for (int i = 0; i < scripts.length; i++) {
+    char *path = scripts.values[i].path;
+    FREE_ARRAY(char, path, strlen(path) + 1);
+  }
+  freeScriptArray(&scripts);
+  return status;
+}
@@ -0,0 +1,29 @@
+#ifndef svm_batch_h
+#define svm_batch_h
+
+#include "vm.h"
+
+typedef struct {
+  int jobs; // Worker threads, or 0 for one per online CPU
+  bool optimize;
+  bool jit;
+  Dispatch dispatch;
+} BatchOptions;
+
+/**
+ * @brief Runs every script named by `source` on a pool of worker threads.
+ *
+ * `source` is either a directory, whose `.svm` files run in name order, or a
+ * file listing one script path per line. Each script gets a fresh VM whose
+ * output and errors are captured and then written to `out` and `err` in the
+ * order the scripts were listed, however the pool scheduled them. A summary
+ * of every script's exit code and run time follows on `err`.
+ *
+ * @return 0 if every script succeeded, otherwise the exit code the first
+ * failing script would have had on its own (65, 70 or 74), or 74 if
+ * `source` cannot be read
+ */
+int runBatch(const char *source, const BatchOptions *options, FILE *out,
+             FILE *err);
+
+#endif
@@ -1,6 +1,7 @@
 #include "chunk.h"
 #include "memory.h"
 #include "value.h"
+#include <string.h>
 
 void initChunk(Chunk *chunk) {
   chunk->length = 0;
@@ -8,9 +9,19 @@ void initChunk(Chunk *chunk) {
   chunk->code = NULL;
   initValueArray(&chunk->constants);
   initLineStartArray(&chunk->lines);
+  chunk->globalCaches = NULL;
+  chunk->globalCacheCount = 0;
 }
 
-void writeChunk(Chunk *chunk, uint8_t byte, int line, int offset) {
+/**
+ * @brief Appends `byte`, recording where `line` starts if this is its first
+ * byte. Lines that produced no code start where the next one does.
+ */
+void writeChunk(Chunk *chunk, uint8_t byte, int line) {
+  while (chunk->lines.length < line) {
+    writeLineStartArray(&chunk->lines, chunk->length);
+  }
+
   if (chunk->capacity == chunk->length) {
     int newCap = GROW_CAPACITY(chunk->capacity);
     GROW_ARRAY(uint8_t, chunk->code, chunk->capacity, newCap);
@@ -18,16 +29,13 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line, int offset) {
   }
   chunk->code[chunk->length] = byte;
   chunk->length++;
-
-  if (line > chunk->lines.length) {
-    writeLineStartArray(&chunk->lines, offset);
-  }
 }
 
 void freeChunk(Chunk *chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
   freeValueArray(&chunk->constants);
   freeLineStartArray(&chunk->lines);
+  FREE_ARRAY(GlobalCache, chunk->globalCaches, chunk->globalCacheCount);
   initChunk(chunk);
 }
 
@@ -39,15 +47,215 @@ void writeConst(Chunk *chunk, Value value, int line) {
   int constantIndex = addConstant(chunk, value);
 
   if (constantIndex <= 255) {
-    writeChunk(chunk, OP_CONSTANT, line, 0);
-    writeChunk(chunk, (uint8_t)constantIndex, line, 0);
+    writeChunk(chunk, OP_CONSTANT, line);
+    writeChunk(chunk, (uint8_t)constantIndex, line);
   } else {
-    writeChunk(chunk, OP_CONSTANT_LONG, line, 0);
-    writeChunk(chunk, (uint8_t)(constantIndex & 0xFF), line, 0);
-    writeChunk(chunk, (uint8_t)((constantIndex >> 8) & 0xFF), line, 0);
+    writeChunk(chunk, OP_CONSTANT_LONG, line);
+    writeChunk(chunk, (uint8_t)(constantIndex & 0xFF), line);
+    writeChunk(chunk, (uint8_t)((constantIndex >> 8) & 0xFF), line);
   }
 }
 
+/**
+ * @brief Returns the global cache slot for `constant`, growing the cache to
+ * cover every current constant if needed.
+ */
+GlobalCache *chunkGlobalCache(Chunk *chunk, int constant) {
+  if (constant >= chunk->globalCacheCount) {
+    int newCount = chunk->constants.length;
+    GROW_ARRAY(GlobalCache, chunk->globalCaches, chunk->globalCacheCount,
+               newCount);
+    memset(chunk->globalCaches + chunk->globalCacheCount, 0,
+           sizeof(GlobalCache) * (newCount - chunk->globalCacheCount));
+    chunk->globalCacheCount = newCount;
+  }
+  return &chunk->globalCaches[constant];
+}
+
+/**
+ * @brief Returns the generic opcode a quickened or unchecked one stands for,
+ * or `op` itself.
+ */
+uint8_t genericOp(uint8_t op) {
+  switch (op) {
+    case OP_NEGATE_N: return OP_NEGATE;
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_ADD_NN: return OP_ADD;
+    case OP_SUBTRACT_NUM:
+    case OP_SUBTRACT_NN: return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM:
+    case OP_MULTIPLY_NN: return OP_MULTIPLY;
+    case OP_DIVIDE_NUM:
+    case OP_DIVIDE_NN: return OP_DIVIDE;
+    case OP_LESS_NUM:
+    case OP_LESS_NN: return OP_LESS;
+    case OP_GREATER_NUM:
+    case OP_GREATER_NN: return OP_GREATER;
+    case OP_GET_GLOBAL_CACHED: return OP_GET_GLOBAL;
+    case OP_SET_GLOBAL_CACHED: return OP_SET_GLOBAL;
+    default: return op;
+  }
+}
+
+/**
+ * @brief Length in bytes of the instruction starting with `op`.
+ *
+ * @return 0 for bytes that are not an opcode
+ */
+int instructionLength(uint8_t op) {
+  switch (genericOp(op)) {
+    case OP_RETURN:
+    case OP_NEGATE:
+    case OP_SUBTRACT:
+    case OP_ADD:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_MODULO:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_PRINT:
+    case OP_POP:
+    case OP_RESUME:
+    case OP_YIELD:
+    case OP_FINISH: return 1;
+    case OP_CONSTANT:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_PICK:
+    case OP_POPN:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL: return 2;
+    case OP_CONSTANT_LONG:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+    case OP_JUMP_IF_FALSE_POP:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+    case OP_LOOP:
+    case OP_SPAWN: return 3;
+    default: return 0;
+  }
+}
+
+// How many values the instruction at `ip` leaves on the stack, minus how
+// many it takes off.
+int stackEffect(const uint8_t *ip) {
+  switch (genericOp(*ip)) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_GET_GLOBAL:
+    case OP_PICK:
+    case OP_GET_LOCAL:
+    case OP_SPAWN: return 1;
+    case OP_SUBTRACT:
+    case OP_ADD:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_MODULO:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_PRINT:
+    case OP_POP:
+    case OP_DEFINE_GLOBAL:
+    case OP_JUMP_IF_FALSE_POP:
+    case OP_YIELD: return -1;
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER: return -2;
+    case OP_POPN: return -ip[1];
+    default: return 0;
+  }
+}
+
+bool isJump(uint8_t op) { return op >= OP_JUMP && op <= OP_LOOP; }
+
+// Offset the jump instruction at `offset` lands on.
+int jumpTarget(Chunk *chunk, int offset) {
+  uint8_t *ip = &chunk->code[offset];
+  int jump = ip[1] | (ip[2] << 8);
+  return *ip == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+}
+
+/**
+ * @brief Finds the stack depth before every instruction, which jumps land
+ * on, and the deepest point of the stack.
+ *
+ * `depths` and `targets` hold one entry per byte of code; operand bytes get
+ * a depth of -1. Code after an unconditional jump keeps the depth it falls
+ * through with.
+ *
+ * @return false if an opcode is unknown, a jump lands outside an
+ * instruction, two paths reach an instruction at different depths, or the
+ * chunk uses fibers, whose bodies run on stacks of their own
+ */
+bool analyzeStack(Chunk *chunk, int *depths, bool *targets, int *maxDepth) {
+  bool ok = true;
+  bool *starts = ALLOCATE(bool, chunk->length);
+  memset(starts, 0, sizeof(bool) * chunk->length);
+  memset(targets, 0, sizeof(bool) * chunk->length);
+  for (int i = 0; i < chunk->length; i++) depths[i] = -1;
+
+  for (int offset = 0; offset < chunk->length && ok;) {
+    uint8_t op = chunk->code[offset];
+    int length = instructionLength(op);
+    ok = length > 0 && offset + length <= chunk->length &&
+         (op < OP_SPAWN || op > OP_FINISH);
+    starts[offset] = true;
+    offset += length;
+  }
+
+  int depth = 0;
+  bool reachable = true;
+  *maxDepth = 0;
+  for (int offset = 0; offset < chunk->length && ok;) {
+    uint8_t *ip = &chunk->code[offset];
+    if (depths[offset] >= 0) {
+      ok = !reachable || depths[offset] == depth;
+      depth = depths[offset];
+    }
+    depths[offset] = depth;
+    reachable = true;
+
+    depth += stackEffect(ip);
+    if (depth < 0) ok = false;
+    if (depth > *maxDepth) *maxDepth = depth;
+
+    if (isJump(*ip)) {
+      int target = jumpTarget(chunk, offset);
+      if (target < 0 || target >= chunk->length || !starts[target]) {
+        ok = false;
+      } else if (depths[target] >= 0 || *ip == OP_LOOP) {
+        ok = ok && depths[target] == depth;
+      } else {
+        depths[target] = depth;
+      }
+      if (ok) targets[target] = true;
+    }
+    if (*ip == OP_JUMP || *ip == OP_LOOP || *ip == OP_RETURN) {
+      reachable = false;
+    }
+    offset += instructionLength(*ip);
+  }
+
+  FREE_ARRAY(bool, starts, chunk->length);
+  return ok;
+}
+
 IMPLEMENT_CONTAINER_FUNCTIONS(int, LineStartArray)
 
 /**
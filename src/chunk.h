@@ -2,6 +2,7 @@
 #define svm_chunk_h
 
 #include "common.h"
+#include "map.h"
 #include "memory.h"
 #include "value.h"
 
@@ -26,7 +27,45 @@ typedef enum {
   OP_POP,
   OP_DEFINE_GLOBAL,
   OP_GET_GLOBAL,
-  OP_SET_GLOBAL
+  OP_SET_GLOBAL,
+  OP_PICK,
+  OP_POPN,
+  OP_GET_LOCAL,
+  OP_SET_LOCAL,
+  OP_JUMP,
+  OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_TRUE,
+  OP_JUMP_IF_FALSE_POP,
+  OP_JUMP_IF_LESS,
+  OP_JUMP_IF_NOT_LESS,
+  OP_JUMP_IF_GREATER,
+  OP_JUMP_IF_NOT_GREATER,
+  OP_LOOP,
+  // Fibers, which only run() executes: a fiber's body is inline code, skipped
+  // by OP_SPAWN and ended by OP_FINISH, that runs on a stack of its own.
+  OP_SPAWN,
+  OP_RESUME,
+  OP_YIELD,
+  OP_FINISH,
+  // Quickened forms, only ever written by run() over their generic opcode.
+  OP_ADD_NUM,
+  OP_ADD_STR,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_LESS_NUM,
+  OP_GREATER_NUM,
+  OP_GET_GLOBAL_CACHED,
+  OP_SET_GLOBAL_CACHED,
+  // Unchecked forms, only ever emitted by the compiler where it has proved
+  // every operand is a number.
+  OP_NEGATE_N,
+  OP_ADD_NN,
+  OP_SUBTRACT_NN,
+  OP_MULTIPLY_NN,
+  OP_DIVIDE_NN,
+  OP_LESS_NN,
+  OP_GREATER_NN
 } OpCode;
 
 typedef struct {
@@ -37,20 +76,37 @@ typedef struct {
 
 DECLARE_CONTAINER_FUNCTIONS(int, LineStartArray);
 
+// Where the global named by one constant lives in vm->globals, valid while
+// the map's version is still `version`.
+typedef struct {
+  mapObject *entry;
+  uint32_t version;
+} GlobalCache;
+
 typedef struct {
   int length;
   int capacity;
   uint8_t *code;
   ValueArray constants;
   LineStartArray lines;
+  GlobalCache *globalCaches; // Indexed like constants, grown on demand
+  int globalCacheCount;
 } Chunk;
 
 void initChunk(Chunk *chunk);
-void writeChunk(Chunk *chunk, uint8_t byte, int line, int offset);
+void writeChunk(Chunk *chunk, uint8_t byte, int line);
 void freeChunk(Chunk *chunk);
 int addConstant(Chunk *chunk, Value value);
 void writeConst(Chunk *chunk, Value value, int line);
 
 int getLine(LineStartArray *arr, int pos);
+GlobalCache *chunkGlobalCache(Chunk *chunk, int constant);
+
+uint8_t genericOp(uint8_t op);
+int instructionLength(uint8_t op);
+int stackEffect(const uint8_t *ip);
+bool isJump(uint8_t op);
+int jumpTarget(Chunk *chunk, int offset);
+bool analyzeStack(Chunk *chunk, int *depths, bool *targets, int *maxDepth);
 
 #endif
@@ -1,7 +1,10 @@
 #ifndef svm_common_h
 #define svm_common_h
-#define DEBUG_VM
+#ifdef DEBUG
 #define DEBUG_PRINT_CODE
+#define DEBUG_VM
+#define COUNT_INSTRUCTIONS
+#endif
 #include "std/bool.h"
 #include "std/def.h"
 #include <stdint.h>
@@ -1,29 +1,33 @@
 #include "compiler.h"
 #include "chunk.h"
 #include "debug.h"
-#include "lexer.h"
+#include "tokens.h"
+#include <string.h>
 #include "memory.h"
+#include "number.h"
 #include "object.h"
-#include <stdlib.h>
+#include "optimizer.h"
 
-static ParseRule rules[TOK_EOF + 1];
+static const ParseRule rules[TOK_EOF + 1];
 
-Chunk *compilingChunk;
-static Chunk *currentChunk() { return compilingChunk; }
+DECLARE_CONTAINER_FUNCTIONS(int, OffsetArray)
+IMPLEMENT_CONTAINER_FUNCTIONS(int, OffsetArray)
+
+static Chunk *currentChunk(Parser *parser) { return parser->chunk; }
 
 static void errorAt(Parser *parser, Tok *tok, const char *msg) {
   if (parser->isPanicing) return;
   parser->isPanicing = true;
-  fprintf(stderr, "[line %d] Error", tok->line);
+  fprintf(parser->err, "[line %d] Error", tok->line);
 
   if (tok->type == TOK_EOF) {
-    fprintf(stderr, " at end");
+    fprintf(parser->err, " at end");
   } else if (tok->type == TOK_ERROR) {
     // TBD
   } else {
-    fprintf(stderr, " at '%.*s'", tok->length, tok->start);
+    fprintf(parser->err, " at '%.*s'", tok->length, tok->start);
   }
-  fprintf(stderr, ": %s\n", msg);
+  fprintf(parser->err, ": %s\n", msg);
   parser->hadError = true;
 }
 
@@ -35,127 +39,343 @@ static void errorAtCurrent(Parser *parser, const char *msg) {
   errorAt(parser, &parser->current, msg);
 }
 
-static void advance(Parser *parser, Lexer *lexer) {
+static void advance(Parser *parser) {
   parser->previous = parser->current;
   for (;;) {
-    parser->current = lexTok(lexer);
+    parser->current = tokBufferNext(parser->tokens);
     if (parser->current.type != TOK_ERROR) break;
 
     errorAtCurrent(parser, parser->current.start);
   }
 }
 
-static void consume(Parser *parser, Lexer *lexer, TokType type,
+static void consume(Parser *parser, TokType type,
                     const char *msg) {
   if (parser->current.type == type) {
-    advance(parser, lexer);
+    advance(parser);
     return;
   }
 
   errorAtCurrent(parser, msg);
 }
 
-static bool check(Parser *parser, Lexer *lexer, TokType type) {
+static bool check(Parser *parser, TokType type) {
   return parser->current.type == type;
 }
 
-static bool match(Parser *parser, Lexer *lexer, TokType type) {
-  if (!check(parser, lexer, type)) return false;
-  advance(parser, lexer);
+static bool match(Parser *parser, TokType type) {
+  if (!check(parser, type)) return false;
+  advance(parser);
   return true;
 }
 
 static void emitByte(Parser *parser, uint8_t byte) {
-  writeChunk(currentChunk(), byte, parser->previous.line, 0); // TODO: offset
+  writeChunk(currentChunk(parser), byte, parser->previous.line);
 }
 
 static void emitReturn(Parser *parser) { emitByte(parser, OP_RETURN); }
-static uint8_t makeConstant(Parser *parser, Value value) {
-  int constant = addConstant(currentChunk(), value);
+static int makeConstant(Parser *parser, Value value) {
+  int constant = addConstant(currentChunk(parser), value);
   if (constant > UINT16_MAX) {
     error(parser, "Too many constants in one chunk.");
     return 0;
   }
-  return (uint8_t)constant;
+  return constant;
 }
 static void emitBytes(Parser *parser, int8_t byte1, int8_t byte2) {
   emitByte(parser, byte1);
   emitByte(parser, byte2);
 }
 
+/**
+ * @brief Emits `instruction` with a placeholder 16-bit offset.
+ *
+ * @return Offset of the placeholder, to be filled in by patchJump
+ */
+static int emitJump(Parser *parser, uint8_t instruction) {
+  emitByte(parser, instruction);
+  emitByte(parser, 0xff);
+  emitByte(parser, 0xff);
+  return currentChunk(parser)->length - 2;
+}
+
+static void patchJump(Parser *parser, int offset) {
+  int jump = currentChunk(parser)->length - offset - 2;
+  if (jump > UINT16_MAX) {
+    error(parser, "Too much code to jump over.");
+  }
+
+  currentChunk(parser)->code[offset] = jump & 0xff;
+  currentChunk(parser)->code[offset + 1] = (jump >> 8) & 0xff;
+  parser->compiler->lastTarget = currentChunk(parser)->length;
+}
+
+static void emitLoop(Parser *parser, int loopStart) {
+  emitByte(parser, OP_LOOP);
+
+  int offset = currentChunk(parser)->length - loopStart + 2;
+  if (offset > UINT16_MAX) error(parser, "Loop body too large.");
+
+  emitByte(parser, offset & 0xff);
+  emitByte(parser, (offset >> 8) & 0xff);
+}
+
+/**
+ * @brief Emits the jump taken when the condition just compiled is false,
+ * popping the condition either way.
+ *
+ * A condition ending in a comparison is rewritten into a single fused
+ * compare-and-branch, unless a jump lands between the comparison and here.
+ *
+ * @return Offset of the placeholder, to be filled in by patchJump
+ */
+static int emitConditionJump(Parser *parser) {
+  Chunk *chunk = currentChunk(parser);
+  int compare = parser->compiler->lastCompare;
+
+  if (compare >= 0 && compare >= parser->compiler->lastTarget) {
+    uint8_t op = chunk->code[compare];
+    int tail = chunk->length - compare;
+    if (tail == 1) {
+      chunk->length = compare;
+      return emitJump(parser, genericOp(op) == OP_LESS
+                                  ? OP_JUMP_IF_NOT_LESS
+                                  : OP_JUMP_IF_NOT_GREATER);
+    }
+    if (tail == 2 && chunk->code[compare + 1] == OP_NOT) {
+      chunk->length = compare;
+      return emitJump(parser, genericOp(op) == OP_LESS ? OP_JUMP_IF_LESS
+                                                       : OP_JUMP_IF_GREATER);
+    }
+  }
+  return emitJump(parser, OP_JUMP_IF_FALSE_POP);
+}
+
+static void setType(Parser *parser, ExprType type, bool assumed) {
+  parser->type = type;
+  parser->assumed = type != TYPE_UNKNOWN && assumed;
+}
+
+/**
+ * @brief Whether both operands are proved to be numbers.
+ *
+ * `assumed` operand types only count while the compiler still trusts locals
+ * to keep the type they were declared with.
+ */
+static bool provedNumbers(Parser *parser, ExprType a, ExprType b,
+                          bool assumed) {
+  return a == TYPE_NUMBER && b == TYPE_NUMBER &&
+         (!assumed || parser->compiler->trustLocals);
+}
+
+/**
+ * @brief Emits `unchecked` if `numbers`, remembering it for poisonLocals if
+ * the proof was `assumed`, and the guarded `op` otherwise.
+ */
+static void emitTypedOp(Parser *parser, uint8_t op, uint8_t unchecked,
+                        bool numbers, bool assumed) {
+  if (!numbers) {
+    emitByte(parser, op);
+    return;
+  }
+  if (assumed) {
+    writeOffsetArray(&parser->compiler->assumed, currentChunk(parser)->length);
+  }
+  emitByte(parser, unchecked);
+}
+
+/**
+ * @brief Gives up the assumption that locals declared with a number only
+ * ever hold numbers, once an assignment breaks it.
+ *
+ * Every unchecked instruction emitted on that basis, before or after the
+ * assignment in the loop that may run it, goes back to its guarded form, and
+ * locals are untyped for the rest of the compilation.
+ */
+static void poisonLocals(Parser *parser) {
+  Compiler *compiler = parser->compiler;
+  Chunk *chunk = currentChunk(parser);
+
+  for (int i = 0; i < compiler->assumed.length; i++) {
+    uint8_t *op = &chunk->code[compiler->assumed.values[i]];
+    *op = genericOp(*op); // A fused compare-and-branch is left alone
+  }
+  compiler->assumed.length = 0;
+  compiler->trustLocals = false;
+}
+
+static void initCompiler(Compiler *compiler, Compiler *enclosing, int start) {
+  compiler->enclosing = enclosing;
+  compiler->localCount = 0;
+  compiler->scopeDepth = 0;
+  compiler->lastCompare = -1;
+  compiler->lastTarget = start;
+  compiler->trustLocals = true;
+  initOffsetArray(&compiler->assumed);
+}
+
 static void endCompiler(Parser *parser) {
   emitReturn(parser);
 #ifdef DEBUG_PRINT_CODE
-  if (!parser->hadError) { disassembleChunk(currentChunk(), "code"); }
+  if (!parser->hadError) { disassembleChunk(currentChunk(parser), "code"); }
 #endif
 }
 
-static ParseRule *getRule(TokType type) { return &rules[type]; }
+static const ParseRule *getRule(TokType type) { return &rules[type]; }
 
-static void parsePrecedence(VM *vm, Parser *parser, Lexer *lexer,
-                            Precedence precedence) {
-  advance(parser, lexer);
+static void parsePrecedence(VM *vm, Parser *parser, Precedence precedence) {
+  advance(parser);
   ParseFn prefixRule = getRule(parser->previous.type)->prefix;
   if (prefixRule == NULL) {
     error(parser, "Expect expression.");
     return;
   }
   bool canAssign = precedence <= PREC_ASSIGNMENT;
-  prefixRule(vm, parser, lexer, canAssign);
+  prefixRule(vm, parser, canAssign);
 
   while (precedence <= getRule(parser->current.type)->precedence) {
-    advance(parser, lexer);
+    advance(parser);
     ParseFn infixRule = getRule(parser->previous.type)->infix;
-    infixRule(vm, parser, lexer, canAssign);
+    infixRule(vm, parser, canAssign);
   }
-  if (canAssign && match(parser, lexer, TOK_EQUAL)) {
+  if (canAssign && match(parser, TOK_EQUAL)) {
     error(parser, "Invalid assignment target");
   }
 }
+/**
+ * @brief Returns the constant holding the name in the previous token, adding
+ * it only the first time the name is seen by this parser's name cache.
+ */
 static uint8_t identifierConstant(VM *vm, Parser *parser) {
-  return makeConstant(parser, OBJ_VAL(copyString(vm, parser->previous.start,
-                                                 parser->previous.length)));
+  const char *start = parser->previous.start;
+  int length = parser->previous.length;
+  Value index;
+
+  ObjString *name = mapFindString(parser->names, start, length,
+                                  hashString(start, length));
+  if (name != NULL && mapGet(parser->names, name, &index)) {
+    return (uint8_t)AS_NUMBER(index);
+  }
+
+  name = copyString(vm, start, length);
+  int constant = makeConstant(parser, OBJ_VAL(name));
+  if (constant > UINT8_MAX) {
+    error(parser, "Too many global names in one chunk.");
+    return 0;
+  }
+  mapInsert(parser->names, name, NUMBER_VAL(constant));
+  return (uint8_t)constant;
+}
+static bool identifiersEqual(Tok *a, Tok *b) {
+  return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
+}
+
+/**
+ * @brief Finds the stack slot of the innermost local named by `name`.
+ *
+ * @return Slot index, or -1 if the name refers to a global
+ */
+static int resolveLocal(Parser *parser, Compiler *compiler, Tok *name) {
+  for (int i = compiler->localCount - 1; i >= 0; i--) {
+    Local *local = &compiler->locals[i];
+    if (identifiersEqual(name, &local->name)) {
+      if (local->depth == -1) {
+        error(parser, "Can't read local variable in its own initializer.");
+      }
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void addLocal(Parser *parser, Tok name) {
+  if (parser->compiler->localCount == UINT8_COUNT) {
+    error(parser, "Too many local variables in scope.");
+    return;
+  }
+  Local *local = &parser->compiler->locals[parser->compiler->localCount++];
+  local->name = name;
+  local->depth = -1;
+  local->type = TYPE_UNKNOWN;
 }
-static uint8_t parseVar(VM *vm, Parser *parser, Lexer *lexer,
-                        const char *errorMessage) {
-  consume(parser, lexer, TOK_IDENTIFIER, errorMessage);
+
+static void declareVariable(Parser *parser) {
+  if (parser->compiler->scopeDepth == 0) return;
+
+  Tok *name = &parser->previous;
+  for (int i = parser->compiler->localCount - 1; i >= 0; i--) {
+    Local *local = &parser->compiler->locals[i];
+    if (local->depth != -1 && local->depth < parser->compiler->scopeDepth) break;
+    if (identifiersEqual(name, &local->name)) {
+      error(parser, "Already a variable with this name in this scope.");
+    }
+  }
+  addLocal(parser, *name);
+}
+
+static uint8_t parseVar(VM *vm, Parser *parser, const char *errorMessage) {
+  consume(parser, TOK_IDENTIFIER, errorMessage);
+
+  declareVariable(parser);
+  if (parser->compiler->scopeDepth > 0) return 0;
+
   return identifierConstant(vm, parser);
 }
 
 static void defineVar(Parser *parser, uint8_t global) {
+  if (parser->compiler->scopeDepth > 0) {
+    // The initializer's value is already in the local's stack slot.
+    Local *local = &parser->compiler->locals[parser->compiler->localCount - 1];
+    local->depth = parser->compiler->scopeDepth;
+    local->type = parser->type == TYPE_NUMBER ? TYPE_NUMBER : TYPE_UNKNOWN;
+    return;
+  }
   emitBytes(parser, OP_DEFINE_GLOBAL, global);
 }
 
-static void expression(VM *vm, Parser *parser, Lexer *lexer) {
-  parsePrecedence(vm, parser, lexer, PREC_ASSIGNMENT);
+static void expression(VM *vm, Parser *parser) {
+  parsePrecedence(vm, parser, PREC_ASSIGNMENT);
 }
 
-static void varDecl(VM *vm, Parser *parser, Lexer *lexer) {
-  uint8_t global = parseVar(vm, parser, lexer, "Expect variable name.");
+static void varDecl(VM *vm, Parser *parser) {
+  uint8_t global = parseVar(vm, parser, "Expect variable name.");
 
-  if (match(parser, lexer, TOK_EQUAL)) {
-    expression(vm, parser, lexer);
+  if (match(parser, TOK_EQUAL)) {
+    expression(vm, parser);
   } else {
     emitByte(parser, OP_NIL);
+    setType(parser, TYPE_NIL, false);
   }
-  consume(parser, lexer, TOK_SEMICOLON,
-          "Expected ';' after variable declaration.");
+  consume(parser, TOK_SEMICOLON, "Expected ';' after variable declaration.");
 
   defineVar(parser, global);
 }
 
-static void expressionStmt(VM *vm, Parser *parser, Lexer *lexer) {
-  expression(vm, parser, lexer);
-  consume(parser, lexer, TOK_SEMICOLON, "Expect ';' after expression.");
+static void expressionStmt(VM *vm, Parser *parser) {
+  expression(vm, parser);
+  consume(parser, TOK_SEMICOLON, "Expect ';' after expression.");
   emitByte(parser, OP_POP);
 }
-static void printStmt(VM *vm, Parser *parser, Lexer *lexer) {
-  expression(vm, parser, lexer);
-  consume(parser, lexer, TOK_SEMICOLON, "Expect ';' after value.");
+static void printStmt(VM *vm, Parser *parser) {
+  expression(vm, parser);
+  consume(parser, TOK_SEMICOLON, "Expect ';' after value.");
   emitByte(parser, OP_PRINT);
 }
 
-static void synchronize(Parser *parser, Lexer *lexer) {
+static void yieldStmt(VM *vm, Parser *parser) {
+  if (parser->compiler->enclosing == NULL) {
+    error(parser, "Can't yield outside a fiber.");
+  }
+  if (match(parser, TOK_SEMICOLON)) {
+    emitByte(parser, OP_NIL);
+  } else {
+    expression(vm, parser);
+    consume(parser, TOK_SEMICOLON, "Expect ';' after value.");
+  }
+  emitByte(parser, OP_YIELD);
+}
+
+static void synchronize(Parser *parser) {
   parser->isPanicing = false;
 
   while (parser->current.type != TOK_EOF) {
@@ -168,120 +388,414 @@ static void synchronize(Parser *parser, Lexer *lexer) {
       case TOK_IF:
       case TOK_WHILE:
       case TOK_PRINT:
+      case TOK_YIELD:
       case TOK_RETURN: return;
       default:;
     }
-    advance(parser, lexer);
+    advance(parser);
   }
 }
-static void stmt(VM *vm, Parser *parser, Lexer *lexer);
-static void decl(VM *vm, Parser *parser, Lexer *lexer);
+static void stmt(VM *vm, Parser *parser);
+static void decl(VM *vm, Parser *parser);
 
-static void decl(VM *vm, Parser *parser, Lexer *lexer) {
-  if (match(parser, lexer, TOK_VAR)) {
-    varDecl(vm, parser, lexer);
+static void decl(VM *vm, Parser *parser) {
+  if (match(parser, TOK_VAR)) {
+    varDecl(vm, parser);
   } else {
-    stmt(vm, parser, lexer);
+    stmt(vm, parser);
+  }
+  if (parser->isPanicing) synchronize(parser);
+}
+static void block(VM *vm, Parser *parser) {
+  while (!check(parser, TOK_RIGHT_BRACE) && !check(parser, TOK_EOF)) {
+    decl(vm, parser);
   }
-  if (parser->isPanicing) synchronize(parser, lexer);
+  consume(parser, TOK_RIGHT_BRACE, "Expect '}' after block.");
 }
-static void stmt(VM *vm, Parser *parser, Lexer *lexer) {
-  if (match(parser, lexer, TOK_PRINT)) {
-    printStmt(vm, parser, lexer);
+
+static void beginScope(Parser *parser) { parser->compiler->scopeDepth++; }
+
+/**
+ * @brief Closes the innermost scope, dropping all of its locals with a
+ * single OP_POP or OP_POPN, or two OP_POPNs for a full scope.
+ */
+static void endScope(Parser *parser) {
+  parser->compiler->scopeDepth--;
+
+  int popped = 0;
+  while (parser->compiler->localCount > 0 &&
+         parser->compiler->locals[parser->compiler->localCount - 1].depth > parser->compiler->scopeDepth) {
+    parser->compiler->localCount--;
+    popped++;
+  }
+
+  // A full scope holds UINT8_COUNT locals, one more than an operand counts.
+  for (; popped > UINT8_MAX; popped -= UINT8_MAX) {
+    emitBytes(parser, OP_POPN, UINT8_MAX);
+  }
+  if (popped == 1) {
+    emitByte(parser, OP_POP);
+  } else if (popped > 1) {
+    emitBytes(parser, OP_POPN, popped);
+  }
+}
+
+static void ifStmt(VM *vm, Parser *parser) {
+  consume(parser, TOK_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression(vm, parser);
+  consume(parser, TOK_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int thenJump = emitConditionJump(parser);
+  stmt(vm, parser);
+
+  if (match(parser, TOK_ELSE)) {
+    int elseJump = emitJump(parser, OP_JUMP);
+    patchJump(parser, thenJump);
+    stmt(vm, parser);
+    patchJump(parser, elseJump);
   } else {
-    expressionStmt(vm, parser, lexer);
+    patchJump(parser, thenJump);
   }
 }
-static void grouping(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
-  expression(vm, parser, lexer);
-  consume(parser, lexer, TOK_RIGHT_PAREN, "Expect `)` after expression.");
+
+static void whileStmt(VM *vm, Parser *parser) {
+  int loopStart = currentChunk(parser)->length;
+  consume(parser, TOK_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression(vm, parser);
+  consume(parser, TOK_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int exitJump = emitConditionJump(parser);
+  stmt(vm, parser);
+  emitLoop(parser, loopStart);
+
+  patchJump(parser, exitJump);
+}
+
+static void forStmt(VM *vm, Parser *parser) {
+  beginScope(parser);
+  consume(parser, TOK_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(parser, TOK_SEMICOLON)) {
+    // No initializer.
+  } else if (match(parser, TOK_VAR)) {
+    varDecl(vm, parser);
+  } else {
+    expressionStmt(vm, parser);
+  }
+
+  int loopStart = currentChunk(parser)->length;
+  int exitJump = -1;
+  if (!match(parser, TOK_SEMICOLON)) {
+    expression(vm, parser);
+    consume(parser, TOK_SEMICOLON, "Expect ';' after loop condition.");
+    exitJump = emitConditionJump(parser);
+  }
+
+  if (!match(parser, TOK_RIGHT_PAREN)) {
+    int bodyJump = emitJump(parser, OP_JUMP);
+    int incrementStart = currentChunk(parser)->length;
+    expression(vm, parser);
+    emitByte(parser, OP_POP);
+    consume(parser, TOK_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    emitLoop(parser, loopStart);
+    loopStart = incrementStart;
+    patchJump(parser, bodyJump);
+  }
+
+  stmt(vm, parser);
+  emitLoop(parser, loopStart);
+
+  if (exitJump != -1) patchJump(parser, exitJump);
+  endScope(parser);
+}
+
+static void stmt(VM *vm, Parser *parser) {
+  if (match(parser, TOK_PRINT)) {
+    printStmt(vm, parser);
+  } else if (match(parser, TOK_IF)) {
+    ifStmt(vm, parser);
+  } else if (match(parser, TOK_WHILE)) {
+    whileStmt(vm, parser);
+  } else if (match(parser, TOK_FOR)) {
+    forStmt(vm, parser);
+  } else if (match(parser, TOK_YIELD)) {
+    yieldStmt(vm, parser);
+  } else if (match(parser, TOK_LEFT_BRACE)) {
+    beginScope(parser);
+    block(vm, parser);
+    endScope(parser);
+  } else {
+    expressionStmt(vm, parser);
+  }
+}
+static void grouping(VM *vm, Parser *parser, bool canAssign) {
+  expression(vm, parser);
+  consume(parser, TOK_RIGHT_PAREN, "Expect `)` after expression.");
 }
 static void emitConstant(Parser *parser, Value value) {
-  emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
+  int constant = makeConstant(parser, value);
+  if (constant <= UINT8_MAX) {
+    emitBytes(parser, OP_CONSTANT, constant);
+  } else {
+    emitByte(parser, OP_CONSTANT_LONG);
+    emitBytes(parser, constant & 0xff, (constant >> 8) & 0xff);
+  }
 }
-static void number(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
-  double value = strtod(parser->previous.start, NULL);
+static void number(VM *vm, Parser *parser, bool canAssign) {
+  double value = parseNumber(parser->previous.start, parser->previous.length);
   emitConstant(parser, NUMBER_VAL(value));
+  setType(parser, TYPE_NUMBER, false);
 }
-static void unary(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
+static void unary(VM *vm, Parser *parser, bool canAssign) {
   TokType opType = parser->previous.type;
 
-  parsePrecedence(vm, parser, lexer, PREC_UNARY);
+  parsePrecedence(vm, parser, PREC_UNARY);
 
   switch (opType) {
-    case TOK_MINUS: emitByte(parser, OP_NEGATE); break;
-    case TOK_BANG: emitByte(parser, OP_NOT); break;
+    case TOK_MINUS: {
+      bool numbers = provedNumbers(parser, parser->type, TYPE_NUMBER,
+                                   parser->assumed);
+      emitTypedOp(parser, OP_NEGATE, OP_NEGATE_N, numbers, parser->assumed);
+      setType(parser, TYPE_NUMBER, false);
+      break;
+    }
+    case TOK_BANG:
+      emitByte(parser, OP_NOT);
+      setType(parser, TYPE_BOOL, false);
+      break;
     default: return;
   }
 }
 
-static void binary(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
+/**
+ * @brief Compiles the right operand and the operator.
+ *
+ * Arithmetic and comparisons whose operands are both proved to be numbers
+ * use the unchecked opcodes. Whatever the operands, an arithmetic result
+ * other than `+` is a number, or the guarded instruction has raised an
+ * error, so it is typed without assumptions.
+ */
+static void binary(VM *vm, Parser *parser, bool canAssign) {
   TokType opType = parser->previous.type;
-  ParseRule *rule = getRule(opType);
-  parsePrecedence(vm, parser, lexer, (Precedence)rule->precedence + 1);
+  ExprType left = parser->type;
+  bool leftAssumed = parser->assumed;
+  const ParseRule *rule = getRule(opType);
+  parsePrecedence(vm, parser, (Precedence)rule->precedence + 1);
+
+  ExprType right = parser->type;
+  bool assumed = leftAssumed || parser->assumed;
+  bool numbers = provedNumbers(parser, left, right, assumed);
 
   switch (opType) {
-    case TOK_PLUS: emitByte(parser, OP_ADD); break;
-    case TOK_MINUS: emitByte(parser, OP_SUBTRACT); break;
-    case TOK_STAR: emitByte(parser, OP_MULTIPLY); break;
-    case TOK_SLASH: emitByte(parser, OP_DIVIDE); break;
+    case TOK_PLUS:
+      emitTypedOp(parser, OP_ADD, OP_ADD_NN, numbers, assumed);
+      if (left == TYPE_NUMBER || right == TYPE_NUMBER) {
+        setType(parser, TYPE_NUMBER, assumed);
+      } else if (left == TYPE_STRING && right == TYPE_STRING) {
+        setType(parser, TYPE_STRING, assumed);
+      } else {
+        setType(parser, TYPE_UNKNOWN, false);
+      }
+      return;
+    case TOK_MINUS:
+      emitTypedOp(parser, OP_SUBTRACT, OP_SUBTRACT_NN, numbers, assumed);
+      setType(parser, TYPE_NUMBER, false);
+      return;
+    case TOK_STAR:
+      emitTypedOp(parser, OP_MULTIPLY, OP_MULTIPLY_NN, numbers, assumed);
+      setType(parser, TYPE_NUMBER, false);
+      return;
+    case TOK_SLASH:
+      emitTypedOp(parser, OP_DIVIDE, OP_DIVIDE_NN, numbers, assumed);
+      setType(parser, TYPE_NUMBER, false);
+      return;
     case TOK_BANG: emitByte(parser, OP_NOT); break;
     case TOK_EQUAL_EQUAL: emitByte(parser, OP_EQUAL); break;
     case TOK_BANG_EQUAL: emitBytes(parser, OP_EQUAL, OP_NOT); break;
-    case TOK_GREATER: emitByte(parser, OP_GREATER); break;
-    case TOK_GREATER_EQUAL: emitBytes(parser, OP_LESS, OP_NOT); break;
-    case TOK_LESS: emitByte(parser, OP_LESS); break;
-    case TOK_LESS_EQUAL: emitBytes(parser, OP_GREATER, OP_NOT); break;
+    case TOK_GREATER:
+      parser->compiler->lastCompare = currentChunk(parser)->length;
+      emitTypedOp(parser, OP_GREATER, OP_GREATER_NN, numbers, assumed);
+      break;
+    case TOK_GREATER_EQUAL:
+      parser->compiler->lastCompare = currentChunk(parser)->length;
+      emitTypedOp(parser, OP_LESS, OP_LESS_NN, numbers, assumed);
+      emitByte(parser, OP_NOT);
+      break;
+    case TOK_LESS:
+      parser->compiler->lastCompare = currentChunk(parser)->length;
+      emitTypedOp(parser, OP_LESS, OP_LESS_NN, numbers, assumed);
+      break;
+    case TOK_LESS_EQUAL:
+      parser->compiler->lastCompare = currentChunk(parser)->length;
+      emitTypedOp(parser, OP_GREATER, OP_GREATER_NN, numbers, assumed);
+      emitByte(parser, OP_NOT);
+      break;
     default: return;
   }
+  setType(parser, TYPE_BOOL, false);
 }
 
-static void literal(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
+static void literal(VM *vm, Parser *parser, bool canAssign) {
   switch (parser->previous.type) {
     case TOK_FALSE: emitByte(parser, OP_FALSE); break;
     case TOK_NIL: emitByte(parser, OP_NIL); break;
     case TOK_TRUE: emitByte(parser, OP_TRUE); break;
     default: return;
   }
+  setType(parser, parser->previous.type == TOK_NIL ? TYPE_NIL : TYPE_BOOL,
+          false);
 }
 
-static void string(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
+static void string(VM *vm, Parser *parser, bool canAssign) {
   emitConstant(parser, OBJ_VAL(copyString(vm, parser->previous.start + 1,
                                           parser->previous.length - 2)));
+  setType(parser, TYPE_STRING, false);
 };
 
-static void namedVar(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
-  uint8_t arg = identifierConstant(vm, parser);
+/**
+ * @brief Compiles `spawn { ... }` into a new fiber running the block.
+ *
+ * The block is emitted inline behind an OP_SPAWN that jumps over it, and ends
+ * in OP_FINISH. It has a compiler of its own, so its locals number from slot
+ * 0 of the fiber's stack and the locals around it are out of reach.
+ */
+static void spawn(VM *vm, Parser *parser, bool canAssign) {
+  consume(parser, TOK_LEFT_BRACE, "Expect '{' after 'spawn'.");
+  int skip = emitJump(parser, OP_SPAWN);
+
+  Compiler body;
+  initCompiler(&body, parser->compiler, currentChunk(parser)->length);
+  parser->compiler = &body;
+  beginScope(parser);
+  block(vm, parser);
+  emitByte(parser, OP_FINISH); // Its stack is freed, so no need to pop
+  parser->compiler = body.enclosing;
+  freeOffsetArray(&body.assumed);
+
+  patchJump(parser, skip);
+  setType(parser, TYPE_UNKNOWN, false);
+}
+
+// `resume f` runs f until it yields, and is the value it yielded, or nil
+// once it finishes.
+static void resume(VM *vm, Parser *parser, bool canAssign) {
+  parsePrecedence(vm, parser, PREC_UNARY);
+  emitByte(parser, OP_RESUME);
+  setType(parser, TYPE_UNKNOWN, false);
+}
 
-  if (canAssign && match(parser, lexer, TOK_EQUAL)) {
-    expression(vm, parser, lexer);
-    emitBytes(parser, OP_SET_GLOBAL, arg);
+static void namedVar(VM *vm, Parser *parser, bool canAssign) {
+  uint8_t getOp, setOp;
+  int arg = resolveLocal(parser, parser->compiler, &parser->previous);
+  if (arg != -1) {
+    getOp = OP_GET_LOCAL;
+    setOp = OP_SET_LOCAL;
   } else {
+    for (Compiler *outer = parser->compiler->enclosing; outer != NULL;
+         outer = outer->enclosing) {
+      if (resolveLocal(parser, outer, &parser->previous) != -1) {
+        error(parser, "Can't use a local variable from outside a fiber.");
+      }
+    }
+    arg = identifierConstant(vm, parser);
+    getOp = OP_GET_GLOBAL;
+    setOp = OP_SET_GLOBAL;
+  }
 
-    emitBytes(parser, OP_GET_GLOBAL, arg);
+  if (canAssign && match(parser, TOK_EQUAL)) {
+    expression(vm, parser);
+    emitBytes(parser, setOp, arg);
+    if (getOp == OP_GET_LOCAL && parser->type != TYPE_NUMBER &&
+        parser->compiler->locals[arg].type == TYPE_NUMBER) {
+      poisonLocals(parser);
+    }
+  } else {
+    emitBytes(parser, getOp, arg);
+    if (getOp == OP_GET_LOCAL && parser->compiler->trustLocals) {
+      setType(parser, parser->compiler->locals[arg].type, true);
+    } else {
+      setType(parser, TYPE_UNKNOWN, false);
+    }
   }
 };
 
-static void var(VM *vm, Parser *parser, Lexer *lexer, bool canAssign) {
-  namedVar(vm, parser, lexer, canAssign);
+static void var(VM *vm, Parser *parser, bool canAssign) {
+  namedVar(vm, parser, canAssign);
 };
 
-bool compile(VM *vm, const char *src, Chunk *chunk) {
-  Lexer lexer;
-  Parser parser = {0};
-  initLexer(&lexer, src);
-  compilingChunk = chunk;
+// `and` and `or` yield one of their operands, so their type is the join.
+static void joinType(Parser *parser, ExprType left, bool leftAssumed) {
+  if (parser->type != left) {
+    setType(parser, TYPE_UNKNOWN, false);
+  } else {
+    setType(parser, left, leftAssumed || parser->assumed);
+  }
+}
+
+static void and_(VM *vm, Parser *parser, bool canAssign) {
+  ExprType left = parser->type;
+  bool leftAssumed = parser->assumed;
+  int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+
+  emitByte(parser, OP_POP);
+  parsePrecedence(vm, parser, PREC_AND);
 
-  advance(&parser, &lexer);
+  patchJump(parser, endJump);
+  joinType(parser, left, leftAssumed);
+}
+
+static void or_(VM *vm, Parser *parser, bool canAssign) {
+  ExprType left = parser->type;
+  bool leftAssumed = parser->assumed;
+  int endJump = emitJump(parser, OP_JUMP_IF_TRUE);
+
+  emitByte(parser, OP_POP);
+  parsePrecedence(vm, parser, PREC_OR);
 
-  while (!match(&parser, &lexer, TOK_EOF)) {
-    decl(vm, &parser, &lexer);
+  patchJump(parser, endJump);
+  joinType(parser, left, leftAssumed);
+}
+
+bool compile(VM *vm, const char *src, Chunk *chunk) {
+  hashMap names;
+  mapInit(&names);
+  bool ok = compileWithNames(vm, src, chunk, &names);
+  mapReset(&names);
+  return ok;
+}
+
+/**
+ * @brief Compiles `src`, appending to `chunk`.
+ *
+ * `names` maps each global name already stored in `chunk`'s constants to its
+ * index (as a number), and is extended with the names this source adds.
+ */
+bool compileWithNames(VM *vm, const char *src, Chunk *chunk, hashMap *names) {
+  TokBuffer tokens;
+  Parser parser = {0};
+  Compiler compiler;
+  initCompiler(&compiler, NULL, 0);
+  tokBufferInit(&tokens, src);
+  parser.tokens = &tokens;
+  parser.chunk = chunk;
+  parser.names = names;
+  parser.err = vm->err;
+  parser.compiler = &compiler;
+
+  advance(&parser);
+
+  while (!match(&parser, TOK_EOF)) {
+    decl(vm, &parser);
   }
   endCompiler(&parser);
+  tokBufferFree(&tokens);
+  freeOffsetArray(&compiler.assumed);
+
+  if (!parser.hadError && vm->optimize) optimizeChunk(vm, chunk);
   return !parser.hadError;
 }
 
-static ParseRule rules[] = {
+static const ParseRule rules[] = {
     [TOK_LEFT_PAREN] = {grouping, NULL, PREC_NONE},
     [TOK_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
     [TOK_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
@@ -303,7 +817,7 @@ static ParseRule rules[] = {
     [TOK_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
     [TOK_IDENTIFIER] = {var, NULL, PREC_NONE},
     [TOK_NUMBER] = {number, NULL, PREC_NONE},
-    [TOK_AND] = {NULL, NULL, PREC_NONE},
+    [TOK_AND] = {NULL, and_, PREC_AND},
     [TOK_CLASS] = {NULL, NULL, PREC_NONE},
     [TOK_ELSE] = {NULL, NULL, PREC_NONE},
     [TOK_FALSE] = {literal, NULL, PREC_NONE},
@@ -311,14 +825,17 @@ static ParseRule rules[] = {
     [TOK_FUN] = {NULL, NULL, PREC_NONE},
     [TOK_IF] = {NULL, NULL, PREC_NONE},
     [TOK_NIL] = {literal, NULL, PREC_NONE},
-    [TOK_OR] = {NULL, NULL, PREC_NONE},
+    [TOK_OR] = {NULL, or_, PREC_OR},
     [TOK_PRINT] = {NULL, NULL, PREC_NONE},
+    [TOK_RESUME] = {resume, NULL, PREC_NONE},
     [TOK_RETURN] = {NULL, NULL, PREC_NONE},
+    [TOK_SPAWN] = {spawn, NULL, PREC_NONE},
     [TOK_SUPER] = {NULL, NULL, PREC_NONE},
     [TOK_THIS] = {NULL, NULL, PREC_NONE},
     [TOK_TRUE] = {literal, NULL, PREC_NONE},
     [TOK_VAR] = {NULL, NULL, PREC_NONE},
     [TOK_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOK_YIELD] = {NULL, NULL, PREC_NONE},
     [TOK_ERROR] = {NULL, NULL, PREC_NONE},
     [TOK_EOF] = {NULL, NULL, PREC_NONE},
     [TOK_STRING] = {string, NULL, PREC_NONE}};
@@ -2,13 +2,64 @@
 #define svm_compiler_h
 
 #include "chunk.h"
-#include "lexer.h"
+#include "tokens.h"
 #include "vm.h"
 bool compile(VM *vm, const char *src, Chunk *chunk);
+bool compileWithNames(VM *vm, const char *src, Chunk *chunk, hashMap *names);
 
+#define UINT8_COUNT (UINT8_MAX + 1)
+
+// What the compiler can prove about the value of an expression.
+// TYPE_UNKNOWN is the top of the lattice: any value at all.
+typedef enum {
+  TYPE_UNKNOWN,
+  TYPE_NUMBER,
+  TYPE_BOOL,
+  TYPE_NIL,
+  TYPE_STRING,
+} ExprType;
+
+typedef struct {
+  Tok name;
+  int depth; // Scope depth, or -1 until the initializer has been compiled
+  ExprType type; // TYPE_NUMBER if declared with a number, else TYPE_UNKNOWN
+} Local;
+
+typedef struct {
+  int length;
+  int capacity;
+  int *values;
+} OffsetArray;
+
+typedef struct Compiler {
+  struct Compiler *enclosing; // The code around a fiber body, or NULL
+  Local locals[UINT8_COUNT];
+  int localCount;
+  int scopeDepth;
+  // Offset of the last OP_LESS/OP_GREATER emitted, or -1, and the highest
+  // offset any jump has been patched to land on; see emitConditionJump.
+  int lastCompare;
+  int lastTarget;
+  // Whether locals declared as numbers are still taken to hold numbers, and
+  // the unchecked instructions emitted on that basis; see poisonLocals.
+  bool trustLocals;
+  OffsetArray assumed;
+} Compiler;
+
+/**
+ * @brief Everything one compilation touches. Each call to compile() owns its
+ * own Parser, so separate threads can compile into separate chunks at once.
+ */
 typedef struct {
+  TokBuffer *tokens;
+  Chunk *chunk;
+  hashMap *names; // Global name -> constant index
+  FILE *err;      // Where errors are reported
+  Compiler *compiler;
   Tok current;
   Tok previous;
+  ExprType type; // Type of the expression just compiled
+  bool assumed;  // Whether `type` relies on compiler->trustLocals
   bool hadError;
   bool isPanicing;
 } Parser;
@@ -27,7 +78,7 @@ typedef enum {
   PREC_PRIMARY,
 } Precedence;
 
-typedef void (*ParseFn)(VM *, Parser *, Lexer *, bool canAssign);
+typedef void (*ParseFn)(VM *, Parser *, bool canAssign);
 
 typedef struct {
   ParseFn prefix;
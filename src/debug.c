@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "chunk.h"
+#include "object.h"
 #include <stdio.h>
 
 static int simpleInstruction(const char *name, int offset) {
@@ -7,6 +8,18 @@ static int simpleInstruction(const char *name, int offset) {
   return offset + 1;
 }
 
+static int byteInstruction(const char *name, Chunk *chunk, int offset) {
+  printf("%-16s %4d\n", name, chunk->code[offset + 1]);
+  return offset + 2;
+}
+
+static int jumpInstruction(const char *name, int sign, Chunk *chunk,
+                           int offset) {
+  uint16_t jump = chunk->code[offset + 1] | (chunk->code[offset + 2] << 8);
+  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+  return offset + 3;
+}
+
 static int constantInstruction(const char *name, Chunk *chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   printf("%-16s %4d '", name, constant);
@@ -68,7 +81,152 @@ int disassembleInstruction(Chunk *chunk, int offset) {
       return constantInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_SET_GLOBAL:
       return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_PICK: return byteInstruction("OP_PICK", chunk, offset);
+    case OP_POPN: return byteInstruction("OP_POPN", chunk, offset);
+    case OP_GET_LOCAL: return byteInstruction("OP_GET_LOCAL", chunk, offset);
+    case OP_SET_LOCAL: return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_JUMP: return jumpInstruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE:
+      return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+      return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE_POP:
+      return jumpInstruction("OP_JUMP_IF_FALSE_POP", 1, chunk, offset);
+    case OP_JUMP_IF_LESS:
+      return jumpInstruction("OP_JUMP_IF_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_LESS:
+      return jumpInstruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset);
+    case OP_JUMP_IF_GREATER:
+      return jumpInstruction("OP_JUMP_IF_GREATER", 1, chunk, offset);
+    case OP_JUMP_IF_NOT_GREATER:
+      return jumpInstruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset);
+    case OP_LOOP: return jumpInstruction("OP_LOOP", -1, chunk, offset);
+    case OP_SPAWN: return jumpInstruction("OP_SPAWN", 1, chunk, offset);
+    case OP_RESUME: return simpleInstruction("OP_RESUME", offset);
+    case OP_YIELD: return simpleInstruction("OP_YIELD", offset);
+    case OP_FINISH: return simpleInstruction("OP_FINISH", offset);
+    case OP_ADD_NUM: return simpleInstruction("OP_ADD_NUM", offset);
+    case OP_ADD_STR: return simpleInstruction("OP_ADD_STR", offset);
+    case OP_SUBTRACT_NUM: return simpleInstruction("OP_SUBTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM: return simpleInstruction("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM: return simpleInstruction("OP_DIVIDE_NUM", offset);
+    case OP_LESS_NUM: return simpleInstruction("OP_LESS_NUM", offset);
+    case OP_GREATER_NUM: return simpleInstruction("OP_GREATER_NUM", offset);
+    case OP_GET_GLOBAL_CACHED:
+      return constantInstruction("OP_GET_GLOBAL_CACHED", chunk, offset);
+    case OP_SET_GLOBAL_CACHED:
+      return constantInstruction("OP_SET_GLOBAL_CACHED", chunk, offset);
+    case OP_NEGATE_N: return simpleInstruction("OP_NEGATE_N", offset);
+    case OP_ADD_NN: return simpleInstruction("OP_ADD_NN", offset);
+    case OP_SUBTRACT_NN: return simpleInstruction("OP_SUBTRACT_NN", offset);
+    case OP_MULTIPLY_NN: return simpleInstruction("OP_MULTIPLY_NN", offset);
+    case OP_DIVIDE_NN: return simpleInstruction("OP_DIVIDE_NN", offset);
+    case OP_LESS_NN: return simpleInstruction("OP_LESS_NN", offset);
+    case OP_GREATER_NN: return simpleInstruction("OP_GREATER_NN", offset);
 
     default: printf("Unknown opcode %d\n", instruction); return offset + 1;
   }
 }
+
+// Prints a register operand: r<n> for frame slots, k<n> for constants.
+static void printRegister(RegCode *code, int reg) {
+  int literals = code->registerCount - 3;
+  if (reg < code->frameSize) {
+    printf("r%d", reg);
+  } else if (reg < literals) {
+    printf("k%d", reg - code->frameSize);
+  } else {
+    static const char *names[] = {"nil", "true", "false"};
+    printf("%s", names[reg - literals]);
+  }
+}
+
+void disassembleRegCode(RegCode *code, const char *name) {
+  printf("== %s ==\n", name);
+  for (int i = 0; i < code->code.length; i++) {
+    disassembleRegInstruction(code, i);
+  }
+}
+
+void disassembleRegInstruction(RegCode *code, int index) {
+  static const char *names[] = {
+      [ROP_MOVE] = "MOVE",
+      [ROP_NEGATE] = "NEGATE",
+      [ROP_NOT] = "NOT",
+      [ROP_ADD] = "ADD",
+      [ROP_SUBTRACT] = "SUBTRACT",
+      [ROP_MULTIPLY] = "MULTIPLY",
+      [ROP_DIVIDE] = "DIVIDE",
+      [ROP_EQUAL] = "EQUAL",
+      [ROP_GREATER] = "GREATER",
+      [ROP_LESS] = "LESS",
+      [ROP_PRINT] = "PRINT",
+      [ROP_DEFINE_GLOBAL] = "DEFINE_GLOBAL",
+      [ROP_GET_GLOBAL] = "GET_GLOBAL",
+      [ROP_SET_GLOBAL] = "SET_GLOBAL",
+      [ROP_JUMP] = "JUMP",
+      [ROP_JUMP_IF_FALSE] = "JUMP_IF_FALSE",
+      [ROP_JUMP_IF_TRUE] = "JUMP_IF_TRUE",
+      [ROP_JUMP_IF_LESS] = "JUMP_IF_LESS",
+      [ROP_JUMP_IF_NOT_LESS] = "JUMP_IF_NOT_LESS",
+      [ROP_JUMP_IF_GREATER] = "JUMP_IF_GREATER",
+      [ROP_JUMP_IF_NOT_GREATER] = "JUMP_IF_NOT_GREATER",
+      [ROP_LOOP] = "LOOP",
+      [ROP_RETURN] = "RETURN",
+      [ROP_NEGATE_N] = "NEGATE_N",
+      [ROP_ADD_NN] = "ADD_NN",
+      [ROP_SUBTRACT_NN] = "SUBTRACT_NN",
+      [ROP_MULTIPLY_NN] = "MULTIPLY_NN",
+      [ROP_DIVIDE_NN] = "DIVIDE_NN",
+      [ROP_LESS_NN] = "LESS_NN",
+      [ROP_GREATER_NN] = "GREATER_NN",
+  };
+  RegInstr *instr = &code->code.values[index];
+  printf("%04d %-20s ", index, names[instr->op]);
+
+  switch (instr->op) {
+    case ROP_RETURN: break;
+    case ROP_PRINT: printRegister(code, instr->a); break;
+    case ROP_GET_GLOBAL:
+      printRegister(code, instr->a);
+      printf(", '%s'", instr->as.name->chars);
+      break;
+    case ROP_DEFINE_GLOBAL:
+    case ROP_SET_GLOBAL:
+      printf("'%s', ", instr->as.name->chars);
+      printRegister(code, instr->a);
+      break;
+    case ROP_JUMP:
+    case ROP_LOOP: printf("-> %d", instr->as.target); break;
+    case ROP_JUMP_IF_FALSE:
+    case ROP_JUMP_IF_TRUE:
+      printRegister(code, instr->a);
+      printf(" -> %d", instr->as.target);
+      break;
+    case ROP_JUMP_IF_LESS:
+    case ROP_JUMP_IF_NOT_LESS:
+    case ROP_JUMP_IF_GREATER:
+    case ROP_JUMP_IF_NOT_GREATER:
+      printRegister(code, instr->b);
+      printf(", ");
+      printRegister(code, instr->c);
+      printf(" -> %d", instr->as.target);
+      break;
+    case ROP_MOVE:
+    case ROP_NEGATE:
+    case ROP_NOT:
+    case ROP_NEGATE_N:
+      printRegister(code, instr->a);
+      printf(", ");
+      printRegister(code, instr->b);
+      break;
+    default:
+      printRegister(code, instr->a);
+      printf(", ");
+      printRegister(code, instr->b);
+      printf(", ");
+      printRegister(code, instr->c);
+      break;
+  }
+  printf("\n");
+}
@@ -1,8 +1,11 @@
 #ifndef svm_debug_h
 #define svm_debug_h
 #include "chunk.h"
+#include "regcode.h"
 
 void disassembleChunk(Chunk *chunk, const char *name);
 int disassembleInstruction(Chunk *chunk, int offset);
+void disassembleRegCode(RegCode *code, const char *name);
+void disassembleRegInstruction(RegCode *code, int index);
 
 #endif
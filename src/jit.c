@@ -0,0 +1,662 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+/*
+ * Baseline template JIT. Every bytecode instruction is replaced by a fixed
+ * machine-code template; the VM stack stays in memory, addressed through
+ * registers that live for the whole native call:
+ *
+ *   r12  VM *
+ *   r13  vm->stack->data, the base of the locals
+ *   r14  vm->stack
+ *   rbx  address of the top stack Value
+ *
+ * Number checks are inline tag compares. When one fails, or an instruction
+ * has no template, the code takes a side exit: it stores the stack top and
+ * returns the offset of that instruction so run() continues from there with
+ * the stack exactly as the interpreter expects it.
+ */
+
+typedef enum {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSI = 6,
+  RDI = 7,
+  R12 = 12,
+  R13 = 13,
+  R14 = 14,
+} Reg;
+
+typedef enum { XMM0 = 0, XMM1 = 1 } XmmReg;
+
+typedef enum { CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7 } Cond;
+
+#define VALUE_TYPE offsetof(Value, type)
+#define VALUE_AS offsetof(Value, as)
+#define SLOT(n) ((int32_t)((n) * (int32_t)sizeof(Value)))
+
+typedef struct {
+  int length;
+  int capacity;
+  uint8_t *values;
+} CodeBuffer;
+
+DECLARE_CONTAINER_FUNCTIONS(uint8_t, CodeBuffer);
+IMPLEMENT_CONTAINER_FUNCTIONS(uint8_t, CodeBuffer)
+
+// A rel32 at native offset `at` that must reach bytecode offset `target`,
+// either directly or through that offset's side exit.
+typedef struct {
+  int at;
+  int target;
+} JitPatch;
+
+typedef struct {
+  int length;
+  int capacity;
+  JitPatch *values;
+} JitPatchArray;
+
+DECLARE_CONTAINER_FUNCTIONS(JitPatch, JitPatchArray);
+IMPLEMENT_CONTAINER_FUNCTIONS(JitPatch, JitPatchArray)
+
+typedef struct {
+  Chunk *chunk;
+  CodeBuffer code;
+  JitPatchArray jumps;
+  JitPatchArray exits;
+  int *entries;
+  bool *targets;
+  int epilogue;
+} Jit;
+
+// Unchecked opcodes compile like their generic form minus the type guards.
+static bool isUnchecked(uint8_t op) {
+  return op >= OP_NEGATE_N && op <= OP_GREATER_NN;
+}
+
+static void emit8(Jit *j, uint8_t byte) { writeCodeBuffer(&j->code, byte); }
+
+static void emit32(Jit *j, uint32_t value) {
+  for (int i = 0; i < 4; i++) emit8(j, (value >> (8 * i)) & 0xff);
+}
+
+static void emit64(Jit *j, uint64_t value) {
+  for (int i = 0; i < 8; i++) emit8(j, (value >> (8 * i)) & 0xff);
+}
+
+static void emitOpcode(Jit *j, int prefix, bool wide, int opcode, int reg,
+                       int rm) {
+  if (prefix) emit8(j, prefix);
+  uint8_t rex = (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1);
+  if (rex) emit8(j, 0x40 | rex);
+  if (opcode > 0xff) emit8(j, opcode >> 8);
+  emit8(j, opcode & 0xff);
+}
+
+// `opcode reg, [base + disp32]`; two-byte opcodes are written as 0x0Fxx.
+static void memOp(Jit *j, int prefix, bool wide, int opcode, int reg, Reg base,
+                  int32_t disp) {
+  emitOpcode(j, prefix, wide, opcode, reg, base);
+  emit8(j, 0x80 | (reg & 7) << 3 | (base & 7));
+  if ((base & 7) == 4) emit8(j, 0x24);
+  emit32(j, (uint32_t)disp);
+}
+
+// `opcode reg, rm` with both operands in registers.
+static void regOp(Jit *j, int prefix, bool wide, int opcode, int reg, int rm) {
+  emitOpcode(j, prefix, wide, opcode, reg, rm);
+  emit8(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void movImm64(Jit *j, Reg reg, uint64_t value) {
+  emit8(j, 0x48 | ((reg >> 3) & 1));
+  emit8(j, 0xb8 + (reg & 7));
+  emit64(j, value);
+}
+
+static void storeType(Jit *j, Reg base, int32_t disp, ValueType type) {
+  memOp(j, 0, false, 0xc7, 0, base, disp + VALUE_TYPE);
+  emit32(j, type);
+}
+
+static void cmpType(Jit *j, Reg base, int32_t disp, ValueType type) {
+  memOp(j, 0, false, 0x83, 7, base, disp + VALUE_TYPE);
+  emit8(j, type);
+}
+
+static void moveTop(Jit *j, int slots) {
+  if (slots == 0) return;
+  regOp(j, 0, true, 0x81, slots > 0 ? 0 : 5, RBX);
+  emit32(j, (uint32_t)SLOT(slots > 0 ? slots : -slots));
+}
+
+static void jumpTo(Jit *j, int opcode, JitPatchArray *patches, int target) {
+  if (opcode > 0xff) emit8(j, opcode >> 8);
+  emit8(j, opcode & 0xff);
+  writeJitPatchArray(patches, (JitPatch){j->code.length, target});
+  emit32(j, 0);
+}
+
+static void exitIf(Jit *j, Cond cc, int offset) {
+  jumpTo(j, 0x0f80 | cc, &j->exits, offset);
+}
+
+static void exitUnlessNumber(Jit *j, Reg base, int32_t disp, int offset) {
+  cmpType(j, base, disp, VAL_NUMBER);
+  exitIf(j, CC_NE, offset);
+}
+
+// Writes the stack top back into vm->stack->top.
+static void flushTop(Jit *j) {
+  regOp(j, 0, true, 0x89, RBX, RAX);
+  regOp(j, 0, true, 0x29, R13, RAX);
+  emit8(j, 0x48), emit8(j, 0xc1), emit8(j, 0xf8), emit8(j, 4); // sar rax, 4
+  memOp(j, 0, false, 0x89, RAX, R14, offsetof(Stack, top));
+}
+
+// Reloads the stack registers, which a helper may have moved.
+static void reloadStack(Jit *j) {
+  memOp(j, 0, true, 0x8b, R13, R14, offsetof(Stack, data));
+  memOp(j, 0, true, 0x63, RAX, R14, offsetof(Stack, top));
+  emit8(j, 0x48), emit8(j, 0xc1), emit8(j, 0xe0), emit8(j, 4); // shl rax, 4
+  regOp(j, 0, true, 0x89, RAX, RBX);
+  regOp(j, 0, true, 0x01, R13, RBX);
+}
+
+/**
+ * @brief Calls `fn(vm, arg)` with the stack flushed; the helper's bool result
+ * is left in cl.
+ */
+static void callHelper(Jit *j, void *fn, uint64_t arg) {
+  flushTop(j);
+  regOp(j, 0, true, 0x89, R12, RDI);
+  movImm64(j, RSI, arg);
+  movImm64(j, RAX, (uint64_t)(uintptr_t)fn);
+  emit8(j, 0xff), emit8(j, 0xd0); // call rax
+  emit8(j, 0x89), emit8(j, 0xc1); // mov ecx, eax
+  reloadStack(j);
+}
+
+static bool helperGetGlobal(VM *vm, ObjString *name) {
+  Value value;
+  if (!mapGet(&vm->globals, name, &value)) return false;
+  stackPush(vm->stack, value);
+  return true;
+}
+
+static bool helperSetGlobal(VM *vm, ObjString *name) {
+  Value value = vm->stack->data[vm->stack->top];
+  if (mapInsert(&vm->globals, name, value)) {
+    mapDelete(&vm->globals, name);
+    return false;
+  }
+  return true;
+}
+
+static bool helperDefineGlobal(VM *vm, ObjString *name) {
+  mapInsert(&vm->globals, name, stackPop(vm->stack));
+  return true;
+}
+
+static bool helperPrint(VM *vm, ObjString *unused) {
+  (void)unused;
+  sinkPrintLine(&vm->out, stackPop(vm->stack));
+  return true;
+}
+
+static bool helperEqual(VM *vm, ObjString *unused) {
+  (void)unused;
+  Value b = stackPop(vm->stack);
+  Value a = stackPop(vm->stack);
+  stackPush(vm->stack, BOOL_VAL(valuesEqual(a, b)));
+  return true;
+}
+
+// Sets al to 1 when the top Value is falsey (nil or false), else 0.
+static void emitFalsey(Jit *j) {
+  memOp(j, 0, false, 0x8b, RAX, RBX, VALUE_TYPE);
+  emit8(j, 0x83), emit8(j, 0xf8), emit8(j, VAL_NIL); // cmp eax, VAL_NIL
+  emit8(j, 0x0f), emit8(j, 0x94), emit8(j, 0xc1);    // sete cl
+  emit8(j, 0x83), emit8(j, 0xf8), emit8(j, VAL_BOOL); // cmp eax, VAL_BOOL
+  emit8(j, 0x0f), emit8(j, 0x94), emit8(j, 0xc2);    // sete dl
+  memOp(j, 0, false, 0x8a, RAX, RBX, VALUE_AS);      // mov al, [as]
+  emit8(j, 0x84), emit8(j, 0xc0);                    // test al, al
+  emit8(j, 0x0f), emit8(j, 0x94), emit8(j, 0xc0);    // sete al
+  emit8(j, 0x20), emit8(j, 0xd0);                    // and al, dl
+  emit8(j, 0x08), emit8(j, 0xc8);                    // or al, cl
+}
+
+static void storeBool(Jit *j, int32_t disp) {
+  emit8(j, 0x0f), emit8(j, 0xb6), emit8(j, 0xc0); // movzx eax, al
+  storeType(j, RBX, disp, VAL_BOOL);
+  memOp(j, 0, true, 0x89, RAX, RBX, disp + VALUE_AS);
+}
+
+typedef enum { FROM_STACK, FROM_CONSTANT, FROM_LOCAL } OperandKind;
+
+/**
+ * @brief Emits a number-only binary operation or compare-and-branch.
+ *
+ * The right operand is either on the stack or, for a fused pair, the
+ * constant or local that the previous instruction would have pushed; it is
+ * then loaded straight into xmm1 and never touches the stack. Side exits
+ * return to `offset`, the first instruction of the pair; there are none
+ * unless `checked`.
+ */
+static void emitNumberOp(Jit *j, uint8_t op, OperandKind kind, Value operand,
+                         int offset, int target, bool checked) {
+  int32_t left = kind == FROM_STACK ? -SLOT(1) : 0;
+
+  switch (kind) {
+    case FROM_STACK:
+      if (checked) {
+        exitUnlessNumber(j, RBX, 0, offset);
+        exitUnlessNumber(j, RBX, left, offset);
+      }
+      memOp(j, 0xf2, false, 0x0f10, XMM1, RBX, VALUE_AS);
+      break;
+    case FROM_CONSTANT: {
+      uint64_t bits;
+      memcpy(&bits, &AS_NUMBER(operand), sizeof(bits));
+      if (checked) exitUnlessNumber(j, RBX, 0, offset);
+      movImm64(j, RAX, bits);
+      regOp(j, 0x66, true, 0x0f6e, XMM1, RAX); // movq xmm1, rax
+      break;
+    }
+    case FROM_LOCAL: {
+      int32_t slot = SLOT((int)AS_NUMBER(operand));
+      if (checked) {
+        exitUnlessNumber(j, R13, slot, offset);
+        exitUnlessNumber(j, RBX, 0, offset);
+      }
+      memOp(j, 0xf2, false, 0x0f10, XMM1, R13, slot + VALUE_AS);
+      break;
+    }
+  }
+  memOp(j, 0xf2, false, 0x0f10, XMM0, RBX, left + VALUE_AS);
+
+  int arith = 0;
+  switch (op) {
+    case OP_ADD: arith = 0x0f58; break;
+    case OP_MULTIPLY: arith = 0x0f59; break;
+    case OP_SUBTRACT: arith = 0x0f5c; break;
+    case OP_DIVIDE: arith = 0x0f5e; break;
+    default: break;
+  }
+  if (arith) {
+    regOp(j, 0xf2, false, arith, XMM0, XMM1);
+    memOp(j, 0xf2, false, 0x0f11, XMM0, RBX, left + VALUE_AS);
+    moveTop(j, left ? -1 : 0);
+    return;
+  }
+
+  // ucomisd then `a` (above) is a > b, and with the operands swapped a < b;
+  // both are false for NaN, like the C comparisons in run().
+  bool less = op == OP_LESS || op == OP_JUMP_IF_LESS ||
+              op == OP_JUMP_IF_NOT_LESS;
+  if (less) {
+    regOp(j, 0x66, false, 0x0f2e, XMM1, XMM0);
+  } else {
+    regOp(j, 0x66, false, 0x0f2e, XMM0, XMM1);
+  }
+
+  if (op == OP_LESS || op == OP_GREATER) {
+    emit8(j, 0x0f), emit8(j, 0x90 | CC_A), emit8(j, 0xc0); // seta al
+    storeBool(j, left);
+    moveTop(j, left ? -1 : 0);
+    return;
+  }
+
+  // lea keeps the flags of the compare intact.
+  int32_t popped = left - SLOT(1);
+  memOp(j, 0, true, 0x8d, RBX, RBX, popped);
+  bool taken = op == OP_JUMP_IF_LESS || op == OP_JUMP_IF_GREATER;
+  jumpTo(j, 0x0f80 | (taken ? CC_A : CC_BE), &j->jumps, target);
+}
+
+static bool isNumberOp(uint8_t op) {
+  switch (op) {
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER: return true;
+    default: return false;
+  }
+}
+
+static Value readConstant(Chunk *chunk, int offset) {
+  uint8_t *ip = &chunk->code[offset];
+  int index = *ip == OP_CONSTANT ? ip[1] : ip[1] | (ip[2] << 8);
+  return chunk->constants.values[index];
+}
+
+/**
+ * @brief Tries to fuse the constant or local load at `offset` into the
+ * number operation that follows it.
+ *
+ * @return Length of the fused pair, or 0 if it does not apply
+ */
+static int emitFused(Jit *j, int offset) {
+  Chunk *chunk = j->chunk;
+  uint8_t *ip = &chunk->code[offset];
+  int length = instructionLength(*ip);
+  int next = offset + length;
+  if (next >= chunk->length || j->targets[next]) return 0;
+
+  uint8_t op = genericOp(chunk->code[next]);
+  if (!isNumberOp(op)) return 0;
+
+  OperandKind kind;
+  Value operand;
+  if (*ip == OP_GET_LOCAL) {
+    kind = FROM_LOCAL;
+    operand = NUMBER_VAL(ip[1]);
+  } else if (*ip == OP_CONSTANT || *ip == OP_CONSTANT_LONG) {
+    kind = FROM_CONSTANT;
+    operand = readConstant(chunk, offset);
+    if (!IS_NUMBER(operand)) return 0;
+  } else {
+    return 0;
+  }
+
+  int target = isJump(op) ? jumpTarget(chunk, next) : -1;
+  emitNumberOp(j, op, kind, operand, offset, target,
+               !isUnchecked(chunk->code[next]));
+  return length + instructionLength(op);
+}
+
+static void pushImmediate(Jit *j, ValueType type, uint64_t bits) {
+  storeType(j, RBX, SLOT(1), type);
+  movImm64(j, RAX, bits);
+  memOp(j, 0, true, 0x89, RAX, RBX, SLOT(1) + VALUE_AS);
+  moveTop(j, 1);
+}
+
+static void copyValue(Jit *j, Reg fromBase, int32_t from, Reg toBase,
+                      int32_t to) {
+  memOp(j, 0, false, 0x0f10, XMM0, fromBase, from); // movups
+  memOp(j, 0, false, 0x0f11, XMM0, toBase, to);
+}
+
+static void emitGlobalOp(Jit *j, void *helper, Value name, int offset) {
+  callHelper(j, helper, (uint64_t)(uintptr_t)AS_OBJ(name));
+  emit8(j, 0x84), emit8(j, 0xc9); // test cl, cl
+  exitIf(j, CC_E, offset);
+}
+
+static void emitInstruction(Jit *j, int offset) {
+  Chunk *chunk = j->chunk;
+  uint8_t *ip = &chunk->code[offset];
+  uint8_t op = genericOp(*ip);
+
+  switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG: {
+      Value value = readConstant(chunk, offset);
+      uint64_t bits;
+      memcpy(&bits, &value.as, sizeof(bits));
+      pushImmediate(j, value.type, bits);
+      break;
+    }
+    case OP_NIL: pushImmediate(j, VAL_NIL, 0); break;
+    case OP_TRUE: pushImmediate(j, VAL_BOOL, 1); break;
+    case OP_FALSE: pushImmediate(j, VAL_BOOL, 0); break;
+    case OP_POP: moveTop(j, -1); break;
+    case OP_POPN: moveTop(j, -ip[1]); break;
+    case OP_PICK:
+      copyValue(j, RBX, -SLOT(ip[1]), RBX, SLOT(1));
+      moveTop(j, 1);
+      break;
+    case OP_GET_LOCAL:
+      copyValue(j, R13, SLOT(ip[1]), RBX, SLOT(1));
+      moveTop(j, 1);
+      break;
+    case OP_SET_LOCAL: copyValue(j, RBX, 0, R13, SLOT(ip[1])); break;
+    case OP_NEGATE:
+      if (!isUnchecked(*ip)) exitUnlessNumber(j, RBX, 0, offset);
+      memOp(j, 0, true, 0x8b, RAX, RBX, VALUE_AS);
+      emit8(j, 0x48), emit8(j, 0x0f), emit8(j, 0xba), emit8(j, 0xf8);
+      emit8(j, 63); // btc rax, 63
+      memOp(j, 0, true, 0x89, RAX, RBX, VALUE_AS);
+      break;
+    case OP_NOT:
+      emitFalsey(j);
+      storeBool(j, 0);
+      break;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+      emitNumberOp(j, op, FROM_STACK, NIL_VAL(), offset, -1,
+                   !isUnchecked(*ip));
+      break;
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER:
+      emitNumberOp(j, op, FROM_STACK, NIL_VAL(), offset,
+                   jumpTarget(chunk, offset), true);
+      break;
+    case OP_EQUAL: callHelper(j, helperEqual, 0); break;
+    case OP_PRINT: callHelper(j, helperPrint, 0); break;
+    case OP_GET_GLOBAL:
+      emitGlobalOp(j, helperGetGlobal, chunk->constants.values[ip[1]], offset);
+      break;
+    case OP_SET_GLOBAL:
+      emitGlobalOp(j, helperSetGlobal, chunk->constants.values[ip[1]], offset);
+      break;
+    case OP_DEFINE_GLOBAL:
+      callHelper(j, helperDefineGlobal,
+                 (uint64_t)(uintptr_t)AS_OBJ(chunk->constants.values[ip[1]]));
+      break;
+    case OP_JUMP: jumpTo(j, 0xe9, &j->jumps, jumpTarget(chunk, offset)); break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_TRUE:
+      emitFalsey(j);
+      emit8(j, 0x84), emit8(j, 0xc0); // test al, al
+      jumpTo(j, 0x0f80 | (*ip == OP_JUMP_IF_FALSE ? CC_NE : CC_E), &j->jumps,
+             jumpTarget(chunk, offset));
+      break;
+    case OP_JUMP_IF_FALSE_POP:
+      emitFalsey(j);
+      moveTop(j, -1);
+      emit8(j, 0x84), emit8(j, 0xc0); // test al, al
+      jumpTo(j, 0x0f80 | CC_NE, &j->jumps, jumpTarget(chunk, offset));
+      break;
+    case OP_LOOP:
+      memOp(j, 0, true, 0xff, 0, R12, offsetof(VM, backedges)); // inc
+      jumpTo(j, 0xe9, &j->jumps, jumpTarget(chunk, offset));
+      break;
+    case OP_RETURN:
+      emit8(j, 0xb8), emit32(j, (uint32_t)-1); // mov eax, -1
+      jumpTo(j, 0xe9, &j->jumps, -1);
+      break;
+    default:
+      // No template: leave to the interpreter.
+      jumpTo(j, 0xe9, &j->exits, offset);
+      break;
+  }
+}
+
+/**
+ * @brief Emits `int fn(VM *vm, void *entry)`: saves the callee-saved
+ * registers, loads the stack registers and jumps to `entry`. The epilogue
+ * that follows returns eax with the stack top flushed.
+ */
+static void emitPrologue(Jit *j) {
+  emit8(j, 0x53);                 // push rbx
+  emit8(j, 0x41), emit8(j, 0x54); // push r12
+  emit8(j, 0x41), emit8(j, 0x55); // push r13
+  emit8(j, 0x41), emit8(j, 0x56); // push r14
+  emit8(j, 0x41), emit8(j, 0x57); // push r15, keeps rsp 16-byte aligned
+  regOp(j, 0, true, 0x89, RDI, R12);
+  memOp(j, 0, true, 0x8b, R14, R12, offsetof(VM, stack));
+  reloadStack(j);
+  emit8(j, 0xff), emit8(j, 0xe6); // jmp rsi
+
+  j->epilogue = j->code.length;
+  emit8(j, 0x89), emit8(j, 0xc1); // mov ecx, eax
+  flushTop(j);
+  emit8(j, 0x89), emit8(j, 0xc8); // mov eax, ecx
+  emit8(j, 0x41), emit8(j, 0x5f); // pop r15
+  emit8(j, 0x41), emit8(j, 0x5e); // pop r14
+  emit8(j, 0x41), emit8(j, 0x5d); // pop r13
+  emit8(j, 0x41), emit8(j, 0x5c); // pop r12
+  emit8(j, 0x5b);                 // pop rbx
+  emit8(j, 0xc3);                 // ret
+}
+
+static void patchRel32(Jit *j, int at, int to) {
+  int32_t rel = to - (at + 4);
+  memcpy(&j->code.values[at], &rel, sizeof(rel));
+}
+
+/**
+ * @brief Emits one side-exit stub per exiting bytecode offset and resolves
+ * every jump.
+ *
+ * @return false if a jump lands where no native code starts
+ */
+static bool link(Jit *j) {
+  int *stubs = ALLOCATE(int, j->chunk->length);
+  for (int i = 0; i < j->chunk->length; i++) stubs[i] = -1;
+
+  for (int i = 0; i < j->exits.length; i++) {
+    JitPatch *exit = &j->exits.values[i];
+    if (stubs[exit->target] < 0) {
+      stubs[exit->target] = j->code.length;
+      emit8(j, 0xb8), emit32(j, (uint32_t)exit->target); // mov eax, offset
+      emit8(j, 0xe9), emit32(j, 0);
+      patchRel32(j, j->code.length - 4, j->epilogue);
+    }
+    patchRel32(j, exit->at, stubs[exit->target]);
+  }
+  FREE_ARRAY(int, stubs, j->chunk->length);
+
+  for (int i = 0; i < j->jumps.length; i++) {
+    JitPatch *jump = &j->jumps.values[i];
+    int to = jump->target < 0 ? j->epilogue : j->entries[jump->target];
+    if (to < 0) return false;
+    patchRel32(j, jump->at, to);
+  }
+  return true;
+}
+
+/**
+ * @brief Compiles `chunk` to native code.
+ *
+ * @return false, leaving `jit` empty, if the chunk uses an opcode this
+ * compiler does not know or its jumps do not keep the stack balanced
+ */
+bool jitCompile(Chunk *chunk, JitCode *jit) {
+  memset(jit, 0, sizeof(JitCode));
+  if (sizeof(Value) != 16 || chunk->length == 0) return false;
+
+  Jit j;
+  j.chunk = chunk;
+  initCodeBuffer(&j.code);
+  initJitPatchArray(&j.jumps);
+  initJitPatchArray(&j.exits);
+  j.entries = ALLOCATE(int, chunk->length);
+  j.targets = ALLOCATE(bool, chunk->length);
+  memset(j.targets, 0, sizeof(bool) * chunk->length);
+  for (int i = 0; i < chunk->length; i++) j.entries[i] = -1;
+
+  int maxDepth;
+  int *depths = ALLOCATE(int, chunk->length);
+  bool ok = analyzeStack(chunk, depths, j.targets, &maxDepth);
+  FREE_ARRAY(int, depths, chunk->length);
+  if (ok) {
+    emitPrologue(&j);
+    for (int offset = 0; offset < chunk->length;) {
+      j.entries[offset] = j.code.length;
+      int fused = emitFused(&j, offset);
+      if (fused == 0) {
+        emitInstruction(&j, offset);
+        fused = instructionLength(chunk->code[offset]);
+      }
+      offset += fused;
+    }
+    ok = link(&j);
+  }
+
+  uint8_t *code = MAP_FAILED;
+  if (ok) {
+    code = mmap(NULL, j.code.length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (code != MAP_FAILED) {
+    memcpy(code, j.code.values, j.code.length);
+    if (mprotect(code, j.code.length, PROT_READ | PROT_EXEC) == 0) {
+      jit->code = code;
+      jit->size = j.code.length;
+      jit->entries = j.entries;
+      jit->length = chunk->length;
+      jit->maxDepth = maxDepth;
+    } else {
+      munmap(code, j.code.length);
+    }
+  }
+
+  if (jit->code == NULL) FREE_ARRAY(int, j.entries, chunk->length);
+  FREE_ARRAY(bool, j.targets, chunk->length);
+  freeCodeBuffer(&j.code);
+  freeJitPatchArray(&j.jumps);
+  freeJitPatchArray(&j.exits);
+  return jit->code != NULL;
+}
+
+void jitFree(JitCode *jit) {
+  if (jit->code != NULL) munmap(jit->code, jit->size);
+  FREE_ARRAY(int, jit->entries, jit->length);
+  memset(jit, 0, sizeof(JitCode));
+}
+
+#else
+
+bool jitCompile(Chunk *chunk, JitCode *jit) {
+  (void)chunk;
+  memset(jit, 0, sizeof(JitCode));
+  return false;
+}
+
+void jitFree(JitCode *jit) { memset(jit, 0, sizeof(JitCode)); }
+
+#endif
+
+bool jitCanEnter(JitCode *jit, int offset) {
+  return jit->code != NULL && offset < jit->length && jit->entries[offset] >= 0;
+}
+
+/**
+ * @brief Runs native code from bytecode `offset`, which must satisfy
+ * jitCanEnter.
+ *
+ * @return -1 once OP_RETURN is reached, otherwise the offset of the
+ * instruction the interpreter has to continue with
+ */
+int jitEnter(VM *vm, JitCode *jit, int offset) {
+  stackReserve(vm->stack, jit->maxDepth);
+
+  int (*fn)(VM *, void *) = (int (*)(VM *, void *))(void *)jit->code;
+  return fn(vm, jit->code + jit->entries[offset]);
+}
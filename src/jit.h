@@ -0,0 +1,28 @@
+#ifndef svm_jit_h
+#define svm_jit_h
+
+#include "chunk.h"
+
+struct VM;
+
+/**
+ * @brief Native x86-64 code for one chunk.
+ *
+ * `entries[offset]` is the native offset of the bytecode instruction at
+ * `offset`, or -1 where native code cannot be entered (operands, and the
+ * second half of a fused pair).
+ */
+typedef struct JitCode {
+  uint8_t *code;
+  size_t size;
+  int *entries;
+  int length;   // Bytecode length, the size of `entries`
+  int maxDepth; // Most stack slots the chunk pushes above its entry depth
+} JitCode;
+
+bool jitCompile(Chunk *chunk, JitCode *jit);
+void jitFree(JitCode *jit);
+bool jitCanEnter(JitCode *jit, int offset);
+int jitEnter(struct VM *vm, JitCode *jit, int offset);
+
+#endif
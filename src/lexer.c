@@ -1,37 +1,83 @@
 #include "lexer.h"
-#include "memory.h"
-#include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
-
-void addKeywords(Trie *t) {
-  trieInsert(t, "and", TOK_AND);
-  trieInsert(t, "class", TOK_CLASS);
-  trieInsert(t, "else", TOK_ELSE);
-  trieInsert(t, "false", TOK_FALSE);
-  trieInsert(t, "for", TOK_FOR);
-  trieInsert(t, "fun", TOK_FUN);
-  trieInsert(t, "if", TOK_IF);
-  trieInsert(t, "nil", TOK_NIL);
-  trieInsert(t, "or", TOK_OR);
-  trieInsert(t, "print", TOK_PRINT);
-  trieInsert(t, "return", TOK_RETURN);
-  trieInsert(t, "super", TOK_SUPER);
-  trieInsert(t, "this", TOK_THIS);
-  trieInsert(t, "true", TOK_TRUE);
-  trieInsert(t, "var", TOK_VAR);
-  trieInsert(t, "while", TOK_WHILE);
-}
+// SCALAR_LEXER selects the byte-loop kernels even where SSE2 is available,
+// so that they are tested too.
+#if defined(__SSE2__) && !defined(SCALAR_LEXER)
+#define SIMD_LEXER
+#include <emmintrin.h>
+#endif
 
 void initLexer(Lexer *l, const char *src) {
   l->start = src;
   l->current = src;
-  l->keywords = trieNew();
   l->line = 1;
-  addKeywords(l->keywords);
+  l->begin = src;
+  l->end = src + strlen(src);
 }
 
-void freeLexer(Lexer *l) { trieFree(l->keywords); }
+void freeLexer(Lexer *l) { (void)l; }
+
+typedef struct {
+  const char *name;
+  int length;
+  TokType type;
+} Keyword;
+
+#define KEYWORD_HASH(s, length)                                                \
+  (((uint8_t)(s)[0] + 13 * (uint8_t)(s)[(length) - 1]) & 63)
+
+/**
+ * @brief Perfect hash of the reserved words.
+ *
+ * KEYWORD_HASH maps every keyword to a distinct slot, so an identifier is
+ * resolved with one hash, one length check and one memcmp. Empty slots have a
+ * length of 0 and never match.
+ */
+static const Keyword keywords[64] = {
+    [0] = {"var", 3, TOK_VAR},       [6] = {"else", 4, TOK_ELSE},
+    [7] = {"false", 5, TOK_FALSE},   [8] = {"return", 6, TOK_RETURN},
+    [9] = {"spawn", 5, TOK_SPAWN},   [11] = {"this", 4, TOK_THIS},
+    [13] = {"yield", 5, TOK_YIELD},  [19] = {"resume", 6, TOK_RESUME},
+    [20] = {"print", 5, TOK_PRINT},  [21] = {"true", 4, TOK_TRUE},
+    [23] = {"if", 2, TOK_IF},        [24] = {"while", 5, TOK_WHILE},
+    [42] = {"nil", 3, TOK_NIL},      [48] = {"for", 3, TOK_FOR},
+    [53] = {"and", 3, TOK_AND},      [57] = {"or", 2, TOK_OR},
+    [58] = {"class", 5, TOK_CLASS},  [60] = {"fun", 3, TOK_FUN},
+    [61] = {"super", 5, TOK_SUPER},
+};
+
+static TokType identifierType(const char *s, int length) {
+  if (length < 2 || length > 6) return TOK_IDENTIFIER;
+
+  const Keyword *kw = &keywords[KEYWORD_HASH(s, length)];
+  if (kw->length == length && memcmp(kw->name, s, length) == 0) {
+    return kw->type;
+  }
+  return TOK_IDENTIFIER;
+}
+
+#ifndef SIMD_LEXER
+enum {
+  CC_DIGIT = 1 << 0,
+  CC_ALPHA = 1 << 1, // Letters and '_'
+  CC_BLANK = 1 << 2, // ' ', '\t' and '\r'; '\n' is tracked separately
+};
+
+#define CHAR_IS(c, cls) (charClass[(uint8_t)(c)] & (cls))
+
+/**
+ * @brief Byte classes for the scalar kernels, used instead of <ctype.h> so
+ * lexing does not depend on the current locale and bytes >= 0x80 never count
+ * as letters. The SSE2 kernels test the same ranges directly.
+ */
+static const uint8_t charClass[256] = {
+    ['0' ... '9'] = CC_DIGIT, ['a' ... 'z'] = CC_ALPHA,
+    ['A' ... 'Z'] = CC_ALPHA, ['_'] = CC_ALPHA,
+    [' '] = CC_BLANK,         ['\t'] = CC_BLANK,
+    ['\r'] = CC_BLANK,
+};
+#endif
 
 static char advance(Lexer *l) {
   l->current++;
@@ -68,83 +114,270 @@ static bool matches(Lexer *l, char c) {
 
 static char peek(Lexer *l) { return *l->current; }
 
+/*
+ * Scanning kernels. Each one walks the source 16 bytes at a time with SSE2
+ * and stops at the first byte outside the run it is looking for, which the
+ * terminating '\0' always is. Blocks are aligned, and the bytes before the
+ * starting position are masked off. Without SSE2, or with SCALAR_LEXER,
+ * the kernels are plain byte loops over charClass.
+ */
+#ifdef SIMD_LEXER
+#define BLOCK_START(p) ((const char *)((uintptr_t)(p) & ~(uintptr_t)15))
+#define LOAD_BLOCK(b) loadBlock(l, b)
+#define BYTES_EQ(v, c) _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define BYTES_IN(v, lo, hi)                                                    \
+  _mm_cmplt_epi8(_mm_add_epi8(v, _mm_set1_epi8((char)(128 - (lo)))),          \
+                 _mm_set1_epi8((char)((hi) - (lo) + 1 - 128)))
+#define BITS(v) ((unsigned)_mm_movemask_epi8(v))
+
+/**
+ * @brief Loads the aligned block at `block`. The first and last blocks of
+ * the source usually reach outside it; those are put together from the bytes
+ * inside, with zeros around them, so no byte outside the string is read.
+ */
+static inline __m128i loadBlock(const Lexer *l, const char *block) {
+  if (block >= l->begin && block + 16 <= l->end + 1) {
+    return _mm_load_si128((const __m128i *)block);
+  }
+  const char *from = block < l->begin ? l->begin : block;
+  const char *to = block + 16 < l->end + 1 ? block + 16 : l->end + 1;
+  char bytes[16] = {0};
+  memcpy(bytes + (from - block), from, to - from);
+  return _mm_loadu_si128((const __m128i *)bytes);
+}
+#endif
+
+/**
+ * @brief Skips spaces, tabs, carriage returns and newlines.
+ *
+ * @return First byte that is not blank; newlines passed are added to *line
+ */
+static const char *scanBlanks(const Lexer *l, const char *p, int *line) {
+#ifdef SIMD_LEXER
+  const char *block = BLOCK_START(p);
+  unsigned valid = (0xFFFFu << (p - block)) & 0xFFFFu;
+  for (;;) {
+    __m128i v = LOAD_BLOCK(block);
+    unsigned nl = BITS(BYTES_EQ(v, '\n')) & valid;
+    unsigned blank = BITS(_mm_or_si128(
+        _mm_or_si128(BYTES_EQ(v, ' '), BYTES_EQ(v, '\t')), BYTES_EQ(v, '\r')));
+    unsigned stop = ~(blank | nl) & valid;
+    if (stop) {
+      int k = __builtin_ctz(stop);
+      *line += __builtin_popcount(nl & ((1u << k) - 1));
+      return block + k;
+    }
+    *line += __builtin_popcount(nl);
+    block += 16;
+    valid = 0xFFFFu;
+  }
+#else
+  (void)l;
+  for (;; p++) {
+    if (*p == '\n') {
+      (*line)++;
+    } else if (!CHAR_IS(*p, CC_BLANK)) {
+      return p;
+    }
+  }
+#endif
+}
+
+/**
+ * @brief Finds the end of a line comment.
+ *
+ * @return Pointer to the next '\n', or to the terminating '\0'
+ */
+static const char *findLineEnd(const Lexer *l, const char *p) {
+#ifdef SIMD_LEXER
+  const char *block = BLOCK_START(p);
+  unsigned valid = (0xFFFFu << (p - block)) & 0xFFFFu;
+  const __m128i zero = _mm_setzero_si128();
+  for (;;) {
+    __m128i v = LOAD_BLOCK(block);
+    unsigned hits =
+        BITS(_mm_or_si128(BYTES_EQ(v, '\n'), _mm_cmpeq_epi8(v, zero))) & valid;
+    if (hits) return block + __builtin_ctz(hits);
+    block += 16;
+    valid = 0xFFFFu;
+  }
+#else
+  (void)l;
+  while (*p != '\n' && *p != '\0') p++;
+  return p;
+#endif
+}
+
+/**
+ * @brief Finds the closing quote of a string literal.
+ *
+ * @return Pointer to the next '"', or to the terminating '\0'; newlines
+ * inside the literal are added to *line
+ */
+static const char *findQuote(const Lexer *l, const char *p, int *line) {
+#ifdef SIMD_LEXER
+  const char *block = BLOCK_START(p);
+  unsigned valid = (0xFFFFu << (p - block)) & 0xFFFFu;
+  const __m128i zero = _mm_setzero_si128();
+  for (;;) {
+    __m128i v = LOAD_BLOCK(block);
+    unsigned nl = BITS(BYTES_EQ(v, '\n')) & valid;
+    unsigned hits =
+        BITS(_mm_or_si128(BYTES_EQ(v, '"'), _mm_cmpeq_epi8(v, zero))) & valid;
+    if (hits) {
+      int k = __builtin_ctz(hits);
+      *line += __builtin_popcount(nl & ((1u << k) - 1));
+      return block + k;
+    }
+    *line += __builtin_popcount(nl);
+    block += 16;
+    valid = 0xFFFFu;
+  }
+#else
+  (void)l;
+  for (; *p != '"' && *p != '\0'; p++) {
+    if (*p == '\n') (*line)++;
+  }
+  return p;
+#endif
+}
+
+/**
+ * @brief Skips the remaining [A-Za-z0-9_] bytes of an identifier.
+ */
+static const char *scanIdentifier(const Lexer *l, const char *p) {
+#ifdef SIMD_LEXER
+  const char *block = BLOCK_START(p);
+  unsigned valid = (0xFFFFu << (p - block)) & 0xFFFFu;
+  for (;;) {
+    __m128i v = LOAD_BLOCK(block);
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    unsigned ident = BITS(_mm_or_si128(
+        _mm_or_si128(BYTES_IN(lower, 'a', 'z'), BYTES_IN(v, '0', '9')),
+        BYTES_EQ(v, '_')));
+    unsigned stop = ~ident & valid;
+    if (stop) return block + __builtin_ctz(stop);
+    block += 16;
+    valid = 0xFFFFu;
+  }
+#else
+  (void)l;
+  while (CHAR_IS(*p, CC_ALPHA | CC_DIGIT)) p++;
+  return p;
+#endif
+}
+
+/**
+ * @brief Skips a run of decimal digits.
+ */
+static const char *scanDigits(const Lexer *l, const char *p) {
+#ifdef SIMD_LEXER
+  const char *block = BLOCK_START(p);
+  unsigned valid = (0xFFFFu << (p - block)) & 0xFFFFu;
+  for (;;) {
+    __m128i v = LOAD_BLOCK(block);
+    unsigned stop = ~BITS(BYTES_IN(v, '0', '9')) & valid;
+    if (stop) return block + __builtin_ctz(stop);
+    block += 16;
+    valid = 0xFFFFu;
+  }
+#else
+  (void)l;
+  while (CHAR_IS(*p, CC_DIGIT)) p++;
+  return p;
+#endif
+}
+
 static void skipWhitespace(Lexer *l) {
   for (;;) {
-    char c = peek(l);
-    switch (c) {
-      case ' ':
-      case '\r':
-      case '\n':
-      case '\t': advance(l); break;
-      case '/':
-        if (l->current[1] == '/') {
-          while (peek(l) != '\n' && !isAtEnd(l)) {
-            advance(l);
-          }
-        } else {
-          return;
-        }
-        break;
-      default: return;
+    l->current = scanBlanks(l, l->current, &l->line);
+    if (l->current[0] != '/' || l->current[1] != '/') return;
+    l->current = findLineEnd(l, l->current);
+  }
+}
+
+/*
+ * Token scanners. Each is entered with the first byte already consumed and
+ * is selected by that byte through the dispatch table below; bytes without
+ * an entry cannot start a token.
+ */
+typedef Tok (*LexFn)(Lexer *l);
+
+/**
+ * @brief Token types of the bytes that always form a token on their own.
+ */
+static const uint8_t singleTokens[256] = {
+    ['('] = TOK_LEFT_PAREN, [')'] = TOK_RIGHT_PAREN, ['{'] = TOK_LEFT_BRACE,
+    ['}'] = TOK_RIGHT_BRACE, [','] = TOK_COMMA,     ['.'] = TOK_DOT,
+    ['-'] = TOK_MINUS,      ['+'] = TOK_PLUS,        [';'] = TOK_SEMICOLON,
+    ['/'] = TOK_SLASH,      ['*'] = TOK_STAR,
+};
+
+/**
+ * @brief Token types of the operators that may be followed by '='; the
+ * second entry is the two-byte form.
+ */
+static const uint8_t equalsTokens[256][2] = {
+    ['!'] = {TOK_BANG, TOK_BANG_EQUAL},
+    ['='] = {TOK_EQUAL, TOK_EQUAL_EQUAL},
+    ['<'] = {TOK_LESS, TOK_LESS_EQUAL},
+    ['>'] = {TOK_GREATER, TOK_GREATER_EQUAL},
+};
+
+static Tok lexSingle(Lexer *l) {
+  return makeTok(l, singleTokens[(uint8_t)l->start[0]]);
+}
+
+static Tok lexOperator(Lexer *l) {
+  const uint8_t *types = equalsTokens[(uint8_t)l->start[0]];
+  return makeTok(l, types[matches(l, '=')]);
+}
+
+static Tok lexString(Lexer *l) {
+  l->current = findQuote(l, l->current, &l->line);
+  if (isAtEnd(l)) { return errorTok(l, "Unexpected stream end."); }
+  advance(l);
+  return makeTok(l, TOK_STRING);
+}
+
+static Tok lexIdentifier(Lexer *l) {
+  l->current = scanIdentifier(l, l->current);
+  return makeTok(l, identifierType(l->start, l->current - l->start));
+}
+
+static Tok lexNumber(Lexer *l) {
+  l->current = scanDigits(l, l->current);
+  if (peek(l) == '.') {
+    l->current = scanDigits(l, l->current + 1);
+    if (peek(l) == '.' || l->current[-1] == '.') {
+      return errorTok(l, "Invalid number literal");
     }
   }
+  return makeTok(l, TOK_NUMBER);
 }
 
+#define LEX_SINGLE(c) [c] = lexSingle
+#define LEX_OPERATOR(c) [c] = lexOperator
+
+static const LexFn dispatch[256] = {
+    LEX_SINGLE('('),  LEX_SINGLE(')'),   LEX_SINGLE('{'),   LEX_SINGLE('}'),
+    LEX_SINGLE(','),  LEX_SINGLE('.'),   LEX_SINGLE('-'),   LEX_SINGLE('+'),
+    LEX_SINGLE(';'),  LEX_SINGLE('/'),   LEX_SINGLE('*'),   LEX_OPERATOR('!'),
+    LEX_OPERATOR('='), LEX_OPERATOR('<'), LEX_OPERATOR('>'), ['"'] = lexString,
+    ['a' ... 'z'] = lexIdentifier,       ['A' ... 'Z'] = lexIdentifier,
+    ['_'] = lexIdentifier,               ['0' ... '9'] = lexNumber,
+};
+
+#undef LEX_SINGLE
+#undef LEX_OPERATOR
+
 Tok lexTok(Lexer *l) {
   skipWhitespace(l);
   l->start = l->current;
 
   if (isAtEnd(l)) return makeTok(l, TOK_EOF);
 
-  char c = advance(l);
-
-  switch (c) {
-    case '/': return makeTok(l, TOK_SLASH);
-    case '(': return makeTok(l, TOK_LEFT_PAREN);
-    case ')': return makeTok(l, TOK_RIGHT_PAREN);
-    case '{': return makeTok(l, TOK_LEFT_BRACE);
-    case '}': return makeTok(l, TOK_RIGHT_BRACE);
-    case ',': return makeTok(l, TOK_COMMA);
-    case '.': return makeTok(l, TOK_DOT);
-    case '-': return makeTok(l, TOK_MINUS);
-    case '+': return makeTok(l, TOK_PLUS);
-    case ';': return makeTok(l, TOK_SEMICOLON);
-    case '*': return makeTok(l, TOK_STAR);
-    case '!': return makeTok(l, matches(l, '=') ? TOK_BANG_EQUAL : TOK_BANG);
-    case '=': return makeTok(l, matches(l, '=') ? TOK_EQUAL_EQUAL : TOK_EQUAL);
-    case '<': return makeTok(l, matches(l, '=') ? TOK_LESS_EQUAL : TOK_LESS);
-    case '>':
-      return makeTok(l, matches(l, '=') ? TOK_GREATER_EQUAL : TOK_GREATER);
-
-    case '"':
-      while (*l->current != '"') {
-        if (isAtEnd(l)) { return errorTok(l, "Unexpected stream end."); }
-        l->current++;
-      }
-      advance(l);
-      return makeTok(l, TOK_STRING);
-
-    case 'a' ... 'z':
-    case 'A' ... 'Z':
-    case '_':
-      while (isalnum(*l->current) || *l->current == '_') {
-        l->current++;
-      }
-      TokType tt = trieFind(l->keywords, l->start, l->current - l->start);
-      return makeTok(l, tt);
-
-    case '0' ... '9':
-      bool seen_dot = false;
-      while (*l->current == '.' || isdigit(*l->current)) {
-        if (seen_dot && *l->current == '.') {
-          return errorTok(l, "Invalid number literal");
-        }
-        seen_dot = *l->current == '.' || seen_dot;
-        l->current++;
-      }
-      return l->current[-1] != '.' ? makeTok(l, TOK_NUMBER)
-                                   : errorTok(l, "Invalid number literal");
-  }
-
-  return errorTok(l, "Unexpected character");
+  LexFn lex = dispatch[(uint8_t)advance(l)];
+  if (lex == NULL) return errorTok(l, "Unexpected character");
+  return lex(l);
 }
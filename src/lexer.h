@@ -1,13 +1,16 @@
 #ifndef svm_lexer_h
 #define svm_lexer_h
 
-#include "memory.h"
+#include "common.h"
+#include "token.h"
+#include <stdbool.h>
 
 typedef struct {
   const char *start;
   const char *current;
-  Trie *keywords;
   int line;
+  const char *begin; // The source, and its terminating '\0'; the scanning
+  const char *end;   // kernels read nothing outside them
 } Lexer;
 
 void initLexer(Lexer *l, const char *src);
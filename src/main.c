@@ -1,19 +1,53 @@
+#include "batch.h"
 #include "chunk.h"
 #include "compiler.h"
+#include "memory.h"
 #include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * @brief Reads one line of any length into `*buf`, growing it as needed.
+ *
+ * @return false at end of input with nothing read
+ */
+static bool readLine(FILE *in, char **buf, size_t *capacity) {
+  size_t length = 0;
+  for (;;) {
+    if (*capacity - length < 2) {
+      size_t newCap = GROW_CAPACITY(*capacity);
+      GROW_ARRAY(char, *buf, *capacity, newCap);
+      *capacity = newCap;
+    }
+    if (!fgets(*buf + length, (int)(*capacity - length), in)) {
+      return length > 0;
+    }
+    length += strlen(*buf + length);
+    if ((*buf)[length - 1] == '\n') return true;
+  }
+}
 
 static void repl(VM *vm) {
-  char line[1024];
+  Session session;
+  initSession(&session);
+  char *line = NULL;
+  size_t capacity = 0;
+
   for (;;) {
     printf("> ");
-    if (!fgets(line, sizeof(line), stdin)) {
+    fflush(stdout);
+    if (!readLine(stdin, &line, &capacity)) {
       printf("\n");
       break;
     }
-    interpret(vm, line);
+    interpretLine(vm, &session, line);
+    sinkFlush(&vm->out);
   }
+
+  FREE_ARRAY(char, line, capacity);
+  freeSession(&session);
 }
 
 static char *readFile(const char *path) {
@@ -44,26 +78,97 @@ static char *readFile(const char *path) {
   return buf;
 }
 
-static void runFile(VM *vm, const char *path) {
+static int runFile(VM *vm, const char *path) {
   char *src = readFile(path);
   InterpretResult res = interpret(vm, src);
   free(src);
 
   switch (res) {
-    case INTERPRET_COMPILE_ERROR: exit(65); break;
-    case INTERPRET_RUNTIME_ERROR: exit(70); break;
+    case INTERPRET_COMPILE_ERROR: return 65;
+    case INTERPRET_RUNTIME_ERROR: return 70;
     case INTERPRET_OK: break;
   }
+  return 0;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: svm [-O] [--jit] [--stats] "
+                  "[--dispatch=threaded|switch|register|tailcall]\n"
+                  "           [path | --batch <dir-or-list> [-j N]]\n");
+}
+
+/**
+ * @brief Reports how many instructions the run interpreted and the processor
+ * time it took since `start`.
+ */
+static void printStats(VM *vm, clock_t start) {
+  static const char *modes[] = {"threaded", "switch", "register", "tailcall"};
+  double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  // After what the script printed, not in the middle of it.
+  sinkFlush(&vm->out);
+#ifdef COUNT_INSTRUCTIONS
+  fprintf(stderr, "%llu instructions (%s dispatch%s) in %.3f s\n",
+          (unsigned long long)vm->instructions, modes[vm->dispatch],
+          vm->jit ? ", native code not counted" : "", seconds);
+#else
+  fprintf(stderr,
+          "%s dispatch in %.3f s; build with ./build.sh stats "
+          "to count instructions\n",
+          modes[vm->dispatch], seconds);
+#endif
 }
 
 int main(int argc, const char *argv[]) {
   VM vm;
   initVM(&vm);
-  switch (argc) {
-    case 1: repl(&vm); break;
-    case 2: runFile(&vm, argv[1]); break;
-    default: fprintf(stderr, "Usage: svm [path]\n");
+
+  const char *batch = NULL;
+  int jobs = 0;
+  bool stats = false;
+  int arg = 1;
+  for (; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (strcmp(argv[arg], "-O") == 0) {
+      vm.optimize = true;
+    } else if (strcmp(argv[arg], "--jit") == 0) {
+      vm.jit = true;
+    } else if (strcmp(argv[arg], "--stats") == 0) {
+      stats = true;
+    } else if (strcmp(argv[arg], "--dispatch=threaded") == 0) {
+      vm.dispatch = DISPATCH_THREADED;
+    } else if (strcmp(argv[arg], "--dispatch=switch") == 0) {
+      vm.dispatch = DISPATCH_SWITCH;
+    } else if (strcmp(argv[arg], "--dispatch=register") == 0) {
+      vm.dispatch = DISPATCH_REGISTER;
+    } else if (strcmp(argv[arg], "--dispatch=tailcall") == 0) {
+      vm.dispatch = DISPATCH_TAILCALL;
+    } else if (strcmp(argv[arg], "--batch") == 0 && arg + 1 < argc) {
+      batch = argv[++arg];
+    } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc &&
+               (jobs = atoi(argv[arg + 1])) > 0) {
+      arg++;
+    } else {
+      usage();
+      closeVM(&vm);
+      return 64;
+    }
   }
+
+  // Batch jobs run on VMs of their own, so there is nothing to report.
+  if (batch != NULL && arg == argc && !stats) {
+    BatchOptions options = {jobs, vm.optimize, vm.jit, vm.dispatch};
+    closeVM(&vm);
+    return runBatch(batch, &options, stdout, stderr);
+  }
+
+  int status = 0;
+  clock_t start = clock();
+  switch (batch != NULL ? -1 : argc - arg) {
+    case 0: repl(&vm); break;
+    case 1: status = runFile(&vm, argv[arg]); break;
+    default: usage();
+  }
+  if (stats && batch == NULL) printStats(&vm, start);
+  // Flushes whatever the script printed.
   closeVM(&vm);
-  return 0;
+  return status;
 }
@@ -39,10 +39,22 @@ void mapInit(hashMap *m) {
   m->length = 0;
   m->capacity = 0;
   m->contents = NULL;
+  m->version = 0;
 }
 void mapReset(hashMap *m) {
+  uint32_t version = m->version;
   free(m->contents);
   mapInit(m);
+  m->version = version + 1;
+}
+
+// Makes `dst` an exact copy of `src`, sharing its keys.
+void mapCopy(hashMap *dst, const hashMap *src) {
+  mapReset(dst);
+  *dst = *src;
+  if (src->capacity == 0) return;
+  dst->contents = ALLOCATE(mapObject, src->capacity);
+  memcpy(dst->contents, src->contents, sizeof(mapObject) * src->capacity);
 }
 
 static void mapReallocate(hashMap *m) {
@@ -61,10 +73,11 @@ static void mapReallocate(hashMap *m) {
 
   for (int n = 0; n < old_cap; n++) {
     mapObject item = m->contents[n];
-    if (IS_TOMBSTONE(item) || IS_NIL(item.value)) { continue; }
+    if (item.key == NULL) { continue; }
 
     mapInsert(&new_map, item.key, item.value);
   }
+  new_map.version = m->version + 1;
   mapReset(m);
   *m = new_map;
 }
@@ -113,6 +126,18 @@ bool mapGet(hashMap *m, ObjString *key, Value *value) {
   return true;
 }
 
+/**
+ * @brief Returns the entry holding `key`, or NULL.
+ *
+ * The pointer stays valid until the map's version changes.
+ */
+mapObject *mapGetEntry(hashMap *m, ObjString *key) {
+  if (m->length == 0) return NULL;
+
+  mapObject *entry = findEntry(m, key);
+  return entry->key == NULL ? NULL : entry;
+}
+
 void mapDelete(hashMap *m, ObjString *key) {
   if (m->capacity == 0) return;
 
@@ -121,4 +146,5 @@ void mapDelete(hashMap *m, ObjString *key) {
 
   item->key = NULL;
   item->value = BOOL_VAL(true);
+  m->version++;
 }
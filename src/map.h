@@ -13,13 +13,16 @@ typedef struct {
   int length;
   int capacity;
   mapObject *contents;
+  uint32_t version; // Bumped whenever entries move or are deleted
 } hashMap;
 
 uint32_t hashString(const char *s, int length);
 void mapInit(hashMap *m);
 void mapReset(hashMap *m);
+void mapCopy(hashMap *dst, const hashMap *src);
 bool mapInsert(hashMap *m, ObjString *key, Value value);
 bool mapGet(hashMap *m, ObjString *key, Value *value);
+mapObject *mapGetEntry(hashMap *m, ObjString *key);
 void mapDelete(hashMap *m, ObjString *key);
 ObjString *mapFindString(hashMap *map, const char *chars, int length,
                          uint32_t hash);
@@ -1,7 +1,6 @@
 #include "memory.h"
 #include "object.h"
 #include "vm.h"
-#include <ctype.h>
 #include <stdlib.h>
 
 void *reallocate(void *ptr, size_t oldSize, size_t newSize) {
@@ -14,45 +13,25 @@ void *reallocate(void *ptr, size_t oldSize, size_t newSize) {
   return result;
 }
 
-Trie *trieNew() { return calloc(1, sizeof(Trie)); }
-void trieFree(Trie *t) {
-  if (t == NULL) { return; }
-
-  for (int n = 0; n < 26; n++) {
-    trieFree(t->children[n]);
-  }
-
-  free(t);
-}
-void trieInsert(Trie *t, const char *s, TokType tt) {
-  if (*s == '\0') {
-    t->is_leaf_node = true;
-    t->token_type = tt;
-    return;
-  }
-
-  int idx = *s - 'a';
-
-  if (t->children[idx] == NULL) { t->children[idx] = trieNew(); }
-  trieInsert(t->children[idx], s + 1, tt);
-}
-
-TokType trieFind(Trie *t, const char *s, int length) {
-  if (length == 0) { return t->is_leaf_node ? t->token_type : TOK_IDENTIFIER; }
-  if (!islower(*s)) { return TOK_IDENTIFIER; }
-  int idx = *s - 'a';
-  if (t->children[idx] == NULL) { return TOK_IDENTIFIER; }
-  return trieFind(t->children[idx], s + 1, length - 1);
-}
-
 static void freeObject(Obj *object) {
   switch (object->type) {
     case OBJ_STRING: {
       ObjString *string = (ObjString *)object;
+      if (string->external) {
+        ObjExternalString *external = (ObjExternalString *)object;
+        if (external->release != NULL) external->release(external->context);
+        FREE(ObjExternalString, object);
+        break;
+      }
       FREE_ARRAY(char, string->chars, string->length + 1);
       FREE(ObjString, object);
       break;
     }
+    case OBJ_FIBER: {
+      stackFree(&((ObjFiber *)object)->stack);
+      FREE(ObjFiber, object);
+      break;
+    }
   }
 }
 
@@ -63,4 +42,5 @@ void freeObjects(VM *vm) {
     freeObject(object);
     object = next;
   }
+  vm->objects = NULL;
 }
@@ -1,7 +1,6 @@
 #ifndef svm_memory_h
 #define svm_memory_h
 #include "common.h"
-#include "token.h"
 #include <stdbool.h>
 
 #define ALLOCATE(type, count)                                                  \
@@ -9,10 +8,11 @@
 
 #define GROW_CAPACITY(c) ((c) == 0 ? 8 : ((c) * 2))
 #define GROW_ARRAY(type, ptr, oldSize, newSize)                                \
-  ptr = (type *)reallocate(ptr, sizeof(type) * oldSize, sizeof(type) * newSize)
+  ptr = (type *)reallocate(ptr, sizeof(type) * (oldSize),                      \
+                           sizeof(type) * (newSize))
 
 #define FREE_ARRAY(type, ptr, oldSize)                                         \
-  reallocate(ptr, sizeof(type) * oldSize, 0)
+  reallocate(ptr, sizeof(type) * (oldSize), 0)
 
 #define FREE(type, ptr) reallocate(ptr, sizeof(type), 0)
 
@@ -47,16 +47,7 @@
 void *realloc(void *ptr, size_t size);
 void *reallocate(void *ptr, size_t oldSize, size_t newSize);
 
-typedef struct Trie {
-  struct Trie *children[26];
-  bool is_leaf_node;
-  TokType token_type;
-} Trie;
-
-Trie *trieNew();
-void trieFree(Trie *t);
-void trieInsert(Trie *t, const char *s, TokType tt);
-TokType trieFind(Trie *t, const char *s, int length);
-void freeObjects();
+struct VM;
+void freeObjects(struct VM *vm);
 
 #endif
@@ -0,0 +1,1353 @@
+#include "number.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_EXACT_INTEGER (1ULL << 53)
+#define POW10_MIN_EXP -64
+#define POW10_MAX_EXP 64
+
+// Powers of ten that are exactly representable as doubles.
+static const double exactPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/**
+ * @brief 128-bit mantissas of 10^e for POW10_MIN_EXP <= e <= POW10_MAX_EXP,
+ * normalized so the top bit is set and rounded down; stored as {low, high}.
+ *
+ * Number literals have no exponent syntax, so only the exponents produced by
+ * fraction digits and long integer parts are needed. Anything outside the
+ * range goes through the exact fallback.
+ */
+static const uint64_t pow10Mantissas[][2] = {
+    {0x3F2398D747B36224ULL, 0xA87FEA27A539E9A5ULL}, // 1e-64
+    {0x8EEC7F0D19A03AADULL, 0xD29FE4B18E88640EULL}, // 1e-63
+    {0x1953CF68300424ACULL, 0x83A3EEEEF9153E89ULL}, // 1e-62
+    {0x5FA8C3423C052DD7ULL, 0xA48CEAAAB75A8E2BULL}, // 1e-61
+    {0x3792F412CB06794DULL, 0xCDB02555653131B6ULL}, // 1e-60
+    {0xE2BBD88BBEE40BD0ULL, 0x808E17555F3EBF11ULL}, // 1e-59
+    {0x5B6ACEAEAE9D0EC4ULL, 0xA0B19D2AB70E6ED6ULL}, // 1e-58
+    {0xF245825A5A445275ULL, 0xC8DE047564D20A8BULL}, // 1e-57
+    {0xEED6E2F0F0D56712ULL, 0xFB158592BE068D2EULL}, // 1e-56
+    {0x55464DD69685606BULL, 0x9CED737BB6C4183DULL}, // 1e-55
+    {0xAA97E14C3C26B886ULL, 0xC428D05AA4751E4CULL}, // 1e-54
+    {0xD53DD99F4B3066A8ULL, 0xF53304714D9265DFULL}, // 1e-53
+    {0xE546A8038EFE4029ULL, 0x993FE2C6D07B7FABULL}, // 1e-52
+    {0xDE98520472BDD033ULL, 0xBF8FDB78849A5F96ULL}, // 1e-51
+    {0x963E66858F6D4440ULL, 0xEF73D256A5C0F77CULL}, // 1e-50
+    {0xDDE7001379A44AA8ULL, 0x95A8637627989AADULL}, // 1e-49
+    {0x5560C018580D5D52ULL, 0xBB127C53B17EC159ULL}, // 1e-48
+    {0xAAB8F01E6E10B4A6ULL, 0xE9D71B689DDE71AFULL}, // 1e-47
+    {0xCAB3961304CA70E8ULL, 0x9226712162AB070DULL}, // 1e-46
+    {0x3D607B97C5FD0D22ULL, 0xB6B00D69BB55C8D1ULL}, // 1e-45
+    {0x8CB89A7DB77C506AULL, 0xE45C10C42A2B3B05ULL}, // 1e-44
+    {0x77F3608E92ADB242ULL, 0x8EB98A7A9A5B04E3ULL}, // 1e-43
+    {0x55F038B237591ED3ULL, 0xB267ED1940F1C61CULL}, // 1e-42
+    {0x6B6C46DEC52F6688ULL, 0xDF01E85F912E37A3ULL}, // 1e-41
+    {0x2323AC4B3B3DA015ULL, 0x8B61313BBABCE2C6ULL}, // 1e-40
+    {0xABEC975E0A0D081AULL, 0xAE397D8AA96C1B77ULL}, // 1e-39
+    {0x96E7BD358C904A21ULL, 0xD9C7DCED53C72255ULL}, // 1e-38
+    {0x7E50D64177DA2E54ULL, 0x881CEA14545C7575ULL}, // 1e-37
+    {0xDDE50BD1D5D0B9E9ULL, 0xAA242499697392D2ULL}, // 1e-36
+    {0x955E4EC64B44E864ULL, 0xD4AD2DBFC3D07787ULL}, // 1e-35
+    {0xBD5AF13BEF0B113EULL, 0x84EC3C97DA624AB4ULL}, // 1e-34
+    {0xECB1AD8AEACDD58EULL, 0xA6274BBDD0FADD61ULL}, // 1e-33
+    {0x67DE18EDA5814AF2ULL, 0xCFB11EAD453994BAULL}, // 1e-32
+    {0x80EACF948770CED7ULL, 0x81CEB32C4B43FCF4ULL}, // 1e-31
+    {0xA1258379A94D028DULL, 0xA2425FF75E14FC31ULL}, // 1e-30
+    {0x096EE45813A04330ULL, 0xCAD2F7F5359A3B3EULL}, // 1e-29
+    {0x8BCA9D6E188853FCULL, 0xFD87B5F28300CA0DULL}, // 1e-28
+    {0x775EA264CF55347DULL, 0x9E74D1B791E07E48ULL}, // 1e-27
+    {0x95364AFE032A819DULL, 0xC612062576589DDAULL}, // 1e-26
+    {0x3A83DDBD83F52204ULL, 0xF79687AED3EEC551ULL}, // 1e-25
+    {0xC4926A9672793542ULL, 0x9ABE14CD44753B52ULL}, // 1e-24
+    {0x75B7053C0F178293ULL, 0xC16D9A0095928A27ULL}, // 1e-23
+    {0x5324C68B12DD6338ULL, 0xF1C90080BAF72CB1ULL}, // 1e-22
+    {0xD3F6FC16EBCA5E03ULL, 0x971DA05074DA7BEEULL}, // 1e-21
+    {0x88F4BB1CA6BCF584ULL, 0xBCE5086492111AEAULL}, // 1e-20
+    {0x2B31E9E3D06C32E5ULL, 0xEC1E4A7DB69561A5ULL}, // 1e-19
+    {0x3AFF322E62439FCFULL, 0x9392EE8E921D5D07ULL}, // 1e-18
+    {0x09BEFEB9FAD487C2ULL, 0xB877AA3236A4B449ULL}, // 1e-17
+    {0x4C2EBE687989A9B3ULL, 0xE69594BEC44DE15BULL}, // 1e-16
+    {0x0F9D37014BF60A10ULL, 0x901D7CF73AB0ACD9ULL}, // 1e-15
+    {0x538484C19EF38C94ULL, 0xB424DC35095CD80FULL}, // 1e-14
+    {0x2865A5F206B06FB9ULL, 0xE12E13424BB40E13ULL}, // 1e-13
+    {0xF93F87B7442E45D3ULL, 0x8CBCCC096F5088CBULL}, // 1e-12
+    {0xF78F69A51539D748ULL, 0xAFEBFF0BCB24AAFEULL}, // 1e-11
+    {0xB573440E5A884D1BULL, 0xDBE6FECEBDEDD5BEULL}, // 1e-10
+    {0x31680A88F8953030ULL, 0x89705F4136B4A597ULL}, // 1e-9
+    {0xFDC20D2B36BA7C3DULL, 0xABCC77118461CEFCULL}, // 1e-8
+    {0x3D32907604691B4CULL, 0xD6BF94D5E57A42BCULL}, // 1e-7
+    {0xA63F9A49C2C1B10FULL, 0x8637BD05AF6C69B5ULL}, // 1e-6
+    {0x0FCF80DC33721D53ULL, 0xA7C5AC471B478423ULL}, // 1e-5
+    {0xD3C36113404EA4A8ULL, 0xD1B71758E219652BULL}, // 1e-4
+    {0x645A1CAC083126E9ULL, 0x83126E978D4FDF3BULL}, // 1e-3
+    {0x3D70A3D70A3D70A3ULL, 0xA3D70A3D70A3D70AULL}, // 1e-2
+    {0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCCULL}, // 1e-1
+    {0x0000000000000000ULL, 0x8000000000000000ULL}, // 1e0
+    {0x0000000000000000ULL, 0xA000000000000000ULL}, // 1e1
+    {0x0000000000000000ULL, 0xC800000000000000ULL}, // 1e2
+    {0x0000000000000000ULL, 0xFA00000000000000ULL}, // 1e3
+    {0x0000000000000000ULL, 0x9C40000000000000ULL}, // 1e4
+    {0x0000000000000000ULL, 0xC350000000000000ULL}, // 1e5
+    {0x0000000000000000ULL, 0xF424000000000000ULL}, // 1e6
+    {0x0000000000000000ULL, 0x9896800000000000ULL}, // 1e7
+    {0x0000000000000000ULL, 0xBEBC200000000000ULL}, // 1e8
+    {0x0000000000000000ULL, 0xEE6B280000000000ULL}, // 1e9
+    {0x0000000000000000ULL, 0x9502F90000000000ULL}, // 1e10
+    {0x0000000000000000ULL, 0xBA43B74000000000ULL}, // 1e11
+    {0x0000000000000000ULL, 0xE8D4A51000000000ULL}, // 1e12
+    {0x0000000000000000ULL, 0x9184E72A00000000ULL}, // 1e13
+    {0x0000000000000000ULL, 0xB5E620F480000000ULL}, // 1e14
+    {0x0000000000000000ULL, 0xE35FA931A0000000ULL}, // 1e15
+    {0x0000000000000000ULL, 0x8E1BC9BF04000000ULL}, // 1e16
+    {0x0000000000000000ULL, 0xB1A2BC2EC5000000ULL}, // 1e17
+    {0x0000000000000000ULL, 0xDE0B6B3A76400000ULL}, // 1e18
+    {0x0000000000000000ULL, 0x8AC7230489E80000ULL}, // 1e19
+    {0x0000000000000000ULL, 0xAD78EBC5AC620000ULL}, // 1e20
+    {0x0000000000000000ULL, 0xD8D726B7177A8000ULL}, // 1e21
+    {0x0000000000000000ULL, 0x878678326EAC9000ULL}, // 1e22
+    {0x0000000000000000ULL, 0xA968163F0A57B400ULL}, // 1e23
+    {0x0000000000000000ULL, 0xD3C21BCECCEDA100ULL}, // 1e24
+    {0x0000000000000000ULL, 0x84595161401484A0ULL}, // 1e25
+    {0x0000000000000000ULL, 0xA56FA5B99019A5C8ULL}, // 1e26
+    {0x0000000000000000ULL, 0xCECB8F27F4200F3AULL}, // 1e27
+    {0x4000000000000000ULL, 0x813F3978F8940984ULL}, // 1e28
+    {0x5000000000000000ULL, 0xA18F07D736B90BE5ULL}, // 1e29
+    {0xA400000000000000ULL, 0xC9F2C9CD04674EDEULL}, // 1e30
+    {0x4D00000000000000ULL, 0xFC6F7C4045812296ULL}, // 1e31
+    {0xF020000000000000ULL, 0x9DC5ADA82B70B59DULL}, // 1e32
+    {0x6C28000000000000ULL, 0xC5371912364CE305ULL}, // 1e33
+    {0xC732000000000000ULL, 0xF684DF56C3E01BC6ULL}, // 1e34
+    {0x3C7F400000000000ULL, 0x9A130B963A6C115CULL}, // 1e35
+    {0x4B9F100000000000ULL, 0xC097CE7BC90715B3ULL}, // 1e36
+    {0x1E86D40000000000ULL, 0xF0BDC21ABB48DB20ULL}, // 1e37
+    {0x1314448000000000ULL, 0x96769950B50D88F4ULL}, // 1e38
+    {0x17D955A000000000ULL, 0xBC143FA4E250EB31ULL}, // 1e39
+    {0x5DCFAB0800000000ULL, 0xEB194F8E1AE525FDULL}, // 1e40
+    {0x5AA1CAE500000000ULL, 0x92EFD1B8D0CF37BEULL}, // 1e41
+    {0xF14A3D9E40000000ULL, 0xB7ABC627050305ADULL}, // 1e42
+    {0x6D9CCD05D0000000ULL, 0xE596B7B0C643C719ULL}, // 1e43
+    {0xE4820023A2000000ULL, 0x8F7E32CE7BEA5C6FULL}, // 1e44
+    {0xDDA2802C8A800000ULL, 0xB35DBF821AE4F38BULL}, // 1e45
+    {0xD50B2037AD200000ULL, 0xE0352F62A19E306EULL}, // 1e46
+    {0x4526F422CC340000ULL, 0x8C213D9DA502DE45ULL}, // 1e47
+    {0x9670B12B7F410000ULL, 0xAF298D050E4395D6ULL}, // 1e48
+    {0x3C0CDD765F114000ULL, 0xDAF3F04651D47B4CULL}, // 1e49
+    {0xA5880A69FB6AC800ULL, 0x88D8762BF324CD0FULL}, // 1e50
+    {0x8EEA0D047A457A00ULL, 0xAB0E93B6EFEE0053ULL}, // 1e51
+    {0x72A4904598D6D880ULL, 0xD5D238A4ABE98068ULL}, // 1e52
+    {0x47A6DA2B7F864750ULL, 0x85A36366EB71F041ULL}, // 1e53
+    {0x999090B65F67D924ULL, 0xA70C3C40A64E6C51ULL}, // 1e54
+    {0xFFF4B4E3F741CF6DULL, 0xD0CF4B50CFE20765ULL}, // 1e55
+    {0xBFF8F10E7A8921A4ULL, 0x82818F1281ED449FULL}, // 1e56
+    {0xAFF72D52192B6A0DULL, 0xA321F2D7226895C7ULL}, // 1e57
+    {0x9BF4F8A69F764490ULL, 0xCBEA6F8CEB02BB39ULL}, // 1e58
+    {0x02F236D04753D5B4ULL, 0xFEE50B7025C36A08ULL}, // 1e59
+    {0x01D762422C946590ULL, 0x9F4F2726179A2245ULL}, // 1e60
+    {0x424D3AD2B7B97EF5ULL, 0xC722F0EF9D80AAD6ULL}, // 1e61
+    {0xD2E0898765A7DEB2ULL, 0xF8EBAD2B84E0D58BULL}, // 1e62
+    {0x63CC55F49F88EB2FULL, 0x9B934C3B330C8577ULL}, // 1e63
+    {0x3CBF6B71C76B25FBULL, 0xC2781F49FFCFA6D5ULL}, // 1e64
+};
+
+/**
+ * @brief Eisel-Lemire conversion of man * 10^exp10 to the nearest double.
+ *
+ * @return false when the 128-bit product is too close to a rounding boundary
+ * to decide, or the result would be subnormal or infinite
+ */
+static bool eiselLemire(uint64_t man, int exp10, double *out) {
+  if (man == 0) {
+    *out = 0;
+    return true;
+  }
+  if (exp10 < POW10_MIN_EXP || exp10 > POW10_MAX_EXP) return false;
+
+  const uint64_t *pow = pow10Mantissas[exp10 - POW10_MIN_EXP];
+  int clz = __builtin_clzll(man);
+  man <<= clz;
+  uint64_t retExp2 = (uint64_t)(((217706 * exp10) >> 16) + 64 + 1023) - clz;
+
+  unsigned __int128 x = (unsigned __int128)man * pow[1];
+  uint64_t xHi = (uint64_t)(x >> 64);
+  uint64_t xLo = (uint64_t)x;
+
+  // The truncated low half of the power may carry into the result.
+  if ((xHi & 0x1FF) == 0x1FF && xLo + man < man) {
+    unsigned __int128 y = (unsigned __int128)man * pow[0];
+    uint64_t yHi = (uint64_t)(y >> 64);
+    uint64_t yLo = (uint64_t)y;
+    uint64_t mergedHi = xHi;
+    uint64_t mergedLo = xLo + yHi;
+    if (mergedLo < xLo) mergedHi++;
+    if ((mergedHi & 0x1FF) == 0x1FF && mergedLo + 1 == 0 && yLo + man < man) {
+      return false;
+    }
+    xHi = mergedHi;
+    xLo = mergedLo;
+  }
+
+  uint64_t msb = xHi >> 63;
+  uint64_t retMantissa = xHi >> (msb + 9);
+  retExp2 -= 1 ^ msb;
+
+  // Exactly halfway between two doubles; let the fallback break the tie.
+  if (xLo == 0 && (xHi & 0x1FF) == 0 && (retMantissa & 3) == 1) return false;
+
+  retMantissa += retMantissa & 1;
+  retMantissa >>= 1;
+  if (retMantissa >> 53 > 0) {
+    retMantissa >>= 1;
+    retExp2 += 1;
+  }
+  if (retExp2 - 1 >= 0x7FF - 1) return false;
+
+  uint64_t bits = retExp2 << 52 | (retMantissa & 0x000FFFFFFFFFFFFFULL);
+  memcpy(out, &bits, sizeof(bits));
+  return true;
+}
+
+/*
+ * Exact fallback: the literal as a decimal of up to DECIMAL_DIGITS digits,
+ * scaled by powers of two into [1/2, 1) and then by 2^53, at which point the
+ * integer part is the rounded mantissa (the "simple decimal conversion" of
+ * Go's strconv). Digits past DECIMAL_DIGITS only decide exact ties, which
+ * `truncated` records.
+ */
+
+#define DECIMAL_DIGITS 800
+#define MAX_SHIFT 60 // Keeps digit << shift + carry within 64 bits
+
+typedef struct {
+  uint8_t digits[DECIMAL_DIGITS]; // Values 0-9, no leading or trailing zeros
+  int count;
+  int point; // The value is 0.digits * 10^point
+  bool truncated;
+} Decimal;
+
+// Bits to shift by to move the decimal point by at least `i` places.
+static const int pointShifts[] = {1, 3, 6, 9, 13, 16, 19, 23, 26};
+
+static void trimDecimal(Decimal *d) {
+  while (d->count > 0 && d->digits[d->count - 1] == 0) d->count--;
+  if (d->count == 0) d->point = 0;
+}
+
+static void readDecimal(Decimal *d, const char *s, int length) {
+  const char *p = s;
+  const char *end = s + length;
+  d->count = 0;
+  d->point = 0;
+  d->truncated = false;
+
+  while (p < end && *p == '0') p++;
+  for (; p < end && *p != '.'; p++) {
+    if (d->count < DECIMAL_DIGITS) {
+      d->digits[d->count++] = (uint8_t)(*p - '0');
+    } else {
+      d->truncated |= *p != '0';
+    }
+    d->point++;
+  }
+  if (p < end) {
+    for (p++; p < end; p++) {
+      if (d->count == 0 && *p == '0') {
+        d->point--;
+      } else if (d->count < DECIMAL_DIGITS) {
+        d->digits[d->count++] = (uint8_t)(*p - '0');
+      } else {
+        d->truncated |= *p != '0';
+      }
+    }
+  }
+  trimDecimal(d);
+}
+
+// Multiplies by 2^shift, shift <= MAX_SHIFT.
+static void shiftLeft(Decimal *d, int shift) {
+  uint8_t out[DECIMAL_DIGITS + 20];
+  int w = (int)sizeof(out);
+  uint64_t n = 0;
+  for (int r = d->count - 1; r >= 0; r--) {
+    n += (uint64_t)d->digits[r] << shift;
+    out[--w] = (uint8_t)(n % 10);
+    n /= 10;
+  }
+  for (; n > 0; n /= 10) out[--w] = (uint8_t)(n % 10);
+
+  int produced = (int)sizeof(out) - w;
+  int kept = produced < DECIMAL_DIGITS ? produced : DECIMAL_DIGITS;
+  for (int i = kept; i < produced; i++) d->truncated |= out[w + i] != 0;
+  memcpy(d->digits, out + w, (size_t)kept);
+  d->point += produced - d->count;
+  d->count = kept;
+  trimDecimal(d);
+}
+
+// Divides by 2^shift, shift <= MAX_SHIFT.
+static void shiftRight(Decimal *d, int shift) {
+  int r = 0;
+  int w = 0;
+  uint64_t n = 0;
+  uint64_t mask = ((uint64_t)1 << shift) - 1;
+
+  // Pick up enough leading digits to produce the first one.
+  for (; n >> shift == 0; r++) {
+    if (r >= d->count) {
+      if (n == 0) {
+        d->count = 0;
+        d->point = 0;
+        return;
+      }
+      while (n >> shift == 0) {
+        n *= 10;
+        r++;
+      }
+      break;
+    }
+    n = n * 10 + d->digits[r];
+  }
+  d->point -= r - 1;
+
+  for (; r < d->count; r++) {
+    d->digits[w++] = (uint8_t)(n >> shift);
+    n = (n & mask) * 10 + d->digits[r];
+  }
+  for (; n > 0; n = (n & mask) * 10) {
+    if (w < DECIMAL_DIGITS) {
+      d->digits[w++] = (uint8_t)(n >> shift);
+    } else {
+      d->truncated |= (n >> shift) != 0;
+    }
+  }
+  d->count = w;
+  trimDecimal(d);
+}
+
+static void shiftDecimal(Decimal *d, int shift) {
+  if (d->count == 0) return;
+  for (; shift > MAX_SHIFT; shift -= MAX_SHIFT) shiftLeft(d, MAX_SHIFT);
+  for (; shift < -MAX_SHIFT; shift += MAX_SHIFT) shiftRight(d, MAX_SHIFT);
+  if (shift > 0) shiftLeft(d, shift);
+  if (shift < 0) shiftRight(d, -shift);
+}
+
+// The integer part rounded to nearest, ties to even; point <= 20.
+static uint64_t roundedInteger(Decimal *d) {
+  uint64_t n = 0;
+  int i = 0;
+  for (; i < d->point && i < d->count; i++) n = n * 10 + d->digits[i];
+  for (; i < d->point; i++) n *= 10;
+
+  int next = d->point;
+  if (next < 0 || next >= d->count) return n;
+  bool up = d->digits[next] >= 5;
+  if (d->digits[next] == 5 && next + 1 == d->count) {
+    // Exactly halfway, unless dropped digits put it a little above.
+    up = d->truncated || (next > 0 && d->digits[next - 1] % 2 == 1);
+  }
+  return n + up;
+}
+
+static double slowParse(const char *s, int length) {
+  Decimal d;
+  readDecimal(&d, s, length);
+
+  uint64_t bits;
+  if (d.count == 0 || d.point < -330) {
+    bits = 0;
+  } else if (d.point > 310) {
+    bits = (uint64_t)0x7FF << 52;
+  } else {
+    // Scale into [1/2, 1), counting the binary exponent.
+    int exp2 = 0;
+    while (d.point > 0) {
+      int shift = d.point < 9 ? pointShifts[d.point] : 27;
+      shiftDecimal(&d, -shift);
+      exp2 += shift;
+    }
+    while (d.point < 0 || (d.point == 0 && d.digits[0] < 5)) {
+      int shift = -d.point < 9 ? pointShifts[-d.point] : 27;
+      shiftDecimal(&d, shift);
+      exp2 -= shift;
+    }
+
+    // A double's significand is in [1, 2); subnormals stop at 2^-1022.
+    exp2--;
+    if (exp2 < -1022) {
+      shiftDecimal(&d, -(-1022 - exp2));
+      exp2 = -1022;
+    }
+    shiftDecimal(&d, 53);
+    uint64_t mantissa = roundedInteger(&d);
+    if (mantissa == (uint64_t)2 << 52) {
+      mantissa >>= 1;
+      exp2++;
+    }
+    if (exp2 + 1023 >= 0x7FF) {
+      bits = (uint64_t)0x7FF << 52;
+    } else {
+      uint64_t biased = mantissa >> 52 == 0 ? 0 : (uint64_t)(exp2 + 1023);
+      bits = biased << 52 | (mantissa & 0x000FFFFFFFFFFFFFULL);
+    }
+  }
+
+  double value;
+  memcpy(&value, &bits, sizeof(bits));
+  return value;
+}
+
+/**
+ * @brief Converts a number literal already validated by the lexer
+ * (digits with at most one inner '.') to the nearest double.
+ *
+ * Integers below 2^53 are converted directly. Up to 19 significant digits
+ * are accumulated and scaled exactly when the mantissa and the power of ten
+ * are both exact doubles, otherwise by Eisel-Lemire. Literals it cannot
+ * decide fall back to an exact decimal conversion.
+ */
+double parseNumber(const char *s, int length) {
+  const char *p = s;
+  const char *end = s + length;
+  uint64_t man = 0;
+  int digits = 0;
+  int exp10 = 0;
+  bool truncated = false;
+
+  while (p < end && *p == '0') p++;
+  for (; p < end && *p != '.'; p++) {
+    if (digits < 19) {
+      man = man * 10 + (uint64_t)(*p - '0');
+      if (man != 0) digits++;
+    } else {
+      exp10++;
+      truncated |= *p != '0';
+    }
+  }
+
+  if (p == end && !truncated && man <= MAX_EXACT_INTEGER) return (double)man;
+
+  if (p < end) {
+    for (p++; p < end; p++) {
+      if (digits < 19) {
+        man = man * 10 + (uint64_t)(*p - '0');
+        if (man != 0) digits++;
+        exp10--;
+      } else {
+        truncated |= *p != '0';
+      }
+    }
+  }
+
+  if (!truncated && man <= MAX_EXACT_INTEGER && exp10 >= -22 && exp10 <= 22) {
+    if (exp10 < 0) return (double)man / exactPow10[-exp10];
+    return (double)man * exactPow10[exp10];
+  }
+
+  double value;
+  if (eiselLemire(man, exp10, &value)) {
+    if (!truncated) return value;
+
+    // The dropped digits put the literal between man and man + 1 units; the
+    // result is exact only if both ends round to the same double.
+    double upper;
+    if (eiselLemire(man + 1, exp10, &upper) && upper == value) return value;
+  }
+  return slowParse(s, length);
+}
+
+/*
+ * Number formatting. Ryu (Adams, "Ryu: fast float-to-string conversion",
+ * PLDI 2018) finds the shortest decimal that reads back as the same double,
+ * choosing the closest one when several are that short. The halfway points
+ * to the neighbouring doubles are scaled by a power of ten with 128-bit
+ * multiplications by the tables below, and digits are dropped while the
+ * scaled interval still contains more than one candidate.
+ */
+
+#define DOUBLE_MANTISSA_BITS 52
+#define DOUBLE_BIAS 1023
+#define POW5_INV_BITCOUNT 125
+#define POW5_BITCOUNT 125
+
+/**
+ * @brief floor(2^k / 5^q) + 1, where k = bitlength(5^q) - 1 + 125, for every
+ * q the conversion of a double with a non-negative binary exponent needs;
+ * stored as {low, high}.
+ */
+static const uint64_t pow5InvSplit[][2] = {
+    {0x0000000000000001ULL, 0x2000000000000000ULL}, // 5^-0
+    {0x999999999999999AULL, 0x1999999999999999ULL}, // 5^-1
+    {0x47AE147AE147AE15ULL, 0x147AE147AE147AE1ULL}, // 5^-2
+    {0x6C8B4395810624DEULL, 0x10624DD2F1A9FBE7ULL}, // 5^-3
+    {0x7A786C226809D496ULL, 0x1A36E2EB1C432CA5ULL}, // 5^-4
+    {0x61F9F01B866E43ABULL, 0x14F8B588E368F084ULL}, // 5^-5
+    {0xB4C7F34938583622ULL, 0x10C6F7A0B5ED8D36ULL}, // 5^-6
+    {0x87A6520EC08D236AULL, 0x1AD7F29ABCAF4857ULL}, // 5^-7
+    {0x9FB841A566D74F88ULL, 0x15798EE2308C39DFULL}, // 5^-8
+    {0xE62D01511F12A607ULL, 0x112E0BE826D694B2ULL}, // 5^-9
+    {0xD6AE6881CB5109A4ULL, 0x1B7CDFD9D7BDBAB7ULL}, // 5^-10
+    {0xDEF1ED34A2A73AEAULL, 0x15FD7FE17964955FULL}, // 5^-11
+    {0x7F27F0F6E885C8BBULL, 0x119799812DEA1119ULL}, // 5^-12
+    {0x650CB4BE40D60DF8ULL, 0x1C25C268497681C2ULL}, // 5^-13
+    {0xEA70909833DE7193ULL, 0x16849B86A12B9B01ULL}, // 5^-14
+    {0x21F3A6E0297EC143ULL, 0x1203AF9EE756159BULL}, // 5^-15
+    {0x6985D7CD0F313537ULL, 0x1CD2B297D889BC2BULL}, // 5^-16
+    {0x2137DFD73F5A90F9ULL, 0x170EF54646D49689ULL}, // 5^-17
+    {0xE75FE645CC4873FAULL, 0x12725DD1D243ABA0ULL}, // 5^-18
+    {0xA5663D3C7A0D865DULL, 0x1D83C94FB6D2AC34ULL}, // 5^-19
+    {0x511E976394D79EB1ULL, 0x179CA10C9242235DULL}, // 5^-20
+    {0xDA7EDF82DD794BC1ULL, 0x12E3B40A0E9B4F7DULL}, // 5^-21
+    {0x2A6498D1625BAC68ULL, 0x1E392010175EE596ULL}, // 5^-22
+    {0xEEB6E0A781E2F053ULL, 0x182DB34012B25144ULL}, // 5^-23
+    {0x58924D52CE4F26A9ULL, 0x1357C299A88EA76AULL}, // 5^-24
+    {0x27507BB7B07EA441ULL, 0x1EF2D0F5DA7DD8AAULL}, // 5^-25
+    {0x52A6C95FC0655034ULL, 0x18C240C4AECB13BBULL}, // 5^-26
+    {0x0EEBD44C99EAA690ULL, 0x13CE9A36F23C0FC9ULL}, // 5^-27
+    {0xB17953ADC3110A80ULL, 0x1FB0F6BE50601941ULL}, // 5^-28
+    {0xC12DDC8B02740867ULL, 0x195A5EFEA6B34767ULL}, // 5^-29
+    {0x3424B06F3529A052ULL, 0x14484BFEEBC29F86ULL}, // 5^-30
+    {0x901D59F290EE19DBULL, 0x1039D66589687F9EULL}, // 5^-31
+    {0x4CFBC31DB4B0295FULL, 0x19F623D5A8A73297ULL}, // 5^-32
+    {0x3D9635B15D59BAB2ULL, 0x14C4E977BA1F5BACULL}, // 5^-33
+    {0x97AB5E277DE16228ULL, 0x109D8792FB4C4956ULL}, // 5^-34
+    {0xF2ABC9D8C9689D0DULL, 0x1A95A5B7F87A0EF0ULL}, // 5^-35
+    {0x5BBCA17A3ABA173EULL, 0x154484932D2E725AULL}, // 5^-36
+    {0xAFCA1AC82EFB45CBULL, 0x11039D428A8B8EAEULL}, // 5^-37
+    {0xB2DCF7A6B1920945ULL, 0x1B38FB9DAA78E44AULL}, // 5^-38
+    {0xF57D92EBC141A104ULL, 0x15C72FB1552D836EULL}, // 5^-39
+    {0xC46475896767B403ULL, 0x116C262777579C58ULL}, // 5^-40
+    {0x6D6D88DBD8A5ECD2ULL, 0x1BE03D0BF225C6F4ULL}, // 5^-41
+    {0x8ABE071646EB23DBULL, 0x164CFDA3281E38C3ULL}, // 5^-42
+    {0x6EFE6C11D255B649ULL, 0x11D7314F534B609CULL}, // 5^-43
+    {0xB197134FB6EF8A0EULL, 0x1C8B821885456760ULL}, // 5^-44
+    {0x27AC0F72F8BFA1A5ULL, 0x16D601AD376AB91AULL}, // 5^-45
+    {0xB95672C260994E1EULL, 0x1244CE242C5560E1ULL}, // 5^-46
+    {0xF5571E03CDC21695ULL, 0x1D3AE36D13BBCE35ULL}, // 5^-47
+    {0x2AAC18030B01ABABULL, 0x17624F8A762FD82BULL}, // 5^-48
+    {0xBBBCE0026F348956ULL, 0x12B50C6EC4F31355ULL}, // 5^-49
+    {0x92C7CCD0B1EDA889ULL, 0x1DEE7A4AD4B81EEFULL}, // 5^-50
+    {0xDBD30A408E57BA07ULL, 0x17F1FB6F10934BF2ULL}, // 5^-51
+    {0x7CA8D50071DFC806ULL, 0x1327FC58DA0F6FF5ULL}, // 5^-52
+    {0xFAA7BB33E9660CD6ULL, 0x1EA6608E29B24CBBULL}, // 5^-53
+    {0x9552FC298784D711ULL, 0x18851A0B548EA3C9ULL}, // 5^-54
+    {0xAAA8C9BAD2D0AC0EULL, 0x139DAE6F76D88307ULL}, // 5^-55
+    {0xDDDADC5E1E1AACE3ULL, 0x1F62B0B257C0D1A5ULL}, // 5^-56
+    {0x7E48B04B4B488A4FULL, 0x191BC08EAC9A4151ULL}, // 5^-57
+    {0xCB6D59D5D5D3A1D9ULL, 0x141633A556E1CDDAULL}, // 5^-58
+    {0x3C577B1177DC817BULL, 0x1011C2EAABE7D7E2ULL}, // 5^-59
+    {0xC6F25E825960CF2AULL, 0x19B604AAACA62636ULL}, // 5^-60
+    {0x6BF518684780A5BBULL, 0x14919D5556EB51C5ULL}, // 5^-61
+    {0x232A79ED06008496ULL, 0x10747DDDDF22A7D1ULL}, // 5^-62
+    {0xD1DD8FE1A3340756ULL, 0x1A53FC9631D10C81ULL}, // 5^-63
+    {0xA7E4731AE8F66C45ULL, 0x150FFD44F4A73D34ULL}, // 5^-64
+    {0x531D28E253F8569EULL, 0x10D9976A5D52975DULL}, // 5^-65
+    {0xEB61DB03B98D5762ULL, 0x1AF5BF109550F22EULL}, // 5^-66
+    {0xBC4E48CFC7A445E8ULL, 0x159165A6DDDA5B58ULL}, // 5^-67
+    {0x6371D3D96C836B20ULL, 0x11411E1F17E1E2ADULL}, // 5^-68
+    {0x9F1C8628AD9F11CDULL, 0x1B9B6364F3030448ULL}, // 5^-69
+    {0xE5B06B53BE18DB0BULL, 0x1615E91D8F359D06ULL}, // 5^-70
+    {0xEAF3890FCB4715A2ULL, 0x11AB20E472914A6BULL}, // 5^-71
+    {0x44B8DB4C7871BC37ULL, 0x1C45016D841BAA46ULL}, // 5^-72
+    {0x03C715D6C6C1635FULL, 0x169D9ABE03495505ULL}, // 5^-73
+    {0x3638DE456BCDE919ULL, 0x1217AEFE69077737ULL}, // 5^-74
+    {0x56C163A2461641C1ULL, 0x1CF2B1970E725858ULL}, // 5^-75
+    {0xDF011C81D1AB67CEULL, 0x17288E1271F51379ULL}, // 5^-76
+    {0x7F3416CE4155ECA5ULL, 0x1286D80EC190DC61ULL}, // 5^-77
+    {0x6520247D3556476EULL, 0x1DA48CE468E7C702ULL}, // 5^-78
+    {0xEA801D30F7783925ULL, 0x17B6D71D20B96C01ULL}, // 5^-79
+    {0xBB99B0F3F92CFA84ULL, 0x12F8AC174D612334ULL}, // 5^-80
+    {0x5F5C4E532847F739ULL, 0x1E5AACF215683854ULL}, // 5^-81
+    {0x7F7D0B75B9D32C2EULL, 0x18488A5B44536043ULL}, // 5^-82
+    {0x9930D5F7C7DC2358ULL, 0x136D3B7C36A919CFULL}, // 5^-83
+    {0x8EB4898C72F9D226ULL, 0x1F152BF9F10E8FB2ULL}, // 5^-84
+    {0x722A07A38F2E41B8ULL, 0x18DDBCC7F40BA628ULL}, // 5^-85
+    {0xC1BB394FA5BE9AFAULL, 0x13E497065CD61E86ULL}, // 5^-86
+    {0x9C5EC2190930F7F6ULL, 0x1FD424D6FAF030D7ULL}, // 5^-87
+    {0x49E56814075A5FF8ULL, 0x197683DF2F268D79ULL}, // 5^-88
+    {0x6E51201005E1E660ULL, 0x145ECFE5BF520AC7ULL}, // 5^-89
+    {0xF1DA800CD181851AULL, 0x104BD984990E6F05ULL}, // 5^-90
+    {0x4FC400148268D4F5ULL, 0x1A12F5A0F4E3E4D6ULL}, // 5^-91
+    {0xD96999AA01ED772BULL, 0x14DBF7B3F71CB711ULL}, // 5^-92
+    {0xADEE1488018AC5BCULL, 0x10AFF95CC5B09274ULL}, // 5^-93
+    {0x497CEDA668DE092CULL, 0x1AB328946F80EA54ULL}, // 5^-94
+    {0x3ACA57B853E4D424ULL, 0x155C2076BF9A5510ULL}, // 5^-95
+    {0x623B7960431D7683ULL, 0x1116805EFFAEAA73ULL}, // 5^-96
+    {0x9D2BF566D1C8BD9EULL, 0x1B5733CB32B110B8ULL}, // 5^-97
+    {0x7DBCC452416D647FULL, 0x15DF5CA28EF40D60ULL}, // 5^-98
+    {0xCAFD69DB678AB6CCULL, 0x117F7D4ED8C33DE6ULL}, // 5^-99
+    {0xAB2F0FC572778ADFULL, 0x1BFF2EE48E052FD7ULL}, // 5^-100
+    {0x88F273045B92D580ULL, 0x1665BF1D3E6A8CACULL}, // 5^-101
+    {0xD3F528D049424466ULL, 0x11EAFF4A98553D56ULL}, // 5^-102
+    {0xB988414D4203A0A3ULL, 0x1CAB3210F3BB9557ULL}, // 5^-103
+    {0x6139CDD76802E6E9ULL, 0x16EF5B40C2FC7779ULL}, // 5^-104
+    {0xE761717920025254ULL, 0x125915CD68C9F92DULL}, // 5^-105
+    {0xA568B58E999D5086ULL, 0x1D5B561574765B7CULL}, // 5^-106
+    {0x5120913EE14AA6D2ULL, 0x177C44DDF6C515FDULL}, // 5^-107
+    {0xA74D40FF1AA21F0EULL, 0x12C9D0B1923744CAULL}, // 5^-108
+    {0x0BAECE64F769CB4AULL, 0x1E0FB44F50586E11ULL}, // 5^-109
+    {0x3C8BD850C5EE3C3BULL, 0x180C903F7379F1A7ULL}, // 5^-110
+    {0xCA0979DA37F1C9C9ULL, 0x133D4032C2C7F485ULL}, // 5^-111
+    {0xA9A8C2F6BFE942DBULL, 0x1EC866B79E0CBA6FULL}, // 5^-112
+    {0x2153CF2BCCBA9BE3ULL, 0x18A0522C7E709526ULL}, // 5^-113
+    {0x1AA9728970954982ULL, 0x13B374F06526DDB8ULL}, // 5^-114
+    {0xF775840F1A88759DULL, 0x1F8587E7083E2F8CULL}, // 5^-115
+    {0x5F9136727BA05E17ULL, 0x19379FEC0698260AULL}, // 5^-116
+    {0x1940F85B9619E4DFULL, 0x142C7FF0054684D5ULL}, // 5^-117
+    {0xE100C6AFAB47EA4CULL, 0x1023998CD1053710ULL}, // 5^-118
+    {0xCE67A44C453FDD47ULL, 0x19D28F47B4D524E7ULL}, // 5^-119
+    {0xD852E9D69DCCB106ULL, 0x14A8729FC3DDB71FULL}, // 5^-120
+    {0x79DBEE454B0A2738ULL, 0x1086C219697E2C19ULL}, // 5^-121
+    {0x295FE3A211A9D859ULL, 0x1A71368F0F30468FULL}, // 5^-122
+    {0xBAB31C81A7BB137AULL, 0x15275ED8D8F36BA5ULL}, // 5^-123
+    {0x6228E39AEC95A92FULL, 0x10EC4BE0AD8F8951ULL}, // 5^-124
+    {0x9D0E38F7E0EF7517ULL, 0x1B13AC9AAF4C0EE8ULL}, // 5^-125
+    {0xB0D82D931A592A79ULL, 0x15A956E225D67253ULL}, // 5^-126
+    {0x8D79BE0F4847552EULL, 0x11544581B7DEC1DCULL}, // 5^-127
+    {0x158F967EDA0BBB7CULL, 0x1BBA08CF8C979C94ULL}, // 5^-128
+    {0x77A611FF14D62F97ULL, 0x162E6D72D6DFB076ULL}, // 5^-129
+    {0xF951A7FF43DE8C79ULL, 0x11BEBDF578B2F391ULL}, // 5^-130
+    {0xC21C3FFED2FDAD8EULL, 0x1C6463225AB7EC1CULL}, // 5^-131
+    {0x01B0333242648AD8ULL, 0x16B6B5B5155FF017ULL}, // 5^-132
+    {0x0159C28E9B83A246ULL, 0x122BC490DDE659ACULL}, // 5^-133
+    {0xCEF604175F3903A3ULL, 0x1D12D41AFCA3C2ACULL}, // 5^-134
+    {0x725E69AC4C2D9C83ULL, 0x17424348CA1C9BBDULL}, // 5^-135
+    {0xF5185489D68AE39CULL, 0x129B69070816E2FDULL}, // 5^-136
+    {0xEE8D540FBDAB05C6ULL, 0x1DC574D80CF16B2FULL}, // 5^-137
+    {0xBED77672FE226B05ULL, 0x17D12A4670C1228CULL}, // 5^-138
+    {0xFF12C528CB4EBC04ULL, 0x130DBB6B8D674ED6ULL}, // 5^-139
+    {0xCB513B74787DF9A0ULL, 0x1E7C5F127BD87E24ULL}, // 5^-140
+    {0x090DC929F9FE614DULL, 0x18637F41FCAD31B7ULL}, // 5^-141
+    {0xA0D7D42194CB810AULL, 0x1382CC34CA2427C5ULL}, // 5^-142
+    {0x67BFB9CF5478CE77ULL, 0x1F37AD21436D0C6FULL}, // 5^-143
+    {0x1FCC94A5DD2D71F9ULL, 0x18F9574DCF8A7059ULL}, // 5^-144
+    {0x7FD6DD517DBDF4C7ULL, 0x13FAAC3E3FA1F37AULL}, // 5^-145
+    {0xFFBE2EE8C92FEE0BULL, 0x1FF779FD329CB8C3ULL}, // 5^-146
+    {0x6631BF20A0F324D6ULL, 0x1992C7FDC216FA36ULL}, // 5^-147
+    {0xB827CC1A1A5C1D78ULL, 0x14756CCB01ABFB5EULL}, // 5^-148
+    {0x935309AE7B7CE460ULL, 0x105DF0A267BCC918ULL}, // 5^-149
+    {0x1EEB42B0C594A099ULL, 0x1A2FE76A3F9474F4ULL}, // 5^-150
+    {0xE58902270476E6E1ULL, 0x14F31F8832DD2A5CULL}, // 5^-151
+    {0xB7A0CE859D2BEBE7ULL, 0x10C27FA028B0EEB0ULL}, // 5^-152
+    {0x59014A6F61DFDFD8ULL, 0x1AD0CC33744E4AB4ULL}, // 5^-153
+    {0xE0CDD525E7E64CADULL, 0x1573D68F903EA229ULL}, // 5^-154
+    {0x4D7177518651D6F1ULL, 0x11297872D9CBB4EEULL}, // 5^-155
+    {0x7BE8BEE8D6E957E8ULL, 0x1B758D848FAC54B0ULL}, // 5^-156
+    {0xFCBA3253DF211320ULL, 0x15F7A46A0C89DD59ULL}, // 5^-157
+    {0x63C8284318E74280ULL, 0x1192E9EE706E4AAEULL}, // 5^-158
+    {0x060D0D3827D86A66ULL, 0x1C1E43171A4A1117ULL}, // 5^-159
+    {0x6B3DA42CECAD21EBULL, 0x167E9C127B6E7412ULL}, // 5^-160
+    {0x88FE1CF0BD574E56ULL, 0x11FEE341FC585CDBULL}, // 5^-161
+    {0x419694B462254A23ULL, 0x1CCB0536608D615FULL}, // 5^-162
+    {0x67ABAA29E81DD4E9ULL, 0x1708D0F84D3DE77FULL}, // 5^-163
+    {0xB95621BB2017DD87ULL, 0x126D73F9D764B932ULL}, // 5^-164
+    {0xC223692B668C95A5ULL, 0x1D7BECC2F23AC1EAULL}, // 5^-165
+    {0xCE82BA891ED6DE1DULL, 0x179657025B6234BBULL}, // 5^-166
+    {0xA53562074BDF1818ULL, 0x12DEAC01E2B4F6FCULL}, // 5^-167
+    {0x3B889CD87964F359ULL, 0x1E3113363787F194ULL}, // 5^-168
+    {0xFC6D4A46C783F5E1ULL, 0x18274291C6065ADCULL}, // 5^-169
+    {0x30576E9F06032B1AULL, 0x13529BA7D19EAF17ULL}, // 5^-170
+    {0x1A257DCB3CD1DE90ULL, 0x1EEA92A61C311825ULL}, // 5^-171
+    {0x481DFE3C30A7E540ULL, 0x18BBA884E35A79B7ULL}, // 5^-172
+    {0xD34B31C9C0865100ULL, 0x13C9539D82AEC7C5ULL}, // 5^-173
+    {0x5211E942CDA3B4CDULL, 0x1FA885C8D117A609ULL}, // 5^-174
+    {0x74DB21023E1C90A4ULL, 0x19539E3A40DFB807ULL}, // 5^-175
+    {0xF715B401CB4A0D50ULL, 0x1442E4FB67196005ULL}, // 5^-176
+    {0xF8DE299B09080AA7ULL, 0x103583FC527AB337ULL}, // 5^-177
+    {0x8E304291A80CDDD7ULL, 0x19EF3993B72AB859ULL}, // 5^-178
+    {0x3E8D020E200A4B13ULL, 0x14BF6142F8EEF9E1ULL}, // 5^-179
+    {0x653D9B3E80083C0FULL, 0x10991A9BFA58C7E7ULL}, // 5^-180
+    {0x6EC8F864000D2CE4ULL, 0x1A8E90F9908E0CA5ULL}, // 5^-181
+    {0x8BD3F9E999A423EAULL, 0x153EDA614071A3B7ULL}, // 5^-182
+    {0x3CA994BAE1501CBBULL, 0x10FF151A99F482F9ULL}, // 5^-183
+    {0xC775BAC49BB3612BULL, 0x1B31BB5DC320D18EULL}, // 5^-184
+    {0xD2C4956A16291A89ULL, 0x15C162B168E70E0BULL}, // 5^-185
+    {0xDBD0778811BA7BA1ULL, 0x11678227871F3E6FULL}, // 5^-186
+    {0x2C80BF401C5D929BULL, 0x1BD8D03F3E9863E6ULL}, // 5^-187
+    {0xBD33CC3349E47549ULL, 0x16470CFF6546B651ULL}, // 5^-188
+    {0xCA8FD68F6E505DD4ULL, 0x11D270CC51055EA7ULL}, // 5^-189
+    {0x4419574BE3B3C953ULL, 0x1C83E7AD4E6EFDD9ULL}, // 5^-190
+    {0x0347790982F63AA9ULL, 0x16CFEC8AA52597E1ULL}, // 5^-191
+    {0xCF6C60D468C4FBBAULL, 0x123FF06EEA847980ULL}, // 5^-192
+    {0xE57A34870E07F92AULL, 0x1D331A4B10D3F59AULL}, // 5^-193
+    {0x512E906C0B399422ULL, 0x175C1508DA432AE2ULL}, // 5^-194
+    {0xDA8BA6BCD5C7A9B5ULL, 0x12B010D3E1CF5581ULL}, // 5^-195
+    {0x90DF712E22D90F87ULL, 0x1DE6815302E5559CULL}, // 5^-196
+    {0xDA4C5A8B4F140C6CULL, 0x17EB9AA8CF1DDE16ULL}, // 5^-197
+    {0xAEA37BA2A5A9A38AULL, 0x1322E220A5B17E78ULL}, // 5^-198
+    {0x7DD25F6AA2A905A9ULL, 0x1E9E369AA2B59727ULL}, // 5^-199
+    {0x97DB7F888220D154ULL, 0x187E92154EF7AC1FULL}, // 5^-200
+    {0x797C6606CE80A777ULL, 0x139874DDD8C6234CULL}, // 5^-201
+    {0x8F2D700AE4010BF1ULL, 0x1F5A549627A36BADULL}, // 5^-202
+    {0x0C2459A25000D65AULL, 0x191510781FB5EFBEULL}, // 5^-203
+    {0x701D1481D99A4515ULL, 0x1410D9F9B2F7F2FEULL}, // 5^-204
+    {0xC017439B147B6A77ULL, 0x100D7B2E28C65BFEULL}, // 5^-205
+    {0xCCF205C4ED9243F2ULL, 0x19AF2B7D0E0A2CCAULL}, // 5^-206
+    {0x0A5B37D0BE0E9CC2ULL, 0x148C22CA71A1BD6FULL}, // 5^-207
+    {0x0848F973CB3EE3CEULL, 0x10701BD527B4978CULL}, // 5^-208
+    {0xDA0E5BEC78649FB0ULL, 0x1A4CF9550C5425ACULL}, // 5^-209
+    {0x7B3EAFF060507FC0ULL, 0x150A6110D6A9B7BDULL}, // 5^-210
+    {0x95CBBFF380406633ULL, 0x10D51A73DEEE2C97ULL}, // 5^-211
+    {0xEFAC665266CD7052ULL, 0x1AEE90B964B04758ULL}, // 5^-212
+    {0x2623850EB8A459DBULL, 0x158BA6FAB6F36C47ULL}, // 5^-213
+    {0x1E82D0D893B6AE49ULL, 0x113C85955F29236CULL}, // 5^-214
+    {0xFD9E1AF41F8AB075ULL, 0x1B9408EEFEA838ACULL}, // 5^-215
+    {0x97B1AF29B2D559F7ULL, 0x16100725988693BDULL}, // 5^-216
+    {0xAC8E25BAF5777B2CULL, 0x11A66C1E139EDC97ULL}, // 5^-217
+    {0x7A7D092B2258C513ULL, 0x1C3D79C9B8FE2DBFULL}, // 5^-218
+    {0x61FDA0EF4EAD6A76ULL, 0x169794A160CB57CCULL}, // 5^-219
+    {0xE7FE1A590BBDEEC5ULL, 0x1212DD4DE7091309ULL}, // 5^-220
+    {0xA6635D5B45FCB13AULL, 0x1CEAFBAFD80E84DCULL}, // 5^-221
+    {0x851C4AAF6B308DC8ULL, 0x172262F3133ED0B0ULL}, // 5^-222
+    {0xD0E36EF2BC26D7D4ULL, 0x1281E8C275CBDA26ULL}, // 5^-223
+    {0xB49F17EAC6A48C86ULL, 0x1D9CA79D894629D7ULL}, // 5^-224
+    {0x2A18DFEF0550706BULL, 0x17B08617A104EE46ULL}, // 5^-225
+    {0x54E0B3259DD9F389ULL, 0x12F39E794D9D8B6BULL}, // 5^-226
+    {0x87CDEB6F62F65274ULL, 0x1E5297287C2F4578ULL}, // 5^-227
+    {0xD30B22BF825EA85DULL, 0x18421286C9BF6AC6ULL}, // 5^-228
+    {0x0F3C1BCC684BB9E4ULL, 0x13680ED23AFF889FULL}, // 5^-229
+    {0x18602C7A4079296DULL, 0x1F0CE4839198DA98ULL}, // 5^-230
+    {0x46B356C833942124ULL, 0x18D71D360E13E213ULL}, // 5^-231
+    {0x388F78A029434DB6ULL, 0x13DF4A91A4DCB4DCULL}, // 5^-232
+    {0x5A7F2766A86BAF8AULL, 0x1FCBAA82A1612160ULL}, // 5^-233
+    {0x153285EBB9EFBFA2ULL, 0x196FBB9BB44DB44DULL}, // 5^-234
+    {0xAA8ED189618C994EULL, 0x145962E2F6A4903DULL}, // 5^-235
+    {0xEED8A7A11AD6E10CULL, 0x1047824F2BB6D9CAULL}, // 5^-236
+    {0x7E27729B5E249B45ULL, 0x1A0C03B1DF8AF611ULL}, // 5^-237
+    {0xFE85F549181D4904ULL, 0x14D6695B193BF80DULL}, // 5^-238
+    {0xCB9E5DD4134AA0D0ULL, 0x10AB877C142FF9A4ULL}, // 5^-239
+    {0xDF63C9535211014DULL, 0x1AAC0BF9B9E65C3AULL}, // 5^-240
+    {0x191CA10F74DA6771ULL, 0x15566FFAFB1EB02FULL}, // 5^-241
+    {0xADB080D92A4852C1ULL, 0x1111F32F2F4BC025ULL}, // 5^-242
+    {0x15E7348EAA0D5134ULL, 0x1B4FEB7EB212CD09ULL}, // 5^-243
+    {0xAB1F5D3EEE710DC4ULL, 0x15D98932280F0A6DULL}, // 5^-244
+    {0xBC1917658B8DA49DULL, 0x117AD428200C0857ULL}, // 5^-245
+    {0x2CF4F23C127C3A94ULL, 0x1BF7B9D9CCE00D59ULL}, // 5^-246
+    {0xF0C3F4FCDB969543ULL, 0x165FC7E170B33DE0ULL}, // 5^-247
+    {0x5A365D9716121103ULL, 0x11E6398126F5CB1AULL}, // 5^-248
+    {0x9056FC24F01CE804ULL, 0x1CA38F350B22DE90ULL}, // 5^-249
+    {0xD9DF301D8CE3ECD0ULL, 0x16E93F5DA2824BA6ULL}, // 5^-250
+    {0xE17F59B13D8323DAULL, 0x125432B14ECEA2EBULL}, // 5^-251
+    {0x68CBC2B52F38395CULL, 0x1D53844EE47DD179ULL}, // 5^-252
+    {0x53D6355DBF602DE3ULL, 0x177603725064A794ULL}, // 5^-253
+    {0xA9782AB165E68B1CULL, 0x12C4CF8EA6B6EC76ULL}, // 5^-254
+    {0x0F26AAB56FD744FAULL, 0x1E07B27DD78B13F1ULL}, // 5^-255
+    {0x3F52222ABFDF6A62ULL, 0x18062864AC6F4327ULL}, // 5^-256
+    {0x65DB4E88997F884EULL, 0x1338205089F29C1FULL}, // 5^-257
+    {0x6FC54A7428CC0D4AULL, 0x1EC033B40FEA9365ULL}, // 5^-258
+    {0x596AA1F68709A43BULL, 0x1899C2F673220F84ULL}, // 5^-259
+    {0xADEEE7F86C07B696ULL, 0x13AE3591F5B4D936ULL}, // 5^-260
+    {0x497E3FF3E00C5756ULL, 0x1F7D228322BAF524ULL}, // 5^-261
+    {0xD464FFF64CD6AC45ULL, 0x1930E868E89590E9ULL}, // 5^-262
+    {0x4383FFF83D7889D1ULL, 0x14272053ED4473EEULL}, // 5^-263
+    {0xCF9CCCC69793A174ULL, 0x101F4D0FF1038FF1ULL}, // 5^-264
+    {0x7F6147A425B90252ULL, 0x19CBAE7FE805B31CULL}, // 5^-265
+    {0xCC4DD2E9B7C7350FULL, 0x14A2F1FFECD15C16ULL}, // 5^-266
+    {0x3D0B0F215FD290D9ULL, 0x10825B3323DAB012ULL}, // 5^-267
+    {0x61AB4B689950E7C1ULL, 0x1A6A2B85062AB350ULL}, // 5^-268
+    {0x4E22A2BA1440B967ULL, 0x1521BC6A6B555C40ULL}, // 5^-269
+    {0x0B4EE894DD009453ULL, 0x10E7C9EEBC4449CDULL}, // 5^-270
+    {0x1217DA87C800ED51ULL, 0x1B0C764AC6D3A948ULL}, // 5^-271
+    {0xDB46486CA000BDDAULL, 0x15A391D56BDC876CULL}, // 5^-272
+    {0x490506BD4CCD64AFULL, 0x114FA7DDEFE39F8AULL}, // 5^-273
+    {0xA8080AC87AE23AB1ULL, 0x1BB2A62FE638FF43ULL}, // 5^-274
+    {0x5339A239FBE82EF4ULL, 0x162884F31E93FF69ULL}, // 5^-275
+    {0x75C7B4FB2FECF25DULL, 0x11BA03F5B20FFF87ULL}, // 5^-276
+    {0x22D92191E647EA2EULL, 0x1C5CD322B67FFF3FULL}, // 5^-277
+    {0xB57A8141850654F2ULL, 0x16B0A8E891FFFF65ULL}, // 5^-278
+    {0xC4620101373843F5ULL, 0x1226ED86DB3332B7ULL}, // 5^-279
+    {0x3A366801F1F39FEEULL, 0x1D0B15A491EB8459ULL}, // 5^-280
+    {0xFB5EB99B27F6198BULL, 0x173C115074BC69E0ULL}, // 5^-281
+    {0x2F7EFAE2865E7AD6ULL, 0x129674405D6387E7ULL}, // 5^-282
+    {0xE597F7D0D6FD9156ULL, 0x1DBD86CD6238D971ULL}, // 5^-283
+    {0x8479930D78CADAABULL, 0x17CAD23DE82D7AC1ULL}, // 5^-284
+    {0xD06142712D6F1556ULL, 0x1308A831868AC89AULL}, // 5^-285
+    {0x4D686A4EAF182222ULL, 0x1E74404F3DAADA91ULL}, // 5^-286
+    {0xA453883EF279B4E8ULL, 0x185D003F6488AEDAULL}, // 5^-287
+    {0xE9DC6CFF28615D87ULL, 0x137D99CC506D58AEULL}, // 5^-288
+    {0xA960AE650D6895A4ULL, 0x1F2F5C7A1A488DE4ULL}, // 5^-289
+    {0xBAB3BEB73DED4483ULL, 0x18F2B061AEA07183ULL}, // 5^-290
+};
+
+/**
+ * @brief 5^i scaled to exactly 125 bits (truncated when longer), for every i
+ * the conversion of a double with a negative binary exponent needs; stored
+ * as {low, high}.
+ */
+static const uint64_t pow5Split[][2] = {
+    {0x0000000000000000ULL, 0x1000000000000000ULL}, // 5^0
+    {0x0000000000000000ULL, 0x1400000000000000ULL}, // 5^1
+    {0x0000000000000000ULL, 0x1900000000000000ULL}, // 5^2
+    {0x0000000000000000ULL, 0x1F40000000000000ULL}, // 5^3
+    {0x0000000000000000ULL, 0x1388000000000000ULL}, // 5^4
+    {0x0000000000000000ULL, 0x186A000000000000ULL}, // 5^5
+    {0x0000000000000000ULL, 0x1E84800000000000ULL}, // 5^6
+    {0x0000000000000000ULL, 0x1312D00000000000ULL}, // 5^7
+    {0x0000000000000000ULL, 0x17D7840000000000ULL}, // 5^8
+    {0x0000000000000000ULL, 0x1DCD650000000000ULL}, // 5^9
+    {0x0000000000000000ULL, 0x12A05F2000000000ULL}, // 5^10
+    {0x0000000000000000ULL, 0x174876E800000000ULL}, // 5^11
+    {0x0000000000000000ULL, 0x1D1A94A200000000ULL}, // 5^12
+    {0x0000000000000000ULL, 0x12309CE540000000ULL}, // 5^13
+    {0x0000000000000000ULL, 0x16BCC41E90000000ULL}, // 5^14
+    {0x0000000000000000ULL, 0x1C6BF52634000000ULL}, // 5^15
+    {0x0000000000000000ULL, 0x11C37937E0800000ULL}, // 5^16
+    {0x0000000000000000ULL, 0x16345785D8A00000ULL}, // 5^17
+    {0x0000000000000000ULL, 0x1BC16D674EC80000ULL}, // 5^18
+    {0x0000000000000000ULL, 0x1158E460913D0000ULL}, // 5^19
+    {0x0000000000000000ULL, 0x15AF1D78B58C4000ULL}, // 5^20
+    {0x0000000000000000ULL, 0x1B1AE4D6E2EF5000ULL}, // 5^21
+    {0x0000000000000000ULL, 0x10F0CF064DD59200ULL}, // 5^22
+    {0x0000000000000000ULL, 0x152D02C7E14AF680ULL}, // 5^23
+    {0x0000000000000000ULL, 0x1A784379D99DB420ULL}, // 5^24
+    {0x0000000000000000ULL, 0x108B2A2C28029094ULL}, // 5^25
+    {0x0000000000000000ULL, 0x14ADF4B7320334B9ULL}, // 5^26
+    {0x4000000000000000ULL, 0x19D971E4FE8401E7ULL}, // 5^27
+    {0x8800000000000000ULL, 0x1027E72F1F128130ULL}, // 5^28
+    {0xAA00000000000000ULL, 0x1431E0FAE6D7217CULL}, // 5^29
+    {0xD480000000000000ULL, 0x193E5939A08CE9DBULL}, // 5^30
+    {0xC9A0000000000000ULL, 0x1F8DEF8808B02452ULL}, // 5^31
+    {0xBE04000000000000ULL, 0x13B8B5B5056E16B3ULL}, // 5^32
+    {0xAD85000000000000ULL, 0x18A6E32246C99C60ULL}, // 5^33
+    {0xD8E6400000000000ULL, 0x1ED09BEAD87C0378ULL}, // 5^34
+    {0x878FE80000000000ULL, 0x13426172C74D822BULL}, // 5^35
+    {0x6973E20000000000ULL, 0x1812F9CF7920E2B6ULL}, // 5^36
+    {0x03D0DA8000000000ULL, 0x1E17B84357691B64ULL}, // 5^37
+    {0x8262889000000000ULL, 0x12CED32A16A1B11EULL}, // 5^38
+    {0x22FB2AB400000000ULL, 0x178287F49C4A1D66ULL}, // 5^39
+    {0xABB9F56100000000ULL, 0x1D6329F1C35CA4BFULL}, // 5^40
+    {0xCB54395CA0000000ULL, 0x125DFA371A19E6F7ULL}, // 5^41
+    {0xBE2947B3C8000000ULL, 0x16F578C4E0A060B5ULL}, // 5^42
+    {0x2DB399A0BA000000ULL, 0x1CB2D6F618C878E3ULL}, // 5^43
+    {0xFC90400474400000ULL, 0x11EFC659CF7D4B8DULL}, // 5^44
+    {0x7BB4500591500000ULL, 0x166BB7F0435C9E71ULL}, // 5^45
+    {0xDAA16406F5A40000ULL, 0x1C06A5EC5433C60DULL}, // 5^46
+    {0xA8A4DE8459868000ULL, 0x118427B3B4A05BC8ULL}, // 5^47
+    {0xD2CE16256FE82000ULL, 0x15E531A0A1C872BAULL}, // 5^48
+    {0x87819BAECBE22800ULL, 0x1B5E7E08CA3A8F69ULL}, // 5^49
+    {0xF4B1014D3F6D5900ULL, 0x111B0EC57E6499A1ULL}, // 5^50
+    {0x71DD41A08F48AF40ULL, 0x1561D276DDFDC00AULL}, // 5^51
+    {0x0E549208B31ADB10ULL, 0x1ABA4714957D300DULL}, // 5^52
+    {0x28F4DB456FF0C8EAULL, 0x10B46C6CDD6E3E08ULL}, // 5^53
+    {0x33321216CBECFB24ULL, 0x14E1878814C9CD8AULL}, // 5^54
+    {0xBFFE969C7EE839EDULL, 0x1A19E96A19FC40ECULL}, // 5^55
+    {0xF7FF1E21CF512434ULL, 0x105031E2503DA893ULL}, // 5^56
+    {0xF5FEE5AA43256D41ULL, 0x14643E5AE44D12B8ULL}, // 5^57
+    {0x337E9F14D3EEC892ULL, 0x197D4DF19D605767ULL}, // 5^58
+    {0x005E46DA08EA7AB6ULL, 0x1FDCA16E04B86D41ULL}, // 5^59
+    {0xA03AEC4845928CB2ULL, 0x13E9E4E4C2F34448ULL}, // 5^60
+    {0xC849A75A56F72FDEULL, 0x18E45E1DF3B0155AULL}, // 5^61
+    {0x7A5C1130ECB4FBD6ULL, 0x1F1D75A5709C1AB1ULL}, // 5^62
+    {0xEC798ABE93F11D65ULL, 0x13726987666190AEULL}, // 5^63
+    {0xA797ED6E38ED64BFULL, 0x184F03E93FF9F4DAULL}, // 5^64
+    {0x517DE8C9C728BDEFULL, 0x1E62C4E38FF87211ULL}, // 5^65
+    {0xD2EEB17E1C7976B5ULL, 0x12FDBB0E39FB474AULL}, // 5^66
+    {0x87AA5DDDA397D462ULL, 0x17BD29D1C87A191DULL}, // 5^67
+    {0xE994F5550C7DC97BULL, 0x1DAC74463A989F64ULL}, // 5^68
+    {0x11FD195527CE9DEDULL, 0x128BC8ABE49F639FULL}, // 5^69
+    {0xD67C5FAA71C24568ULL, 0x172EBAD6DDC73C86ULL}, // 5^70
+    {0x8C1B77950E32D6C2ULL, 0x1CFA698C95390BA8ULL}, // 5^71
+    {0x57912ABD28DFC639ULL, 0x121C81F7DD43A749ULL}, // 5^72
+    {0xAD75756C7317B7C8ULL, 0x16A3A275D494911BULL}, // 5^73
+    {0x98D2D2C78FDDA5BAULL, 0x1C4C8B1349B9B562ULL}, // 5^74
+    {0x9F83C3BCB9EA8794ULL, 0x11AFD6EC0E14115DULL}, // 5^75
+    {0x0764B4ABE8652979ULL, 0x161BCCA7119915B5ULL}, // 5^76
+    {0x493DE1D6E27E73D7ULL, 0x1BA2BFD0D5FF5B22ULL}, // 5^77
+    {0x6DC6AD264D8F0866ULL, 0x1145B7E285BF98F5ULL}, // 5^78
+    {0xC938586FE0F2CA80ULL, 0x159725DB272F7F32ULL}, // 5^79
+    {0x7B866E8BD92F7D20ULL, 0x1AFCEF51F0FB5EFFULL}, // 5^80
+    {0xAD34051767BDAE34ULL, 0x10DE1593369D1B5FULL}, // 5^81
+    {0x9881065D41AD19C1ULL, 0x15159AF804446237ULL}, // 5^82
+    {0x7EA147F492186032ULL, 0x1A5B01B605557AC5ULL}, // 5^83
+    {0x6F24CCF8DB4F3C1FULL, 0x1078E111C3556CBBULL}, // 5^84
+    {0x4AEE003712230B27ULL, 0x14971956342AC7EAULL}, // 5^85
+    {0xDDA98044D6ABCDF0ULL, 0x19BCDFABC13579E4ULL}, // 5^86
+    {0x0A89F02B062B60B6ULL, 0x10160BCB58C16C2FULL}, // 5^87
+    {0xCD2C6C35C7B638E4ULL, 0x141B8EBE2EF1C73AULL}, // 5^88
+    {0x8077874339A3C71DULL, 0x1922726DBAAE3909ULL}, // 5^89
+    {0xE0956914080CB8E4ULL, 0x1F6B0F092959C74BULL}, // 5^90
+    {0x6C5D61AC8507F38EULL, 0x13A2E965B9D81C8FULL}, // 5^91
+    {0x4774BA17A649F072ULL, 0x188BA3BF284E23B3ULL}, // 5^92
+    {0x1951E89D8FDC6C8FULL, 0x1EAE8CAEF261ACA0ULL}, // 5^93
+    {0x0FD3316279E9C3D9ULL, 0x132D17ED577D0BE4ULL}, // 5^94
+    {0x13C7FDBB186434CFULL, 0x17F85DE8AD5C4EDDULL}, // 5^95
+    {0x58B9FD29DE7D4203ULL, 0x1DF67562D8B36294ULL}, // 5^96
+    {0xB7743E3A2B0E4942ULL, 0x12BA095DC7701D9CULL}, // 5^97
+    {0xE5514DC8B5D1DB92ULL, 0x17688BB5394C2503ULL}, // 5^98
+    {0xDEA5A13AE3465277ULL, 0x1D42AEA2879F2E44ULL}, // 5^99
+    {0x0B2784C4CE0BF38AULL, 0x1249AD2594C37CEBULL}, // 5^100
+    {0xCDF165F6018EF06DULL, 0x16DC186EF9F45C25ULL}, // 5^101
+    {0x416DBF7381F2AC88ULL, 0x1C931E8AB871732FULL}, // 5^102
+    {0x88E497A83137ABD5ULL, 0x11DBF316B346E7FDULL}, // 5^103
+    {0xEB1DBD923D8596CAULL, 0x1652EFDC6018A1FCULL}, // 5^104
+    {0x25E52CF6CCE6FC7DULL, 0x1BE7ABD3781ECA7CULL}, // 5^105
+    {0x97AF3C1A40105DCEULL, 0x1170CB642B133E8DULL}, // 5^106
+    {0xFD9B0B20D0147542ULL, 0x15CCFE3D35D80E30ULL}, // 5^107
+    {0x3D01CDE904199292ULL, 0x1B403DCC834E11BDULL}, // 5^108
+    {0x462120B1A28FFB9BULL, 0x1108269FD210CB16ULL}, // 5^109
+    {0xD7A968DE0B33FA82ULL, 0x154A3047C694FDDBULL}, // 5^110
+    {0xCD93C3158E00F923ULL, 0x1A9CBC59B83A3D52ULL}, // 5^111
+    {0xC07C59ED78C09BB6ULL, 0x10A1F5B813246653ULL}, // 5^112
+    {0xB09B7068D6F0C2A3ULL, 0x14CA732617ED7FE8ULL}, // 5^113
+    {0xDCC24C830CACF34CULL, 0x19FD0FEF9DE8DFE2ULL}, // 5^114
+    {0xC9F96FD1E7EC180FULL, 0x103E29F5C2B18BEDULL}, // 5^115
+    {0x3C77CBC661E71E13ULL, 0x144DB473335DEEE9ULL}, // 5^116
+    {0x8B95BEB7FA60E598ULL, 0x1961219000356AA3ULL}, // 5^117
+    {0x6E7B2E65F8F91EFEULL, 0x1FB969F40042C54CULL}, // 5^118
+    {0xC50CFCFFBB9BB35FULL, 0x13D3E2388029BB4FULL}, // 5^119
+    {0xB6503C3FAA82A037ULL, 0x18C8DAC6A0342A23ULL}, // 5^120
+    {0xA3E44B4F95234844ULL, 0x1EFB1178484134ACULL}, // 5^121
+    {0xE66EAF11BD360D2BULL, 0x135CEAEB2D28C0EBULL}, // 5^122
+    {0xE00A5AD62C839075ULL, 0x183425A5F872F126ULL}, // 5^123
+    {0x980CF18BB7A47493ULL, 0x1E412F0F768FAD70ULL}, // 5^124
+    {0x5F0816F752C6C8DCULL, 0x12E8BD69AA19CC66ULL}, // 5^125
+    {0xF6CA1CB527787B13ULL, 0x17A2ECC414A03F7FULL}, // 5^126
+    {0xF47CA3E2715699D7ULL, 0x1D8BA7F519C84F5FULL}, // 5^127
+    {0xF8CDE66D86D62026ULL, 0x127748F9301D319BULL}, // 5^128
+    {0xF7016008E88BA830ULL, 0x17151B377C247E02ULL}, // 5^129
+    {0xB4C1B80B22AE923CULL, 0x1CDA62055B2D9D83ULL}, // 5^130
+    {0x50F91306F5AD1B65ULL, 0x12087D4358FC8272ULL}, // 5^131
+    {0xE53757C8B318623FULL, 0x168A9C942F3BA30EULL}, // 5^132
+    {0x9E852DBADFDE7ACFULL, 0x1C2D43B93B0A8BD2ULL}, // 5^133
+    {0xA3133C94CBEB0CC1ULL, 0x119C4A53C4E69763ULL}, // 5^134
+    {0x8BD80BB9FEE5CFF1ULL, 0x16035CE8B6203D3CULL}, // 5^135
+    {0xAECE0EA87E9F43EEULL, 0x1B843422E3A84C8BULL}, // 5^136
+    {0x4D40C9294F238A75ULL, 0x1132A095CE492FD7ULL}, // 5^137
+    {0x2090FB73A2EC6D12ULL, 0x157F48BB41DB7BCDULL}, // 5^138
+    {0x68B53A508BA78856ULL, 0x1ADF1AEA12525AC0ULL}, // 5^139
+    {0x417144725748B536ULL, 0x10CB70D24B7378B8ULL}, // 5^140
+    {0x51CD958EED1AE283ULL, 0x14FE4D06DE5056E6ULL}, // 5^141
+    {0xE640FAF2A8619B24ULL, 0x1A3DE04895E46C9FULL}, // 5^142
+    {0xEFE89CD7A93D00F7ULL, 0x1066AC2D5DAEC3E3ULL}, // 5^143
+    {0xEBE2C40D938C4134ULL, 0x14805738B51A74DCULL}, // 5^144
+    {0x26DB7510F86F5181ULL, 0x19A06D06E2611214ULL}, // 5^145
+    {0x9849292A9B4592F1ULL, 0x100444244D7CAB4CULL}, // 5^146
+    {0xBE5B73754216F7ADULL, 0x1405552D60DBD61FULL}, // 5^147
+    {0xADF25052929CB598ULL, 0x1906AA78B912CBA7ULL}, // 5^148
+    {0x996EE4673743E2FFULL, 0x1F485516E7577E91ULL}, // 5^149
+    {0xFFE54EC0828A6DDFULL, 0x138D352E5096AF1AULL}, // 5^150
+    {0xBFDEA270A32D0957ULL, 0x18708279E4BC5AE1ULL}, // 5^151
+    {0x2FD64B0CCBF84BADULL, 0x1E8CA3185DEB719AULL}, // 5^152
+    {0x5DE5EEE7FF7B2F4CULL, 0x1317E5EF3AB32700ULL}, // 5^153
+    {0x755F6AA1FF59FB1FULL, 0x17DDDF6B095FF0C0ULL}, // 5^154
+    {0x92B7454A7F3079E7ULL, 0x1DD55745CBB7ECF0ULL}, // 5^155
+    {0x5BB28B4E8F7E4C30ULL, 0x12A5568B9F52F416ULL}, // 5^156
+    {0xF29F2E22335DDF3CULL, 0x174EAC2E8727B11BULL}, // 5^157
+    {0xEF46F9AAC035570BULL, 0x1D22573A28F19D62ULL}, // 5^158
+    {0xD58C5C0AB8215667ULL, 0x123576845997025DULL}, // 5^159
+    {0x4AEF730D6629AC01ULL, 0x16C2D4256FFCC2F5ULL}, // 5^160
+    {0x9DAB4FD0BFB41701ULL, 0x1C73892ECBFBF3B2ULL}, // 5^161
+    {0xA28B11E277D08E60ULL, 0x11C835BD3F7D784FULL}, // 5^162
+    {0x8B2DD65B15C4B1F9ULL, 0x163A432C8F5CD663ULL}, // 5^163
+    {0x6DF94BF1DB35DE77ULL, 0x1BC8D3F7B3340BFCULL}, // 5^164
+    {0xC4BBCF772901AB0AULL, 0x115D847AD000877DULL}, // 5^165
+    {0x35EAC354F34215CDULL, 0x15B4E5998400A95DULL}, // 5^166
+    {0x8365742A30129B40ULL, 0x1B221EFFE500D3B4ULL}, // 5^167
+    {0xD21F689A5E0BA108ULL, 0x10F5535FEF208450ULL}, // 5^168
+    {0x06A742C0F58E894AULL, 0x1532A837EAE8A565ULL}, // 5^169
+    {0x4851137132F22B9DULL, 0x1A7F5245E5A2CEBEULL}, // 5^170
+    {0xED32AC26BFD75B42ULL, 0x108F936BAF85C136ULL}, // 5^171
+    {0xA87F57306FCD3212ULL, 0x14B378469B673184ULL}, // 5^172
+    {0xD29F2CFC8BC07E97ULL, 0x19E056584240FDE5ULL}, // 5^173
+    {0xA3A37C1DD7584F1EULL, 0x102C35F729689EAFULL}, // 5^174
+    {0x8C8C5B254D2E62E6ULL, 0x14374374F3C2C65BULL}, // 5^175
+    {0x6FAF71EEA079FB9FULL, 0x1945145230B377F2ULL}, // 5^176
+    {0x0B9B4E6A48987A87ULL, 0x1F965966BCE055EFULL}, // 5^177
+    {0x674111026D5F4C94ULL, 0x13BDF7E0360C35B5ULL}, // 5^178
+    {0xC111554308B71FBAULL, 0x18AD75D8438F4322ULL}, // 5^179
+    {0x7155AA93CAE4E7A8ULL, 0x1ED8D34E547313EBULL}, // 5^180
+    {0x26D58A9C5ECF10C9ULL, 0x13478410F4C7EC73ULL}, // 5^181
+    {0xF08AED437682D4FBULL, 0x1819651531F9E78FULL}, // 5^182
+    {0xECADA89454238A3AULL, 0x1E1FBE5A7E786173ULL}, // 5^183
+    {0x73EC895CB4963664ULL, 0x12D3D6F88F0B3CE8ULL}, // 5^184
+    {0x90E7ABB3E1BBC3FDULL, 0x1788CCB6B2CE0C22ULL}, // 5^185
+    {0x352196A0DA2AB4FDULL, 0x1D6AFFE45F818F2BULL}, // 5^186
+    {0x0134FE24885AB11EULL, 0x1262DFEEBBB0F97BULL}, // 5^187
+    {0xC1823DADAA715D65ULL, 0x16FB97EA6A9D37D9ULL}, // 5^188
+    {0x31E2CD19150DB4BFULL, 0x1CBA7DE5054485D0ULL}, // 5^189
+    {0x1F2DC02FAD2890F7ULL, 0x11F48EAF234AD3A2ULL}, // 5^190
+    {0xA6F9303B9872B535ULL, 0x1671B25AEC1D888AULL}, // 5^191
+    {0x50B77C4A7E8F6282ULL, 0x1C0E1EF1A724EAADULL}, // 5^192
+    {0x5272ADAE8F199D91ULL, 0x1188D357087712ACULL}, // 5^193
+    {0x670F591A32E004F6ULL, 0x15EB082CCA94D757ULL}, // 5^194
+    {0x40D32F60BF980633ULL, 0x1B65CA37FD3A0D2DULL}, // 5^195
+    {0x4883FD9C77BF03E0ULL, 0x111F9E62FE44483CULL}, // 5^196
+    {0x5AA4FD0395AEC4D8ULL, 0x156785FBBDD55A4BULL}, // 5^197
+    {0x314E3C447B1A760EULL, 0x1AC1677AAD4AB0DEULL}, // 5^198
+    {0xDED0E5AACCF089C9ULL, 0x10B8E0ACAC4EAE8AULL}, // 5^199
+    {0x96851F15802CAC3BULL, 0x14E718D7D7625A2DULL}, // 5^200
+    {0xFC2666DAE037D74AULL, 0x1A20DF0DCD3AF0B8ULL}, // 5^201
+    {0x9D980048CC22E68EULL, 0x10548B68A044D673ULL}, // 5^202
+    {0x84FE005AFF2BA032ULL, 0x1469AE42C8560C10ULL}, // 5^203
+    {0xA63D8071BEF6883EULL, 0x198419D37A6B8F14ULL}, // 5^204
+    {0xCFCCE08E2EB42A4EULL, 0x1FE52048590672D9ULL}, // 5^205
+    {0x21E00C58DD309A70ULL, 0x13EF342D37A407C8ULL}, // 5^206
+    {0x2A580F6F147CC10DULL, 0x18EB0138858D09BAULL}, // 5^207
+    {0xB4EE134AD99BF150ULL, 0x1F25C186A6F04C28ULL}, // 5^208
+    {0x7114CC0EC80176D2ULL, 0x137798F428562F99ULL}, // 5^209
+    {0xCD59FF127A01D486ULL, 0x18557F31326BBB7FULL}, // 5^210
+    {0xC0B07ED7188249A8ULL, 0x1E6ADEFD7F06AA5FULL}, // 5^211
+    {0xD86E4F466F516E09ULL, 0x1302CB5E6F642A7BULL}, // 5^212
+    {0xCE89E3180B25C98BULL, 0x17C37E360B3D351AULL}, // 5^213
+    {0x822C5BDE0DEF3BEEULL, 0x1DB45DC38E0C8261ULL}, // 5^214
+    {0xF15BB96AC8B58575ULL, 0x1290BA9A38C7D17CULL}, // 5^215
+    {0x2DB2A7C57AE2E6D2ULL, 0x1734E940C6F9C5DCULL}, // 5^216
+    {0x391F51B6D99BA086ULL, 0x1D022390F8B83753ULL}, // 5^217
+    {0x03B3931248014454ULL, 0x1221563A9B732294ULL}, // 5^218
+    {0x04A077D6DA019569ULL, 0x16A9ABC9424FEB39ULL}, // 5^219
+    {0x45C895CC9081FAC3ULL, 0x1C5416BB92E3E607ULL}, // 5^220
+    {0x8B9D5D9FDA513CBAULL, 0x11B48E353BCE6FC4ULL}, // 5^221
+    {0xAE84B507D0E58BE8ULL, 0x1621B1C28AC20BB5ULL}, // 5^222
+    {0x1A25E249C51EEEE3ULL, 0x1BAA1E332D728EA3ULL}, // 5^223
+    {0xF057AD6E1B33554DULL, 0x114A52DFFC679925ULL}, // 5^224
+    {0x6C6D98C9A2002AA1ULL, 0x159CE797FB817F6FULL}, // 5^225
+    {0x4788FEFC0A803549ULL, 0x1B04217DFA61DF4BULL}, // 5^226
+    {0x0CB59F5D8690214EULL, 0x10E294EEBC7D2B8FULL}, // 5^227
+    {0xCFE30734E83429A1ULL, 0x151B3A2A6B9C7672ULL}, // 5^228
+    {0x83DBC9022241340AULL, 0x1A6208B50683940FULL}, // 5^229
+    {0xB2695DA15568C086ULL, 0x107D457124123C89ULL}, // 5^230
+    {0x1F03B509AAC2F0A7ULL, 0x149C96CD6D16CBACULL}, // 5^231
+    {0x26C4A24C1573ACD1ULL, 0x19C3BC80C85C7E97ULL}, // 5^232
+    {0x783AE56F8D684C03ULL, 0x101A55D07D39CF1EULL}, // 5^233
+    {0x16499ECB70C25F03ULL, 0x1420EB449C8842E6ULL}, // 5^234
+    {0x9BDC067E4CF2F6C4ULL, 0x19292615C3AA539FULL}, // 5^235
+    {0x82D3081DE02FB476ULL, 0x1F736F9B3494E887ULL}, // 5^236
+    {0xB1C3E512AC1DD0C9ULL, 0x13A825C100DD1154ULL}, // 5^237
+    {0xDE34DE57572544FCULL, 0x18922F31411455A9ULL}, // 5^238
+    {0x55C215ED2CEE963BULL, 0x1EB6BAFD91596B14ULL}, // 5^239
+    {0xB5994DB43C151DE5ULL, 0x133234DE7AD7E2ECULL}, // 5^240
+    {0xE2FFA1214B1A655EULL, 0x17FEC216198DDBA7ULL}, // 5^241
+    {0xDBBF89699DE0FEB6ULL, 0x1DFE729B9FF15291ULL}, // 5^242
+    {0x2957B5E202AC9F31ULL, 0x12BF07A143F6D39BULL}, // 5^243
+    {0xF3ADA35A8357C6FEULL, 0x176EC98994F48881ULL}, // 5^244
+    {0x70990C31242DB8BDULL, 0x1D4A7BEBFA31AAA2ULL}, // 5^245
+    {0x865FA79EB69C9376ULL, 0x124E8D737C5F0AA5ULL}, // 5^246
+    {0xE7F791866443B854ULL, 0x16E230D05B76CD4EULL}, // 5^247
+    {0xA1F575E7FD54A669ULL, 0x1C9ABD04725480A2ULL}, // 5^248
+    {0xA53969B0FE54E801ULL, 0x11E0B622C774D065ULL}, // 5^249
+    {0x0E87C41D3DEA2202ULL, 0x1658E3AB7952047FULL}, // 5^250
+    {0xD229B5248D64AA82ULL, 0x1BEF1C9657A6859EULL}, // 5^251
+    {0x435A1136D85EEA91ULL, 0x117571DDF6C81383ULL}, // 5^252
+    {0x143095848E76A536ULL, 0x15D2CE55747A1864ULL}, // 5^253
+    {0x193CBAE5B2144E83ULL, 0x1B4781EAD1989E7DULL}, // 5^254
+    {0x2FC5F4CF8F4CB112ULL, 0x110CB132C2FF630EULL}, // 5^255
+    {0xBBB77203731FDD56ULL, 0x154FDD7F73BF3BD1ULL}, // 5^256
+    {0x2AA54E844FE7D4ACULL, 0x1AA3D4DF50AF0AC6ULL}, // 5^257
+    {0xDAA75112B1F0E4EBULL, 0x10A6650B926D66BBULL}, // 5^258
+    {0xD15125575E6D1E26ULL, 0x14CFFE4E7708C06AULL}, // 5^259
+    {0x85A56EAD360865B0ULL, 0x1A03FDE214CAF085ULL}, // 5^260
+    {0x7387652C41C53F8EULL, 0x10427EAD4CFED653ULL}, // 5^261
+    {0x50693E7752368F71ULL, 0x14531E58A03E8BE8ULL}, // 5^262
+    {0x64838E1526C4334EULL, 0x1967E5EEC84E2EE2ULL}, // 5^263
+    {0xFDA4719A70754022ULL, 0x1FC1DF6A7A61BA9AULL}, // 5^264
+    {0xDE86C70086494815ULL, 0x13D92BA28C7D14A0ULL}, // 5^265
+    {0x162878C0A7DB9A1AULL, 0x18CF768B2F9C59C9ULL}, // 5^266
+    {0x5BB296F0D1D280A1ULL, 0x1F03542DFB83703BULL}, // 5^267
+    {0x194F9E5683239064ULL, 0x1362149CBD322625ULL}, // 5^268
+    {0x5FA385EC23EC747EULL, 0x183A99C3EC7EAFAEULL}, // 5^269
+    {0xF78C67672CE7919DULL, 0x1E494034E79E5B99ULL}, // 5^270
+    {0x3AB7C0A07C10BB02ULL, 0x12EDC82110C2F940ULL}, // 5^271
+    {0x4965B0C89B14E9C3ULL, 0x17A93A2954F3B790ULL}, // 5^272
+    {0x5BBF1CFAC1DA2433ULL, 0x1D9388B3AA30A574ULL}, // 5^273
+    {0xB957721CB92856A0ULL, 0x127C35704A5E6768ULL}, // 5^274
+    {0xE7AD4EA3E7726C48ULL, 0x171B42CC5CF60142ULL}, // 5^275
+    {0xA198A24CE14F075AULL, 0x1CE2137F74338193ULL}, // 5^276
+    {0x44FF65700CD16498ULL, 0x120D4C2FA8A030FCULL}, // 5^277
+    {0x563F3ECC1005BDBEULL, 0x16909F3B92C83D3BULL}, // 5^278
+    {0x2BCF0E7F14072D2EULL, 0x1C34C70A777A4C8AULL}, // 5^279
+    {0x5B61690F6C847C3DULL, 0x11A0FC668AAC6FD6ULL}, // 5^280
+    {0xF239C35347A59B4CULL, 0x16093B802D578BCBULL}, // 5^281
+    {0xEEC83428198F021FULL, 0x1B8B8A6038AD6EBEULL}, // 5^282
+    {0x553D20990FF96153ULL, 0x1137367C236C6537ULL}, // 5^283
+    {0x2A8C68BF53F7B9A8ULL, 0x1585041B2C477E85ULL}, // 5^284
+    {0x752F82EF28F5A812ULL, 0x1AE64521F7595E26ULL}, // 5^285
+    {0x093DB1D57999890BULL, 0x10CFEB353A97DAD8ULL}, // 5^286
+    {0x0B8D1E4AD7FFEB4EULL, 0x1503E602893DD18EULL}, // 5^287
+    {0x8E7065DD8DFFE622ULL, 0x1A44DF832B8D45F1ULL}, // 5^288
+    {0xF9063FAA78BFEFD5ULL, 0x106B0BB1FB384BB6ULL}, // 5^289
+    {0xB747CF9516EFEBCAULL, 0x1485CE9E7A065EA4ULL}, // 5^290
+    {0xE519C37A5CABE6BDULL, 0x19A742461887F64DULL}, // 5^291
+    {0xAF301A2C79EB7036ULL, 0x1008896BCF54F9F0ULL}, // 5^292
+    {0xDAFC20B798664C43ULL, 0x140AABC6C32A386CULL}, // 5^293
+    {0x11BB28E57E7FDF54ULL, 0x190D56B873F4C688ULL}, // 5^294
+    {0x1629F31EDE1FD72AULL, 0x1F50AC6690F1F82AULL}, // 5^295
+    {0x4DDA37F34AD3E67AULL, 0x13926BC01A973B1AULL}, // 5^296
+    {0xE150C5F01D88E019ULL, 0x187706B0213D09E0ULL}, // 5^297
+    {0x19A4F76C24EB181FULL, 0x1E94C85C298C4C59ULL}, // 5^298
+    {0xB0071AA39712EF13ULL, 0x131CFD3999F7AFB7ULL}, // 5^299
+    {0x9C08E14C7CD7AAD8ULL, 0x17E43C8800759BA5ULL}, // 5^300
+    {0x030B199F9C0D958EULL, 0x1DDD4BAA0093028FULL}, // 5^301
+    {0x61E6F003C1887D79ULL, 0x12AA4F4A405BE199ULL}, // 5^302
+    {0xBA60AC04B1EA9CD7ULL, 0x1754E31CD072D9FFULL}, // 5^303
+    {0xA8F8D705DE65440DULL, 0x1D2A1BE4048F907FULL}, // 5^304
+    {0xC99B8663AAFF4A88ULL, 0x123A516E82D9BA4FULL}, // 5^305
+    {0xBC0267FC95BF1D2AULL, 0x16C8E5CA239028E3ULL}, // 5^306
+    {0xAB0301FBBB2EE474ULL, 0x1C7B1F3CAC74331CULL}, // 5^307
+    {0xEAE1E13D54FD4EC9ULL, 0x11CCF385EBC89FF1ULL}, // 5^308
+    {0x659A598CAA3CA27BULL, 0x1640306766BAC7EEULL}, // 5^309
+    {0xFF00EFEFD4CBCB1AULL, 0x1BD03C81406979E9ULL}, // 5^310
+    {0x3F6095F5E4FF5EF0ULL, 0x116225D0C841EC32ULL}, // 5^311
+    {0xCF38BB735E3F36ACULL, 0x15BAAF44FA52673EULL}, // 5^312
+    {0x8306EA5035CF0457ULL, 0x1B295B1638E7010EULL}, // 5^313
+    {0x11E4527221A162B6ULL, 0x10F9D8EDE39060A9ULL}, // 5^314
+    {0x565D670EAA09BB64ULL, 0x15384F295C7478D3ULL}, // 5^315
+    {0x2BF4C0D2548C2A3DULL, 0x1A8662F3B3919708ULL}, // 5^316
+    {0x1B78F88374D79A66ULL, 0x1093FDD8503AFE65ULL}, // 5^317
+    {0x625736A4520D8100ULL, 0x14B8FD4E6449BDFEULL}, // 5^318
+    {0xFAED044D6690E140ULL, 0x19E73CA1FD5C2D7DULL}, // 5^319
+    {0xBCD422B0601A8CC8ULL, 0x103085E53E599C6EULL}, // 5^320
+    {0x6C092B5C78212FFAULL, 0x143CA75E8DF0038AULL}, // 5^321
+    {0x070B763396297BF8ULL, 0x194BD136316C046DULL}, // 5^322
+    {0x48CE53C07BB3DAF6ULL, 0x1F9EC583BDC70588ULL}, // 5^323
+    {0x2D80F4584D5068DAULL, 0x13C33B72569C6375ULL}, // 5^324
+    {0x78E1316E60A48310ULL, 0x18B40A4EEC437C52ULL}, // 5^325
+};
+
+// bitlength(5^e), for 0 <= e <= 3528.
+static int pow5Bits(int e) { return (int)(((uint32_t)e * 1217359) >> 19) + 1; }
+
+// floor(log10(2^e)), for 0 <= e <= 1650.
+static int log10Pow2(int e) { return (int)(((uint32_t)e * 78913) >> 18); }
+
+// floor(log10(5^e)), for 0 <= e <= 2620.
+static int log10Pow5(int e) { return (int)(((uint32_t)e * 732923) >> 20); }
+
+static bool multipleOfPow5(uint64_t value, int p) {
+  int count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count >= p;
+}
+
+static bool multipleOfPow2(uint64_t value, int p) {
+  return (value & ((1ULL << p) - 1)) == 0;
+}
+
+// (m * mul) >> shift, for shift >= 64, where mul is a 128-bit table entry.
+static uint64_t mulShift(uint64_t m, const uint64_t *mul, int shift) {
+  unsigned __int128 low = (unsigned __int128)m * mul[0];
+  unsigned __int128 high = (unsigned __int128)m * mul[1];
+  return (uint64_t)(((low >> 64) + high) >> (shift - 64));
+}
+
+/**
+ * @brief Finds the shortest `*digits` * 10^`*exp10` that rounds to the
+ * finite, non-zero double with the given IEEE fields.
+ */
+static void shortestDecimal(uint64_t ieeeMantissa, int ieeeExponent,
+                            uint64_t *digits, int *exp10) {
+  int e2;
+  uint64_t m2;
+  if (ieeeExponent == 0) {
+    e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+    m2 = ieeeMantissa;
+  } else {
+    e2 = ieeeExponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+    m2 = (1ULL << DOUBLE_MANTISSA_BITS) | ieeeMantissa;
+  }
+  // Round-half-even reading accepts the interval's bounds for even doubles.
+  bool acceptBounds = (m2 & 1) == 0;
+
+  // The double is mv / 4 * 2^e2 and the halfway points to its neighbours
+  // are mp and mm, closer below at the bottom of a binade.
+  uint64_t mv = 4 * m2;
+  int mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+  uint64_t mp = mv + 2;
+  uint64_t mm = mv - 1 - mmShift;
+
+  // Scale all three to vr, vp, vm by 10^-e10, truncating, and note whether
+  // the truncation dropped only zeros.
+  uint64_t vr, vp, vm;
+  int e10;
+  bool vmIsTrailingZeros = false;
+  bool vrIsTrailingZeros = false;
+  if (e2 >= 0) {
+    int q = log10Pow2(e2) - (e2 > 3);
+    e10 = q;
+    int shift = -e2 + q + POW5_INV_BITCOUNT + pow5Bits(q) - 1;
+    vr = mulShift(mv, pow5InvSplit[q], shift);
+    vp = mulShift(mp, pow5InvSplit[q], shift);
+    vm = mulShift(mm, pow5InvSplit[q], shift);
+    if (q <= 21) {
+      // At most one of mp, mv and mm can be a multiple of 5.
+      if (mv % 5 == 0) {
+        vrIsTrailingZeros = multipleOfPow5(mv, q);
+      } else if (acceptBounds) {
+        vmIsTrailingZeros = multipleOfPow5(mm, q);
+      } else {
+        vp -= multipleOfPow5(mp, q);
+      }
+    }
+  } else {
+    int q = log10Pow5(-e2) - (-e2 > 1);
+    e10 = q + e2;
+    int i = -e2 - q;
+    int shift = q - (pow5Bits(i) - POW5_BITCOUNT);
+    vr = mulShift(mv, pow5Split[i], shift);
+    vp = mulShift(mp, pow5Split[i], shift);
+    vm = mulShift(mm, pow5Split[i], shift);
+    if (q <= 1) {
+      // mv has at least two trailing zero bits, mp at least one.
+      vrIsTrailingZeros = true;
+      if (acceptBounds) {
+        vmIsTrailingZeros = mmShift == 1;
+      } else {
+        vp--;
+      }
+    } else if (q < 63) {
+      vrIsTrailingZeros = multipleOfPow2(mv, q);
+    }
+  }
+
+  // Drop digits while vm and vp still differ in what is left; vr tracks the
+  // correctly rounded value.
+  int removed = 0;
+  int lastRemovedDigit = 0;
+  uint64_t output;
+  if (vmIsTrailingZeros || vrIsTrailingZeros) {
+    // Rare: the bounds or the value itself are exact, so ties matter.
+    while (vp / 10 > vm / 10) {
+      vmIsTrailingZeros &= vm % 10 == 0;
+      vrIsTrailingZeros &= lastRemovedDigit == 0;
+      lastRemovedDigit = (int)(vr % 10);
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vmIsTrailingZeros) {
+      while (vm % 10 == 0) {
+        vrIsTrailingZeros &= lastRemovedDigit == 0;
+        lastRemovedDigit = (int)(vr % 10);
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
+    }
+    if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) {
+      lastRemovedDigit = 4; // Exactly halfway: round to even
+    }
+    output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) ||
+                   lastRemovedDigit >= 5);
+  } else {
+    bool roundUp = false;
+    if (vp / 100 > vm / 100) {
+      roundUp = vr % 100 >= 50;
+      vr /= 100;
+      vp /= 100;
+      vm /= 100;
+      removed += 2;
+    }
+    while (vp / 10 > vm / 10) {
+      roundUp = vr % 10 >= 5;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || roundUp);
+  }
+
+  *digits = output;
+  *exp10 = e10 + removed;
+}
+
+/**
+ * @brief Writes digits * 10^exp10 in decimal notation when its decimal
+ * exponent is from -6 to 20, in scientific notation (1.5e+300) otherwise.
+ */
+static int writeDecimal(char *out, uint64_t digits, int exp10) {
+  while (digits % 10 == 0) {
+    digits /= 10;
+    exp10++;
+  }
+
+  char buf[20];
+  int count = 0;
+  for (uint64_t rest = digits; rest > 0; rest /= 10) {
+    buf[sizeof(buf) - ++count] = (char)('0' + rest % 10);
+  }
+  const char *s = buf + sizeof(buf) - count;
+  // Where the decimal point goes, counted in digits from the first one.
+  int point = count + exp10;
+  int length = 0;
+
+  if (point >= count && point <= 21) {
+    memcpy(out, s, count);
+    length = count;
+    while (length < point) out[length++] = '0';
+  } else if (point > 0 && point <= 21) {
+    memcpy(out, s, point);
+    out[point] = '.';
+    memcpy(out + point + 1, s + point, count - point);
+    length = count + 1;
+  } else if (point > -6 && point <= 0) {
+    out[length++] = '0';
+    out[length++] = '.';
+    while (length < 2 - point) out[length++] = '0';
+    memcpy(out + length, s, count);
+    length += count;
+  } else {
+    out[length++] = s[0];
+    if (count > 1) {
+      out[length++] = '.';
+      memcpy(out + length, s + 1, count - 1);
+      length += count - 1;
+    }
+    int exponent = point - 1;
+    out[length++] = 'e';
+    out[length++] = exponent < 0 ? '-' : '+';
+    if (exponent < 0) exponent = -exponent;
+    if (exponent >= 100) out[length++] = (char)('0' + exponent / 100);
+    out[length++] = (char)('0' + exponent / 10 % 10);
+    out[length++] = (char)('0' + exponent % 10);
+  }
+  return length;
+}
+
+/**
+ * @brief Writes the shortest decimal that reads back as `value` into `out`,
+ * which must have room for NUMBER_MAX_LENGTH characters. Nothing depends on
+ * the C library or the locale, so the output is the same everywhere.
+ *
+ * @return Number of characters written; `out` is not terminated
+ */
+int formatNumber(double value, char *out) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t ieeeMantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+  int ieeeExponent = (int)(bits >> DOUBLE_MANTISSA_BITS) & 0x7FF;
+
+  int length = 0;
+  if (ieeeExponent == 0x7FF && ieeeMantissa != 0) {
+    memcpy(out, "nan", 3);
+    return 3;
+  }
+  if (bits >> 63) out[length++] = '-';
+  if (ieeeExponent == 0x7FF) {
+    memcpy(out + length, "inf", 3);
+    return length + 3;
+  }
+  if (ieeeExponent == 0 && ieeeMantissa == 0) {
+    out[length++] = '0';
+    return length;
+  }
+
+  // Integers below 2^53 are already their own shortest form.
+  double magnitude = value < 0 ? -value : value;
+  uint64_t digits;
+  int exp10 = 0;
+  if (magnitude < (double)MAX_EXACT_INTEGER &&
+      magnitude == (double)(uint64_t)magnitude) {
+    digits = (uint64_t)magnitude;
+  } else {
+    shortestDecimal(ieeeMantissa, ieeeExponent, &digits, &exp10);
+  }
+  return length + writeDecimal(out + length, digits, exp10);
+}
@@ -0,0 +1,12 @@
+#ifndef svm_number_h
+#define svm_number_h
+
+#include "common.h"
+
+// Longest output of formatNumber(), e.g. -1.2345678901234567e-308.
+#define NUMBER_MAX_LENGTH 32
+
+double parseNumber(const char *s, int length);
+int formatNumber(double value, char *out);
+
+#endif
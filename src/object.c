@@ -3,6 +3,9 @@
 #include "value.h"
 #include "vm.h"
 #include <string.h>
+// Slots a fiber's stack starts with; most bodies need only a few.
+#define FIBER_STACK_SIZE 8
+
 #define ALLOCATE_OBJ(vm, type, objectType)                                     \
   (type *)allocateObject(vm, sizeof(type), objectType)
 
@@ -11,6 +14,7 @@ static Obj *allocateObject(VM *vm, size_t size, ObjType type) {
   object->type = type;
 
   object->next = vm->objects;
+  vm->objects = object;
   return object;
 }
 
@@ -19,6 +23,7 @@ static ObjString *allocateString(VM *vm, char *chars, int length) {
   string->length = length;
   string->chars = chars;
   string->hash = hashString(chars, length);
+  string->external = false;
   mapInsert(&vm->strings, string, NIL_VAL());
   return string;
 }
@@ -34,9 +39,47 @@ ObjString *copyString(VM *vm, const char *chars, int length) {
   return allocateString(vm, heapChars, length);
 }
 
+/**
+ * @brief Wraps the `length` bytes at `chars` as a string without copying or
+ * hashing them. They must stay unchanged until `release(context)` is called,
+ * when the VM frees the string.
+ */
+ObjString *newExternalString(VM *vm, const char *chars, int length,
+                             void (*release)(void *context), void *context) {
+  ObjExternalString *external =
+      ALLOCATE_OBJ(vm, ObjExternalString, OBJ_STRING);
+  external->string.length = length;
+  external->string.chars = (char *)chars;
+  external->string.hash = 0;
+  external->string.external = true;
+  external->release = release;
+  external->context = context;
+  return &external->string;
+}
+
+/**
+ * @brief Creates a suspended fiber whose body starts at `ip`.
+ */
+ObjFiber *newFiber(VM *vm, uint8_t *ip) {
+  ObjFiber *fiber = ALLOCATE_OBJ(vm, ObjFiber, OBJ_FIBER);
+  fiber->state = FIBER_SUSPENDED;
+  fiber->run = vm->runs;
+  stackInitSized(&fiber->stack, FIBER_STACK_SIZE);
+  fiber->ip = ip;
+  fiber->caller = NULL;
+  fiber->callerStack = NULL;
+  fiber->callerIp = NULL;
+  return fiber;
+}
+
 void printObject(Value value) {
   switch (OBJ_TYPE(value)) {
-    case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+    case OBJ_STRING: {
+      ObjString *string = AS_STRING(value);
+      fwrite(string->chars, 1, string->length, stdout);
+      break;
+    }
+    case OBJ_FIBER: printf("<fiber>"); break;
   }
 }
 
@@ -47,7 +90,13 @@ bool valuesEqual(Value a, Value b) {
     case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_NIL: return true;
     case VAL_OBJ: {
-      return AS_OBJ(a) == AS_OBJ(b);
+      if (AS_OBJ(a) == AS_OBJ(b)) return true;
+      // Interned strings are equal only if they are the same object.
+      if (!IS_STRING(a) || !IS_STRING(b)) return false;
+      ObjString *x = AS_STRING(a);
+      ObjString *y = AS_STRING(b);
+      return (x->external || y->external) && x->length == y->length &&
+             memcmp(x->chars, y->chars, x->length) == 0;
     }
     default: return false;
   }
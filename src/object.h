@@ -4,8 +4,10 @@
 #define IS_STRING(value) (isObjType(value, OBJ_STRING))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define IS_FIBER(value) (isObjType(value, OBJ_FIBER))
+#define AS_FIBER(value) ((ObjFiber *)AS_OBJ(value))
 
-typedef enum { OBJ_STRING } ObjType;
+typedef enum { OBJ_STRING, OBJ_FIBER } ObjType;
 
 struct Obj {
   ObjType type;
@@ -15,14 +17,61 @@ struct Obj {
 struct ObjString {
   Obj obj;
   int length;
-  char *chars;
-  uint32_t hash;
+  char *chars;   // NUL-terminated unless the string is external
+  uint32_t hash; // Only computed for interned strings
+  bool external; // An ObjExternalString, never interned
+};
+
+/**
+ * @brief A string over memory the host owns, made in O(1) by
+ * newExternalString().
+ *
+ * Its bytes are neither copied nor hashed, and it is not interned, so it may
+ * equal an interned string without being the same object; valuesEqual()
+ * compares the characters when either side is external. Anything that needs
+ * it interned, like a snapshot, copies it then.
+ */
+typedef struct {
+  ObjString string;
+  void (*release)(void *context); // Called when the string is freed, if set
+  void *context;
+} ObjExternalString;
+
+typedef enum {
+  FIBER_SUSPENDED, // Spawned or yielded, waiting to be resumed
+  FIBER_RUNNING,   // Resumed, possibly resuming another fiber in turn
+  FIBER_DONE,      // Finished its body or hit a runtime error
+} FiberState;
+
+/**
+ * @brief A coroutine created by `spawn`.
+ *
+ * A fiber owns a value stack, which starts at FIBER_STACK_SIZE slots and
+ * doubles as it fills, and the point in its body it continues from. While it
+ * runs it also holds the stack and ip of whoever resumed it, which it hands
+ * back to on `yield`. Its body is code in the chunk that spawned it, so it
+ * can only be resumed while that chunk runs.
+ */
+struct ObjFiber {
+  Obj obj;
+  FiberState state;
+  uint32_t run; // vm->runs when spawned
+  Stack stack;  // Freed once the fiber is done
+  uint8_t *ip;
+  ObjFiber *caller; // The fiber that resumed it, or NULL for the script
+  Stack *callerStack;
+  uint8_t *callerIp;
 };
 
 ObjString *takeString(VM *vm, char *chars, int length);
 
 ObjString *copyString(VM *vm, const char *chars, int length);
 
+ObjString *newExternalString(VM *vm, const char *chars, int length,
+                             void (*release)(void *context), void *context);
+
+ObjFiber *newFiber(VM *vm, uint8_t *ip);
+
 static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
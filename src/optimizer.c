@@ -0,0 +1,551 @@
+#include "optimizer.h"
+#include "debug.h"
+#include "map.h"
+#include "memory.h"
+#include "object.h"
+#include <string.h>
+
+#define NO_NODE -1
+#define MAX_TEMPS (UINT8_MAX - 1)
+
+/*
+ * The optimizing tier lifts the single-pass compiler's bytecode back into
+ * one expression DAG per statement, rewrites the DAG and lowers it into a
+ * fresh code array for the same Chunk.
+ *
+ * A statement ends at OP_PRINT, OP_POP or OP_DEFINE_GLOBAL, the only
+ * instructions that consume a value without producing one. Within a
+ * statement:
+ *   - pure nodes are hash-consed, so repeated subexpressions and repeated
+ *     OP_GET_GLOBAL loads of the same name share a node;
+ *   - operators over constants are folded;
+ *   - globals last assigned a constant are replaced by that constant.
+ * Shared nodes that cannot raise a runtime error are evaluated once at the
+ * start of the statement, kept on the stack, copied with OP_PICK where used
+ * and dropped with OP_POPN. Other shared nodes are evaluated where they are
+ * used, so errors are reported in the order the unoptimized code would.
+ */
+
+typedef struct {
+  uint8_t op;  // OpCode; constants use OP_CONSTANT, OP_NIL, OP_TRUE, OP_FALSE
+  int operand; // Constant index, -1 for a folded value not in the table yet
+  Value value; // Constant value, or the name of a global
+  int a;
+  int b;
+  int uses;
+  int temp;  // Stack slot of a hoisted node above the statement base, or -1
+  bool pure; // No side effects and reads only values live at statement start
+} IrNode;
+
+typedef struct {
+  int length;
+  int capacity;
+  IrNode *values;
+} IrNodeArray;
+
+typedef struct {
+  int length;
+  int capacity;
+  int *values;
+} NodeStack;
+
+typedef struct {
+  int length;
+  int capacity;
+  ObjString **values;
+} NameArray;
+
+DECLARE_CONTAINER_FUNCTIONS(IrNode, IrNodeArray)
+DECLARE_CONTAINER_FUNCTIONS(int, NodeStack)
+DECLARE_CONTAINER_FUNCTIONS(ObjString *, NameArray)
+IMPLEMENT_CONTAINER_FUNCTIONS(IrNode, IrNodeArray)
+IMPLEMENT_CONTAINER_FUNCTIONS(int, NodeStack)
+IMPLEMENT_CONTAINER_FUNCTIONS(ObjString *, NameArray)
+
+typedef struct {
+  VM *vm;
+  Chunk *in;
+  Chunk out;
+  IrNodeArray nodes;
+  NodeStack stack;
+  NameArray written; // Globals assigned so far in the current statement
+  hashMap known;     // Globals currently holding a known constant
+  hashMap defined;   // Globals earlier statements of the chunk define
+  int depth;
+  int line;
+} Optimizer;
+
+static IrNode *node(Optimizer *opt, int idx) { return &opt->nodes.values[idx]; }
+
+static bool isConstantOp(uint8_t op) {
+  return op == OP_CONSTANT || op == OP_NIL || op == OP_TRUE || op == OP_FALSE;
+}
+
+static bool identical(Value a, Value b) {
+  if (a.type != b.type) return false;
+  switch (a.type) {
+    case VAL_NUMBER: {
+      double x = AS_NUMBER(a), y = AS_NUMBER(b);
+      return memcmp(&x, &y, sizeof(double)) == 0;
+    }
+    case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_NIL: return true;
+    case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+  }
+  return false;
+}
+
+static bool isFalsey(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static IrNode blankNode(uint8_t op) {
+  IrNode n;
+  n.op = op;
+  n.operand = -1;
+  n.value = NIL_VAL();
+  n.a = NO_NODE;
+  n.b = NO_NODE;
+  n.uses = 0;
+  n.temp = -1;
+  n.pure = true;
+  return n;
+}
+
+static int addNode(Optimizer *opt, IrNode n) {
+  if (n.pure) {
+    for (int i = 0; i < opt->nodes.length; i++) {
+      IrNode *m = node(opt, i);
+      if (m->pure && m->op == n.op && m->a == n.a && m->b == n.b &&
+          identical(m->value, n.value)) {
+        return i;
+      }
+    }
+  }
+  writeIrNodeArray(&opt->nodes, n);
+  return opt->nodes.length - 1;
+}
+
+static int constantNode(Optimizer *opt, Value value, int operand) {
+  uint8_t op = OP_CONSTANT;
+  if (IS_NIL(value)) op = OP_NIL;
+  if (IS_BOOL(value)) op = AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+
+  IrNode n = blankNode(op);
+  n.value = value;
+  n.operand = op == OP_CONSTANT ? operand : -1;
+  return addNode(opt, n);
+}
+
+static ObjString *globalName(Optimizer *opt, int operand) {
+  return AS_STRING(opt->in->constants.values[operand]);
+}
+
+static bool writtenInStatement(Optimizer *opt, ObjString *name) {
+  for (int i = 0; i < opt->written.length; i++) {
+    if (opt->written.values[i] == name) return true;
+  }
+  return false;
+}
+
+static int getGlobal(Optimizer *opt, int operand) {
+  ObjString *name = globalName(opt, operand);
+  Value value;
+  if (mapGet(&opt->known, name, &value)) return constantNode(opt, value, -1);
+
+  IrNode n = blankNode(OP_GET_GLOBAL);
+  n.operand = operand;
+  n.value = OBJ_VAL(name);
+  n.pure = !writtenInStatement(opt, name);
+  return addNode(opt, n);
+}
+
+static void recordStore(Optimizer *opt, ObjString *name, int value) {
+  IrNode *v = node(opt, value);
+  if (isConstantOp(v->op)) {
+    mapInsert(&opt->known, name, v->value);
+  } else {
+    mapDelete(&opt->known, name);
+  }
+}
+
+static int setGlobal(Optimizer *opt, int operand, int value) {
+  ObjString *name = globalName(opt, operand);
+  recordStore(opt, name, value);
+  writeNameArray(&opt->written, name);
+
+  IrNode n = blankNode(OP_SET_GLOBAL);
+  n.operand = operand;
+  n.a = value;
+  n.pure = false;
+  return addNode(opt, n);
+}
+
+/**
+ * @brief Evaluates an operator over constants with the VM's semantics.
+ *
+ * @return false when the operation would be a runtime error, which is left
+ * in place to be raised at run time
+ */
+static bool fold(Optimizer *opt, uint8_t op, Value a, Value b, Value *out) {
+  op = genericOp(op); // Unchecked forms fold like the generic ones
+  switch (op) {
+    case OP_NEGATE:
+      if (!IS_NUMBER(a)) return false;
+      *out = NUMBER_VAL(-AS_NUMBER(a));
+      return true;
+    case OP_NOT: *out = BOOL_VAL(isFalsey(a)); return true;
+    case OP_EQUAL: *out = BOOL_VAL(valuesEqual(a, b)); return true;
+    case OP_ADD:
+      if (IS_STRING(a) && IS_STRING(b)) {
+        ObjString *x = AS_STRING(a);
+        ObjString *y = AS_STRING(b);
+        int length = x->length + y->length;
+        char *chars = ALLOCATE(char, length + 1);
+        memcpy(chars, x->chars, x->length);
+        memcpy(chars + x->length, y->chars, y->length);
+        chars[length] = '\0';
+        *out = OBJ_VAL(takeString(opt->vm, chars, length));
+        return true;
+      }
+      break;
+    default: break;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+  double x = AS_NUMBER(a), y = AS_NUMBER(b);
+  switch (op) {
+    case OP_ADD: *out = NUMBER_VAL(x + y); return true;
+    case OP_SUBTRACT: *out = NUMBER_VAL(x - y); return true;
+    case OP_MULTIPLY: *out = NUMBER_VAL(x * y); return true;
+    case OP_DIVIDE: *out = NUMBER_VAL(x / y); return true;
+    case OP_GREATER: *out = BOOL_VAL(x > y); return true;
+    case OP_LESS: *out = BOOL_VAL(x < y); return true;
+    default: return false;
+  }
+}
+
+static int operatorNode(Optimizer *opt, uint8_t op, int a, int b) {
+  IrNode *x = node(opt, a);
+  IrNode *y = b == NO_NODE ? NULL : node(opt, b);
+  Value folded;
+
+  if (isConstantOp(x->op) && (y == NULL || isConstantOp(y->op)) &&
+      fold(opt, op, x->value, y == NULL ? NIL_VAL() : y->value, &folded)) {
+    return constantNode(opt, folded, -1);
+  }
+
+  IrNode n = blankNode(op);
+  n.a = a;
+  n.b = b;
+  n.pure = x->pure && (y == NULL || y->pure);
+  return addNode(opt, n);
+}
+
+static void push(Optimizer *opt, int idx) { writeNodeStack(&opt->stack, idx); }
+
+static int pop(Optimizer *opt) {
+  return opt->stack.values[--opt->stack.length];
+}
+
+static void emit(Optimizer *opt, uint8_t byte) {
+  writeChunk(&opt->out, byte, opt->line);
+}
+
+static bool emitConstant(Optimizer *opt, IrNode *n) {
+  if (n->operand < 0) {
+    n->operand = addConstant(opt->in, n->value);
+    if (n->operand > UINT16_MAX) return false;
+  }
+  if (n->operand <= UINT8_MAX) {
+    emit(opt, OP_CONSTANT);
+    emit(opt, (uint8_t)n->operand);
+  } else {
+    emit(opt, OP_CONSTANT_LONG);
+    emit(opt, (uint8_t)(n->operand & 0xFF));
+    emit(opt, (uint8_t)(n->operand >> 8));
+  }
+  return true;
+}
+
+static bool emitNode(Optimizer *opt, int idx, bool useTemp) {
+  IrNode *n = node(opt, idx);
+
+  if (useTemp && n->temp >= 0) {
+    int distance = opt->depth - 1 - n->temp;
+    if (distance > UINT8_MAX) return false;
+    emit(opt, OP_PICK);
+    emit(opt, (uint8_t)distance);
+    opt->depth++;
+    return true;
+  }
+
+  switch (n->op) {
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE: emit(opt, n->op); opt->depth++; return true;
+    case OP_CONSTANT: opt->depth++; return emitConstant(opt, n);
+    case OP_GET_GLOBAL:
+      emit(opt, OP_GET_GLOBAL);
+      emit(opt, (uint8_t)n->operand);
+      opt->depth++;
+      return true;
+    case OP_SET_GLOBAL:
+      if (!emitNode(opt, n->a, true)) return false;
+      emit(opt, OP_SET_GLOBAL);
+      emit(opt, (uint8_t)n->operand);
+      return true;
+    default: break;
+  }
+
+  if (!emitNode(opt, n->a, true)) return false;
+  if (n->b != NO_NODE) {
+    if (!emitNode(opt, n->b, true)) return false;
+    opt->depth--;
+  }
+  emit(opt, n->op);
+  return true;
+}
+
+static void countUses(Optimizer *opt, int idx) {
+  IrNode *n = node(opt, idx);
+  if (n->uses++ > 0) return;
+  if (n->a != NO_NODE) countUses(opt, n->a);
+  if (n->b != NO_NODE) countUses(opt, n->b);
+}
+
+/**
+ * @brief Whether evaluating the node can raise a runtime error. Globals
+ * exist from their definition on, so a load of one the VM already has, or
+ * that an earlier statement of this straight-line chunk defines, cannot.
+ */
+static bool canFail(Optimizer *opt, int idx) {
+  IrNode *n = node(opt, idx);
+  Value value;
+  switch (n->op) {
+    case OP_CONSTANT:
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE: return false;
+    case OP_GET_GLOBAL: {
+      ObjString *name = AS_STRING(n->value);
+      return !mapGet(&opt->vm->globals, name, &value) &&
+             !mapGet(&opt->defined, name, &value);
+    }
+    // These accept any operands, or were only emitted for numbers.
+    case OP_NOT:
+    case OP_EQUAL:
+    case OP_NEGATE_N:
+    case OP_ADD_NN:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE_NN:
+    case OP_LESS_NN:
+    case OP_GREATER_NN:
+      return canFail(opt, n->a) || (n->b != NO_NODE && canFail(opt, n->b));
+    default: return true;
+  }
+}
+
+/**
+ * @brief Lowers one statement. Shared pure nodes are hoisted into stack
+ * temporaries when `hoist` is set.
+ *
+ * @return false if an operand does not fit its encoding
+ */
+static bool lowerStatement(Optimizer *opt, uint8_t sink, int operand, int root,
+                           bool hoist) {
+  int temps = 0;
+  opt->depth = 0;
+
+  for (int i = 0; hoist && i < opt->nodes.length && temps < MAX_TEMPS; i++) {
+    IrNode *n = node(opt, i);
+    if (n->uses < 2 || !n->pure || isConstantOp(n->op) || canFail(opt, i)) {
+      continue;
+    }
+
+    if (!emitNode(opt, i, true)) return false;
+    node(opt, i)->temp = temps++;
+  }
+
+  if (!emitNode(opt, root, true)) return false;
+
+  switch (sink) {
+    case OP_PRINT:
+      emit(opt, OP_PRINT);
+      break;
+    case OP_DEFINE_GLOBAL:
+      emit(opt, OP_DEFINE_GLOBAL);
+      emit(opt, (uint8_t)operand);
+      break;
+    case OP_POP:
+      if (temps > 0) {
+        emit(opt, OP_POPN);
+        emit(opt, (uint8_t)(temps + 1));
+        return true;
+      }
+      emit(opt, OP_POP);
+      break;
+  }
+
+  if (temps > 0) {
+    emit(opt, OP_POPN);
+    emit(opt, (uint8_t)temps);
+  }
+  return true;
+}
+
+static bool endStatement(Optimizer *opt, uint8_t sink, int operand) {
+  int root = pop(opt);
+  if (opt->stack.length != 0) return false;
+
+  if (sink == OP_DEFINE_GLOBAL) {
+    recordStore(opt, globalName(opt, operand), root);
+  }
+  countUses(opt, root);
+
+  int codeLength = opt->out.length;
+  int linesLength = opt->out.lines.length;
+  if (!lowerStatement(opt, sink, operand, root, true)) {
+    opt->out.length = codeLength;
+    opt->out.lines.length = linesLength;
+    for (int i = 0; i < opt->nodes.length; i++) node(opt, i)->temp = -1;
+    if (!lowerStatement(opt, sink, operand, root, false)) return false;
+  }
+
+  if (sink == OP_DEFINE_GLOBAL) {
+    mapInsert(&opt->defined, globalName(opt, operand), NIL_VAL());
+  }
+  opt->nodes.length = 0;
+  opt->written.length = 0;
+  return true;
+}
+
+static bool lift(Optimizer *opt) {
+  Chunk *in = opt->in;
+
+  for (int offset = 0; offset < in->length;) {
+    uint8_t op = in->code[offset];
+    opt->line = getLine(&in->lines, offset);
+
+    switch (op) {
+      case OP_CONSTANT:
+        push(opt, constantNode(opt, in->constants.values[in->code[offset + 1]],
+                               in->code[offset + 1]));
+        offset += 2;
+        break;
+      case OP_CONSTANT_LONG: {
+        int idx = in->code[offset + 1] | (in->code[offset + 2] << 8);
+        push(opt, constantNode(opt, in->constants.values[idx], idx));
+        offset += 3;
+        break;
+      }
+      case OP_NIL: push(opt, constantNode(opt, NIL_VAL(), -1)); offset++; break;
+      case OP_TRUE:
+        push(opt, constantNode(opt, BOOL_VAL(true), -1));
+        offset++;
+        break;
+      case OP_FALSE:
+        push(opt, constantNode(opt, BOOL_VAL(false), -1));
+        offset++;
+        break;
+      case OP_NEGATE:
+      case OP_NEGATE_N:
+      case OP_NOT: {
+        int a = pop(opt);
+        push(opt, operatorNode(opt, op, a, NO_NODE));
+        offset++;
+        break;
+      }
+      case OP_ADD:
+      case OP_SUBTRACT:
+      case OP_MULTIPLY:
+      case OP_DIVIDE:
+      case OP_EQUAL:
+      case OP_GREATER:
+      case OP_LESS:
+      case OP_ADD_NN:
+      case OP_SUBTRACT_NN:
+      case OP_MULTIPLY_NN:
+      case OP_DIVIDE_NN:
+      case OP_LESS_NN:
+      case OP_GREATER_NN: {
+        int b = pop(opt);
+        int a = pop(opt);
+        push(opt, operatorNode(opt, op, a, b));
+        offset++;
+        break;
+      }
+      case OP_GET_GLOBAL:
+        push(opt, getGlobal(opt, in->code[offset + 1]));
+        offset += 2;
+        break;
+      case OP_SET_GLOBAL: {
+        int value = pop(opt);
+        push(opt, setGlobal(opt, in->code[offset + 1], value));
+        offset += 2;
+        break;
+      }
+      case OP_DEFINE_GLOBAL:
+        if (!endStatement(opt, op, in->code[offset + 1])) return false;
+        offset += 2;
+        break;
+      case OP_PRINT:
+      case OP_POP:
+        if (!endStatement(opt, op, 0)) return false;
+        offset++;
+        break;
+      case OP_RETURN:
+        if (opt->stack.length != 0) return false;
+        emit(opt, OP_RETURN);
+        offset++;
+        break;
+      default: return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Rewrites `chunk` with the optimizing tier.
+ *
+ * The chunk keeps its constant table, which may gain folded values. If it
+ * contains an instruction the tier does not model, the code is left as it
+ * was.
+ *
+ * @return true if the code was replaced
+ */
+bool optimizeChunk(VM *vm, Chunk *chunk) {
+  Optimizer opt;
+  opt.vm = vm;
+  opt.in = chunk;
+  initChunk(&opt.out);
+  initIrNodeArray(&opt.nodes);
+  initNodeStack(&opt.stack);
+  initNameArray(&opt.written);
+  mapInit(&opt.known);
+  mapInit(&opt.defined);
+
+  bool ok = lift(&opt);
+  if (ok) {
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    freeLineStartArray(&chunk->lines);
+    chunk->code = opt.out.code;
+    chunk->length = opt.out.length;
+    chunk->capacity = opt.out.capacity;
+    chunk->lines = opt.out.lines;
+#ifdef DEBUG_PRINT_CODE
+    disassembleChunk(chunk, "optimized");
+#endif
+  } else {
+    FREE_ARRAY(uint8_t, opt.out.code, opt.out.capacity);
+    freeLineStartArray(&opt.out.lines);
+  }
+
+  freeIrNodeArray(&opt.nodes);
+  freeNodeStack(&opt.stack);
+  freeNameArray(&opt.written);
+  mapReset(&opt.known);
+  mapReset(&opt.defined);
+  return ok;
+}
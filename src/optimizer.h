@@ -0,0 +1,9 @@
+#ifndef svm_optimizer_h
+#define svm_optimizer_h
+
+#include "chunk.h"
+#include "vm.h"
+
+bool optimizeChunk(VM *vm, Chunk *chunk);
+
+#endif
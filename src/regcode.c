@@ -0,0 +1,256 @@
+#include "regcode.h"
+#include "memory.h"
+#include "object.h"
+#include <string.h>
+
+/*
+ * Register backend. Translates a compiled chunk into three-address code by
+ * walking it once with a symbolic stack: `src[i]` is the register currently
+ * holding stack slot i, which is i itself once the value has been stored
+ * there. Pushing a local, a picked slot or a constant only records its
+ * register, so `a = b + c` becomes one ADD reading b and c directly and
+ * writing a. Wherever control flow joins, every slot is first moved home so
+ * all paths agree on where values live.
+ */
+
+IMPLEMENT_CONTAINER_FUNCTIONS(RegInstr, RegInstrArray)
+
+typedef struct {
+  Chunk *chunk;
+  RegCode *out;
+  int *src;
+  int depth;
+  int retarget; // Instruction that just wrote the top slot, or -1
+} Translator;
+
+static int emit(Translator *t, RegOp op, int a, int b, int c, int offset) {
+  RegInstr instr;
+  memset(&instr, 0, sizeof(instr));
+  instr.op = op;
+  instr.a = (uint16_t)a;
+  instr.b = (uint16_t)b;
+  instr.c = (uint16_t)c;
+  instr.offset = offset;
+  writeRegInstrArray(&t->out->code, instr);
+  t->retarget = -1;
+  return t->out->code.length - 1;
+}
+
+static void push(Translator *t, int reg) { t->src[t->depth++] = reg; }
+
+static int pop(Translator *t) { return t->src[--t->depth]; }
+
+static void materialize(Translator *t, int slot, int offset) {
+  if (t->src[slot] == slot) return;
+  emit(t, ROP_MOVE, slot, t->src[slot], 0, offset);
+  t->src[slot] = slot;
+}
+
+static void materializeAll(Translator *t, int offset) {
+  for (int slot = 0; slot < t->depth; slot++) materialize(t, slot, offset);
+}
+
+// Emits an instruction writing the new top slot, which a following
+// OP_SET_LOCAL may redirect straight into the local.
+static void emitResult(Translator *t, RegOp op, int b, int c, int offset) {
+  int dst = t->depth;
+  int index = emit(t, op, dst, b, c, offset);
+  push(t, dst);
+  t->retarget = index;
+}
+
+static void binary(Translator *t, RegOp op, int offset) {
+  int c = pop(t);
+  int b = pop(t);
+  emitResult(t, op, b, c, offset);
+}
+
+static void unary(Translator *t, RegOp op, int offset) {
+  int b = pop(t);
+  emitResult(t, op, b, 0, offset);
+}
+
+static void setLocal(Translator *t, int slot, int offset) {
+  int top = t->depth - 1;
+  int value = t->src[top];
+  if (value == slot) return;
+
+  bool clobbers = false;
+  for (int i = slot + 1; i < top; i++) {
+    if (t->src[i] == slot) clobbers = true;
+  }
+
+  RegInstr *last =
+      t->retarget >= 0 ? &t->out->code.values[t->retarget] : NULL;
+  if (!clobbers && last != NULL && value == top && last->a == top) {
+    last->a = (uint16_t)slot;
+    t->retarget = -1;
+  } else {
+    // Anything still reading the old value must get its own copy first.
+    for (int i = slot + 1; i < top; i++) {
+      if (t->src[i] == slot) materialize(t, i, offset);
+    }
+    emit(t, ROP_MOVE, slot, value, 0, offset);
+  }
+  t->src[slot] = slot;
+  t->src[top] = slot;
+}
+
+static void jump(Translator *t, RegOp op, int a, int b, int c, int offset) {
+  materializeAll(t, offset);
+  int index = emit(t, op, a, b, c, offset);
+  // The bytecode offset for now; resolved once every label is known.
+  t->out->code.values[index].as.target = jumpTarget(t->chunk, offset);
+}
+
+static bool translate(Translator *t, int offset) {
+  Chunk *chunk = t->chunk;
+  uint8_t *ip = &chunk->code[offset];
+  int constants = t->out->frameSize;
+  int literals = constants + chunk->constants.length;
+
+  switch (*ip) {
+    case OP_NEGATE_N: unary(t, ROP_NEGATE_N, offset); return true;
+    case OP_ADD_NN: binary(t, ROP_ADD_NN, offset); return true;
+    case OP_SUBTRACT_NN: binary(t, ROP_SUBTRACT_NN, offset); return true;
+    case OP_MULTIPLY_NN: binary(t, ROP_MULTIPLY_NN, offset); return true;
+    case OP_DIVIDE_NN: binary(t, ROP_DIVIDE_NN, offset); return true;
+    case OP_LESS_NN: binary(t, ROP_LESS_NN, offset); return true;
+    case OP_GREATER_NN: binary(t, ROP_GREATER_NN, offset); return true;
+  }
+
+  switch (genericOp(*ip)) {
+    case OP_RETURN: emit(t, ROP_RETURN, 0, 0, 0, offset); return true;
+    case OP_NEGATE: unary(t, ROP_NEGATE, offset); return true;
+    case OP_NOT: unary(t, ROP_NOT, offset); return true;
+    case OP_ADD: binary(t, ROP_ADD, offset); return true;
+    case OP_SUBTRACT: binary(t, ROP_SUBTRACT, offset); return true;
+    case OP_MULTIPLY: binary(t, ROP_MULTIPLY, offset); return true;
+    case OP_DIVIDE: binary(t, ROP_DIVIDE, offset); return true;
+    case OP_EQUAL: binary(t, ROP_EQUAL, offset); return true;
+    case OP_GREATER: binary(t, ROP_GREATER, offset); return true;
+    case OP_LESS: binary(t, ROP_LESS, offset); return true;
+    case OP_CONSTANT: push(t, constants + ip[1]); return true;
+    case OP_CONSTANT_LONG:
+      push(t, constants + (ip[1] | (ip[2] << 8)));
+      return true;
+    case OP_NIL: push(t, literals); return true;
+    case OP_TRUE: push(t, literals + 1); return true;
+    case OP_FALSE: push(t, literals + 2); return true;
+    case OP_PRINT: emit(t, ROP_PRINT, pop(t), 0, 0, offset); return true;
+    case OP_POP: t->depth--; return true;
+    case OP_POPN: t->depth -= ip[1]; return true;
+    case OP_PICK: push(t, t->src[t->depth - 1 - ip[1]]); return true;
+    case OP_GET_LOCAL: push(t, t->src[ip[1]]); return true;
+    case OP_SET_LOCAL: setLocal(t, ip[1], offset); return true;
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL: {
+      ObjString *name = AS_STRING(chunk->constants.values[ip[1]]);
+      uint8_t op = genericOp(*ip);
+      if (op == OP_DEFINE_GLOBAL) {
+        emit(t, ROP_DEFINE_GLOBAL, pop(t), 0, 0, offset);
+      } else if (op == OP_GET_GLOBAL) {
+        emitResult(t, ROP_GET_GLOBAL, 0, 0, offset);
+      } else {
+        emit(t, ROP_SET_GLOBAL, t->src[t->depth - 1], 0, 0, offset);
+      }
+      RegInstr *instr = &t->out->code.values[t->out->code.length - 1];
+      instr->as.name = name;
+      return true;
+    }
+    case OP_JUMP: jump(t, ROP_JUMP, 0, 0, 0, offset); return true;
+    case OP_LOOP: jump(t, ROP_LOOP, 0, 0, 0, offset); return true;
+    case OP_JUMP_IF_FALSE:
+      jump(t, ROP_JUMP_IF_FALSE, t->depth - 1, 0, 0, offset);
+      return true;
+    case OP_JUMP_IF_TRUE:
+      jump(t, ROP_JUMP_IF_TRUE, t->depth - 1, 0, 0, offset);
+      return true;
+    case OP_JUMP_IF_FALSE_POP:
+      jump(t, ROP_JUMP_IF_FALSE, pop(t), 0, 0, offset);
+      return true;
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER: {
+      int c = pop(t);
+      int b = pop(t);
+      RegOp op = ROP_JUMP_IF_LESS + (*ip - OP_JUMP_IF_LESS);
+      jump(t, op, 0, b, c, offset);
+      return true;
+    }
+    default: return false; // OP_MODULO has no implementation to translate
+  }
+}
+
+/**
+ * @brief Translates `chunk` into register code.
+ *
+ * @return false if the chunk's stack use cannot be worked out, it uses an
+ * instruction the register machine lacks, or it needs more registers than
+ * an operand can name
+ */
+bool compileRegisters(Chunk *chunk, RegCode *out) {
+  int *depths = ALLOCATE(int, chunk->length);
+  bool *targets = ALLOCATE(bool, chunk->length);
+  int maxDepth;
+  bool ok = analyzeStack(chunk, depths, targets, &maxDepth);
+
+  initRegInstrArray(&out->code);
+  out->frameSize = maxDepth;
+  out->registerCount = maxDepth + chunk->constants.length + 3;
+  ok = ok && out->registerCount <= UINT16_MAX + 1;
+
+  Translator t;
+  t.chunk = chunk;
+  t.out = out;
+  t.src = ALLOCATE(int, maxDepth + 1);
+  t.depth = 0;
+  t.retarget = -1;
+
+  // `depths` is reused to map bytecode offsets to instruction indices.
+  int *labels = depths;
+  bool reachable = true;
+  for (int offset = 0; offset < chunk->length && ok;
+       offset += instructionLength(chunk->code[offset])) {
+    if (!reachable) {
+      t.depth = depths[offset];
+      for (int slot = 0; slot < t.depth; slot++) t.src[slot] = slot;
+    }
+    if (targets[offset]) {
+      materializeAll(&t, offset);
+      t.retarget = -1;
+    }
+    labels[offset] = out->code.length;
+
+    ok = translate(&t, offset);
+    uint8_t op = chunk->code[offset];
+    reachable = op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+  }
+
+  for (int i = 0; i < out->code.length && ok; i++) {
+    RegInstr *instr = &out->code.values[i];
+    if (instr->op >= ROP_JUMP && instr->op <= ROP_LOOP) {
+      instr->as.target = labels[instr->as.target];
+    }
+  }
+
+  FREE_ARRAY(int, t.src, maxDepth + 1);
+  FREE_ARRAY(bool, targets, chunk->length);
+  FREE_ARRAY(int, depths, chunk->length);
+  if (!ok) freeRegCode(out);
+  return ok;
+}
+
+void freeRegCode(RegCode *code) { freeRegInstrArray(&code->code); }
+
+// Fills the registers above the frame with the constants they stand for.
+void loadRegisterConstants(Chunk *chunk, RegCode *code, Value *registers) {
+  Value *constants = registers + code->frameSize;
+  int count = chunk->constants.length;
+  memcpy(constants, chunk->constants.values, sizeof(Value) * count);
+  constants[count] = NIL_VAL();
+  constants[count + 1] = BOOL_VAL(true);
+  constants[count + 2] = BOOL_VAL(false);
+}
@@ -0,0 +1,77 @@
+#ifndef svm_regcode_h
+#define svm_regcode_h
+
+#include "chunk.h"
+
+/**
+ * @brief Three-address instructions of the register machine.
+ *
+ * `a` is the destination (or the only operand), `b` and `c` are sources.
+ * Register i of the first `frameSize` is stack slot i, so locals keep their
+ * slot numbers; the registers above them hold the chunk's constants.
+ */
+typedef enum {
+  ROP_MOVE,          // a = b
+  ROP_NEGATE,        // a = -b
+  ROP_NOT,           // a = !b
+  ROP_ADD,           // a = b + c
+  ROP_SUBTRACT,      // a = b - c
+  ROP_MULTIPLY,      // a = b * c
+  ROP_DIVIDE,        // a = b / c
+  ROP_EQUAL,         // a = b == c
+  ROP_GREATER,       // a = b > c
+  ROP_LESS,          // a = b < c
+  ROP_PRINT,         // print a
+  ROP_DEFINE_GLOBAL, // name = a
+  ROP_GET_GLOBAL,    // a = name
+  ROP_SET_GLOBAL,    // name = a
+  ROP_JUMP,          // goto target
+  ROP_JUMP_IF_FALSE, // if (!a) goto target
+  ROP_JUMP_IF_TRUE,  // if (a) goto target
+  ROP_JUMP_IF_LESS,  // if (b < c) goto target
+  ROP_JUMP_IF_NOT_LESS,
+  ROP_JUMP_IF_GREATER,
+  ROP_JUMP_IF_NOT_GREATER,
+  ROP_LOOP, // goto target, counted as a backedge
+  ROP_RETURN,
+  // Unchecked forms of the compiler's proved-number instructions.
+  ROP_NEGATE_N,
+  ROP_ADD_NN,
+  ROP_SUBTRACT_NN,
+  ROP_MULTIPLY_NN,
+  ROP_DIVIDE_NN,
+  ROP_LESS_NN,
+  ROP_GREATER_NN,
+} RegOp;
+
+typedef struct {
+  uint8_t op;
+  uint16_t a, b, c;
+  int offset; // Bytecode offset this came from, for errors and tracing
+  union {
+    ObjString *name; // Global instructions
+    int target;      // Jumps: index of the instruction to go to
+  } as;
+  mapObject *entry; // Cached global entry, valid while `version` matches
+  uint32_t version;
+} RegInstr;
+
+typedef struct {
+  int length;
+  int capacity;
+  RegInstr *values;
+} RegInstrArray;
+
+DECLARE_CONTAINER_FUNCTIONS(RegInstr, RegInstrArray);
+
+typedef struct {
+  RegInstrArray code;
+  int frameSize;     // Registers standing for stack slots
+  int registerCount; // frameSize plus one per constant, nil, true and false
+} RegCode;
+
+bool compileRegisters(Chunk *chunk, RegCode *out);
+void freeRegCode(RegCode *code);
+void loadRegisterConstants(Chunk *chunk, RegCode *code, Value *registers);
+
+#endif
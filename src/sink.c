@@ -0,0 +1,121 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sink.h"
+#include "number.h"
+#include "object.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Sets up a sink writing to `fd`, or capturing in memory if `fd` is
+ * -1. Output to a terminal is flushed line by line, anything else only when
+ * the buffer fills or is flushed.
+ */
+void sinkInit(Sink *sink, int fd) {
+  sink->buffer = NULL;
+  sink->length = 0;
+  sink->capacity = 0;
+  sink->fd = fd;
+  sink->flush = fd >= 0 && isatty(fd) ? FLUSH_LINE : FLUSH_FULL;
+}
+
+void sinkFree(Sink *sink) {
+  sinkFlush(sink);
+  FREE_ARRAY(char, sink->buffer, sink->capacity);
+  sink->buffer = NULL;
+  sink->length = 0;
+  sink->capacity = 0;
+}
+
+static void writeAll(int fd, const char *chars, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, chars, length);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return; // Nowhere to report it; the output is dropped
+    }
+    chars += written;
+    length -= written;
+  }
+}
+
+void sinkFlush(Sink *sink) {
+  if (sink->fd < 0 || sink->length == 0) return;
+  writeAll(sink->fd, sink->buffer, sink->length);
+  sink->length = 0;
+}
+
+// Makes room for `length` more bytes, flushing first if there is a file.
+static void reserve(Sink *sink, size_t length) {
+  if (sink->capacity - sink->length >= length) return;
+  sinkFlush(sink);
+  if (sink->capacity - sink->length >= length) return;
+
+  size_t capacity = sink->fd >= 0 ? SINK_BUFFER_SIZE : 256;
+  while (capacity < sink->length + length) capacity *= 2;
+  GROW_ARRAY(char, sink->buffer, sink->capacity, capacity);
+  sink->capacity = capacity;
+}
+
+void sinkWrite(Sink *sink, const char *chars, size_t length) {
+  if (sink->fd >= 0 && length >= SINK_BUFFER_SIZE) {
+    // Too big to be worth copying.
+    sinkFlush(sink);
+    writeAll(sink->fd, chars, length);
+    return;
+  }
+  reserve(sink, length);
+  memcpy(sink->buffer + sink->length, chars, length);
+  sink->length += length;
+}
+
+/**
+ * @brief Prints `value` and a newline, as the `print` statement does.
+ */
+void sinkPrintLine(Sink *sink, Value value) {
+  switch (value.type) {
+    case VAL_BOOL:
+      if (AS_BOOL(value)) {
+        sinkWrite(sink, "true\n", 5);
+      } else {
+        sinkWrite(sink, "false\n", 6);
+      }
+      break;
+    case VAL_NIL: sinkWrite(sink, "nil\n", 4); break;
+    case VAL_NUMBER: {
+      reserve(sink, NUMBER_MAX_LENGTH + 1);
+      char *end = sink->buffer + sink->length;
+      end += formatNumber(AS_NUMBER(value), end);
+      *end++ = '\n';
+      sink->length = end - sink->buffer;
+      break;
+    }
+    case VAL_OBJ:
+      switch (OBJ_TYPE(value)) {
+        case OBJ_STRING: {
+          ObjString *string = AS_STRING(value);
+          sinkWrite(sink, string->chars, string->length);
+          sinkWrite(sink, "\n", 1);
+          break;
+        }
+        case OBJ_FIBER: sinkWrite(sink, "<fiber>\n", 8); break;
+      }
+      break;
+  }
+  if (sink->flush == FLUSH_LINE) sinkFlush(sink);
+}
+
+/**
+ * @brief Hands over what an in-memory sink has captured, terminated by
+ * '\0', and leaves the sink empty. The caller frees the result with free().
+ */
+char *sinkTake(Sink *sink, size_t *length) {
+  reserve(sink, 1);
+  sink->buffer[sink->length] = '\0';
+  char *chars = sink->buffer;
+  *length = sink->length;
+  sink->buffer = NULL;
+  sink->length = 0;
+  sink->capacity = 0;
+  return chars;
+}
@@ -0,0 +1,35 @@
+#ifndef svm_sink_h
+#define svm_sink_h
+
+#include "value.h"
+
+#define SINK_BUFFER_SIZE (64 * 1024)
+
+typedef enum {
+  FLUSH_FULL, // When the buffer fills, and on sinkFlush()
+  FLUSH_LINE, // Also after every line printed
+} FlushMode;
+
+/**
+ * @brief Where a VM's `print` output goes.
+ *
+ * Output is formatted straight into `buffer` and written to `fd` with
+ * write(2) when the flush mode says so, bypassing stdio. A sink with no file
+ * descriptor keeps everything in `buffer`, which grows as needed.
+ */
+typedef struct {
+  char *buffer;
+  size_t length;
+  size_t capacity;
+  int fd; // Flushes write here, or -1 to keep the output in memory
+  FlushMode flush;
+} Sink;
+
+void sinkInit(Sink *sink, int fd);
+void sinkFree(Sink *sink);
+void sinkFlush(Sink *sink);
+void sinkWrite(Sink *sink, const char *chars, size_t length);
+void sinkPrintLine(Sink *sink, Value value);
+char *sinkTake(Sink *sink, size_t *length);
+
+#endif
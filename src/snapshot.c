@@ -0,0 +1,87 @@
+#include "snapshot.h"
+#include "memory.h"
+#include "object.h"
+#include <string.h>
+
+// The snapshot's copy of `string`, which must be interned in `vm`.
+static ObjString *snapshotString(Snapshot *snapshot, ObjString *string) {
+  return mapFindString(&snapshot->strings, string->chars, string->length,
+                       string->hash);
+}
+
+/**
+ * @brief Copies every string `vm` has interned, and its globals, into
+ * `snapshot`. `vm` keeps working as before and may be freed afterwards.
+ *
+ * External strings held by globals are interned first, which copies them;
+ * the globals then hold the copies, which compare equal to them.
+ */
+void takeSnapshot(VM *vm, Snapshot *snapshot) {
+  for (int i = 0; i < vm->globals.capacity; i++) {
+    mapObject *entry = &vm->globals.contents[i];
+    if (entry->key == NULL || !IS_STRING(entry->value)) continue;
+    ObjString *string = AS_STRING(entry->value);
+    if (string->external) {
+      entry->value = OBJ_VAL(copyString(vm, string->chars, string->length));
+    }
+  }
+
+  int count = 0;
+  size_t chars = 0;
+  for (int i = 0; i < vm->strings.capacity; i++) {
+    ObjString *string = vm->strings.contents[i].key;
+    if (string == NULL) continue;
+    count++;
+    chars += string->length + 1;
+  }
+
+  snapshot->heapSize = sizeof(ObjString) * count + chars;
+  snapshot->heap = ALLOCATE(char, snapshot->heapSize);
+  mapInit(&snapshot->strings);
+  mapInit(&snapshot->globals);
+
+  ObjString *copy = (ObjString *)snapshot->heap;
+  char *text = snapshot->heap + sizeof(ObjString) * count;
+  for (int i = 0; i < vm->strings.capacity; i++) {
+    ObjString *string = vm->strings.contents[i].key;
+    if (string == NULL) continue;
+
+    *copy = *string;
+    copy->obj.next = NULL; // Owned by the snapshot, not by any VM
+    copy->chars = text;
+    memcpy(text, string->chars, string->length + 1);
+    mapInsert(&snapshot->strings, copy, NIL_VAL());
+    text += string->length + 1;
+    copy++;
+  }
+
+  for (int i = 0; i < vm->globals.capacity; i++) {
+    mapObject *entry = &vm->globals.contents[i];
+    if (entry->key == NULL) continue;
+
+    Value value = entry->value;
+    if (IS_STRING(value)) {
+      value = OBJ_VAL(snapshotString(snapshot, AS_STRING(value)));
+    } else if (IS_FIBER(value)) {
+      value = NIL_VAL(); // Its body is gone once the script that spawned it ends
+    }
+    mapInsert(&snapshot->globals, snapshotString(snapshot, entry->key), value);
+  }
+}
+
+/**
+ * @brief Initializes `vm` with the strings and globals of `snapshot`.
+ *
+ * Only the two maps are copied; their strings stay in the snapshot's heap.
+ */
+void initVMFromSnapshot(VM *vm, const Snapshot *snapshot) {
+  initVM(vm);
+  mapCopy(&vm->strings, &snapshot->strings);
+  mapCopy(&vm->globals, &snapshot->globals);
+}
+
+void freeSnapshot(Snapshot *snapshot) {
+  FREE_ARRAY(char, snapshot->heap, snapshot->heapSize);
+  mapReset(&snapshot->strings);
+  mapReset(&snapshot->globals);
+}
@@ -0,0 +1,27 @@
+#ifndef svm_snapshot_h
+#define svm_snapshot_h
+
+#include "map.h"
+#include "vm.h"
+
+/**
+ * @brief A VM's interned strings and globals, frozen so that new VMs can
+ * start from them without running the code that created them.
+ *
+ * The strings are copied into one block the snapshot owns. Strings never
+ * change after they are created, so VMs started from the snapshot share that
+ * block read-only, from any thread, and only copy the two maps. The snapshot
+ * must outlive every VM started from it.
+ */
+typedef struct Snapshot {
+  char *heap; // Every ObjString, then all of their characters
+  size_t heapSize;
+  hashMap strings;
+  hashMap globals;
+} Snapshot;
+
+void takeSnapshot(VM *vm, Snapshot *snapshot);
+void initVMFromSnapshot(VM *vm, const Snapshot *snapshot);
+void freeSnapshot(Snapshot *snapshot);
+
+#endif
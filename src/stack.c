@@ -11,18 +11,44 @@ void stackInit(Stack *s) {
 }
 
 void stackFree(Stack *s) {
-  free(s->data);
+  if (s->data != NULL) free(s->data - 1);
   stackInit(s);
 }
 
+// Reallocates the values, keeping one scratch slot below data[0] so a
+// cached top value can be written back even when the stack is empty.
+static void stackGrow(Stack *s, int new_capacity) {
+  Value *base = s->data == NULL ? NULL : s->data - 1;
+  GROW_ARRAY(Value, base, s->capacity + 1, new_capacity + 1);
+  if (s->data == NULL) base[0] = NIL_VAL();
+  s->data = base + 1;
+  s->capacity = new_capacity;
+}
+
+// Starts `s` with room for `capacity` values rather than growing it to
+// INITIAL_STACK_SIZE on the first push, for the many stacks that stay small.
+void stackInitSized(Stack *s, int capacity) {
+  stackInit(s);
+  stackGrow(s, capacity);
+}
+
 void stackPush(Stack *s, Value v) {
   if (s->top + 1 >= s->capacity) {
-    int new_capacity = s->capacity == 0 ? INITIAL_STACK_SIZE : s->capacity * 2;
-    GROW_ARRAY(Value, s->data, s->capacity, new_capacity);
-    s->capacity = new_capacity;
+    stackGrow(s, s->capacity == 0 ? INITIAL_STACK_SIZE : s->capacity * 2);
   }
 
   s->data[++s->top] = v;
 }
 
 Value stackPop(Stack *s) { return s->data[s->top--]; }
+
+// Makes room for `slots` more values above the top, so they can be pushed
+// without a capacity check.
+void stackReserve(Stack *s, int slots) {
+  int needed = s->top + 1 + slots;
+  if (needed <= s->capacity) return;
+
+  int new_capacity = s->capacity == 0 ? INITIAL_STACK_SIZE : s->capacity;
+  while (new_capacity < needed) new_capacity *= 2;
+  stackGrow(s, new_capacity);
+}
@@ -12,8 +12,10 @@ typedef struct {
 } Stack;
 
 void stackInit(Stack *s);
+void stackInitSized(Stack *s, int capacity);
 void stackFree(Stack *s);
 void stackPush(Stack *s, Value v);
 Value stackPop(Stack *s);
+void stackReserve(Stack *s, int slots);
 
 #endif
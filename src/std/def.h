@@ -1,4 +1,7 @@
 typedef long ptrdiff_t;
 typedef unsigned long size_t;
 #define NULL ((void *)0)
+// <stddef.h> may come first, as through svm.h; keep its builtin version.
+#ifndef offsetof
 #define offsetof(type, member) ((size_t)&((type *)0)->member)
+#endif
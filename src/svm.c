@@ -0,0 +1,90 @@
+#include "svm.h"
+#include "map.h"
+#include "object.h"
+#include "snapshot.h"
+#include "vm.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+svm_vm *svm_new(void) {
+  VM *vm = malloc(sizeof(VM));
+  if (vm == NULL) return NULL;
+  initVM(vm);
+  return vm;
+}
+
+svm_result svm_eval(svm_vm *vm, const char *source) {
+  switch (interpret(vm, source)) {
+    case INTERPRET_OK: return SVM_OK;
+    case INTERPRET_COMPILE_ERROR: return SVM_COMPILE_ERROR;
+    case INTERPRET_RUNTIME_ERROR: break;
+  }
+  return SVM_RUNTIME_ERROR;
+}
+
+bool svm_get_number(svm_vm *vm, const char *name, double *out) {
+  int length = (int)strlen(name);
+  // A name that was never interned cannot be a global.
+  ObjString *key =
+      mapFindString(&vm->strings, name, length, hashString(name, length));
+  Value value;
+  if (key == NULL || !mapGet(&vm->globals, key, &value)) return false;
+  if (!IS_NUMBER(value)) return false;
+  *out = AS_NUMBER(value);
+  return true;
+}
+
+bool svm_set_string(svm_vm *vm, const char *name, const char *chars,
+                    size_t length, void (*release)(void *context),
+                    void *context) {
+  if (length > INT_MAX) return false;
+  ObjString *key = copyString(vm, name, (int)strlen(name));
+  ObjString *string =
+      newExternalString(vm, chars, (int)length, release, context);
+  mapInsert(&vm->globals, key, OBJ_VAL(string));
+  return true;
+}
+
+void svm_output_to_fd(svm_vm *vm, int fd) {
+  sinkFree(&vm->out);
+  sinkInit(&vm->out, fd);
+}
+
+void svm_output_to_memory(svm_vm *vm) {
+  sinkFree(&vm->out);
+  sinkInit(&vm->out, -1);
+}
+
+const char *svm_output(svm_vm *vm, size_t *length) {
+  sinkWrite(&vm->out, "", 1);
+  vm->out.length--; // Terminated, but not part of the output
+  *length = vm->out.length;
+  return vm->out.buffer;
+}
+
+void svm_flush(svm_vm *vm) { sinkFlush(&vm->out); }
+
+void svm_free(svm_vm *vm) {
+  closeVM(vm);
+  free(vm);
+}
+
+svm_snapshot *svm_snapshot_new(svm_vm *vm) {
+  Snapshot *snapshot = malloc(sizeof(Snapshot));
+  if (snapshot == NULL) return NULL;
+  takeSnapshot(vm, snapshot);
+  return snapshot;
+}
+
+svm_vm *svm_clone(const svm_snapshot *snapshot) {
+  VM *vm = malloc(sizeof(VM));
+  if (vm == NULL) return NULL;
+  initVMFromSnapshot(vm, snapshot);
+  return vm;
+}
+
+void svm_snapshot_free(svm_snapshot *snapshot) {
+  freeSnapshot(snapshot);
+  free(snapshot);
+}
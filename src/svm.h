@@ -0,0 +1,134 @@
+#ifndef svm_h
+#define svm_h
+
+/*
+ * Embedding API.
+ *
+ * Every svm_vm owns all of its state: the compiler's, the stack, interned
+ * strings, globals and objects. Nothing is shared between instances, so
+ * separate VMs may run on separate threads at the same time. A single VM
+ * must not be used from two threads at once.
+ *
+ *   svm_vm *vm = svm_new();
+ *   if (svm_eval(vm, "var answer = 6 * 7;") == SVM_OK) {
+ *     double answer;
+ *     svm_get_number(vm, "answer", &answer);
+ *   }
+ *   svm_free(vm);
+ *
+ * Large host buffers can be handed to scripts without a copy:
+ *
+ *   svm_set_string(vm, "body", buffer, size, free, buffer);
+ *
+ * Scripts print to stdout through a buffer of the VM's own, flushed when the
+ * VM is freed, when it fills, or after each line if stdout is a terminal.
+ * The host can send it to another file descriptor or keep it in memory.
+ * Errors are reported on stderr.
+ *
+ * A VM that has run a common prelude can be frozen into a snapshot, and new
+ * VMs cloned from it start with the prelude's globals already defined:
+ *
+ *   svm_snapshot *base = svm_snapshot_new(prelude_vm);
+ *   svm_vm *vm = svm_clone(base); // From any thread
+ *   ...
+ *   svm_free(vm);
+ *   svm_snapshot_free(base);      // After every clone is freed
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct VM svm_vm;
+typedef struct Snapshot svm_snapshot;
+
+typedef enum {
+  SVM_OK,
+  SVM_COMPILE_ERROR,
+  SVM_RUNTIME_ERROR,
+} svm_result;
+
+/**
+ * @brief Creates a VM with no globals.
+ *
+ * @return The VM, or NULL if memory ran out
+ */
+svm_vm *svm_new(void);
+
+/**
+ * @brief Compiles and runs `source` as one script.
+ *
+ * Globals it defines stay for later calls. After an error the VM is still
+ * usable.
+ */
+svm_result svm_eval(svm_vm *vm, const char *source);
+
+/**
+ * @brief Reads the global `name` into `*out`.
+ *
+ * @return false if it is not defined or not a number
+ */
+bool svm_get_number(svm_vm *vm, const char *name, double *out);
+
+/**
+ * @brief Defines the global `name` as a string of the `length` bytes at
+ * `chars`, in constant time: they are not copied, hashed or interned.
+ *
+ * The bytes must stay valid and unchanged until the VM calls
+ * `release(context)`, once, when it is freed. `release` may be NULL.
+ *
+ * @return false, without calling `release`, if `length` is too large for a
+ * string
+ */
+bool svm_set_string(svm_vm *vm, const char *name, const char *chars,
+                    size_t length, void (*release)(void *context),
+                    void *context);
+
+/**
+ * @brief Sends what the VM prints from now on to `fd`, after flushing
+ * anything still buffered. `fd` is not closed by the VM.
+ */
+void svm_output_to_fd(svm_vm *vm, int fd);
+
+/**
+ * @brief Keeps what the VM prints from now on in memory; see svm_output().
+ */
+void svm_output_to_memory(svm_vm *vm);
+
+/**
+ * @brief Returns what the VM has printed into memory so far, terminated by
+ * '\0'. The pointer is valid until the next call into the VM.
+ */
+const char *svm_output(svm_vm *vm, size_t *length);
+
+/**
+ * @brief Writes out anything the VM has buffered for a file descriptor.
+ */
+void svm_flush(svm_vm *vm);
+
+/**
+ * @brief Frees the VM and every object it created, flushing its output.
+ */
+void svm_free(svm_vm *vm);
+
+/**
+ * @brief Captures the strings and globals of `vm`, which stays usable and
+ * may be freed independently.
+ *
+ * @return The snapshot, or NULL if memory ran out
+ */
+svm_snapshot *svm_snapshot_new(svm_vm *vm);
+
+/**
+ * @brief Creates a VM whose globals are those of the snapshot, without
+ * running any code. Each clone has its own copy of the globals.
+ *
+ * @return The VM, or NULL if memory ran out
+ */
+svm_vm *svm_clone(const svm_snapshot *snapshot);
+
+/**
+ * @brief Frees the snapshot. Every VM cloned from it must be freed first.
+ */
+void svm_snapshot_free(svm_snapshot *snapshot);
+
+#endif
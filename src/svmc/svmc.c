@@ -0,0 +1,464 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../chunk.h"
+#include "../compiler.h"
+#include "../memory.h"
+#include "../object.h"
+#include "../vm.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/wait.h>
+
+/*
+ * svmc, the ahead-of-time translator. A script is compiled with compile()
+ * and its chunk written out as a single C function:
+ *
+ *   - stack slot i is the C local s<i>; analyzeStack gives the depth before
+ *     every instruction, so pushes, pops and locals are plain assignments;
+ *   - jumps are gotos to a label at each jump target;
+ *   - each global name gets a slot in a static array and a defined flag;
+ *   - strings and printing go through the runtime library (svmrt.h).
+ *
+ * The C file is then compiled with the system C compiler and linked against
+ * libsvmrt.a, leaving no bytecode dispatch at run time.
+ */
+
+#ifndef SVMC_INCLUDE
+#define SVMC_INCLUDE "src/svmc"
+#endif
+#ifndef SVMC_LIB
+#define SVMC_LIB "target"
+#endif
+
+typedef struct {
+  Chunk *chunk;
+  FILE *out;
+  int *depths;
+  bool *targets;
+  int maxDepth;
+  bool globals; // Whether the chunk touches any global
+} Translator;
+
+static void line(Translator *t, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  fputs("  ", t->out);
+  vfprintf(t->out, format, args);
+  fputs("\n", t->out);
+  va_end(args);
+}
+
+static void writeString(FILE *out, ObjString *string) {
+  fputc('"', out);
+  for (int i = 0; i < string->length; i++) {
+    unsigned char c = (unsigned char)string->chars[i];
+    if (c == '"' || c == '\\' || c == '?') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// Writes a C expression for `value` that loses no precision.
+static void writeNumber(FILE *out, double value) {
+  if (isnan(value)) {
+    fputs("NAN", out);
+  } else if (isinf(value)) {
+    fputs(value > 0 ? "HUGE_VAL" : "-HUGE_VAL", out);
+  } else {
+    fprintf(out, "%a", value);
+  }
+}
+
+static void writeConstant(FILE *out, Value value) {
+  switch (value.type) {
+    case VAL_BOOL:
+      fputs(AS_BOOL(value) ? "BOOL_VAL(true)" : "BOOL_VAL(false)", out);
+      break;
+    case VAL_NIL: fputs("NIL_VAL()", out); break;
+    case VAL_NUMBER:
+      fputs("NUMBER_VAL(", out);
+      writeNumber(out, AS_NUMBER(value));
+      fputs(")", out);
+      break;
+    case VAL_OBJ:
+      fputs("svmrtString(vm, ", out);
+      writeString(out, AS_STRING(value));
+      fprintf(out, ", %d)", AS_STRING(value)->length);
+      break;
+  }
+}
+
+static void checkNumbers(Translator *t, int a, int b, int srcLine) {
+  line(t, "if (!IS_NUMBER(s%d) || !IS_NUMBER(s%d))", a, b);
+  line(t, "  return svmrtError(%d, \"Operands must be numbers.\");", srcLine);
+}
+
+static const char *binaryOperator(uint8_t op) {
+  switch (genericOp(op)) {
+    case OP_SUBTRACT: return "-";
+    case OP_ADD: return "+";
+    case OP_MULTIPLY: return "*";
+    case OP_DIVIDE: return "/";
+    case OP_LESS:
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS: return "<";
+    default: return ">";
+  }
+}
+
+/**
+ * @brief Writes the C statements for the instruction at `offset`.
+ *
+ * @return false for an instruction run() has no implementation of either
+ */
+static bool translateInstruction(Translator *t, int offset) {
+  Chunk *chunk = t->chunk;
+  uint8_t *ip = &chunk->code[offset];
+  int d = t->depths[offset];
+  int srcLine = getLine(&chunk->lines, offset);
+
+  switch (*ip) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG: {
+      int index = *ip == OP_CONSTANT ? ip[1] : ip[1] | (ip[2] << 8);
+      Value value = chunk->constants.values[index];
+      if (IS_NUMBER(value)) {
+        fprintf(t->out, "  s%d = ", d);
+        writeConstant(t->out, value);
+        fputs(";\n", t->out);
+      } else {
+        line(t, "s%d = K[%d];", d, index);
+      }
+      break;
+    }
+    case OP_NIL: line(t, "s%d = NIL_VAL();", d); break;
+    case OP_TRUE: line(t, "s%d = BOOL_VAL(true);", d); break;
+    case OP_FALSE: line(t, "s%d = BOOL_VAL(false);", d); break;
+    case OP_POP:
+    case OP_POPN: break;
+    case OP_PICK: line(t, "s%d = s%d;", d, d - 1 - ip[1]); break;
+    case OP_GET_LOCAL: line(t, "s%d = s%d;", d, ip[1]); break;
+    case OP_SET_LOCAL: line(t, "s%d = s%d;", ip[1], d - 1); break;
+    case OP_NEGATE:
+      line(t, "if (!IS_NUMBER(s%d))", d - 1);
+      line(t, "  return svmrtError(%d, \"Operand must be a number.\");",
+           srcLine);
+      // Fall through.
+    case OP_NEGATE_N:
+      line(t, "s%d = NUMBER_VAL(-AS_NUMBER(s%d));", d - 1, d - 1);
+      break;
+    case OP_NOT:
+      line(t, "s%d = BOOL_VAL(svmrtFalsey(s%d));", d - 1, d - 1);
+      break;
+    case OP_EQUAL:
+      line(t, "s%d = BOOL_VAL(valuesEqual(s%d, s%d));", d - 2, d - 2, d - 1);
+      break;
+    case OP_ADD:
+      line(t, "if (!svmrtAdd(vm, &s%d, s%d))", d - 2, d - 1);
+      line(t,
+           "  return svmrtError(%d, \"Operands must be two numbers or two "
+           "strings.\");",
+           srcLine);
+      break;
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER:
+      checkNumbers(t, d - 2, d - 1, srcLine);
+      // Fall through.
+    case OP_ADD_NN:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE_NN:
+    case OP_LESS_NN:
+    case OP_GREATER_NN: {
+      uint8_t op = genericOp(*ip);
+      bool compare = op == OP_LESS || op == OP_GREATER;
+      line(t, "s%d = %s(AS_NUMBER(s%d) %s AS_NUMBER(s%d));", d - 2,
+           compare ? "BOOL_VAL" : "NUMBER_VAL", d - 2, binaryOperator(op),
+           d - 1);
+      break;
+    }
+    case OP_PRINT: line(t, "svmrtPrint(s%d);", d - 1); break;
+    case OP_DEFINE_GLOBAL:
+      line(t, "G[%d] = s%d;", ip[1], d - 1);
+      line(t, "D[%d] = true;", ip[1]);
+      break;
+    case OP_GET_GLOBAL:
+    case OP_SET_GLOBAL:
+      line(t, "if (!D[%d])", ip[1]);
+      line(t,
+           "  return svmrtError(%d, \"Undefined variable '%%s'.\", "
+           "AS_CSTRING(K[%d]));",
+           srcLine, ip[1]);
+      if (*ip == OP_GET_GLOBAL) {
+        line(t, "s%d = G[%d];", d, ip[1]);
+      } else {
+        line(t, "G[%d] = s%d;", ip[1], d - 1);
+      }
+      break;
+    case OP_JUMP:
+    case OP_LOOP: line(t, "goto L%d;", jumpTarget(chunk, offset)); break;
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_POP:
+      line(t, "if (svmrtFalsey(s%d)) goto L%d;", d - 1,
+           jumpTarget(chunk, offset));
+      break;
+    case OP_JUMP_IF_TRUE:
+      line(t, "if (!svmrtFalsey(s%d)) goto L%d;", d - 1,
+           jumpTarget(chunk, offset));
+      break;
+    case OP_JUMP_IF_LESS:
+    case OP_JUMP_IF_NOT_LESS:
+    case OP_JUMP_IF_GREATER:
+    case OP_JUMP_IF_NOT_GREATER: {
+      bool taken = *ip == OP_JUMP_IF_LESS || *ip == OP_JUMP_IF_GREATER;
+      checkNumbers(t, d - 2, d - 1, srcLine);
+      line(t, "if (%s(AS_NUMBER(s%d) %s AS_NUMBER(s%d))) goto L%d;",
+           taken ? "" : "!", d - 2, binaryOperator(*ip), d - 1,
+           jumpTarget(chunk, offset));
+      break;
+    }
+    case OP_RETURN: line(t, "return 0;"); break;
+    default: return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes `chunk` as a complete C program.
+ *
+ * @return false if the chunk cannot be translated
+ */
+static bool translate(Chunk *chunk, const char *source, FILE *out) {
+  Translator t;
+  t.chunk = chunk;
+  t.out = out;
+  t.depths = ALLOCATE(int, chunk->length);
+  t.targets = ALLOCATE(bool, chunk->length);
+  t.globals = false;
+
+  bool ok = analyzeStack(chunk, t.depths, t.targets, &t.maxDepth);
+  for (int offset = 0; ok && offset < chunk->length;
+       offset += instructionLength(chunk->code[offset])) {
+    uint8_t op = genericOp(chunk->code[offset]);
+    if (op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL || op == OP_SET_GLOBAL) {
+      t.globals = true;
+    }
+  }
+
+  int constants = chunk->constants.length;
+  if (ok) {
+    fprintf(out, "/* Generated by svmc from %s. */\n", source);
+    fprintf(out, "#include \"svmrt.h\"\n\n");
+    if (constants > 0) fprintf(out, "static Value K[%d];\n", constants);
+    if (t.globals) {
+      fprintf(out, "static Value G[%d];\n", constants);
+      fprintf(out, "static bool D[%d];\n", constants);
+    }
+    fprintf(out, "\nstatic int run(VM *vm) {\n");
+    if (t.maxDepth > 0) {
+      fputs("  Value", out);
+      for (int i = 0; i < t.maxDepth; i++) {
+        fprintf(out, "%s s%d", i > 0 ? "," : "", i);
+      }
+      fputs(";\n", out);
+    }
+    fputs("  (void)vm;\n\n", out);
+  }
+
+  for (int offset = 0; ok && offset < chunk->length;
+       offset += instructionLength(chunk->code[offset])) {
+    if (t.targets[offset]) fprintf(out, "L%d:;\n", offset);
+    ok = translateInstruction(&t, offset);
+  }
+
+  if (ok) {
+    fputs("}\n\nint main(void) {\n  VM state;\n  VM *vm = &state;\n", out);
+    fputs("  svmrtInit(vm);\n", out);
+    for (int i = 0; i < constants; i++) {
+      if (IS_NUMBER(chunk->constants.values[i])) continue; // Inlined
+      fprintf(out, "  K[%d] = ", i);
+      writeConstant(out, chunk->constants.values[i]);
+      fputs(";\n", out);
+    }
+    fputs("  int status = run(vm);\n  svmrtFree(vm);\n  return status;\n}\n", out);
+  }
+
+  FREE_ARRAY(int, t.depths, chunk->length);
+  FREE_ARRAY(bool, t.targets, chunk->length);
+  return ok;
+}
+
+static char *readFile(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t fileSize = ftell(file);
+  rewind(file);
+
+  char *buf = (char *)malloc(fileSize + 1);
+  if (buf == NULL) {
+    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    exit(74);
+  }
+
+  size_t bytesRead = fread(buf, sizeof(char), fileSize, file);
+  if (bytesRead < fileSize) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  buf[bytesRead] = '\0';
+
+  fclose(file);
+  return buf;
+}
+
+// The script's file name without directory or extension.
+static char *defaultOutput(const char *path) {
+  const char *base = strrchr(path, '/');
+  base = base == NULL ? path : base + 1;
+  const char *dot = strrchr(base, '.');
+  int length = dot == NULL || dot == base ? (int)strlen(base)
+                                           : (int)(dot - base);
+
+  char *name = malloc(length + 1);
+  memcpy(name, base, length);
+  name[length] = '\0';
+  return name;
+}
+
+extern char **environ;
+
+/**
+ * @brief Compiles `cFile` into `output` with $CC, or cc. The compiler is run
+ * directly with an argument vector, so file names reach it verbatim and are
+ * never seen by a shell; $CC may still hold options, split at spaces.
+ */
+static int buildExecutable(const char *cFile, const char *output) {
+  const char *cc = getenv("CC");
+  if (cc == NULL || cc[0] == '\0') cc = "cc";
+
+  char *words = malloc(strlen(cc) + 1);
+  strcpy(words, cc);
+  char **argv = malloc(sizeof(char *) * (strlen(cc) / 2 + 10));
+  int argc = 0;
+  for (char *word = strtok(words, " \t"); word != NULL;
+       word = strtok(NULL, " \t")) {
+    argv[argc++] = word;
+  }
+  argv[argc++] = "-O2";
+  argv[argc++] = "-I" SVMC_INCLUDE;
+  argv[argc++] = "-o";
+  argv[argc++] = (char *)output;
+  argv[argc++] = (char *)cFile;
+  argv[argc++] = SVMC_LIB "/libsvmrt.a";
+  argv[argc++] = "-lm";
+  argv[argc] = NULL;
+
+  pid_t pid;
+  int status = -1;
+  int error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+  if (error == 0 && waitpid(pid, &status, 0) != pid) status = -1;
+  free(argv);
+  free(words);
+
+  if (error != 0) {
+    fprintf(stderr, "svmc: could not run %s: %s.\n", cc, strerror(error));
+    return 1;
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "svmc: C compiler failed on %s.\n", cFile);
+    return 1;
+  }
+  return 0;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: svmc [-O] [-c] script [-o output]\n"
+                  "  -O  run the optimizing tier before translating\n"
+                  "  -c  write the C translation only\n");
+}
+
+int main(int argc, const char *argv[]) {
+  VM vm;
+  initVM(&vm);
+  bool emitOnly = false;
+  const char *script = NULL;
+  const char *output = NULL;
+
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "-O") == 0) {
+      vm.optimize = true;
+    } else if (strcmp(argv[arg], "-c") == 0) {
+      emitOnly = true;
+    } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+      output = argv[++arg];
+    } else if (argv[arg][0] != '-' && script == NULL) {
+      script = argv[arg];
+    } else {
+      script = NULL;
+      break;
+    }
+  }
+  if (script == NULL) {
+    usage();
+    closeVM(&vm);
+    return 64;
+  }
+
+  char *src = readFile(script);
+  Chunk chunk;
+  initChunk(&chunk);
+  bool compiled = compile(&vm, src, &chunk);
+  free(src);
+  if (!compiled) {
+    freeChunk(&chunk);
+    closeVM(&vm);
+    return 65;
+  }
+
+  char *name = output == NULL ? defaultOutput(script) : NULL;
+  if (output == NULL) output = name;
+
+  // With -c and no -o the translation goes to stdout.
+  char *cFile = NULL;
+  FILE *out = stdout;
+  if (!emitOnly || name == NULL) {
+    cFile = malloc(strlen(output) + 3);
+    sprintf(cFile, emitOnly ? "%s" : "%s.c", output);
+    out = fopen(cFile, "w");
+    if (out == NULL) {
+      fprintf(stderr, "Could not open file \"%s\".\n", cFile);
+      exit(74);
+    }
+  }
+
+  bool ok = translate(&chunk, script, out);
+  if (out != stdout) fclose(out);
+  if (!ok) {
+    fprintf(stderr, "svmc: %s uses an instruction with no C form.\n", script);
+  }
+
+  int status = ok ? 0 : 1;
+  if (ok && !emitOnly) status = buildExecutable(cFile, output);
+
+  free(cFile);
+  free(name);
+  freeChunk(&chunk);
+  closeVM(&vm);
+  return status;
+}
@@ -0,0 +1,62 @@
+#include "svmrt.h"
+#include "../map.h"
+#include <stdarg.h>
+#include <string.h>
+
+void svmrtInit(VM *vm) {
+  memset(vm, 0, sizeof(VM));
+  mapInit(&vm->strings);
+}
+
+void svmrtFree(VM *vm) {
+  freeObjects(vm);
+  mapReset(&vm->strings);
+}
+
+Value svmrtString(VM *vm, const char *chars, int length) {
+  return OBJ_VAL(copyString(vm, chars, length));
+}
+
+/**
+ * @brief Adds two numbers or concatenates two strings into `*a`, like
+ * OP_ADD in run().
+ *
+ * @return false if the operands are neither
+ */
+bool svmrtAdd(VM *vm, Value *a, Value b) {
+  if (IS_NUMBER(*a) && IS_NUMBER(b)) {
+    *a = NUMBER_VAL(AS_NUMBER(*a) + AS_NUMBER(b));
+    return true;
+  }
+  if (!IS_STRING(*a) || !IS_STRING(b)) return false;
+
+  ObjString *x = AS_STRING(*a);
+  ObjString *y = AS_STRING(b);
+  int length = x->length + y->length;
+  char *chars = ALLOCATE(char, length + 1);
+  memcpy(chars, x->chars, x->length);
+  memcpy(chars + x->length, y->chars, y->length);
+  chars[length] = '\0';
+  *a = OBJ_VAL(takeString(vm, chars, length));
+  return true;
+}
+
+void svmrtPrint(Value value) {
+  printValue(value);
+  printf("\n");
+}
+
+/**
+ * @brief Reports a runtime error the way run() does.
+ *
+ * @return The exit status of a script that failed at run time
+ */
+int svmrtError(int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputs("\n", stderr);
+  fprintf(stderr, "[line %d] in script\n", line);
+  return 70;
+}
@@ -0,0 +1,26 @@
+#ifndef svm_svmrt_h
+#define svm_svmrt_h
+
+#include "../object.h"
+#include "../value.h"
+#include "../vm.h"
+#include <math.h>
+
+/*
+ * Runtime library for programs translated by svmc. Generated code keeps the
+ * VM stack in C locals and globals in C arrays; it only calls in here for
+ * strings, printing and errors.
+ */
+
+void svmrtInit(VM *vm);
+void svmrtFree(VM *vm);
+Value svmrtString(VM *vm, const char *chars, int length);
+bool svmrtAdd(VM *vm, Value *a, Value b);
+void svmrtPrint(Value value);
+int svmrtError(int line, const char *format, ...);
+
+static inline bool svmrtFalsey(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+#endif
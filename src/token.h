@@ -1,3 +1,5 @@
+#ifndef svm_token_h
+#define svm_token_h
 typedef enum {
   // Single-char
   TOK_LEFT_PAREN,
@@ -35,13 +37,17 @@ typedef enum {
   TOK_NIL,
   TOK_OR,
   TOK_PRINT,
+  TOK_RESUME,
   TOK_RETURN,
+  TOK_SPAWN,
   TOK_SUPER,
   TOK_THIS,
   TOK_TRUE,
   TOK_VAR,
   TOK_WHILE,
+  TOK_YIELD,
   // Special
   TOK_ERROR,
   TOK_EOF,
 } TokType;
+#endif
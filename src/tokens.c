@@ -0,0 +1,167 @@
+#include "tokens.h"
+#include "memory.h"
+#include <string.h>
+
+IMPLEMENT_CONTAINER_FUNCTIONS(const char *, ErrorArray)
+
+static void lockBuffer(TokBuffer *b) {
+  if (b->threaded) pthread_mutex_lock(&b->lock);
+}
+
+static void unlockBuffer(TokBuffer *b) {
+  if (b->threaded) pthread_mutex_unlock(&b->lock);
+}
+
+static PackedTok *newBlock(TokBuffer *b) {
+  PackedTok *block = ALLOCATE(PackedTok, TOK_BLOCK_SIZE);
+
+  lockBuffer(b);
+  if (b->blockCount == b->blockCapacity) {
+    int newCap = GROW_CAPACITY(b->blockCapacity);
+    GROW_ARRAY(PackedTok *, b->blocks, b->blockCapacity, newCap);
+    b->blockCapacity = newCap;
+  }
+  b->blocks[b->blockCount++] = block;
+  unlockBuffer(b);
+  return block;
+}
+
+static void publish(TokBuffer *b, int count, bool done) {
+  lockBuffer(b);
+  b->published = count;
+  b->done = done;
+  if (b->threaded) pthread_cond_signal(&b->ready);
+  unlockBuffer(b);
+}
+
+/**
+ * @brief Lexes the whole source into the buffer, publishing every full block
+ * so a reader on another thread can start on it.
+ */
+static void lexAll(TokBuffer *b) {
+  Lexer lexer;
+  initLexer(&lexer, b->src);
+
+  PackedTok *block = NULL;
+  int count = 0;
+  for (;;) {
+    if (count % TOK_BLOCK_SIZE == 0) block = newBlock(b);
+
+    Tok tok = lexTok(&lexer);
+    PackedTok *packed = &block[count % TOK_BLOCK_SIZE];
+    packed->type = (uint8_t)tok.type;
+    packed->length = (uint32_t)tok.length;
+    packed->line = tok.line;
+
+    if (tok.type == TOK_ERROR) {
+      lockBuffer(b);
+      packed->offset = (uint32_t)b->errors.length;
+      writeErrorArray(&b->errors, tok.start);
+      unlockBuffer(b);
+    } else {
+      packed->offset = (uint32_t)(tok.start - b->src);
+    }
+
+    count++;
+    if (tok.type == TOK_EOF) break;
+    if (count % TOK_BLOCK_SIZE == 0) publish(b, count, false);
+  }
+
+  freeLexer(&lexer);
+  publish(b, count, true);
+}
+
+static void *lexThread(void *arg) {
+  lexAll((TokBuffer *)arg);
+  return NULL;
+}
+
+/**
+ * @brief Tokenizes `src` into packed blocks.
+ *
+ * Small sources are lexed completely before returning. Sources of at least
+ * THREADED_LEX_MIN_SOURCE bytes are lexed by a background thread, and
+ * tokBufferNext blocks only when it catches up with that thread.
+ */
+void tokBufferInit(TokBuffer *b, const char *src) {
+  b->src = src;
+  b->blocks = NULL;
+  b->blockCount = 0;
+  b->blockCapacity = 0;
+  initErrorArray(&b->errors);
+  b->readBlock = NULL;
+  b->readIndex = 0;
+  b->readLimit = 0;
+  b->published = 0;
+  b->done = false;
+  b->threaded = strlen(src) >= THREADED_LEX_MIN_SOURCE;
+
+  if (b->threaded) {
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->ready, NULL);
+    if (pthread_create(&b->thread, NULL, lexThread, b) == 0) return;
+
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->ready);
+    b->threaded = false;
+  }
+  lexAll(b);
+}
+
+void tokBufferFree(TokBuffer *b) {
+  if (b->threaded) {
+    pthread_join(b->thread, NULL);
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->ready);
+    b->threaded = false;
+  }
+  for (int i = 0; i < b->blockCount; i++) {
+    FREE_ARRAY(PackedTok, b->blocks[i], TOK_BLOCK_SIZE);
+  }
+  FREE_ARRAY(PackedTok *, b->blocks, b->blockCapacity);
+  freeErrorArray(&b->errors);
+  b->blocks = NULL;
+  b->blockCount = 0;
+  b->blockCapacity = 0;
+}
+
+/**
+ * @brief Makes the block holding the next unread token readable, waiting for
+ * the lexer thread if it has not produced that token yet.
+ */
+static void refill(TokBuffer *b) {
+  lockBuffer(b);
+  while (b->published <= b->readIndex && !b->done) {
+    pthread_cond_wait(&b->ready, &b->lock);
+  }
+
+  int blockEnd = (b->readIndex / TOK_BLOCK_SIZE + 1) * TOK_BLOCK_SIZE;
+  b->readBlock = b->blocks[b->readIndex / TOK_BLOCK_SIZE];
+  b->readLimit = b->published < blockEnd ? b->published : blockEnd;
+  unlockBuffer(b);
+}
+
+/**
+ * @brief Returns the next token; once TOK_EOF is reached it is returned for
+ * every later call.
+ */
+Tok tokBufferNext(TokBuffer *b) {
+  if (b->readIndex == b->readLimit) refill(b);
+
+  PackedTok *packed = &b->readBlock[b->readIndex % TOK_BLOCK_SIZE];
+  if (packed->type != TOK_EOF) b->readIndex++;
+
+  Tok tok;
+  tok.type = (TokType)packed->type;
+  tok.length = (int)packed->length;
+  tok.line = packed->line;
+
+  if (tok.type == TOK_ERROR) {
+    lockBuffer(b);
+    tok.start = b->errors.values[packed->offset];
+    unlockBuffer(b);
+  } else {
+    tok.start = b->src + packed->offset;
+  }
+  return tok;
+}
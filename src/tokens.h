@@ -0,0 +1,62 @@
+#ifndef svm_tokens_h
+#define svm_tokens_h
+
+#include "lexer.h"
+#include "memory.h"
+#include <pthread.h>
+
+// Tokens per block; blocks never move once written, so a reader can keep
+// using one while the lexer thread appends to the next.
+#define TOK_BLOCK_SIZE 4096
+
+// Sources at least this large are lexed on a background thread while the
+// compiler consumes the tokens already produced.
+#define THREADED_LEX_MIN_SOURCE (256 * 1024)
+
+/**
+ * @brief A token stored as an offset into the source instead of a pointer.
+ *
+ * For TOK_ERROR tokens `offset` indexes TokBuffer.errors, which holds the
+ * message the lexer produced.
+ */
+typedef struct {
+  uint32_t offset;
+  uint32_t length;
+  int32_t line;
+  uint8_t type;
+} PackedTok;
+
+typedef struct {
+  int length;
+  int capacity;
+  const char **values;
+} ErrorArray;
+
+DECLARE_CONTAINER_FUNCTIONS(const char *, ErrorArray);
+
+typedef struct {
+  const char *src;
+  PackedTok **blocks;
+  int blockCount;
+  int blockCapacity;
+  ErrorArray errors;
+
+  // Only touched by the reader.
+  PackedTok *readBlock;
+  int readIndex;
+  int readLimit;
+
+  // Shared with the lexer thread and guarded by `lock` when `threaded`.
+  int published;
+  bool done;
+  bool threaded;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+} TokBuffer;
+
+void tokBufferInit(TokBuffer *b, const char *src);
+void tokBufferFree(TokBuffer *b);
+Tok tokBufferNext(TokBuffer *b);
+
+#endif
@@ -5,11 +5,21 @@
 #include "debug.h"
 #include "map.h"
 #include "object.h"
+#include "regcode.h"
 #include "stack.h"
 #include "value.h"
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+// Every interpreter bumps the count each time it enters an instruction,
+// reverts of quickened instructions included, in builds that ask for it.
+#ifdef COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() (vm->instructions++)
+#else
+#define COUNT_INSTRUCTION() ((void)0)
+#endif
 
 void initVM(VM *vm) {
   vm->stack = malloc(sizeof(Stack));
@@ -18,109 +28,230 @@ void initVM(VM *vm) {
 
   mapInit(&vm->strings);
   mapInit(&vm->globals);
+  vm->optimize = false;
+  vm->backedges = 0;
+  vm->instructions = 0;
+  vm->jit = false;
+  vm->native = NULL;
+  vm->dispatch = DISPATCH_THREADED;
+  sinkInit(&vm->out, STDOUT_FILENO);
+  vm->err = stderr;
+  vm->fiber = NULL;
+  vm->runs = 0;
 }
 void closeVM(VM *vm) {
-  freeObjects();
+  sinkFree(&vm->out);
+  freeObjects(vm);
   mapReset(&vm->strings);
   mapReset(&vm->globals);
-}
-
-static Value peek(VM *vm, int distance) {
-  return vm->stack->data[vm->stack->top - distance];
+  stackFree(vm->stack);
+  free(vm->stack);
+  vm->stack = NULL;
 }
 
 static bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate(VM *vm) {
-  ObjString *b = AS_STRING(stackPop(vm->stack));
-  ObjString *a = AS_STRING(stackPop(vm->stack));
+static ObjString *concatStrings(VM *vm, ObjString *a, ObjString *b) {
   int length = a->length + b->length;
   char *chars = ALLOCATE(char, length + 1);
   memcpy(chars, a->chars, a->length);
   memcpy(chars + a->length, b->chars, b->length);
   chars[length] = '\0';
-  ObjString *result = takeString(vm, chars, length);
-  stackPush(vm->stack, OBJ_VAL(result));
+  return takeString(vm, chars, length);
+}
+
+static void concatenate(VM *vm) {
+  ObjString *b = AS_STRING(stackPop(vm->stack));
+  ObjString *a = AS_STRING(stackPop(vm->stack));
+  stackPush(vm->stack, OBJ_VAL(concatStrings(vm, a, b)));
+}
+
+/**
+ * @brief Switches from whatever is running to `fiber`, which must be
+ * suspended. The caller's ip is saved; its stack must already be in memory.
+ */
+static void enterFiber(VM *vm, ObjFiber *fiber) {
+  fiber->state = FIBER_RUNNING;
+  fiber->caller = vm->fiber;
+  fiber->callerStack = vm->stack;
+  fiber->callerIp = vm->ip;
+  vm->fiber = fiber;
+  vm->stack = &fiber->stack;
+  vm->ip = fiber->ip;
+}
+
+/**
+ * @brief Switches from the running fiber back to whoever resumed it, leaving
+ * the fiber in `state`. A fiber that is done gives up its stack.
+ */
+static void leaveFiber(VM *vm, FiberState state) {
+  ObjFiber *fiber = vm->fiber;
+  fiber->state = state;
+  fiber->ip = vm->ip;
+  if (state == FIBER_DONE) stackFree(&fiber->stack);
+  vm->fiber = fiber->caller;
+  vm->stack = fiber->callerStack;
+  vm->ip = fiber->callerIp;
 }
 
 static void runtimeError(VM *vm, const char *format, ...) {
   va_list args;
   va_start(args, format);
-  vfprintf(stderr, format, args);
+  vfprintf(vm->err, format, args);
   va_end(args);
-  fputs("\n", stderr);
+  fputs("\n", vm->err);
 
-  size_t instruction = vm->ip - vm->chunk->code - 1;
-  int line = vm->chunk->lines.values[instruction];
-  fprintf(stderr, "[line %d] in script\n", line);
-  stackFree(vm->stack);
+  int instruction = (int)(vm->ip - vm->chunk->code - 1);
+  int line = getLine(&vm->chunk->lines, instruction);
+  fprintf(vm->err, "[line %d] in script\n", line);
+  // Drop what the failed script left so the VM can run the next one. The
+  // error ends every fiber it happened inside of.
+  while (vm->fiber != NULL) leaveFiber(vm, FIBER_DONE);
+  vm->stack->top = -1;
+}
+
+/**
+ * @brief Remembers where the global just read by a GET/SET_GLOBAL lives and
+ * rewrites that instruction into its cached form.
+ */
+static void cacheGlobal(VM *vm, mapObject *entry, OpCode quickened) {
+  GlobalCache *cache = chunkGlobalCache(vm->chunk, vm->ip[-1]);
+  cache->entry = entry;
+  cache->version = vm->globals.version;
+  vm->ip[-2] = quickened;
+}
+
+/**
+ * @brief Reads the operand of a cached global instruction and returns its
+ * entry, or reverts the instruction to `generic` and returns NULL when the
+ * globals map has changed shape since the entry was cached.
+ */
+static mapObject *cachedGlobal(VM *vm, OpCode generic) {
+  uint8_t constant = *vm->ip++;
+  GlobalCache *cache = &vm->chunk->globalCaches[constant];
+  if (cache->version == vm->globals.version &&
+      cache->entry->key == AS_STRING(vm->chunk->constants.values[constant])) {
+    return cache->entry;
+  }
+
+  vm->ip -= 2;
+  *vm->ip = generic;
+  return NULL;
+}
+
+#ifdef DEBUG_VM
+static void traceInstruction(VM *vm, int offset) {
+  for (int i = 0; i <= vm->stack->top; i++) {
+    printf("[ ");
+    printValue(vm->stack->data[i]);
+    printf(" ]");
+  }
+  printf("\n");
+  disassembleInstruction(vm->chunk, offset);
 }
+#endif
 
+/**
+ * @brief The switch interpreter.
+ *
+ * The top of the stack lives in the local `tos` rather than in
+ * stack->data[stack->top], so handlers that only touch the top value never
+ * go through memory; stack->top still counts it. It is written back (SPILL)
+ * before anything else reads the stack and reloaded (FILL) after anything
+ * else may have changed it.
+ */
 InterpretResult run(VM *vm) {
 #define READ_BYTE() (*vm->ip++)
 #define READ_CONSTANT() (vm->chunk->constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_SHORT()                                                           \
+  (vm->ip += 2, (uint16_t)(vm->ip[-2] | (vm->ip[-1] << 8)))
 #define READ_CONSTANT_LONG()                                                   \
   ({                                                                           \
     uint8_t low = READ_BYTE();                                                 \
     uint8_t high = READ_BYTE();                                                \
     vm->chunk->constants.values[low | (high << 8)];                            \
   })
+// With an empty stack these use the scratch slot below data[0].
+#define SPILL() (stack->data[stack->top] = tos)
+#define FILL() (tos = stack->data[stack->top])
+#define PUSH(value)                                                            \
+  do {                                                                         \
+    Value pushed = (value);                                                    \
+    if (stack->top + 1 >= stack->capacity) stackReserve(stack, 1);             \
+    SPILL();                                                                   \
+    stack->top++;                                                              \
+    tos = pushed;                                                              \
+  } while (false)
+#define DROP()                                                                 \
+  do {                                                                         \
+    stack->top--;                                                              \
+    FILL();                                                                    \
+  } while (false)
+
+  Stack *stack = vm->stack;
+  stackReserve(stack, 1);
+  Value tos;
+  FILL();
 
   for (;;) {
 
 #ifdef DEBUG_VM
-    for (int i = 0; i <= vm->stack->top; i++) {
-      printf("[ ");
-      printValue(vm->stack->data[i]);
-      printf(" ]");
-    }
-    printf("\n");
-    disassembleInstruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
+    SPILL();
+    traceInstruction(vm, (int)(vm->ip - vm->chunk->code));
 #endif
+    COUNT_INSTRUCTION();
 
     uint8_t instruction;
     switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        stackPush(vm->stack, constant);
-        break;
-      }
-      case OP_CONSTANT_LONG: {
-        Value constant = READ_CONSTANT_LONG();
-        stackPush(vm->stack, constant);
-        break;
-      }
+      case OP_CONSTANT: PUSH(READ_CONSTANT()); break;
+      case OP_CONSTANT_LONG: PUSH(READ_CONSTANT_LONG()); break;
       case OP_NEGATE:
-        if (!IS_NUMBER(peek(vm, 0))) {
+        if (!IS_NUMBER(tos)) {
           runtimeError(vm, "Operand must be a number.");
           return INTERPRET_RUNTIME_ERROR;
         }
-        stackPush(vm->stack, NUMBER_VAL(-AS_NUMBER(stackPop(vm->stack))));
-        break;
-      case OP_SUBTRACT: BINARY_OP(vm, NUMBER_VAL, -); break;
-      case OP_MULTIPLY: BINARY_OP(vm, NUMBER_VAL, *); break;
-      case OP_DIVIDE: BINARY_OP(vm, NUMBER_VAL, /); break;
-      case OP_EQUAL: {
-        Value b = stackPop(vm->stack);
-        Value a = stackPop(vm->stack);
-        stackPush(vm->stack, BOOL_VAL(valuesEqual(a, b)));
-      }; break;
-      case OP_GREATER: BINARY_OP(vm, NUMBER_VAL, >); break;
-      case OP_LESS: BINARY_OP(vm, NUMBER_VAL, <); break;
-      case OP_NOT:
-        stackPush(vm->stack, BOOL_VAL(isFalsey(stackPop(vm->stack))));
-        break;
-      case OP_NIL: stackPush(vm->stack, NIL_VAL()); break;
+        tos = NUMBER_VAL(-AS_NUMBER(tos));
+        break;
+      case OP_SUBTRACT:
+        QUICKEN_NUMBER(vm, OP_SUBTRACT_NUM);
+        BINARY_OP(vm, NUMBER_VAL, -);
+        break;
+      case OP_MULTIPLY:
+        QUICKEN_NUMBER(vm, OP_MULTIPLY_NUM);
+        BINARY_OP(vm, NUMBER_VAL, *);
+        break;
+      case OP_DIVIDE:
+        QUICKEN_NUMBER(vm, OP_DIVIDE_NUM);
+        BINARY_OP(vm, NUMBER_VAL, /);
+        break;
+      case OP_EQUAL:
+        stack->top--;
+        tos = BOOL_VAL(valuesEqual(stack->data[stack->top], tos));
+        break;
+      case OP_GREATER:
+        QUICKEN_NUMBER(vm, OP_GREATER_NUM);
+        BINARY_OP(vm, BOOL_VAL, >);
+        break;
+      case OP_LESS:
+        QUICKEN_NUMBER(vm, OP_LESS_NUM);
+        BINARY_OP(vm, BOOL_VAL, <);
+        break;
+      case OP_NOT: tos = BOOL_VAL(isFalsey(tos)); break;
+      case OP_NIL: PUSH(NIL_VAL()); break;
+      case OP_TRUE: PUSH(BOOL_VAL(true)); break;
+      case OP_FALSE: PUSH(BOOL_VAL(false)); break;
       case OP_ADD: {
-        if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-          concatenate(vm);
-        } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-          double b = AS_NUMBER(stackPop(vm->stack));
-          double a = AS_NUMBER(stackPop(vm->stack));
-          stackPush(vm->stack, NUMBER_VAL(a + b));
+        if (IS_STRING(tos) && IS_STRING(SECOND)) {
+          vm->ip[-1] = OP_ADD_STR;
+          stack->top--;
+          ObjString *a = AS_STRING(stack->data[stack->top]);
+          tos = OBJ_VAL(concatStrings(vm, a, AS_STRING(tos)));
+        } else if (IS_NUMBER(tos) && IS_NUMBER(SECOND)) {
+          vm->ip[-1] = OP_ADD_NUM;
+          UNCHECKED_OP(vm, NUMBER_VAL, +);
         } else {
           runtimeError(vm, "Operands must be two numbers or two strings.");
           return INTERPRET_RUNTIME_ERROR;
@@ -128,47 +259,1230 @@ InterpretResult run(VM *vm) {
         break;
       }
       case OP_PRINT: {
-        printValue(stackPop(vm->stack));
-        printf("\n");
-        break;
-      }
-      case OP_POP: {
-        stackPop(vm->stack);
+        sinkPrintLine(&vm->out, tos);
+        DROP();
         break;
       }
+      case OP_POP: DROP(); break;
       case OP_DEFINE_GLOBAL: {
         ObjString *name = READ_STRING();
-        mapInsert(&vm->globals, name, peek(vm, 0));
-        stackPop(vm->stack);
+        mapInsert(&vm->globals, name, tos);
+        DROP();
         break;
       }
       case OP_GET_GLOBAL: {
         ObjString *name = READ_STRING();
-        Value value;
-        if (!mapGet(&vm->globals, name, &value)) {
+        mapObject *entry = mapGetEntry(&vm->globals, name);
+        if (entry == NULL) {
           runtimeError(vm, "Undefined variable '%s'.", name->chars);
           return INTERPRET_RUNTIME_ERROR;
         }
-        stackPush(vm->stack, value);
+        cacheGlobal(vm, entry, OP_GET_GLOBAL_CACHED);
+        PUSH(entry->value);
         break;
       }
 
       case OP_SET_GLOBAL: {
         ObjString *name = READ_STRING();
-        if (mapInsert(&vm->globals, name, peek(vm, 0))) {
-          mapDelete(&vm->globals, name);
+        mapObject *entry = mapGetEntry(&vm->globals, name);
+        if (entry == NULL) {
           runtimeError(vm, "Undefined variable '%s'.", name->chars);
           return INTERPRET_RUNTIME_ERROR;
         }
+        cacheGlobal(vm, entry, OP_SET_GLOBAL_CACHED);
+        entry->value = tos;
+        break;
+      }
+      case OP_PICK: {
+        int distance = READ_BYTE();
+        PUSH(distance == 0 ? tos : stack->data[stack->top - distance]);
+        break;
+      }
+      case OP_POPN:
+        stack->top -= READ_BYTE();
+        FILL();
+        break;
+      case OP_GET_LOCAL: {
+        uint8_t slot = READ_BYTE();
+        PUSH(slot == stack->top ? tos : stack->data[slot]);
+        break;
+      }
+      case OP_SET_LOCAL: {
+        uint8_t slot = READ_BYTE();
+        stack->data[slot] = tos;
+        break;
+      }
+      case OP_JUMP: {
+        uint16_t offset = READ_SHORT();
+        vm->ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_FALSE: {
+        uint16_t offset = READ_SHORT();
+        if (isFalsey(tos)) vm->ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_TRUE: {
+        uint16_t offset = READ_SHORT();
+        if (!isFalsey(tos)) vm->ip += offset;
+        break;
+      }
+      case OP_JUMP_IF_FALSE_POP: {
+        uint16_t offset = READ_SHORT();
+        if (isFalsey(tos)) vm->ip += offset;
+        DROP();
+        break;
+      }
+      case OP_JUMP_IF_LESS: COMPARE_JUMP(vm, <, true); break;
+      case OP_JUMP_IF_NOT_LESS: COMPARE_JUMP(vm, <, false); break;
+      case OP_JUMP_IF_GREATER: COMPARE_JUMP(vm, >, true); break;
+      case OP_JUMP_IF_NOT_GREATER: COMPARE_JUMP(vm, >, false); break;
+      case OP_LOOP: {
+        uint16_t offset = READ_SHORT();
+        vm->ip -= offset;
+        vm->backedges++;
+
+        int target = (int)(vm->ip - vm->chunk->code);
+        if (vm->native != NULL && jitCanEnter(vm->native, target)) {
+          SPILL();
+          int exit = jitEnter(vm, vm->native, target);
+          if (exit < 0) return INTERPRET_OK;
+          vm->ip = vm->chunk->code + exit;
+          stack = vm->stack;
+          FILL();
+        }
+        break;
+      }
+      case OP_SPAWN: {
+        uint16_t offset = READ_SHORT();
+        ObjFiber *fiber = newFiber(vm, vm->ip);
+        vm->ip += offset;
+        PUSH(OBJ_VAL(fiber));
+        break;
+      }
+      case OP_RESUME: {
+        if (!IS_FIBER(tos)) {
+          runtimeError(vm, "Can only resume fibers.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        ObjFiber *fiber = AS_FIBER(tos);
+        if (fiber->run != vm->runs) {
+          runtimeError(vm, "Cannot resume a fiber from an earlier script.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        if (fiber->state != FIBER_SUSPENDED) {
+          runtimeError(vm, fiber->state == FIBER_RUNNING
+                               ? "Cannot resume a running fiber."
+                               : "Cannot resume a finished fiber.");
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        DROP();
+        enterFiber(vm, fiber);
+        stack = vm->stack;
+        FILL();
+        break;
+      }
+      case OP_YIELD: {
+        Value value = tos;
+        DROP();
+        leaveFiber(vm, FIBER_SUSPENDED);
+        stack = vm->stack;
+        FILL();
+        PUSH(value);
+        break;
+      }
+      case OP_FINISH:
+        leaveFiber(vm, FIBER_DONE);
+        stack = vm->stack;
+        FILL();
+        PUSH(NIL_VAL());
+        break;
+      case OP_ADD_NUM: NUMBER_OP(vm, NUMBER_VAL, +, OP_ADD); break;
+      case OP_SUBTRACT_NUM: NUMBER_OP(vm, NUMBER_VAL, -, OP_SUBTRACT); break;
+      case OP_MULTIPLY_NUM: NUMBER_OP(vm, NUMBER_VAL, *, OP_MULTIPLY); break;
+      case OP_DIVIDE_NUM: NUMBER_OP(vm, NUMBER_VAL, /, OP_DIVIDE); break;
+      case OP_LESS_NUM: NUMBER_OP(vm, BOOL_VAL, <, OP_LESS); break;
+      case OP_GREATER_NUM: NUMBER_OP(vm, BOOL_VAL, >, OP_GREATER); break;
+      case OP_ADD_STR: {
+        if (!IS_STRING(tos) || !IS_STRING(SECOND)) {
+          *--vm->ip = OP_ADD;
+          break;
+        }
+        stack->top--;
+        ObjString *a = AS_STRING(stack->data[stack->top]);
+        tos = OBJ_VAL(concatStrings(vm, a, AS_STRING(tos)));
+        break;
+      }
+      case OP_GET_GLOBAL_CACHED: {
+        mapObject *entry = cachedGlobal(vm, OP_GET_GLOBAL);
+        if (entry != NULL) PUSH(entry->value);
         break;
       }
-      case OP_RETURN: return INTERPRET_OK;
+      case OP_SET_GLOBAL_CACHED: {
+        mapObject *entry = cachedGlobal(vm, OP_SET_GLOBAL);
+        if (entry != NULL) entry->value = tos;
+        break;
+      }
+      case OP_NEGATE_N: tos = NUMBER_VAL(-AS_NUMBER(tos)); break;
+      case OP_ADD_NN: UNCHECKED_OP(vm, NUMBER_VAL, +); break;
+      case OP_SUBTRACT_NN: UNCHECKED_OP(vm, NUMBER_VAL, -); break;
+      case OP_MULTIPLY_NN: UNCHECKED_OP(vm, NUMBER_VAL, *); break;
+      case OP_DIVIDE_NN: UNCHECKED_OP(vm, NUMBER_VAL, /); break;
+      case OP_LESS_NN: UNCHECKED_OP(vm, BOOL_VAL, <); break;
+      case OP_GREATER_NN: UNCHECKED_OP(vm, BOOL_VAL, >); break;
+      case OP_RETURN: SPILL(); return INTERPRET_OK;
     }
   }
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_SHORT
 #undef READ_CONSTANT_LONG
+#undef SPILL
+#undef FILL
+#undef PUSH
+#undef DROP
+}
+
+/**
+ * @brief One pre-decoded instruction of a chunk's threaded form.
+ *
+ * `handler` is the label in runThreaded() that executes it, and operands are
+ * resolved ahead of time, so dispatch is one indirect jump and nothing is
+ * decoded while running. Quickening rewrites `handler` in place.
+ */
+typedef struct Instr {
+  const void *handler;
+  union {
+    Value *constant;      // OP_CONSTANT(_LONG): slot in chunk->constants
+    ObjString *name;      // Global instructions
+    struct Instr *target; // Jumps
+    int operand;          // Local slot, OP_PICK distance, OP_POPN count
+  } as;
+  mapObject *entry; // Cached global entry, valid while `version` matches
+  uint32_t version;
+  int offset; // Bytecode offset, for errors and tracing
+} Instr;
+
+/**
+ * @brief Decodes `chunk` into one Instr per bytecode instruction.
+ *
+ * @return The instructions, or NULL if the chunk's stack use cannot be
+ * worked out; `*maxDepth` is the most it grows the stack
+ */
+static Instr *threadChunk(Chunk *chunk, const void *const *labels,
+                          int *count, int *maxDepth) {
+  int *depths = ALLOCATE(int, chunk->length);
+  bool *targets = ALLOCATE(bool, chunk->length);
+  bool ok = analyzeStack(chunk, depths, targets, maxDepth);
+  FREE_ARRAY(bool, targets, chunk->length);
+  if (!ok) {
+    FREE_ARRAY(int, depths, chunk->length);
+    return NULL;
+  }
+
+  // Reuse `depths` to map each instruction's offset to its index.
+  int *index = depths;
+  *count = 0;
+  for (int offset = 0; offset < chunk->length;
+       offset += instructionLength(chunk->code[offset])) {
+    index[offset] = (*count)++;
+  }
+
+  Instr *code = ALLOCATE(Instr, *count);
+  Instr *instr = code;
+  for (int offset = 0; offset < chunk->length;
+       offset += instructionLength(chunk->code[offset]), instr++) {
+    uint8_t *ip = &chunk->code[offset];
+    instr->handler = labels[*ip];
+    instr->as.operand = 0;
+    instr->entry = NULL;
+    instr->version = 0;
+    instr->offset = offset;
+
+    switch (*ip) {
+      case OP_CONSTANT:
+        instr->as.constant = &chunk->constants.values[ip[1]];
+        break;
+      case OP_CONSTANT_LONG:
+        instr->as.constant = &chunk->constants.values[ip[1] | (ip[2] << 8)];
+        break;
+      case OP_DEFINE_GLOBAL:
+      case OP_GET_GLOBAL:
+      case OP_SET_GLOBAL:
+        instr->as.name = AS_STRING(chunk->constants.values[ip[1]]);
+        break;
+      case OP_PICK:
+      case OP_POPN:
+      case OP_GET_LOCAL:
+      case OP_SET_LOCAL: instr->as.operand = ip[1]; break;
+      default:
+        if (isJump(*ip)) {
+          instr->as.target = &code[index[jumpTarget(chunk, offset)]];
+        }
+        break;
+    }
+  }
+
+  FREE_ARRAY(int, depths, chunk->length);
+  return code;
+}
+
+/**
+ * @brief Runs vm->chunk through its threaded form, dispatching with computed
+ * goto. Behaves exactly like run(), which it falls back to for a chunk it
+ * cannot decode.
+ */
+static InterpretResult runThreaded(VM *vm) {
+  static const void *const labels[] = {
+      [OP_RETURN] = &&op_return,
+      [OP_NEGATE] = &&op_negate,
+      [OP_SUBTRACT] = &&op_subtract,
+      [OP_ADD] = &&op_add,
+      [OP_MULTIPLY] = &&op_multiply,
+      [OP_DIVIDE] = &&op_divide,
+      [OP_NOT] = &&op_not,
+      [OP_MODULO] = &&op_unimplemented,
+      [OP_CONSTANT] = &&op_constant,
+      [OP_CONSTANT_LONG] = &&op_constant,
+      [OP_NIL] = &&op_nil,
+      [OP_TRUE] = &&op_true,
+      [OP_FALSE] = &&op_false,
+      [OP_EQUAL] = &&op_equal,
+      [OP_GREATER] = &&op_greater,
+      [OP_LESS] = &&op_less,
+      [OP_PRINT] = &&op_print,
+      [OP_POP] = &&op_pop,
+      [OP_DEFINE_GLOBAL] = &&op_define_global,
+      [OP_GET_GLOBAL] = &&op_get_global,
+      [OP_SET_GLOBAL] = &&op_set_global,
+      [OP_PICK] = &&op_pick,
+      [OP_POPN] = &&op_popn,
+      [OP_GET_LOCAL] = &&op_get_local,
+      [OP_SET_LOCAL] = &&op_set_local,
+      [OP_JUMP] = &&op_jump,
+      [OP_JUMP_IF_FALSE] = &&op_jump_if_false,
+      [OP_JUMP_IF_TRUE] = &&op_jump_if_true,
+      [OP_JUMP_IF_FALSE_POP] = &&op_jump_if_false_pop,
+      [OP_JUMP_IF_LESS] = &&op_jump_if_less,
+      [OP_JUMP_IF_NOT_LESS] = &&op_jump_if_not_less,
+      [OP_JUMP_IF_GREATER] = &&op_jump_if_greater,
+      [OP_JUMP_IF_NOT_GREATER] = &&op_jump_if_not_greater,
+      [OP_LOOP] = &&op_loop,
+      [OP_ADD_NUM] = &&op_add_num,
+      [OP_ADD_STR] = &&op_add_str,
+      [OP_SUBTRACT_NUM] = &&op_subtract_num,
+      [OP_MULTIPLY_NUM] = &&op_multiply_num,
+      [OP_DIVIDE_NUM] = &&op_divide_num,
+      [OP_LESS_NUM] = &&op_less_num,
+      [OP_GREATER_NUM] = &&op_greater_num,
+      [OP_GET_GLOBAL_CACHED] = &&op_get_global_cached,
+      [OP_SET_GLOBAL_CACHED] = &&op_set_global_cached,
+      [OP_NEGATE_N] = &&op_negate_n,
+      [OP_ADD_NN] = &&op_add_nn,
+      [OP_SUBTRACT_NN] = &&op_subtract_nn,
+      [OP_MULTIPLY_NN] = &&op_multiply_nn,
+      [OP_DIVIDE_NN] = &&op_divide_nn,
+      [OP_LESS_NN] = &&op_less_nn,
+      [OP_GREATER_NN] = &&op_greater_nn,
+  };
+
+  int count, maxDepth;
+  Instr *code = threadChunk(vm->chunk, labels, &count, &maxDepth);
+  if (code == NULL) {
+    vm->ip = vm->chunk->code;
+    return run(vm);
+  }
+  // Every push below is then in bounds.
+  stackReserve(vm->stack, maxDepth);
+
+  InterpretResult result = INTERPRET_OK;
+  Stack *stack = vm->stack;
+  Instr *ip = code;
+
+#define TOP (stack->data[stack->top])
+#define PEEK(distance) (stack->data[stack->top - (distance)])
+#define PUSH(value) (stack->data[++stack->top] = (value))
+#ifdef DEBUG_VM
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    traceInstruction(vm, ip->offset);                                          \
+    REDISPATCH();                                                              \
+  } while (false)
+#else
+#define DISPATCH() REDISPATCH()
+#endif
+// Runs the current instruction again after its handler was rewritten.
+#define REDISPATCH()                                                           \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    goto *ip->handler;                                                         \
+  } while (false)
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ip++;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+#define FAIL(...)                                                              \
+  do {                                                                         \
+    vm->ip = vm->chunk->code + ip->offset + 1;                                 \
+    runtimeError(vm, __VA_ARGS__);                                             \
+    result = INTERPRET_RUNTIME_ERROR;                                          \
+    goto done;                                                                 \
+  } while (false)
+#define BOTH_NUMBERS() (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1)))
+// Generic arithmetic: checks, quickens to `quickened` and computes.
+#define THREADED_BINARY(valueType, op, quickened)                              \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) FAIL("Operands must be numbers.");                    \
+    ip->handler = labels[quickened];                                           \
+    THREADED_UNCHECKED(valueType, op);                                         \
+  } while (false)
+// Quickened arithmetic: reverts to `generic` when the guard fails.
+#define THREADED_NUMBER(valueType, op, generic)                                \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) {                                                     \
+      ip->handler = labels[generic];                                           \
+      REDISPATCH();                                                            \
+    }                                                                          \
+    THREADED_UNCHECKED(valueType, op);                                         \
+  } while (false)
+#define THREADED_UNCHECKED(valueType, op)                                      \
+  do {                                                                         \
+    double b = AS_NUMBER(TOP);                                                 \
+    stack->top--;                                                              \
+    TOP = valueType(AS_NUMBER(TOP) op b);                                      \
+    NEXT();                                                                    \
+  } while (false)
+#define THREADED_COMPARE_JUMP(op, taken)                                       \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) FAIL("Operands must be numbers.");                    \
+    bool jump = (AS_NUMBER(PEEK(1)) op AS_NUMBER(PEEK(0))) == taken;           \
+    stack->top -= 2;                                                           \
+    if (jump) {                                                                \
+      ip = ip->as.target;                                                      \
+      DISPATCH();                                                              \
+    }                                                                          \
+    NEXT();                                                                    \
+  } while (false)
+
+  DISPATCH();
+
+op_constant:
+  PUSH(*ip->as.constant);
+  NEXT();
+op_nil:
+  PUSH(NIL_VAL());
+  NEXT();
+op_true:
+  PUSH(BOOL_VAL(true));
+  NEXT();
+op_false:
+  PUSH(BOOL_VAL(false));
+  NEXT();
+op_negate:
+  if (!IS_NUMBER(TOP)) FAIL("Operand must be a number.");
+  // Fall through.
+op_negate_n:
+  TOP = NUMBER_VAL(-AS_NUMBER(TOP));
+  NEXT();
+op_not:
+  TOP = BOOL_VAL(isFalsey(TOP));
+  NEXT();
+op_equal: {
+  Value b = TOP;
+  stack->top--;
+  TOP = BOOL_VAL(valuesEqual(TOP, b));
+  NEXT();
+}
+op_add:
+  if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+    ip->handler = labels[OP_ADD_STR];
+    concatenate(vm);
+    NEXT();
+  }
+  if (!BOTH_NUMBERS()) FAIL("Operands must be two numbers or two strings.");
+  ip->handler = labels[OP_ADD_NUM];
+  THREADED_UNCHECKED(NUMBER_VAL, +);
+op_subtract:
+  THREADED_BINARY(NUMBER_VAL, -, OP_SUBTRACT_NUM);
+op_multiply:
+  THREADED_BINARY(NUMBER_VAL, *, OP_MULTIPLY_NUM);
+op_divide:
+  THREADED_BINARY(NUMBER_VAL, /, OP_DIVIDE_NUM);
+op_greater:
+  THREADED_BINARY(BOOL_VAL, >, OP_GREATER_NUM);
+op_less:
+  THREADED_BINARY(BOOL_VAL, <, OP_LESS_NUM);
+op_add_num:
+  THREADED_NUMBER(NUMBER_VAL, +, OP_ADD);
+op_subtract_num:
+  THREADED_NUMBER(NUMBER_VAL, -, OP_SUBTRACT);
+op_multiply_num:
+  THREADED_NUMBER(NUMBER_VAL, *, OP_MULTIPLY);
+op_divide_num:
+  THREADED_NUMBER(NUMBER_VAL, /, OP_DIVIDE);
+op_greater_num:
+  THREADED_NUMBER(BOOL_VAL, >, OP_GREATER);
+op_less_num:
+  THREADED_NUMBER(BOOL_VAL, <, OP_LESS);
+op_add_str:
+  if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1))) {
+    ip->handler = labels[OP_ADD];
+    REDISPATCH();
+  }
+  concatenate(vm);
+  NEXT();
+op_add_nn:
+  THREADED_UNCHECKED(NUMBER_VAL, +);
+op_subtract_nn:
+  THREADED_UNCHECKED(NUMBER_VAL, -);
+op_multiply_nn:
+  THREADED_UNCHECKED(NUMBER_VAL, *);
+op_divide_nn:
+  THREADED_UNCHECKED(NUMBER_VAL, /);
+op_greater_nn:
+  THREADED_UNCHECKED(BOOL_VAL, >);
+op_less_nn:
+  THREADED_UNCHECKED(BOOL_VAL, <);
+op_print:
+  sinkPrintLine(&vm->out, TOP);
+  stack->top--;
+  NEXT();
+op_pop:
+  stack->top--;
+  NEXT();
+op_popn:
+  stack->top -= ip->as.operand;
+  NEXT();
+op_pick: {
+  Value value = PEEK(ip->as.operand);
+  PUSH(value);
+  NEXT();
+}
+op_get_local:
+  PUSH(stack->data[ip->as.operand]);
+  NEXT();
+op_set_local:
+  stack->data[ip->as.operand] = TOP;
+  NEXT();
+op_define_global:
+  mapInsert(&vm->globals, ip->as.name, TOP);
+  stack->top--;
+  NEXT();
+op_get_global:
+op_set_global: {
+  // Both labels share this code, so tell them apart by opcode.
+  mapObject *entry = mapGetEntry(&vm->globals, ip->as.name);
+  if (entry == NULL) FAIL("Undefined variable '%s'.", ip->as.name->chars);
+  ip->entry = entry;
+  ip->version = vm->globals.version;
+  bool get = vm->chunk->code[ip->offset] == OP_GET_GLOBAL;
+  ip->handler = labels[get ? OP_GET_GLOBAL_CACHED : OP_SET_GLOBAL_CACHED];
+  REDISPATCH();
+}
+op_get_global_cached:
+  if (ip->version != vm->globals.version) {
+    ip->handler = labels[OP_GET_GLOBAL];
+    REDISPATCH();
+  }
+  PUSH(ip->entry->value);
+  NEXT();
+op_set_global_cached:
+  if (ip->version != vm->globals.version) {
+    ip->handler = labels[OP_SET_GLOBAL];
+    REDISPATCH();
+  }
+  ip->entry->value = TOP;
+  NEXT();
+op_jump:
+  ip = ip->as.target;
+  DISPATCH();
+op_jump_if_false:
+  if (isFalsey(TOP)) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_if_true:
+  if (!isFalsey(TOP)) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_if_false_pop:
+  if (isFalsey(stack->data[stack->top--])) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+op_jump_if_less:
+  THREADED_COMPARE_JUMP(<, true);
+op_jump_if_not_less:
+  THREADED_COMPARE_JUMP(<, false);
+op_jump_if_greater:
+  THREADED_COMPARE_JUMP(>, true);
+op_jump_if_not_greater:
+  THREADED_COMPARE_JUMP(>, false);
+op_loop:
+  vm->backedges++;
+  ip = ip->as.target;
+  DISPATCH();
+op_unimplemented:
+  // run() has no case for these either and steps over them.
+  NEXT();
+op_return:
+done:
+  FREE_ARRAY(Instr, code, count);
+  return result;
+
+#undef TOP
+#undef PEEK
+#undef PUSH
+#undef DISPATCH
+#undef REDISPATCH
+#undef NEXT
+#undef FAIL
+#undef BOTH_NUMBERS
+#undef THREADED_BINARY
+#undef THREADED_NUMBER
+#undef THREADED_UNCHECKED
+#undef THREADED_COMPARE_JUMP
+}
+
+/*
+ * Tail-call dispatch. Every opcode is its own function and ends by calling
+ * the next instruction's handler in tail position, so the compiler turns
+ * each call into a jump and keeps `ip`, the stack top and the locals base
+ * in argument registers for the whole run. musttail guarantees that. GCC
+ * before 15 has no musttail, so the handlers are built with -O2 and
+ * -foptimize-sibling-calls whatever the rest of the file uses; ThreadSanitizer
+ * instruments every return and keeps the frames anyway. Builds that cannot
+ * count on the jumps use runThreaded() instead of growing the C stack by a
+ * frame per instruction.
+ */
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#if defined(MUSTTAIL)
+#define TAILCALL_DISPATCH
+#define SIBLING_CALLS
+#elif defined(__GNUC__) && !defined(__clang__) && defined(__OPTIMIZE__) &&     \
+    !defined(__SANITIZE_THREAD__)
+#define TAILCALL_DISPATCH
+#define MUSTTAIL
+#define SIBLING_CALLS __attribute__((optimize("O2", "optimize-sibling-calls")))
+#endif
+
+#ifdef TAILCALL_DISPATCH
+
+typedef InterpretResult (*Handler)(VM *vm, Instr *ip, Value *sp, Value *slots);
+
+#define HANDLER(name)                                                          \
+  static SIBLING_CALLS InterpretResult name(VM *vm, Instr *ip, Value *sp,      \
+                                            Value *slots)
+
+// Handlers that quickened ones revert to.
+HANDLER(tailAdd);
+HANDLER(tailSubtract);
+HANDLER(tailMultiply);
+HANDLER(tailDivide);
+HANDLER(tailGreater);
+HANDLER(tailLess);
+HANDLER(tailGetGlobal);
+HANDLER(tailSetGlobal);
+
+#define SYNC_TOP() (vm->stack->top = (int)(sp - slots))
+#ifdef DEBUG_VM
+#define TRACE()                                                                \
+  do {                                                                         \
+    SYNC_TOP();                                                                \
+    traceInstruction(vm, ip->offset);                                          \
+  } while (false)
+#else
+#define TRACE()                                                                \
+  do {                                                                         \
+  } while (false)
+#endif
+// Runs the current instruction again after its handler was rewritten.
+#define REDISPATCH()                                                           \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    MUSTTAIL return ((Handler)ip->handler)(vm, ip, sp, slots);                 \
+  } while (false)
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE();                                                                   \
+    REDISPATCH();                                                              \
+  } while (false)
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ip++;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+#define FAIL(...)                                                              \
+  do {                                                                         \
+    SYNC_TOP();                                                                \
+    vm->ip = vm->chunk->code + ip->offset + 1;                                 \
+    runtimeError(vm, __VA_ARGS__);                                             \
+    return INTERPRET_RUNTIME_ERROR;                                            \
+  } while (false)
+#define BOTH_NUMBERS() (IS_NUMBER(sp[0]) && IS_NUMBER(sp[-1]))
+#define TAIL_BINARY(valueType, op, quickened)                                  \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) FAIL("Operands must be numbers.");                    \
+    ip->handler = (const void *)quickened;                                     \
+    TAIL_UNCHECKED(valueType, op);                                             \
+  } while (false)
+#define TAIL_NUMBER(valueType, op, generic)                                    \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) {                                                     \
+      ip->handler = (const void *)generic;                                     \
+      REDISPATCH();                                                            \
+    }                                                                          \
+    TAIL_UNCHECKED(valueType, op);                                             \
+  } while (false)
+#define TAIL_UNCHECKED(valueType, op)                                          \
+  do {                                                                         \
+    double b = AS_NUMBER(*sp);                                                 \
+    sp--;                                                                      \
+    *sp = valueType(AS_NUMBER(*sp) op b);                                      \
+    NEXT();                                                                    \
+  } while (false)
+#define TAIL_COMPARE_JUMP(op, taken)                                           \
+  do {                                                                         \
+    if (!BOTH_NUMBERS()) FAIL("Operands must be numbers.");                    \
+    bool jump = (AS_NUMBER(sp[-1]) op AS_NUMBER(sp[0])) == taken;              \
+    sp -= 2;                                                                   \
+    if (jump) {                                                                \
+      ip = ip->as.target;                                                      \
+      DISPATCH();                                                              \
+    }                                                                          \
+    NEXT();                                                                    \
+  } while (false)
+
+HANDLER(tailConstant) {
+  *++sp = *ip->as.constant;
+  NEXT();
+}
+HANDLER(tailNil) {
+  *++sp = NIL_VAL();
+  NEXT();
+}
+HANDLER(tailTrue) {
+  *++sp = BOOL_VAL(true);
+  NEXT();
+}
+HANDLER(tailFalse) {
+  *++sp = BOOL_VAL(false);
+  NEXT();
+}
+HANDLER(tailNegateN) {
+  *sp = NUMBER_VAL(-AS_NUMBER(*sp));
+  NEXT();
+}
+HANDLER(tailNegate) {
+  if (!IS_NUMBER(*sp)) FAIL("Operand must be a number.");
+  *sp = NUMBER_VAL(-AS_NUMBER(*sp));
+  NEXT();
+}
+HANDLER(tailNot) {
+  *sp = BOOL_VAL(isFalsey(*sp));
+  NEXT();
+}
+HANDLER(tailEqual) {
+  Value b = *sp--;
+  *sp = BOOL_VAL(valuesEqual(*sp, b));
+  NEXT();
+}
+HANDLER(tailAddNum) { TAIL_NUMBER(NUMBER_VAL, +, tailAdd); }
+HANDLER(tailSubtractNum) { TAIL_NUMBER(NUMBER_VAL, -, tailSubtract); }
+HANDLER(tailMultiplyNum) { TAIL_NUMBER(NUMBER_VAL, *, tailMultiply); }
+HANDLER(tailDivideNum) { TAIL_NUMBER(NUMBER_VAL, /, tailDivide); }
+HANDLER(tailGreaterNum) { TAIL_NUMBER(BOOL_VAL, >, tailGreater); }
+HANDLER(tailLessNum) { TAIL_NUMBER(BOOL_VAL, <, tailLess); }
+HANDLER(tailAddStr) {
+  if (!IS_STRING(sp[0]) || !IS_STRING(sp[-1])) {
+    ip->handler = (const void *)tailAdd;
+    REDISPATCH();
+  }
+  Value b = *sp--;
+  *sp = OBJ_VAL(concatStrings(vm, AS_STRING(*sp), AS_STRING(b)));
+  NEXT();
+}
+HANDLER(tailAdd) {
+  if (IS_STRING(sp[0]) && IS_STRING(sp[-1])) {
+    ip->handler = (const void *)tailAddStr;
+    REDISPATCH();
+  }
+  if (!BOTH_NUMBERS()) FAIL("Operands must be two numbers or two strings.");
+  ip->handler = (const void *)tailAddNum;
+  TAIL_UNCHECKED(NUMBER_VAL, +);
+}
+HANDLER(tailSubtract) { TAIL_BINARY(NUMBER_VAL, -, tailSubtractNum); }
+HANDLER(tailMultiply) { TAIL_BINARY(NUMBER_VAL, *, tailMultiplyNum); }
+HANDLER(tailDivide) { TAIL_BINARY(NUMBER_VAL, /, tailDivideNum); }
+HANDLER(tailGreater) { TAIL_BINARY(BOOL_VAL, >, tailGreaterNum); }
+HANDLER(tailLess) { TAIL_BINARY(BOOL_VAL, <, tailLessNum); }
+HANDLER(tailAddNN) { TAIL_UNCHECKED(NUMBER_VAL, +); }
+HANDLER(tailSubtractNN) { TAIL_UNCHECKED(NUMBER_VAL, -); }
+HANDLER(tailMultiplyNN) { TAIL_UNCHECKED(NUMBER_VAL, *); }
+HANDLER(tailDivideNN) { TAIL_UNCHECKED(NUMBER_VAL, /); }
+HANDLER(tailGreaterNN) { TAIL_UNCHECKED(BOOL_VAL, >); }
+HANDLER(tailLessNN) { TAIL_UNCHECKED(BOOL_VAL, <); }
+HANDLER(tailPrint) {
+  sinkPrintLine(&vm->out, *sp--);
+  NEXT();
+}
+HANDLER(tailPop) {
+  sp--;
+  NEXT();
+}
+HANDLER(tailPopN) {
+  sp -= ip->as.operand;
+  NEXT();
+}
+HANDLER(tailPick) {
+  Value value = sp[-ip->as.operand];
+  *++sp = value;
+  NEXT();
+}
+HANDLER(tailGetLocal) {
+  *++sp = slots[ip->as.operand];
+  NEXT();
+}
+HANDLER(tailSetLocal) {
+  slots[ip->as.operand] = *sp;
+  NEXT();
+}
+HANDLER(tailDefineGlobal) {
+  mapInsert(&vm->globals, ip->as.name, *sp--);
+  NEXT();
+}
+HANDLER(tailGetGlobalCached) {
+  if (ip->version != vm->globals.version) {
+    ip->handler = (const void *)tailGetGlobal;
+    REDISPATCH();
+  }
+  *++sp = ip->entry->value;
+  NEXT();
+}
+HANDLER(tailSetGlobalCached) {
+  if (ip->version != vm->globals.version) {
+    ip->handler = (const void *)tailSetGlobal;
+    REDISPATCH();
+  }
+  ip->entry->value = *sp;
+  NEXT();
+}
+HANDLER(tailGetGlobal) {
+  ip->entry = mapGetEntry(&vm->globals, ip->as.name);
+  if (ip->entry == NULL) FAIL("Undefined variable '%s'.", ip->as.name->chars);
+  ip->version = vm->globals.version;
+  ip->handler = (const void *)tailGetGlobalCached;
+  REDISPATCH();
+}
+HANDLER(tailSetGlobal) {
+  ip->entry = mapGetEntry(&vm->globals, ip->as.name);
+  if (ip->entry == NULL) FAIL("Undefined variable '%s'.", ip->as.name->chars);
+  ip->version = vm->globals.version;
+  ip->handler = (const void *)tailSetGlobalCached;
+  REDISPATCH();
+}
+HANDLER(tailJump) {
+  ip = ip->as.target;
+  DISPATCH();
+}
+HANDLER(tailJumpIfFalse) {
+  if (isFalsey(*sp)) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+}
+HANDLER(tailJumpIfTrue) {
+  if (!isFalsey(*sp)) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+}
+HANDLER(tailJumpIfFalsePop) {
+  if (isFalsey(*sp--)) {
+    ip = ip->as.target;
+    DISPATCH();
+  }
+  NEXT();
+}
+HANDLER(tailJumpIfLess) { TAIL_COMPARE_JUMP(<, true); }
+HANDLER(tailJumpIfNotLess) { TAIL_COMPARE_JUMP(<, false); }
+HANDLER(tailJumpIfGreater) { TAIL_COMPARE_JUMP(>, true); }
+HANDLER(tailJumpIfNotGreater) { TAIL_COMPARE_JUMP(>, false); }
+HANDLER(tailLoop) {
+  vm->backedges++;
+  ip = ip->as.target;
+  DISPATCH();
+}
+HANDLER(tailUnimplemented) {
+  // run() has no case for these either and steps over them.
+  NEXT();
+}
+HANDLER(tailReturn) {
+  (void)ip;
+  SYNC_TOP();
+  return INTERPRET_OK;
+}
+
+/**
+ * @brief Runs vm->chunk through its threaded form with one handler function
+ * per opcode chained by tail calls. Behaves exactly like run(), which it
+ * falls back to for a chunk it cannot decode.
+ */
+static InterpretResult runTailCall(VM *vm) {
+  static const void *const handlers[] = {
+      [OP_RETURN] = (const void *)tailReturn,
+      [OP_NEGATE] = (const void *)tailNegate,
+      [OP_SUBTRACT] = (const void *)tailSubtract,
+      [OP_ADD] = (const void *)tailAdd,
+      [OP_MULTIPLY] = (const void *)tailMultiply,
+      [OP_DIVIDE] = (const void *)tailDivide,
+      [OP_NOT] = (const void *)tailNot,
+      [OP_MODULO] = (const void *)tailUnimplemented,
+      [OP_CONSTANT] = (const void *)tailConstant,
+      [OP_CONSTANT_LONG] = (const void *)tailConstant,
+      [OP_NIL] = (const void *)tailNil,
+      [OP_TRUE] = (const void *)tailTrue,
+      [OP_FALSE] = (const void *)tailFalse,
+      [OP_EQUAL] = (const void *)tailEqual,
+      [OP_GREATER] = (const void *)tailGreater,
+      [OP_LESS] = (const void *)tailLess,
+      [OP_PRINT] = (const void *)tailPrint,
+      [OP_POP] = (const void *)tailPop,
+      [OP_DEFINE_GLOBAL] = (const void *)tailDefineGlobal,
+      [OP_GET_GLOBAL] = (const void *)tailGetGlobal,
+      [OP_SET_GLOBAL] = (const void *)tailSetGlobal,
+      [OP_PICK] = (const void *)tailPick,
+      [OP_POPN] = (const void *)tailPopN,
+      [OP_GET_LOCAL] = (const void *)tailGetLocal,
+      [OP_SET_LOCAL] = (const void *)tailSetLocal,
+      [OP_JUMP] = (const void *)tailJump,
+      [OP_JUMP_IF_FALSE] = (const void *)tailJumpIfFalse,
+      [OP_JUMP_IF_TRUE] = (const void *)tailJumpIfTrue,
+      [OP_JUMP_IF_FALSE_POP] = (const void *)tailJumpIfFalsePop,
+      [OP_JUMP_IF_LESS] = (const void *)tailJumpIfLess,
+      [OP_JUMP_IF_NOT_LESS] = (const void *)tailJumpIfNotLess,
+      [OP_JUMP_IF_GREATER] = (const void *)tailJumpIfGreater,
+      [OP_JUMP_IF_NOT_GREATER] = (const void *)tailJumpIfNotGreater,
+      [OP_LOOP] = (const void *)tailLoop,
+      [OP_ADD_NUM] = (const void *)tailAddNum,
+      [OP_ADD_STR] = (const void *)tailAddStr,
+      [OP_SUBTRACT_NUM] = (const void *)tailSubtractNum,
+      [OP_MULTIPLY_NUM] = (const void *)tailMultiplyNum,
+      [OP_DIVIDE_NUM] = (const void *)tailDivideNum,
+      [OP_LESS_NUM] = (const void *)tailLessNum,
+      [OP_GREATER_NUM] = (const void *)tailGreaterNum,
+      [OP_GET_GLOBAL_CACHED] = (const void *)tailGetGlobalCached,
+      [OP_SET_GLOBAL_CACHED] = (const void *)tailSetGlobalCached,
+      [OP_NEGATE_N] = (const void *)tailNegateN,
+      [OP_ADD_NN] = (const void *)tailAddNN,
+      [OP_SUBTRACT_NN] = (const void *)tailSubtractNN,
+      [OP_MULTIPLY_NN] = (const void *)tailMultiplyNN,
+      [OP_DIVIDE_NN] = (const void *)tailDivideNN,
+      [OP_LESS_NN] = (const void *)tailLessNN,
+      [OP_GREATER_NN] = (const void *)tailGreaterNN,
+  };
+
+  int count, maxDepth;
+  Instr *code = threadChunk(vm->chunk, handlers, &count, &maxDepth);
+  if (code == NULL) {
+    vm->ip = vm->chunk->code;
+    return run(vm);
+  }
+  stackReserve(vm->stack, maxDepth);
+
+  Value *slots = vm->stack->data;
+  Value *sp = slots + vm->stack->top;
+  Instr *ip = code;
+  TRACE();
+  COUNT_INSTRUCTION();
+  InterpretResult result = ((Handler)ip->handler)(vm, ip, sp, slots);
+  FREE_ARRAY(Instr, code, count);
+  return result;
+}
+
+#undef SYNC_TOP
+#undef TRACE
+#undef REDISPATCH
+#undef DISPATCH
+#undef NEXT
+#undef FAIL
+#undef BOTH_NUMBERS
+#undef TAIL_BINARY
+#undef TAIL_NUMBER
+#undef TAIL_UNCHECKED
+#undef TAIL_COMPARE_JUMP
+#undef HANDLER
+
+#endif
+
+/**
+ * @brief Runs vm->chunk on the register machine: translates it with
+ * compileRegisters() and dispatches the three-address code with computed
+ * goto. The frame registers are the VM stack's slots, so locals and globals
+ * end up exactly as run() leaves them. Falls back to run() for a chunk it
+ * cannot translate.
+ */
+static InterpretResult runRegister(VM *vm) {
+  static const void *const labels[] = {
+      [ROP_MOVE] = &&rop_move,
+      [ROP_NEGATE] = &&rop_negate,
+      [ROP_NOT] = &&rop_not,
+      [ROP_ADD] = &&rop_add,
+      [ROP_SUBTRACT] = &&rop_subtract,
+      [ROP_MULTIPLY] = &&rop_multiply,
+      [ROP_DIVIDE] = &&rop_divide,
+      [ROP_EQUAL] = &&rop_equal,
+      [ROP_GREATER] = &&rop_greater,
+      [ROP_LESS] = &&rop_less,
+      [ROP_PRINT] = &&rop_print,
+      [ROP_DEFINE_GLOBAL] = &&rop_define_global,
+      [ROP_GET_GLOBAL] = &&rop_get_global,
+      [ROP_SET_GLOBAL] = &&rop_set_global,
+      [ROP_JUMP] = &&rop_jump,
+      [ROP_JUMP_IF_FALSE] = &&rop_jump_if_false,
+      [ROP_JUMP_IF_TRUE] = &&rop_jump_if_true,
+      [ROP_JUMP_IF_LESS] = &&rop_jump_if_less,
+      [ROP_JUMP_IF_NOT_LESS] = &&rop_jump_if_not_less,
+      [ROP_JUMP_IF_GREATER] = &&rop_jump_if_greater,
+      [ROP_JUMP_IF_NOT_GREATER] = &&rop_jump_if_not_greater,
+      [ROP_LOOP] = &&rop_loop,
+      [ROP_RETURN] = &&rop_return,
+      [ROP_NEGATE_N] = &&rop_negate_n,
+      [ROP_ADD_NN] = &&rop_add_nn,
+      [ROP_SUBTRACT_NN] = &&rop_subtract_nn,
+      [ROP_MULTIPLY_NN] = &&rop_multiply_nn,
+      [ROP_DIVIDE_NN] = &&rop_divide_nn,
+      [ROP_LESS_NN] = &&rop_less_nn,
+      [ROP_GREATER_NN] = &&rop_greater_nn,
+  };
+
+  RegCode code;
+  if (!compileRegisters(vm->chunk, &code)) {
+    vm->ip = vm->chunk->code;
+    return run(vm);
+  }
+#ifdef DEBUG_PRINT_CODE
+  disassembleRegCode(&code, "registers");
+#endif
+  stackReserve(vm->stack, code.registerCount);
+  Value *registers = vm->stack->data;
+  loadRegisterConstants(vm->chunk, &code, registers);
+
+  InterpretResult result = INTERPRET_OK;
+  RegInstr *start = code.code.values;
+  RegInstr *ip = start;
+
+#define A (registers[ip->a])
+#define B (registers[ip->b])
+#define C (registers[ip->c])
+#ifdef DEBUG_VM
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    disassembleRegInstruction(&code, (int)(ip - start));                       \
+    COUNT_INSTRUCTION();                                                       \
+    goto *labels[ip->op];                                                      \
+  } while (false)
+#else
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    COUNT_INSTRUCTION();                                                       \
+    goto *labels[ip->op];                                                      \
+  } while (false)
+#endif
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ip++;                                                                      \
+    DISPATCH();                                                                \
+  } while (false)
+#define JUMP()                                                                 \
+  do {                                                                         \
+    ip = start + ip->as.target;                                                \
+    DISPATCH();                                                                \
+  } while (false)
+#define FAIL(...)                                                              \
+  do {                                                                         \
+    vm->ip = vm->chunk->code + ip->offset + 1;                                 \
+    runtimeError(vm, __VA_ARGS__);                                             \
+    result = INTERPRET_RUNTIME_ERROR;                                          \
+    goto done;                                                                 \
+  } while (false)
+#define REGISTER_BINARY(valueType, op)                                         \
+  do {                                                                         \
+    if (!IS_NUMBER(B) || !IS_NUMBER(C)) FAIL("Operands must be numbers.");     \
+    REGISTER_UNCHECKED(valueType, op);                                         \
+  } while (false)
+#define REGISTER_UNCHECKED(valueType, op)                                      \
+  do {                                                                         \
+    A = valueType(AS_NUMBER(B) op AS_NUMBER(C));                               \
+    NEXT();                                                                    \
+  } while (false)
+#define REGISTER_COMPARE_JUMP(op, taken)                                       \
+  do {                                                                         \
+    if (!IS_NUMBER(B) || !IS_NUMBER(C)) FAIL("Operands must be numbers.");     \
+    if ((AS_NUMBER(B) op AS_NUMBER(C)) == taken) JUMP();                       \
+    NEXT();                                                                    \
+  } while (false)
+// Looks up the global named by the current instruction, through its cache.
+#define GLOBAL_ENTRY()                                                         \
+  do {                                                                         \
+    if (ip->entry == NULL || ip->version != vm->globals.version) {             \
+      ip->entry = mapGetEntry(&vm->globals, ip->as.name);                      \
+      if (ip->entry == NULL) {                                                 \
+        FAIL("Undefined variable '%s'.", ip->as.name->chars);                  \
+      }                                                                        \
+      ip->version = vm->globals.version;                                       \
+    }                                                                          \
+  } while (false)
+
+  DISPATCH();
+
+rop_move:
+  A = B;
+  NEXT();
+rop_negate:
+  if (!IS_NUMBER(B)) FAIL("Operand must be a number.");
+  // Fall through.
+rop_negate_n:
+  A = NUMBER_VAL(-AS_NUMBER(B));
+  NEXT();
+rop_not:
+  A = BOOL_VAL(isFalsey(B));
+  NEXT();
+rop_add:
+  if (IS_NUMBER(B) && IS_NUMBER(C)) REGISTER_UNCHECKED(NUMBER_VAL, +);
+  if (!IS_STRING(B) || !IS_STRING(C)) {
+    FAIL("Operands must be two numbers or two strings.");
+  }
+  A = OBJ_VAL(concatStrings(vm, AS_STRING(B), AS_STRING(C)));
+  NEXT();
+rop_subtract:
+  REGISTER_BINARY(NUMBER_VAL, -);
+rop_multiply:
+  REGISTER_BINARY(NUMBER_VAL, *);
+rop_divide:
+  REGISTER_BINARY(NUMBER_VAL, /);
+rop_greater:
+  REGISTER_BINARY(BOOL_VAL, >);
+rop_less:
+  REGISTER_BINARY(BOOL_VAL, <);
+rop_add_nn:
+  REGISTER_UNCHECKED(NUMBER_VAL, +);
+rop_subtract_nn:
+  REGISTER_UNCHECKED(NUMBER_VAL, -);
+rop_multiply_nn:
+  REGISTER_UNCHECKED(NUMBER_VAL, *);
+rop_divide_nn:
+  REGISTER_UNCHECKED(NUMBER_VAL, /);
+rop_greater_nn:
+  REGISTER_UNCHECKED(BOOL_VAL, >);
+rop_less_nn:
+  REGISTER_UNCHECKED(BOOL_VAL, <);
+rop_equal:
+  A = BOOL_VAL(valuesEqual(B, C));
+  NEXT();
+rop_print:
+  sinkPrintLine(&vm->out, A);
+  NEXT();
+rop_define_global:
+  mapInsert(&vm->globals, ip->as.name, A);
+  NEXT();
+rop_get_global:
+  GLOBAL_ENTRY();
+  A = ip->entry->value;
+  NEXT();
+rop_set_global:
+  GLOBAL_ENTRY();
+  ip->entry->value = A;
+  NEXT();
+rop_jump:
+  JUMP();
+rop_jump_if_false:
+  if (isFalsey(A)) JUMP();
+  NEXT();
+rop_jump_if_true:
+  if (!isFalsey(A)) JUMP();
+  NEXT();
+rop_jump_if_less:
+  REGISTER_COMPARE_JUMP(<, true);
+rop_jump_if_not_less:
+  REGISTER_COMPARE_JUMP(<, false);
+rop_jump_if_greater:
+  REGISTER_COMPARE_JUMP(>, true);
+rop_jump_if_not_greater:
+  REGISTER_COMPARE_JUMP(>, false);
+rop_loop:
+  vm->backedges++;
+  JUMP();
+rop_return:
+done:
+  freeRegCode(&code);
+  return result;
+
+#undef A
+#undef B
+#undef C
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef FAIL
+#undef REGISTER_BINARY
+#undef REGISTER_UNCHECKED
+#undef REGISTER_COMPARE_JUMP
+#undef GLOBAL_ENTRY
+}
+
+/**
+ * @brief Runs `chunk`, through native code when the JIT is enabled and can
+ * compile it; native code hands back to run() at any instruction it cannot
+ * execute, and run() re-enters it on the next loop backedge. Otherwise the
+ * chunk runs with vm->dispatch.
+ */
+static InterpretResult execute(VM *vm, Chunk *chunk) {
+  JitCode native;
+  vm->chunk = chunk;
+  vm->native = NULL;
+  vm->runs++;
+  if (vm->jit && jitCompile(chunk, &native)) vm->native = &native;
+
+  InterpretResult result = INTERPRET_OK;
+  if (vm->native != NULL) {
+    int exit = jitEnter(vm, vm->native, 0);
+    if (exit >= 0) {
+      vm->ip = chunk->code + exit;
+      result = run(vm);
+    }
+  } else if (vm->dispatch == DISPATCH_THREADED) {
+    result = runThreaded(vm);
+  } else if (vm->dispatch == DISPATCH_REGISTER) {
+    result = runRegister(vm);
+  } else if (vm->dispatch == DISPATCH_TAILCALL) {
+#ifdef TAILCALL_DISPATCH
+    result = runTailCall(vm);
+#else
+    result = runThreaded(vm);
+#endif
+  } else {
+    vm->ip = chunk->code;
+    result = run(vm);
+  }
+
+  if (vm->native != NULL) {
+    jitFree(vm->native);
+    vm->native = NULL;
+  }
+  return result;
 }
 
 InterpretResult interpret(VM *vm, const char *src) {
@@ -180,10 +1494,61 @@ InterpretResult interpret(VM *vm, const char *src) {
     return INTERPRET_COMPILE_ERROR;
   }
 
-  vm->chunk = &chunk;
-  vm->ip = vm->chunk->code;
-  InterpretResult result = run(vm);
+  InterpretResult result = execute(vm, &chunk);
 
   freeChunk(&chunk);
   return result;
 }
+
+void initSession(Session *session) {
+  initChunk(&session->chunk);
+  mapInit(&session->names);
+}
+
+void freeSession(Session *session) {
+  freeChunk(&session->chunk);
+  mapReset(&session->names);
+}
+
+/**
+ * @brief Drops the constants a line added from `mark` on, except the global
+ * names, which are compacted down and re-indexed in the name cache.
+ */
+static void dropLineConstants(Session *session, int mark) {
+  ValueArray *constants = &session->chunk.constants;
+  int kept = mark;
+
+  for (int i = mark; i < constants->length; i++) {
+    Value value = constants->values[i];
+    Value index;
+    if (!IS_STRING(value)) continue;
+    if (!mapGet(&session->names, AS_STRING(value), &index)) continue;
+    if ((int)AS_NUMBER(index) != i) continue;
+
+    mapInsert(&session->names, AS_STRING(value), NUMBER_VAL(kept));
+    constants->values[kept++] = value;
+  }
+  constants->length = kept;
+}
+
+InterpretResult interpretLine(VM *vm, Session *session, const char *src) {
+  Chunk *chunk = &session->chunk;
+  // A line of n characters adds at most (n + 1) / 2 constants. When they
+  // might not all get a one-byte index behind the names earlier lines kept,
+  // forget those names; the globals themselves stay in vm->globals.
+  if (chunk->constants.length + (strlen(src) + 1) / 2 > UINT8_COUNT) {
+    chunk->constants.length = 0;
+    mapReset(&session->names);
+  }
+  int mark = chunk->constants.length;
+  chunk->length = 0;
+  chunk->lines.length = 0;
+
+  InterpretResult result = INTERPRET_COMPILE_ERROR;
+  if (compileWithNames(vm, src, chunk, &session->names)) {
+    result = execute(vm, chunk);
+  }
+
+  dropLineConstants(session, mark);
+  return result;
+}
@@ -2,19 +2,64 @@
 #define svm_vm_h
 
 #include "chunk.h"
+#include "jit.h"
 #include "map.h"
+#include "sink.h"
 #include "stack.h"
 
+// The macros below work on run()'s locals: `stack`, and `tos`, the cached
+// value of the top slot. The slot under it, SECOND, is always in memory.
+#define SECOND (stack->data[stack->top - 1])
+
 #define BINARY_OP(vm, valueType, op)                                           \
   do {                                                                         \
-    if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) {                  \
+    if (!IS_NUMBER(tos) || !IS_NUMBER(SECOND)) {                               \
+      runtimeError(vm, "Operands must be numbers.");                           \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+    }                                                                          \
+    UNCHECKED_OP(vm, valueType, op);                                           \
+  } while (false)
+
+// Rewrites the generic arithmetic instruction just read into its
+// number-only form when both operands are numbers.
+#define QUICKEN_NUMBER(vm, quickened)                                          \
+  do {                                                                         \
+    if (IS_NUMBER(tos) && IS_NUMBER(SECOND)) vm->ip[-1] = quickened;           \
+  } while (false)
+
+// Number-only form of BINARY_OP. If either operand is not a number the
+// instruction reverts to `generic` and is dispatched again.
+#define NUMBER_OP(vm, valueType, op, generic)                                  \
+  do {                                                                         \
+    if (!IS_NUMBER(tos) || !IS_NUMBER(SECOND)) {                               \
+      *--vm->ip = generic;                                                     \
+      break;                                                                   \
+    }                                                                          \
+    UNCHECKED_OP(vm, valueType, op);                                           \
+  } while (false)
+
+// Unchecked form of BINARY_OP for operands the compiler proved are numbers.
+// The result replaces both operands and stays cached.
+#define UNCHECKED_OP(vm, valueType, op)                                        \
+  do {                                                                         \
+    stack->top--;                                                              \
+    tos = valueType(AS_NUMBER(stack->data[stack->top]) op AS_NUMBER(tos));     \
+  } while (false)
+
+// Fused compare-and-branch: pops two numbers and takes the 16-bit forward
+// jump that follows when `a op b` equals `taken`.
+#define COMPARE_JUMP(vm, op, taken)                                            \
+  do {                                                                         \
+    if (!IS_NUMBER(tos) || !IS_NUMBER(SECOND)) {                               \
       runtimeError(vm, "Operands must be numbers.");                           \
       return INTERPRET_RUNTIME_ERROR;                                          \
     }                                                                          \
                                                                                \
-    double b = AS_NUMBER(stackPop(vm->stack));                                 \
-    double a = AS_NUMBER(stackPop(vm->stack));                                 \
-    stackPush(vm->stack, valueType(a op b));                                   \
+    bool jump = (AS_NUMBER(SECOND) op AS_NUMBER(tos)) == taken;                \
+    stack->top -= 2;                                                           \
+    tos = stack->data[stack->top];                                             \
+    uint16_t offset = READ_SHORT();                                            \
+    if (jump) vm->ip += offset;                                                \
   } while (false)
 
 #define BINARY_FUNC(vm, func)                                                  \
@@ -24,6 +69,16 @@
     stackPush(vm->stack, func(a, b));                                          \
   } while (false)
 
+// How run-time bytecode is dispatched when it is not running natively.
+typedef enum {
+  DISPATCH_THREADED, // Pre-decoded instructions, computed goto
+  DISPATCH_SWITCH,   // A switch over the bytecode itself
+  DISPATCH_REGISTER, // Translated to register code, see regcode.h
+  DISPATCH_TAILCALL, // Pre-decoded instructions, one function per opcode
+} Dispatch;
+
+typedef struct ObjFiber ObjFiber;
+
 typedef struct VM {
   Chunk *chunk;
   Stack *stack;
@@ -31,6 +86,18 @@ typedef struct VM {
   hashMap strings;
   Obj *objects;
   hashMap globals;
+  bool optimize;
+  uint64_t backedges; // Taken OP_LOOP instructions since initVM
+  // Instructions interpreted since initVM, counted only in builds with
+  // COUNT_INSTRUCTIONS; native code from the JIT is not counted
+  uint64_t instructions;
+  bool jit;
+  JitCode *native; // Native code for `chunk` while it runs, or NULL
+  Dispatch dispatch;
+  Sink out;  // Where print writes, stdout unless the host redirects it
+  FILE *err; // Where compile and runtime errors are reported
+  ObjFiber *fiber; // The fiber running, or NULL while the script itself runs
+  uint32_t runs;   // Chunks execute() has started, to tell stale fibers apart
 } VM;
 
 typedef enum {
@@ -39,8 +106,24 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+/**
+ * @brief State kept across the lines of an interactive session.
+ *
+ * Every line is compiled into the same chunk, reusing its code buffer and the
+ * constant indices of global names earlier lines already introduced. The
+ * names are forgotten once they leave a line too few one-byte indices.
+ */
+typedef struct {
+  Chunk chunk;
+  hashMap names; // Global name -> constant index in chunk
+} Session;
+
 void initVM(VM *vm);
 void closeVM(VM *vm);
 InterpretResult interpret(VM *vm, const char *src);
 
+void initSession(Session *session);
+void freeSession(Session *session);
+InterpretResult interpretLine(VM *vm, Session *session, const char *src);
+
 #endif
@@ -0,0 +1,446 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/compiler.h"
+#include "../src/object.h"
+#include "../src/sink.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRIPT_COUNT 400
+#define THREAD_COUNT 8
+
+typedef struct {
+  char *src;
+  Chunk expected;
+  bool compiled;
+  bool matches;
+} Job;
+
+static Job jobs[SCRIPT_COUNT];
+static int nextJob = 0;
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Scripts differ in size, constants, names, scopes and jumps so that any
+// state leaking between concurrent compilations shows up in the bytecode.
+static char *makeScript(int n) {
+  size_t capacity = 64 * 1024;
+  char *src = malloc(capacity);
+  int len = 0;
+
+  len += sprintf(src + len, "var g%d = %d;\n", n, n);
+  for (int i = 0; i < 5 + n % 13; i++) {
+    len += sprintf(src + len,
+                   "{ var a = %d; var b = \"s%d_%d\";\n"
+                   "  for (var i = 0; i < %d; i = i + 1) {\n"
+                   "    if (a >= i and i != %d) g%d = g%d + a * %d.5;\n"
+                   "    else { print b; a = a - 1; }\n"
+                   "  }\n"
+                   "  while (a <= %d or !a) a = a + 1;\n"
+                   "}\n",
+                   i * n, n, i, i % 9, n % 5, n, n, i, n % 13);
+  }
+  len += sprintf(src + len, "print g%d;\n", n);
+  assert((size_t)len < capacity);
+  return src;
+}
+
+static bool constantsEqual(Value a, Value b) {
+  if (a.type != b.type) return false;
+  if (IS_STRING(a)) {
+    ObjString *x = AS_STRING(a);
+    ObjString *y = AS_STRING(b);
+    return x->length == y->length && memcmp(x->chars, y->chars, x->length) == 0;
+  }
+  return valuesEqual(a, b);
+}
+
+static bool chunksEqual(Chunk *a, Chunk *b) {
+  if (a->length != b->length) return false;
+  if (memcmp(a->code, b->code, a->length) != 0) return false;
+  if (a->constants.length != b->constants.length) return false;
+  for (int i = 0; i < a->constants.length; i++) {
+    if (!constantsEqual(a->constants.values[i], b->constants.values[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  VM vm;
+  initVM(&vm);
+
+  for (;;) {
+    pthread_mutex_lock(&jobLock);
+    int n = nextJob++;
+    pthread_mutex_unlock(&jobLock);
+    if (n >= SCRIPT_COUNT) break;
+
+    Chunk chunk;
+    initChunk(&chunk);
+    jobs[n].compiled = compile(&vm, jobs[n].src, &chunk);
+    jobs[n].matches = chunksEqual(&chunk, &jobs[n].expected);
+    freeChunk(&chunk);
+  }
+
+  closeVM(&vm);
+  return NULL;
+}
+
+void test_concurrent_compiles() {
+  printf("Testing %d scripts on %d threads...\n", SCRIPT_COUNT, THREAD_COUNT);
+
+  // Reference output, compiled one script at a time.
+  VM serial;
+  initVM(&serial);
+  for (int n = 0; n < SCRIPT_COUNT; n++) {
+    jobs[n].src = makeScript(n);
+    initChunk(&jobs[n].expected);
+    assert(compile(&serial, jobs[n].src, &jobs[n].expected));
+  }
+
+  pthread_t threads[THREAD_COUNT];
+  for (int i = 0; i < THREAD_COUNT; i++) {
+    assert(pthread_create(&threads[i], NULL, worker, NULL) == 0);
+  }
+  for (int i = 0; i < THREAD_COUNT; i++) pthread_join(threads[i], NULL);
+
+  for (int n = 0; n < SCRIPT_COUNT; n++) {
+    assert(jobs[n].compiled);
+    assert(jobs[n].matches);
+    freeChunk(&jobs[n].expected);
+    free(jobs[n].src);
+  }
+  closeVM(&serial);
+  printf("  ✓ every chunk matches its serial compilation\n");
+}
+
+// Counts bytes equal to `op`; only meaningful for opcodes numbered above
+// every operand byte in the chunk.
+static int countOp(Chunk *chunk, uint8_t op) {
+  int count = 0;
+  for (int i = 0; i < chunk->length; i++) count += chunk->code[i] == op;
+  return count;
+}
+
+static void compileInto(VM *vm, const char *src, Chunk *chunk) {
+  initChunk(chunk);
+  assert(compile(vm, src, chunk));
+}
+
+void test_unchecked_ops() {
+  printf("Testing type inference...\n");
+  VM vm;
+  initVM(&vm);
+  Chunk chunk;
+
+  compileInto(&vm, "print 1 + 2 * 3;", &chunk);
+  assert(countOp(&chunk, OP_ADD_NN) == 1 && countOp(&chunk, OP_MULTIPLY_NN) == 1);
+  freeChunk(&chunk);
+  printf("  ✓ literal arithmetic is unchecked\n");
+
+  compileInto(&vm, "{ var a = 1; print a + 1; }", &chunk);
+  assert(countOp(&chunk, OP_ADD_NN) == 1);
+  freeChunk(&chunk);
+  compileInto(&vm, "print (g - 1) * 2;", &chunk);
+  assert(chunk.code[4] == OP_SUBTRACT && chunk.code[7] == OP_MULTIPLY_NN);
+  freeChunk(&chunk);
+  printf("  ✓ numeric locals are trusted, globals are not\n");
+
+  // The assignment comes after the read it invalidates.
+  compileInto(&vm,
+              "{ var a = 1; while (true) { print a + 1; a = \"s\"; } }",
+              &chunk);
+  assert(countOp(&chunk, OP_ADD_NN) == 0 && chunk.code[10] == OP_ADD);
+  freeChunk(&chunk);
+  printf("  ✓ a non-number assignment downgrades earlier reads\n");
+
+  closeVM(&vm);
+}
+
+// Counts instructions with opcode `op`, walking the chunk one instruction at
+// a time so operand bytes are never mistaken for opcodes.
+static int countInstructions(Chunk *chunk, uint8_t op) {
+  int count = 0;
+  for (int i = 0; i < chunk->length; i += instructionLength(chunk->code[i])) {
+    count += chunk->code[i] == op;
+  }
+  return count;
+}
+
+// Runs `src` in a fresh VM and hands back its status, what it printed and
+// what it reported, both of which the caller frees.
+static InterpretResult runCaptured(const char *src, bool optimize, char **out,
+                                   char **err) {
+  size_t outSize, errSize;
+  VM vm;
+  initVM(&vm);
+  vm.optimize = optimize;
+  sinkFree(&vm.out);
+  sinkInit(&vm.out, -1);
+  vm.err = open_memstream(err, &errSize);
+  InterpretResult result = interpret(&vm, src);
+  fclose(vm.err);
+  *out = sinkTake(&vm.out, &outSize);
+  closeVM(&vm);
+  return result;
+}
+
+// Requires the optimized and unoptimized builds of `src` to print and report
+// the same things.
+static void assertSameBehaviour(const char *src) {
+  char *plainOut, *plainErr, *optOut, *optErr;
+  InterpretResult plain = runCaptured(src, false, &plainOut, &plainErr);
+  InterpretResult optimized = runCaptured(src, true, &optOut, &optErr);
+  assert(plain == optimized);
+  assert(strcmp(plainOut, optOut) == 0);
+  assert(strcmp(plainErr, optErr) == 0);
+  free(plainOut);
+  free(plainErr);
+  free(optOut);
+  free(optErr);
+}
+
+void test_optimizer() {
+  printf("Testing the optimizer...\n");
+  VM vm;
+  initVM(&vm);
+  vm.optimize = true;
+  Chunk chunk;
+
+  compileInto(&vm, "print 1 + 2 * 3;", &chunk);
+  assert(chunk.length == 4 && chunk.code[0] == OP_CONSTANT &&
+         chunk.code[2] == OP_PRINT && chunk.code[3] == OP_RETURN);
+  assert(AS_NUMBER(chunk.constants.values[chunk.code[1]]) == 7);
+  freeChunk(&chunk);
+  printf("  ✓ constant operators fold into one constant\n");
+
+  assert(interpret(&vm, "var a = 2; var b = \"s\";") == INTERPRET_OK);
+  compileInto(&vm, "print a; print a + a * a;", &chunk);
+  assert(countInstructions(&chunk, OP_GET_GLOBAL) == 2);
+  assert(countInstructions(&chunk, OP_PICK) == 3);
+  freeChunk(&chunk);
+  printf("  ✓ repeated loads of a defined global are reused\n");
+
+  compileInto(&vm, "print (a == b) == !(a == b);", &chunk);
+  assert(countInstructions(&chunk, OP_EQUAL) == 2);
+  freeChunk(&chunk);
+  printf("  ✓ a repeated subexpression is computed once\n");
+
+  // The load of an undefined global may fail, so it stays where it is used.
+  compileInto(&vm, "print c + c;", &chunk);
+  assert(countInstructions(&chunk, OP_GET_GLOBAL) == 2);
+  assert(countInstructions(&chunk, OP_PICK) == 0);
+  freeChunk(&chunk);
+  printf("  ✓ loads that may fail are not shared\n");
+
+  assertSameBehaviour("var x = 2; var y = 3; print x * y + x * y;"
+                      "x = \"s\"; print x + x; y = x == x; print !y == !y;");
+  assertSameBehaviour("var a = 1; var b = a + a; print b * b - a;");
+  printf("  ✓ results match the unoptimized build\n");
+
+  assertSameBehaviour("var x = \"s\"; var y = 1; print nope + x * y + x * y;");
+  assertSameBehaviour("var x = \"s\"; var y = 1; print x * y + nope + x * y;");
+  assertSameBehaviour("var a = 1; print -nil + (b == a) + (b == a);");
+  assertSameBehaviour("var a = 1; print a + a; print a = \"s\"; print -a + 1;");
+  printf("  ✓ errors match the unoptimized build\n");
+
+  closeVM(&vm);
+}
+
+// Compiles `src`, which must fail, and hands back what the compiler
+// reported; the caller frees it.
+static char *compileError(const char *src) {
+  char *err;
+  size_t errSize;
+  VM vm;
+  initVM(&vm);
+  vm.err = open_memstream(&err, &errSize);
+  Chunk chunk;
+  initChunk(&chunk);
+  assert(!compile(&vm, src, &chunk));
+  fclose(vm.err);
+  freeChunk(&chunk);
+  closeVM(&vm);
+  return err;
+}
+
+void test_locals() {
+  printf("Testing locals...\n");
+  VM vm;
+  initVM(&vm);
+  Chunk chunk;
+
+  compileInto(&vm, "{ var a = 1; var b = 2; print b; "
+                   "{ var a = 3; print a; } print a; }",
+              &chunk);
+  const uint8_t expected[] = {
+      OP_CONSTANT,  0, OP_CONSTANT,  1, OP_GET_LOCAL, 1, OP_PRINT,
+      OP_CONSTANT,  2, OP_GET_LOCAL, 2, OP_PRINT,     OP_POP,
+      OP_GET_LOCAL, 0, OP_PRINT,     OP_POPN, 2,      OP_RETURN};
+  assert(chunk.length == (int)sizeof(expected));
+  assert(memcmp(chunk.code, expected, sizeof(expected)) == 0);
+  freeChunk(&chunk);
+  printf("  ✓ slots follow declarations and inner locals shadow outer ones\n");
+  printf("  ✓ a scope drops its locals with one OP_POP or OP_POPN\n");
+
+  // A full scope has one local more than an OP_POPN operand can count.
+  char src[UINT8_COUNT * 20 + 64] = "{";
+  char local[32];
+  for (int i = 0; i < UINT8_COUNT; i++) {
+    snprintf(local, sizeof(local), " var l%d = true;", i);
+    strcat(src, local);
+  }
+  strcat(src, " } { var z = 7; print z; }");
+  compileInto(&vm, src, &chunk);
+  int end = UINT8_COUNT; // One OP_TRUE per local
+  assert(chunk.code[end] == OP_POPN && chunk.code[end + 1] == UINT8_MAX &&
+         chunk.code[end + 2] == OP_POP);
+  freeChunk(&chunk);
+  char *out;
+  char *err;
+  assert(runCaptured(src, false, &out, &err) == INTERPRET_OK);
+  assert(strcmp(out, "7\n") == 0);
+  free(out);
+  free(err);
+  printf("  ✓ a scope of %d locals is dropped in full\n", UINT8_COUNT);
+
+  err = compileError("var a = 1; { var a = 1; { var a = a + 1; } }");
+  assert(strstr(err, "Can't read local variable in its own initializer.") !=
+         NULL);
+  free(err);
+  err = compileError("{ var a = 1; var a = 2; }");
+  assert(strstr(err, "Already a variable with this name in this scope.") !=
+         NULL);
+  free(err);
+  printf("  ✓ a local cannot be read in its own initializer or redeclared\n");
+
+  assert(runCaptured("var a = \"g\"; { var a = 1; { var b = a + 1; print b; }"
+                     " print a; } print a;",
+                     false, &out, &err) == INTERPRET_OK);
+  assert(strcmp(out, "2\n1\ng\n") == 0 && err[0] == '\0');
+  free(out);
+  free(err);
+  printf("  ✓ globals are visible again once the scope ends\n");
+
+  closeVM(&vm);
+}
+
+// Compiles `src` and requires exactly the bytes in `expected`.
+static void assertCompiles(VM *vm, const char *src, const uint8_t *expected,
+                           int length) {
+  Chunk chunk;
+  compileInto(vm, src, &chunk);
+  assert(chunk.length == length);
+  assert(memcmp(chunk.code, expected, (size_t)length) == 0);
+  freeChunk(&chunk);
+}
+
+// Builds `prefix`, `count` copies of `body` and `suffix` into a new string.
+static char *repeat(const char *prefix, const char *body, int count,
+                    const char *suffix) {
+  size_t length = strlen(prefix) + strlen(body) * count + strlen(suffix);
+  char *src = malloc(length + 1);
+  strcpy(src, prefix);
+  for (int i = 0; i < count; i++) strcat(src, body);
+  strcat(src, suffix);
+  return src;
+}
+
+void test_control_flow() {
+  printf("Testing control flow...\n");
+  VM vm;
+  initVM(&vm);
+
+  const uint8_t ifLess[] = {OP_GET_GLOBAL, 0, OP_CONSTANT, 1,
+                            OP_JUMP_IF_NOT_LESS, 3, 0, OP_CONSTANT, 2,
+                            OP_PRINT, OP_RETURN};
+  assertCompiles(&vm, "if (g < 1) print 1;", ifLess, sizeof(ifLess));
+  const uint8_t whileAtLeast[] = {OP_GET_GLOBAL, 0, OP_CONSTANT, 1,
+                                  OP_JUMP_IF_LESS, 6, 0, OP_CONSTANT, 2,
+                                  OP_PRINT, OP_LOOP, 13, 0, OP_RETURN};
+  assertCompiles(&vm, "while (g >= 1) print 1;", whileAtLeast,
+                 sizeof(whileAtLeast));
+  const uint8_t ifAtMost[] = {OP_GET_GLOBAL, 0, OP_CONSTANT, 1,
+                              OP_JUMP_IF_GREATER, 3, 0, OP_CONSTANT, 2,
+                              OP_PRINT, OP_RETURN};
+  assertCompiles(&vm, "if (g <= 1) print 1;", ifAtMost, sizeof(ifAtMost));
+  printf("  ✓ comparisons in conditions become compare-and-branch jumps\n");
+
+  // The jump of `and` lands right after OP_LESS, with the value to test.
+  const uint8_t ifAnd[] = {OP_GET_GLOBAL, 0, OP_JUMP_IF_FALSE, 6, 0, OP_POP,
+                           OP_GET_GLOBAL, 0, OP_CONSTANT, 1, OP_LESS,
+                           OP_JUMP_IF_FALSE_POP, 3, 0, OP_CONSTANT, 2,
+                           OP_PRINT, OP_RETURN};
+  assertCompiles(&vm, "if (g and g < 1) print 1;", ifAnd, sizeof(ifAnd));
+  printf("  ✓ a comparison another jump lands after is left alone\n");
+
+  // Three bytes per statement, so the body needs more than 65535 / 3.
+  char *src = repeat("if (g) {", "print g;", 22000, "}");
+  char *err = compileError(src);
+  assert(strstr(err, "Too much code to jump over.") != NULL);
+  free(err);
+  free(src);
+  src = repeat("while (g) {", "print g;", 22000, "}");
+  err = compileError(src);
+  assert(strstr(err, "Loop body too large.") != NULL);
+  free(err);
+  free(src);
+  printf("  ✓ jumps past 16-bit offsets are compile errors\n");
+
+  closeVM(&vm);
+}
+
+void test_session() {
+  printf("Testing sessions...\n");
+  VM vm;
+  initVM(&vm);
+  Session session;
+  initSession(&session);
+  char line[64];
+
+  for (int i = 0; i < 600; i++) {
+    snprintf(line, sizeof(line), "var g%d = %d;", i, i);
+    assert(interpretLine(&vm, &session, line) == INTERPRET_OK);
+  }
+  assert(interpretLine(&vm, &session, "var r = g0 + g299 + g599;") ==
+         INTERPRET_OK);
+  Value value;
+  assert(mapGet(&vm.globals, copyString(&vm, "r", 1), &value));
+  assert(AS_NUMBER(value) == 898);
+  printf("  ✓ lines keep defining globals past 256 names\n");
+
+  // A line naming 200 globals fits no matter how many names came before.
+  char src[8 * 200] = "r = 0";
+  for (int i = 0; i < 200; i++) {
+    snprintf(line, sizeof(line), " + g%d", i);
+    strcat(src, line);
+  }
+  strcat(src, ";");
+  for (int i = 0; i < 2; i++) {
+    assert(interpretLine(&vm, &session, src) == INTERPRET_OK);
+    assert(mapGet(&vm.globals, copyString(&vm, "r", 1), &value));
+    assert(AS_NUMBER(value) == 19900);
+  }
+  printf("  ✓ a line naming many globals compiles after earlier lines\n");
+
+  freeSession(&session);
+  closeVM(&vm);
+}
+
+int main(void) {
+  printf("Running compiler tests...\n\n");
+
+  test_concurrent_compiles();
+  test_unchecked_ops();
+  test_optimizer();
+  test_locals();
+  test_control_flow();
+  test_session();
+
+  printf("\n✅ All tests passed!\n");
+  return 0;
+}
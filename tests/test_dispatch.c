@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/compiler.h"
+#include "../src/object.h"
+#include "../src/regcode.h"
+#include "../src/vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MODE_COUNT 4
+
+static const Dispatch modes[MODE_COUNT] = {DISPATCH_SWITCH, DISPATCH_THREADED,
+                                           DISPATCH_REGISTER, DISPATCH_TAILCALL};
+
+// Runs `src` under every dispatch mode and requires the same result and the
+// same final value of the global `r`.
+static void assertSameResult(const char *src) {
+  Value results[MODE_COUNT];
+  InterpretResult statuses[MODE_COUNT];
+
+  for (int m = 0; m < MODE_COUNT; m++) {
+    VM vm;
+    initVM(&vm);
+    vm.dispatch = modes[m];
+    statuses[m] = interpret(&vm, src);
+    ObjString *name = copyString(&vm, "r", 1);
+    if (!mapGet(&vm.globals, name, &results[m])) results[m] = NIL_VAL();
+    if (IS_STRING(results[m])) {
+      // Strings belong to the VM; compare their length instead.
+      results[m] = NUMBER_VAL(AS_STRING(results[m])->length);
+    }
+    closeVM(&vm);
+  }
+
+  for (int m = 1; m < MODE_COUNT; m++) {
+    assert(statuses[0] == statuses[m]);
+    assert(results[0].type == results[m].type);
+    if (IS_NUMBER(results[0])) {
+      assert(AS_NUMBER(results[0]) == AS_NUMBER(results[m]));
+    } else if (IS_BOOL(results[0])) {
+      assert(AS_BOOL(results[0]) == AS_BOOL(results[m]));
+    }
+  }
+}
+
+void test_programs() {
+  printf("Testing dispatch modes agree...\n");
+
+  const char *tests[] = {
+      "var r = 0; for (var i = 0; i < 1000; i = i + 1) r = r + i * 2 - i / 4;",
+      "var r = \"\"; for (var i = 0; i < 10; i = i + 1) r = r + \"ab\";",
+      // Quickened instructions that see other types later.
+      "var r = 0; var x = 1; for (var i = 0; i < 6; i = i + 1) "
+      "{ if (i == 3) x = \"s\"; r = x + x; }",
+      // Globals defined while cached reads are live.
+      "var r = 0; for (var i = 0; i < 5; i = i + 1) { r = r + 1; var g = i; }",
+      "var r = 1; { var a = 2; var b = 3; r = (a < b) == !(a >= b) and b; }",
+      // Locals overwritten while copies of them are still pending.
+      "var r = 0; { var a = 1; var b = a; a = 7; var c = b + a; b = c; a = b; "
+      "var d = a; d = d * 2; r = a + b + c + d; }",
+      // Reads of the local that is itself the top of the stack.
+      "var r = 0; { var a = 5; r = a + a; { var b = a; r = r * b; } }",
+      "var r = 0; r = r + undefined;",
+      "var r = -nil;",
+      // Fibers, which every mode runs through run().
+      "var r = 0; var f = spawn { for (var i = 1; i <= 4; i = i + 1) yield i; };"
+      "for (var v = resume f; v != nil; v = resume f) r = r * 10 + v;",
+      // Enough instructions to overflow the C stack if tail-call handlers
+      // kept their frames.
+      "var r = 0; for (var i = 0; i < 3000000; i = i + 1) r = r + 1;",
+  };
+  for (int i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+    assertSameResult(tests[i]);
+    printf("  ✓ program %d\n", i);
+  }
+}
+
+void test_backedges() {
+  printf("Testing backedge counts...\n");
+
+  // The for loop takes two backedges per iteration: to the increment and
+  // from there to the condition.
+  const char *src = "var r = 0; while (r < 5) r = r + 1;"
+                    "for (var i = 0; i < 3; i = i + 1) r = r + i;";
+  for (int m = 0; m <= MODE_COUNT; m++) {
+    VM vm;
+    initVM(&vm);
+    if (m < MODE_COUNT) {
+      vm.dispatch = modes[m];
+    } else {
+      vm.jit = true;
+    }
+    assert(interpret(&vm, src) == INTERPRET_OK);
+    assert(vm.backedges == 5 + 2 * 3);
+    closeVM(&vm);
+  }
+  printf("  ✓ every dispatch mode and the JIT count each taken OP_LOOP\n");
+}
+
+void test_instruction_counts() {
+#ifdef COUNT_INSTRUCTIONS
+  printf("Testing instruction counts...\n");
+
+  const char *src = "var r = 0; for (var i = 0; i < 100; i = i + 1) r = r + i;";
+  uint64_t counts[MODE_COUNT];
+  for (int m = 0; m < MODE_COUNT; m++) {
+    VM vm;
+    initVM(&vm);
+    vm.dispatch = modes[m];
+    assert(interpret(&vm, src) == INTERPRET_OK);
+    counts[m] = vm.instructions;
+    closeVM(&vm);
+  }
+  assert(counts[0] > 100 * 5);
+  for (int m = 1; m < MODE_COUNT; m++) {
+    if (modes[m] == DISPATCH_REGISTER) {
+      // One register instruction does the work of several stack ones.
+      assert(counts[m] < counts[0]);
+    } else {
+      // The stack interpreters run the same instructions, apart from the
+      // re-dispatch after the pre-decoded ones cache a global.
+      assert(counts[m] >= counts[0] && counts[m] <= counts[0] + 8);
+    }
+  }
+  printf("  ✓ every dispatch mode counts the instructions it runs\n");
+#endif
+}
+
+// Counts instructions with opcode `op`.
+static int countOps(Chunk *chunk, uint8_t op) {
+  int count = 0;
+  for (int i = 0; i < chunk->length; i += instructionLength(chunk->code[i])) {
+    count += chunk->code[i] == op;
+  }
+  return count;
+}
+
+void test_quickening() {
+  printf("Testing quickened instructions...\n");
+
+  // The switch interpreter quickens the bytes of the session's chunk, which
+  // stay there for inspection after the line runs.
+  VM vm;
+  initVM(&vm);
+  vm.dispatch = DISPATCH_SWITCH;
+  vm.err = fopen("/dev/null", "w");
+  Session session;
+  initSession(&session);
+  Chunk *chunk = &session.chunk;
+  ObjString *r = copyString(&vm, "r", 1);
+  Value value;
+
+  assert(interpretLine(&vm, &session, "var a = 1; var b = 2; var r = 0;") ==
+         INTERPRET_OK);
+  assert(interpretLine(&vm, &session,
+                       "for (var i = 0; i < 3; i = i + 1) r = a - b + r;") ==
+         INTERPRET_OK);
+  assert(countOps(chunk, OP_SUBTRACT_NUM) == 1 && countOps(chunk, OP_ADD_NUM) == 1);
+  assert(countOps(chunk, OP_GET_GLOBAL_CACHED) == 3);
+  assert(countOps(chunk, OP_SET_GLOBAL_CACHED) == 1);
+  assert(mapGet(&vm.globals, r, &value) && AS_NUMBER(value) == -3);
+  printf("  ✓ number operators and global accesses are quickened\n");
+
+  assert(interpretLine(&vm, &session,
+                       "for (var i = 0; i < 3; i = i + 1) "
+                       "{ if (i == 2) { a = \"x\"; b = \"y\"; } r = a + b; }") ==
+         INTERPRET_OK);
+  assert(countOps(chunk, OP_ADD_STR) == 1 && countOps(chunk, OP_ADD_NUM) == 0);
+  assert(mapGet(&vm.globals, r, &value) && IS_STRING(value));
+  assert(strcmp(AS_CSTRING(value), "xy") == 0);
+  assert(interpretLine(&vm, &session,
+                       "a = 1; for (var i = 0; i < 3; i = i + 1) "
+                       "{ if (i == 2) a = \"s\"; r = a < 5; }") ==
+         INTERPRET_RUNTIME_ERROR);
+  assert(countOps(chunk, OP_LESS) == 1 && countOps(chunk, OP_LESS_NUM) == 0);
+  printf("  ✓ quickened operators revert when the operand types change\n");
+
+  // The fiber and the assignment cache c's entry, then the globals map grows
+  // and moves every entry before the fiber reads c again.
+  char src[1024] = "var c = 1; var f = spawn { while (true) yield c; };"
+                   "r = resume f; c = 2;";
+  for (int i = 0; i < 40; i++) {
+    char define[32];
+    snprintf(define, sizeof(define), "var g%d = %d;", i, i);
+    strcat(src, define);
+  }
+  strcat(src, "r = r + resume f;");
+  uint32_t version = vm.globals.version;
+  assert(interpretLine(&vm, &session, src) == INTERPRET_OK);
+  assert(vm.globals.version != version);
+  assert(mapGet(&vm.globals, r, &value) && AS_NUMBER(value) == 3);
+  printf("  ✓ a cached global is looked up again after the map changes\n");
+
+  freeSession(&session);
+  fclose(vm.err);
+  closeVM(&vm);
+}
+
+void test_register_code() {
+  printf("Testing register translation...\n");
+
+  VM vm;
+  initVM(&vm);
+  Chunk chunk;
+  initChunk(&chunk);
+  assert(compile(&vm,
+                 "var g = 1; { var a = g; var b = g; var c = g; a = b + c; }",
+                 &chunk));
+
+  RegCode code;
+  assert(compileRegisters(&chunk, &code));
+  // Define g, load the three locals, then one ADD reading b and c and
+  // writing a.
+  assert(code.code.length == 6);
+  RegInstr *add = &code.code.values[4];
+  assert(add->op == ROP_ADD && add->a == 0 && add->b == 1 && add->c == 2);
+  assert(code.code.values[5].op == ROP_RETURN);
+  printf("  ✓ a = b + c is one instruction\n");
+
+  freeRegCode(&code);
+  freeChunk(&chunk);
+  closeVM(&vm);
+}
+
+void test_fibers() {
+  printf("Testing fibers...\n");
+
+  VM vm;
+  initVM(&vm);
+  char *err;
+  size_t errSize;
+  vm.err = open_memstream(&err, &errSize);
+  ObjString *r = copyString(&vm, "r", 1);
+  Value value;
+
+  assert(interpret(&vm, "var r = \"\"; var inner = spawn { yield \"b\"; };"
+                        "var outer = spawn { yield \"a\"; "
+                        "  var b = resume inner; yield b + b; };"
+                        "for (var v = resume outer; v != nil; v = resume outer)"
+                        "  r = r + v;"
+                        "if (resume inner == nil) r = r + \".\";") ==
+         INTERPRET_OK);
+  assert(mapGet(&vm.globals, r, &value) && IS_STRING(value));
+  assert(strcmp(AS_CSTRING(value), "abb.") == 0);
+  printf("  ✓ fibers resume each other and finish with nil\n");
+
+  assert(interpret(&vm, "var f = spawn { var g = spawn { yield 1; -nil; }; "
+                        "resume g; resume g; };"
+                        "resume f;") == INTERPRET_RUNTIME_ERROR);
+  assert(vm.fiber == NULL && vm.stack->top == -1);
+  assert(interpret(&vm, "r = 1; { var a = 2; r = r + a; }") == INTERPRET_OK);
+  assert(mapGet(&vm.globals, r, &value) && AS_NUMBER(value) == 3);
+  printf("  ✓ an error inside nested fibers returns to the script\n");
+
+  assert(interpret(&vm, "var d = spawn {}; resume d; resume d;") ==
+         INTERPRET_RUNTIME_ERROR);
+  fflush(vm.err);
+  assert(strstr(err, "Cannot resume a finished fiber.") != NULL);
+  printf("  ✓ a finished fiber cannot be resumed\n");
+
+  assert(interpret(&vm, "var g = spawn { yield 1; };") == INTERPRET_OK);
+  assert(interpret(&vm, "resume g;") == INTERPRET_RUNTIME_ERROR);
+  fflush(vm.err);
+  assert(strstr(err, "Cannot resume a fiber from an earlier script.") != NULL);
+  printf("  ✓ a fiber does not outlive its script\n");
+
+  fclose(vm.err);
+  free(err);
+  closeVM(&vm);
+}
+
+// Runs printValue with stdout sent to a temporary file and returns what it
+// wrote, which may contain NUL bytes.
+static size_t printed(Value value, char *buf, size_t size) {
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  FILE *file = tmpfile();
+  assert(saved >= 0 && file != NULL);
+  dup2(fileno(file), STDOUT_FILENO);
+  printValue(value);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  rewind(file);
+  size_t length = fread(buf, 1, size, file);
+  fclose(file);
+  return length;
+}
+
+void test_print_value() {
+  printf("Testing printValue...\n");
+
+  VM vm;
+  initVM(&vm);
+  char buf[16];
+  ObjString *string = copyString(&vm, "a\0b", 3);
+  assert(printed(OBJ_VAL(string), buf, sizeof buf) == 3 &&
+         memcmp(buf, "a\0b", 3) == 0);
+  string = copyString(&vm, "\0", 1);
+  assert(printed(OBJ_VAL(string), buf, sizeof buf) == 1 && buf[0] == '\0');
+  closeVM(&vm);
+  printf("  ✓ strings with embedded NUL bytes are printed in full\n");
+}
+
+int main(void) {
+  printf("Running dispatch tests...\n\n");
+
+  test_programs();
+  test_backedges();
+  test_instruction_counts();
+  test_quickening();
+  test_register_code();
+  test_fibers();
+  test_print_value();
+
+  printf("\n✅ All tests passed!\n");
+  return 0;
+}
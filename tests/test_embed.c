@@ -0,0 +1,278 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../src/batch.h"
+#include "../src/svm.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VM_COUNT 64
+#define ROUNDS 20
+
+typedef struct {
+  int id;
+  bool ok;
+  const svm_snapshot *snapshot;
+} Worker;
+
+// Every VM runs its own numbers and strings, hits a runtime error and a
+// compile error, and must still produce exactly its own results.
+static void *runWorker(void *arg) {
+  Worker *worker = arg;
+  int id = worker->id;
+  char src[512];
+  svm_vm *vm = svm_new();
+  worker->ok = vm != NULL;
+
+  snprintf(src, sizeof(src),
+           "var total = 0; var s = \"\";\n"
+           "{ var step = %d; for (var i = 0; i < 1000; i = i + 1) {\n"
+           "    total = total + i * step;\n"
+           "    if (i < 3) s = s + \"vm%d\";\n"
+           "} }\n",
+           id, id);
+  worker->ok = worker->ok && svm_eval(vm, src) == SVM_OK;
+
+  for (int round = 0; round < ROUNDS && worker->ok; round++) {
+    snprintf(src, sizeof(src), "total = total + %d;", round);
+    worker->ok = svm_eval(vm, src) == SVM_OK;
+    worker->ok = worker->ok &&
+                 svm_eval(vm, "total = total + \"x\";") == SVM_RUNTIME_ERROR;
+    worker->ok = worker->ok && svm_eval(vm, "var = ;") == SVM_COMPILE_ERROR;
+  }
+
+  double total;
+  worker->ok = worker->ok && svm_get_number(vm, "total", &total);
+  double expected = 499500.0 * id + ROUNDS * (ROUNDS - 1) / 2;
+  worker->ok = worker->ok && total == expected;
+  worker->ok = worker->ok && !svm_get_number(vm, "s", &total);
+  worker->ok = worker->ok && !svm_get_number(vm, "missing", &total);
+
+  svm_free(vm);
+  return NULL;
+}
+
+void test_parallel_vms() {
+  printf("Testing %d VMs on %d threads...\n", VM_COUNT, VM_COUNT);
+
+  // Errors are expected; keep their reports out of the test output.
+  fflush(stderr);
+  int savedStderr = dup(STDERR_FILENO);
+  assert(freopen("/dev/null", "w", stderr) != NULL);
+
+  pthread_t threads[VM_COUNT];
+  Worker workers[VM_COUNT];
+  for (int i = 0; i < VM_COUNT; i++) {
+    workers[i].id = i;
+    assert(pthread_create(&threads[i], NULL, runWorker, &workers[i]) == 0);
+  }
+  for (int i = 0; i < VM_COUNT; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  fflush(stderr);
+  dup2(savedStderr, STDERR_FILENO);
+  close(savedStderr);
+
+  for (int i = 0; i < VM_COUNT; i++) assert(workers[i].ok);
+  printf("  ✓ every VM kept its own globals and strings\n");
+}
+
+// Clones see the prelude's globals, including strings that live in the
+// snapshot, and change only their own copies.
+static void *runClone(void *arg) {
+  Worker *worker = arg;
+  char src[256];
+  svm_vm *vm = svm_clone(worker->snapshot);
+  snprintf(src, sizeof(src),
+           "base = base + %d; var r = base * scale;\n"
+           "var same = 0; if (greeting == \"prelude!\") same = 1;\n"
+           "greeting = greeting + \"%d\";\n",
+           worker->id, worker->id);
+
+  double r, same, base;
+  worker->ok = vm != NULL && svm_eval(vm, src) == SVM_OK &&
+               svm_get_number(vm, "r", &r) &&
+               svm_get_number(vm, "same", &same) &&
+               svm_get_number(vm, "base", &base);
+  worker->ok = worker->ok && r == (100 + worker->id) * 3 && same == 1 &&
+               base == 100 + worker->id;
+
+  svm_free(vm);
+  return NULL;
+}
+
+void test_snapshot() {
+  printf("Testing VMs cloned from a snapshot...\n");
+
+  const char *src = "var base = 100; var scale = 3;\n"
+                    "var name = \"prelude\"; var greeting = name + \"!\";";
+  svm_vm *prelude = svm_new();
+  assert(svm_eval(prelude, src) == SVM_OK);
+  svm_snapshot *snapshot = svm_snapshot_new(prelude);
+  // The snapshot holds its own copies.
+  svm_free(prelude);
+
+  pthread_t threads[VM_COUNT];
+  Worker workers[VM_COUNT];
+  for (int i = 0; i < VM_COUNT; i++) {
+    workers[i].id = i;
+    workers[i].snapshot = snapshot;
+    assert(pthread_create(&threads[i], NULL, runClone, &workers[i]) == 0);
+  }
+  for (int i = 0; i < VM_COUNT; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+    assert(workers[i].ok);
+  }
+  printf("  ✓ %d clones each changed only their own globals\n", VM_COUNT);
+
+  svm_vm *fresh = svm_clone(snapshot);
+  double base;
+  assert(svm_get_number(fresh, "base", &base) && base == 100);
+  svm_free(fresh);
+  printf("  ✓ the snapshot is unchanged\n");
+
+  svm_snapshot_free(snapshot);
+}
+
+void test_output() {
+  printf("Testing captured output...\n");
+
+  svm_vm *vm = svm_new();
+  svm_output_to_memory(vm);
+  assert(svm_eval(vm, "print 1; print -0; print 2.5; print 1000000; "
+                      "print -123456; print nil; print true; print false; "
+                      "print \"a\" + \"b\";") == SVM_OK);
+  size_t length;
+  const char *out = svm_output(vm, &length);
+  const char *expected =
+      "1\n-0\n2.5\n1000000\n-123456\nnil\ntrue\nfalse\nab\n";
+  assert(length == strlen(expected) && strcmp(out, expected) == 0);
+  printf("  ✓ every kind of value prints as before\n");
+
+  assert(svm_eval(vm, "for (var i = 0; i < 100000; i = i + 1) print i;") ==
+         SVM_OK);
+  out = svm_output(vm, &length);
+  assert(length == strlen(expected) + 588890);
+  assert(strcmp(out + length - 12, "99998\n99999\n") == 0);
+  printf("  ✓ the buffer grows to hold everything printed\n");
+  svm_free(vm);
+}
+
+static void countRelease(void *context) { (*(int *)context)++; }
+
+void test_external_strings() {
+  printf("Testing external strings...\n");
+
+  // Not NUL-terminated, so nothing may read past the length.
+  static const char greeting[] = {'h', 'e', 'l', 'l', 'o', '!'};
+  size_t size = 8 * 1024 * 1024;
+  char *payload = malloc(size);
+  assert(payload != NULL);
+  memset(payload, 'x', size);
+  int released = 0;
+
+  svm_vm *vm = svm_new();
+  svm_output_to_memory(vm);
+  assert(svm_set_string(vm, "greeting", greeting, 5, countRelease, &released));
+  assert(svm_set_string(vm, "payload", payload, size, countRelease,
+                        &released));
+  assert(svm_eval(vm, "var r = 0; var g = greeting;"
+                      "if (greeting == \"hello\") r = r + 1;"
+                      "if (\"hello\" == g) r = r + 1;"
+                      "if (greeting != \"hell\") r = r + 1;"
+                      "if (greeting + \" world\" == \"hello world\") r = r + 1;"
+                      "if (payload != greeting) r = r + 1;"
+                      "print greeting; print \"<\" + greeting + \">\";") ==
+         SVM_OK);
+  double r;
+  assert(svm_get_number(vm, "r", &r) && r == 5);
+  size_t length;
+  assert(strcmp(svm_output(vm, &length), "hello\n<hello>\n") == 0);
+  printf("  ✓ they compare, concatenate and print like any string\n");
+
+  static const char binary[] = {'a', '\0', 'b'};
+  assert(svm_set_string(vm, "binary", binary, 3, NULL, NULL));
+  assert(svm_eval(vm, "print binary;") == SVM_OK);
+  const char *output = svm_output(vm, &length);
+  assert(length == 18 && memcmp(output + 14, "a\0b\n", 4) == 0);
+  printf("  ✓ embedded NUL bytes are printed too\n");
+
+  svm_snapshot *snapshot = svm_snapshot_new(vm);
+  svm_vm *clone = svm_clone(snapshot);
+  assert(svm_eval(clone, "var same = 0; if (greeting == \"hello\") same = 1;") ==
+         SVM_OK);
+  double same;
+  assert(svm_get_number(clone, "same", &same) && same == 1);
+  svm_free(clone);
+  svm_snapshot_free(snapshot);
+  printf("  ✓ snapshots copy them\n");
+
+  assert(released == 0);
+  svm_free(vm);
+  assert(released == 2);
+  free(payload);
+  printf("  ✓ the host's buffers are released with the VM\n");
+}
+
+// Scripts finish out of order on the pool but their output must not.
+void test_batch() {
+  printf("Testing batch runs...\n");
+
+  char dir[] = "/tmp/svm_batchXXXXXX";
+  assert(mkdtemp(dir) != NULL);
+  char path[64];
+  for (int i = 0; i < 8; i++) {
+    snprintf(path, sizeof(path), "%s/%d.svm", dir, i);
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    if (i == 5) {
+      fprintf(file, "print 1; print -\"x\";");
+    } else {
+      // Earlier scripts loop longer, so later ones tend to finish first.
+      fprintf(file, "var n = 0; for (var i = 0; i < %d; i = i + 1) n = n + 1;"
+                    "print \"script\"; print %d;",
+              (8 - i) * 20000, i);
+    }
+    fclose(file);
+  }
+
+  char *out, *err;
+  size_t outSize, errSize;
+  FILE *outStream = open_memstream(&out, &outSize);
+  FILE *errStream = open_memstream(&err, &errSize);
+  BatchOptions options = {3, false, false, DISPATCH_THREADED};
+  int status = runBatch(dir, &options, outStream, errStream);
+  fclose(outStream);
+  fclose(errStream);
+
+  assert(status == 70);
+  assert(strcmp(out, "script\n0\nscript\n1\nscript\n2\nscript\n3\n"
+                     "script\n4\n1\nscript\n6\nscript\n7\n") == 0);
+  printf("  ✓ output is in list order\n");
+  assert(strstr(err, "Operand must be a number.") != NULL);
+  assert(strstr(err, "8 scripts, 1 failed") != NULL);
+  printf("  ✓ failures reach the exit code and the summary\n");
+  free(out);
+  free(err);
+
+  for (int i = 0; i < 8; i++) {
+    snprintf(path, sizeof(path), "%s/%d.svm", dir, i);
+    remove(path);
+  }
+  rmdir(dir);
+}
+
+int main(void) {
+  printf("Running embedding tests...\n\n");
+
+  test_parallel_vms();
+  test_snapshot();
+  test_output();
+  test_external_strings();
+  test_batch();
+
+  printf("\n✅ All tests passed!\n");
+  return 0;
+}
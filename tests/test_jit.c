@@ -0,0 +1,75 @@
+#include "../src/object.h"
+#include "../src/vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Runs `src` with and without the JIT and requires the same result and the
+// same final value of the global `r`.
+static void assertSameResult(const char *src) {
+  Value results[2];
+  InterpretResult statuses[2];
+
+  for (int jit = 0; jit < 2; jit++) {
+    VM vm;
+    initVM(&vm);
+    vm.jit = jit;
+    statuses[jit] = interpret(&vm, src);
+    ObjString *name = copyString(&vm, "r", 1);
+    if (!mapGet(&vm.globals, name, &results[jit])) results[jit] = NIL_VAL();
+    if (IS_OBJ(results[jit])) results[jit] = NIL_VAL(); // VM-owned objects
+    closeVM(&vm);
+  }
+
+  assert(statuses[0] == statuses[1]);
+  assert(results[0].type == results[1].type);
+  if (IS_NUMBER(results[0])) {
+    assert(AS_NUMBER(results[0]) == AS_NUMBER(results[1]));
+  } else if (IS_BOOL(results[0])) {
+    assert(AS_BOOL(results[0]) == AS_BOOL(results[1]));
+  }
+}
+
+void test_arithmetic_loops() {
+  printf("Testing arithmetic loops...\n");
+
+  const char *tests[] = {
+      "var r = 0; for (var i = 0; i < 1000; i = i + 1) r = r + i * 2 - i / 4;",
+      "var r = 1; { var x = 3; while (x <= 30) { r = r * x; x = x + 3; } }",
+      "var r = 0; { var a = 0.5; var b = -a; for (var i = 10; i > 0; i = i - 1)"
+      " { if (i >= 5) a = a + b * i; else a = -a; } r = a; }",
+      "var r = 0; for (var i = 0; i < 100; i = i + 1) { if (!(i < 50) and i != 70"
+      " or i == 3) r = r + 1; }",
+  };
+  for (int i = 0; i < 4; i++) {
+    assertSameResult(tests[i]);
+    printf("  ✓ loop %d\n", i);
+  }
+}
+
+void test_side_exits() {
+  printf("\nTesting side exits back to the interpreter...\n");
+
+  const char *tests[] = {
+      "var r = 0; var s = \"a\"; for (var i = 0; i < 20; i = i + 1) "
+      "{ s = s + \"b\"; r = r + i; }",
+      "var r = 0; { var x = 1; while (x < 100) { x = x * 2; if (x == 64) "
+      "x = \"s\"; } }",
+      "var r = 0; for (var i = 0; i < 10; i = i + 1) r = r + u;",
+      "var r = nil; r = r < 1;",
+  };
+  for (int i = 0; i < 4; i++) {
+    assertSameResult(tests[i]);
+    printf("  ✓ exit %d\n", i);
+  }
+}
+
+int main(void) {
+  printf("Running JIT tests...\n\n");
+
+  test_arithmetic_loops();
+  test_side_exits();
+
+  printf("\n✅ All tests passed!\n");
+  return 0;
+}
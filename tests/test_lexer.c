@@ -1,6 +1,8 @@
 #include "../src/lexer.h"
+#include "../src/tokens.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // Helper function to print token type name
@@ -38,12 +40,15 @@ const char *tokTypeName(TokType type) {
     case TOK_NIL: return "TOK_NIL";
     case TOK_OR: return "TOK_OR";
     case TOK_PRINT: return "TOK_PRINT";
+    case TOK_RESUME: return "TOK_RESUME";
     case TOK_RETURN: return "TOK_RETURN";
+    case TOK_SPAWN: return "TOK_SPAWN";
     case TOK_SUPER: return "TOK_SUPER";
     case TOK_THIS: return "TOK_THIS";
     case TOK_TRUE: return "TOK_TRUE";
     case TOK_VAR: return "TOK_VAR";
     case TOK_WHILE: return "TOK_WHILE";
+    case TOK_YIELD: return "TOK_YIELD";
     case TOK_ERROR: return "TOK_ERROR";
     case TOK_EOF: return "TOK_EOF";
     default: return "UNKNOWN";
@@ -83,16 +88,18 @@ void assertToken(Tok tok, TokType expectedType, const char *expectedLexeme,
 void test_keywords() {
   printf("Testing keywords...\n");
 
-  const char *keywords[] = {"and",  "class", "else", "false", "for",    "fun",
-                            "if",   "nil",   "or",   "print", "return", "super",
-                            "this", "true",  "var",  "while"};
+  const char *keywords[] = {"and",    "class",  "else",  "false", "for",
+                            "fun",    "if",     "nil",   "or",    "print",
+                            "resume", "return", "spawn", "super", "this",
+                            "true",   "var",    "while", "yield"};
 
-  TokType expectedTypes[] = {TOK_AND,  TOK_CLASS, TOK_ELSE,   TOK_FALSE,
-                             TOK_FOR,  TOK_FUN,   TOK_IF,     TOK_NIL,
-                             TOK_OR,   TOK_PRINT, TOK_RETURN, TOK_SUPER,
-                             TOK_THIS, TOK_TRUE,  TOK_VAR,    TOK_WHILE};
+  TokType expectedTypes[] = {TOK_AND,   TOK_CLASS, TOK_ELSE,   TOK_FALSE,
+                             TOK_FOR,   TOK_FUN,   TOK_IF,     TOK_NIL,
+                             TOK_OR,    TOK_PRINT, TOK_RESUME, TOK_RETURN,
+                             TOK_SPAWN, TOK_SUPER, TOK_THIS,   TOK_TRUE,
+                             TOK_VAR,   TOK_WHILE, TOK_YIELD};
 
-  for (int i = 0; i < 16; i++) {
+  for (int i = 0; i < 19; i++) {
     Lexer lexer;
     initLexer(&lexer, keywords[i]);
 
@@ -342,6 +349,85 @@ void test_composite_statement() {
   freeLexer(&lexer);
 }
 
+// Test 9: Runs longer than one scanning block and line tracking
+void test_long_runs() {
+  printf("\nTesting long runs...\n");
+
+  const char *source = "                                        \n"
+                       "a_rather_long_identifier_name_0123456789 "
+                       "// a comment that is longer than sixteen bytes\n"
+                       "\"a string\nspanning two lines\" "
+                       "1234567890123456789.12345678901234567890\n"
+                       "end";
+
+  Lexer lexer;
+  initLexer(&lexer, source);
+
+  Tok tok = lexTok(&lexer);
+  assertToken(tok, TOK_IDENTIFIER, "a_rather_long_identifier_name_0123456789",
+              40);
+  assert(tok.line == 2);
+
+  tok = lexTok(&lexer);
+  assertToken(tok, TOK_STRING, "\"a string\nspanning two lines\"", 29);
+  assert(tok.line == 4);
+
+  tok = lexTok(&lexer);
+  assertToken(tok, TOK_NUMBER, "1234567890123456789.12345678901234567890", 40);
+
+  tok = lexTok(&lexer);
+  assertToken(tok, TOK_IDENTIFIER, "end", 3);
+  assert(tok.line == 5);
+
+  assert(lexTok(&lexer).type == TOK_EOF);
+
+  freeLexer(&lexer);
+  printf("  ✓ Long identifiers, comments, strings and numbers\n");
+}
+
+// Test 10: The token buffer yields the same stream as lexTok, both when it
+// lexes up front and when a large source is lexed on a background thread
+static void checkTokBuffer(const char *source) {
+  Lexer lexer;
+  TokBuffer tokens;
+  initLexer(&lexer, source);
+  tokBufferInit(&tokens, source);
+
+  for (;;) {
+    Tok want = lexTok(&lexer);
+    Tok got = tokBufferNext(&tokens);
+    assert(got.type == want.type);
+    assert(got.length == want.length);
+    assert(got.line == want.line);
+    assert(strncmp(got.start, want.start, want.length) == 0);
+    if (want.type == TOK_EOF) break;
+  }
+  assert(tokBufferNext(&tokens).type == TOK_EOF);
+
+  tokBufferFree(&tokens);
+  freeLexer(&lexer);
+}
+
+void test_token_buffer() {
+  printf("\nTesting token buffer...\n");
+
+  checkTokBuffer("var x = 1;\nprint x + \"two\" # 3..4;");
+  printf("  ✓ Small source matches lexTok\n");
+
+  const char *line = "var item = (item + 12.5) * count; // running total\n";
+  int lineLength = (int)strlen(line);
+  int lines = THREADED_LEX_MIN_SOURCE / lineLength + 100;
+  char *source = malloc((size_t)lines * lineLength + 1);
+  for (int i = 0; i < lines; i++) {
+    memcpy(source + (size_t)i * lineLength, line, lineLength);
+  }
+  source[(size_t)lines * lineLength] = '\0';
+
+  checkTokBuffer(source);
+  free(source);
+  printf("  ✓ Threaded lexing of %d lines matches lexTok\n", lines);
+}
+
 int main(void) {
   printf("Running lexer tests...\n\n");
 
@@ -353,6 +439,8 @@ int main(void) {
   test_numbers();
   test_whitespace_and_comments();
   test_composite_statement();
+  test_long_runs();
+  test_token_buffer();
 
   printf("\n✅ All tests passed!\n");
   return 0;
@@ -0,0 +1,188 @@
+#include "../src/number.h"
+#include <assert.h>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Parses `literal` both with parseNumber and strtod and requires the exact
+// same bits.
+static void assertParses(const char *literal) {
+  int length = (int)strlen(literal);
+  double got = parseNumber(literal, length);
+  double want = strtod(literal, NULL);
+  if (memcmp(&got, &want, sizeof(double)) != 0) {
+    fprintf(stderr, "  ✗ '%s': got %.17g, want %.17g\n", literal, got, want);
+    assert(0);
+  }
+}
+
+void test_integers() {
+  printf("Testing integer literals...\n");
+
+  const char *tests[] = {"0", "7", "42", "1000000", "9007199254740992",
+                         "9007199254740993", "18446744073709551615",
+                         "123456789012345678901234567890"};
+  for (int i = 0; i < 8; i++) {
+    assertParses(tests[i]);
+    printf("  ✓ %s\n", tests[i]);
+  }
+}
+
+void test_fractions() {
+  printf("\nTesting fractional literals...\n");
+
+  const char *tests[] = {
+      "0.5",
+      "3.14",
+      "0.1",
+      "0.30000000000000004",
+      "1.7976931348623157",
+      "2.2250738585072014",
+      "0.000000000000000000000000000001",
+      "12345678901234567890.123456789",
+      "0.00000000000000000000000000000000000000000000000000000000000000000000"
+      "00000000000000000000001",
+  };
+  for (int i = 0; i < 9; i++) {
+    assertParses(tests[i]);
+    printf("  ✓ %.32s\n", tests[i]);
+  }
+}
+
+void test_token_bounds() {
+  printf("\nTesting token bounds...\n");
+
+  // Only the first `length` bytes belong to the literal.
+  assert(parseNumber("1.5e3", 3) == 1.5);
+  assert(parseNumber("250;", 3) == 250);
+  assert(parseNumber("0.12345678901234567890123456789x", 31) ==
+         strtod("0.12345678901234567890123456789", NULL));
+  printf("  ✓ Bytes after the literal are ignored\n");
+}
+
+void test_random_literals() {
+  printf("\nTesting random literals...\n");
+
+  srand(7);
+  char buf[64];
+  for (int n = 0; n < 200000; n++) {
+    int len = 0;
+    int intDigits = 1 + rand() % 22;
+    int fracDigits = rand() % 3 == 0 ? 0 : 1 + rand() % 24;
+
+    buf[len++] = (char)('1' + rand() % 9);
+    for (int i = 1; i < intDigits; i++) buf[len++] = (char)('0' + rand() % 10);
+    if (fracDigits > 0) {
+      buf[len++] = '.';
+      for (int i = 0; i < fracDigits; i++) {
+        buf[len++] = (char)('0' + rand() % 10);
+      }
+    }
+    buf[len] = '\0';
+    assertParses(buf);
+  }
+  printf("  ✓ 200000 literals match strtod\n");
+}
+
+void test_locale() {
+  printf("\nTesting literals under a decimal-comma locale...\n");
+
+  // Longer than 19 significant digits or out of the fast paths' exponent
+  // range, so all of these take the exact fallback.
+  const char *tests[] = {
+      "3.14159265358979323846264338327950288",
+      "9007199254740993.00000000000000000000000000000001",
+      "0.00000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000123456789",
+      "1797693134862315807937289714053034150799341327100378269361737789804449"
+      "6829276475094664901797758720709633028641669288791094655554785194040263"
+      "0657488671505820681908902000708383676273854845817711531764475730270069"
+      "8555713669596228429148198608349364752927190741684443655107043427115596"
+      "99508093042880177904174497791.9",
+  };
+  double want[4];
+  for (int i = 0; i < 4; i++) want[i] = strtod(tests[i], NULL);
+
+  const char *locales[] = {"de_DE.UTF-8", "fr_FR.UTF-8", "ru_RU.UTF-8",
+                           "de_DE", "fr_FR"};
+  const char *name = NULL;
+  for (int i = 0; i < 5 && name == NULL; i++) {
+    if (setlocale(LC_NUMERIC, locales[i]) != NULL) name = locales[i];
+  }
+
+  for (int i = 0; i < 4; i++) {
+    double got = parseNumber(tests[i], (int)strlen(tests[i]));
+    assert(memcmp(&got, &want[i], sizeof(double)) == 0);
+  }
+  setlocale(LC_NUMERIC, "C");
+  if (name != NULL) {
+    printf("  ✓ long literals parse the same under %s\n", name);
+  } else {
+    printf("  ✓ long literals parse exactly (no decimal-comma locale "
+           "installed)\n");
+  }
+}
+
+static void assertFormats(double value, const char *expected) {
+  char out[NUMBER_MAX_LENGTH + 1];
+  int length = formatNumber(value, out);
+  out[length] = '\0';
+  if (strcmp(out, expected) != 0) {
+    fprintf(stderr, "  ✗ %.17g: got '%s', want '%s'\n", value, out, expected);
+    assert(0);
+  }
+}
+
+void test_format() {
+  printf("\nTesting number formatting...\n");
+
+  assertFormats(0, "0");
+  assertFormats(-0.0, "-0");
+  assertFormats(42, "42");
+  assertFormats(-1.5, "-1.5");
+  assertFormats(0.1, "0.1");
+  assertFormats(0.1 + 0.2, "0.30000000000000004");
+  assertFormats(1e6, "1000000");
+  assertFormats(123456789012345680000.0, "123456789012345680000");
+  assertFormats(1e21, "1e+21");
+  assertFormats(0.000001, "0.000001");
+  assertFormats(1e-7, "1e-07");
+  assertFormats(1e23, "1e+23");
+  assertFormats(5e-324, "5e-324");
+  assertFormats(1.7976931348623157e308, "1.7976931348623157e+308");
+  assertFormats(1.0 / 0.0, "inf");
+  assertFormats(-1.0 / 0.0, "-inf");
+  assertFormats(0.0 / 0.0, "nan");
+  printf("  ✓ shortest digits, switching to exponents past 1e21 and 1e-7\n");
+
+  srand(11);
+  char out[NUMBER_MAX_LENGTH + 1];
+  for (int n = 0; n < 200000; n++) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 4; i++) bits = bits << 16 | (uint64_t)(rand() & 0xFFFF);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    if (value != value || value - value != 0) continue; // NaN or infinity
+
+    int length = formatNumber(value, out);
+    out[length] = '\0';
+    double back = strtod(out, NULL);
+    assert(memcmp(&back, &value, sizeof(value)) == 0);
+  }
+  printf("  ✓ 200000 random doubles read back exactly\n");
+}
+
+int main(void) {
+  printf("Running number tests...\n\n");
+
+  test_integers();
+  test_fractions();
+  test_token_bounds();
+  test_random_literals();
+  test_locale();
+  test_format();
+
+  printf("\n✅ All tests passed!\n");
+  return 0;
+}